@@ -0,0 +1,406 @@
+// dirstat_bench: generate a deterministic tree, run every command on it in
+// warm- and cold-cache mode and record the results as JSON, so runs from
+// different commits can be compared.
+#include "treegen.hpp"
+#include "scanner.hpp"
+#include "display.hpp"
+#include "output.hpp"
+#include "walker.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// ------------------------------------------------------- allocation count
+
+// Every operator new in the process is counted; the child running a
+// command resets the counters first
+static std::atomic<uint64_t> g_allocations{0};
+static std::atomic<uint64_t> g_allocated_bytes{0};
+
+static void* counted_alloc(std::size_t size, std::size_t align) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+    void* p = nullptr;
+    if (align <= alignof(std::max_align_t)) {
+        p = std::malloc(size);
+    } else if (posix_memalign(&p, align, size) != 0) {
+        p = nullptr;
+    }
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(std::size_t size) { return counted_alloc(size, 0); }
+void* operator new[](std::size_t size) { return counted_alloc(size, 0); }
+void* operator new(std::size_t size, std::align_val_t align) {
+    return counted_alloc(size, static_cast<std::size_t>(align));
+}
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return counted_alloc(size, static_cast<std::size_t>(align));
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+namespace {
+
+struct Config {
+    treegen::Shape shape;
+    fs::path dir = fs::temp_directory_path() / "dirstat-bench";
+    fs::path results = "bench-results.json";
+    std::string label;
+    std::vector<std::string> commands = {"scan", "index", "verify", "large", "types", "sizes", "dupes", "tree", "report"};
+    std::vector<std::string> modes = {"warm", "cold"};
+    unsigned repeat = 3;
+    walker::Options walk;
+};
+
+// One timed run of one command
+struct Sample {
+    bool ok = false;
+    double seconds = 0;
+    uint64_t allocations = 0;
+    uint64_t allocated_bytes = 0;
+    long peak_rss_kb = 0;
+};
+
+struct Result {
+    std::string command;
+    std::string mode;
+    std::vector<Sample> samples;
+};
+
+void print_help() {
+    printf("dirstat_bench - benchmark dirstat commands on a synthetic tree\n\n");
+    printf("USAGE:\n    dirstat_bench [OPTIONS]\n\n");
+    printf("RUN:\n");
+    printf("    --dir DIR          Where the tree is generated (default: $TMPDIR/dirstat-bench)\n");
+    printf("    --out FILE         Results file (default: bench-results.json)\n");
+    printf("    --label NAME       Stored in the results, e.g. a commit id\n");
+    printf("    --commands LIST    Any of scan,index,verify,large,types,sizes,dupes,tree,report (default: all)\n");
+    printf("                       index is scan --index, verify adds --index-verify; the index\n");
+    printf("                       is kept in --dir and filled by the first run\n");
+    printf("    --modes LIST       warm,cold (default: both)\n");
+    printf("    --repeat N         Timed runs per command and mode (default: 3)\n");
+    printf("    -t, --threads N    Worker threads (default: one per core)\n");
+    printf("    --backend NAME     native or portable\n");
+    printf("    --io-depth N       io_uring batch depth (default: 0 = off)\n\n");
+    printf("TREE:\n");
+    printf("    --depth N          Directory levels below the root (default: 4)\n");
+    printf("    --fanout N         Subdirectories per directory (default: 4)\n");
+    printf("    --files N          Files per directory (default: 24)\n");
+    printf("    --min-size N       Smallest file in bytes (default: 0)\n");
+    printf("    --max-size N       Largest file in bytes (default: 65536)\n");
+    printf("    --ext LIST         Extension weights, e.g. c:4,h:3,:1 (\"\" = none)\n");
+    printf("    --dup-ratio R      Share of files duplicating another (default: 0.1)\n");
+    printf("    --hidden R         Share of hidden entries (default: 0.05)\n");
+    printf("    --excluded R       Share of entries matching -e %s (default: 0.05)\n", treegen::kExcludePattern);
+    printf("    --seed N           Generator seed (default: 1)\n");
+}
+
+std::vector<std::string> split(const std::string& s) {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) out.push_back(item);
+    }
+    return out;
+}
+
+void run_command(const std::string& command, const fs::path& root, const Config& config) {
+    const walker::Options& walk = config.walk;
+    const auto text = output::Format::Text;
+    if (command == "scan") {
+        scanner::scan_directory(root, walk, text);
+    } else if (command == "index" || command == "verify") {
+        scanner::scan_directory(root, walk, text, root.parent_path() / "scan.index", command == "verify");
+    } else if (command == "large") {
+        scanner::find_largest_files(root, 10, walk, text);
+    } else if (command == "types") {
+        scanner::show_file_types(root, 10, walk, text);
+    } else if (command == "sizes") {
+        scanner::show_size_histogram(root, {}, false, 10, walk, text);
+    } else if (command == "dupes") {
+        scanner::find_duplicates(root, 1, walk, text);
+    } else if (command == "tree") {
+        walker::Options all = walk;
+        all.max_depth = config.shape.depth + 1;
+        display::show_tree(root, all, display::TreeOptions{}, text);
+    } else if (command == "report") {
+        scanner::run_report(root, {"scan", "large", "types", "dupes"}, 10, 1, {}, false, walk, text);
+    }
+}
+
+// Run the command in a child process, so peak RSS belongs to this run
+// alone, with its output thrown away
+Sample run_once(const std::string& command, const fs::path& root, const Config& config) {
+    Sample sample;
+    int fds[2];
+    if (pipe(fds) != 0) return sample;
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return sample;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+
+        g_allocations.store(0, std::memory_order_relaxed);
+        g_allocated_bytes.store(0, std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        run_command(command, root, config);
+        output::out().flush();
+        Sample result;
+        result.ok = true;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.allocations = g_allocations.load(std::memory_order_relaxed);
+        result.allocated_bytes = g_allocated_bytes.load(std::memory_order_relaxed);
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == static_cast<ssize_t>(sizeof(result)) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    Sample received;
+    bool got = read(fds[0], &received, sizeof(received)) == static_cast<ssize_t>(sizeof(received));
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage {};
+    if (wait4(pid, &status, 0, &usage) < 0 || !got || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return sample;
+    }
+    sample = received;
+    sample.peak_rss_kb = usage.ru_maxrss;
+    return sample;
+}
+
+// Empty the page cache (needs root), or failing that at least evict the
+// tree's file data
+std::string drop_caches(const fs::path& root) {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd >= 0) {
+        bool ok = write(fd, "3\n", 2) == 2;
+        close(fd);
+        if (ok) return "drop_caches";
+    }
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(root, ec); !ec && it != fs::recursive_directory_iterator();
+         it.increment(ec)) {
+        if (!it->is_regular_file(ec)) continue;
+        int file = open(it->path().c_str(), O_RDONLY);
+        if (file < 0) continue;
+        posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+        close(file);
+    }
+    return "fadvise";
+}
+
+double median(std::vector<double> values) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+std::string number(double value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.6g", value);
+    return buffer;
+}
+
+bool write_results(const Config& config, const treegen::Summary& tree, const std::vector<Result>& results,
+                   const std::string& cold_method) {
+    int fd = open(config.results.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    {
+        output::Writer out(fd);
+        out << "{\n";
+        out << "  \"label\": " << output::quoted(config.label) << ",\n";
+        out << "  \"time\": " << static_cast<uint64_t>(std::time(nullptr)) << ",\n";
+        out << "  \"tree\": {\n";
+        out << "    \"shape\": " << output::quoted(treegen::describe(config.shape)) << ",\n";
+        out << "    \"path\": " << output::quoted((config.dir / "tree").string()) << ",\n";
+        out << "    \"entries\": " << tree.entries() << ", \"files\": " << tree.files << ", \"dirs\": " << tree.dirs
+            << ", \"bytes\": " << tree.bytes << ",\n";
+        out << "    \"duplicates\": " << tree.duplicates << ", \"hidden\": " << tree.hidden
+            << ", \"excluded\": " << tree.excluded << "\n";
+        out << "  },\n";
+        out << "  \"options\": {\"threads\": " << walker::thread_count(config.walk) << ", \"backend\": "
+            << output::quoted(config.walk.backend == backend::Kind::Native ? "native" : "portable")
+            << ", \"io_depth\": " << config.walk.io_depth << ", \"repeat\": " << config.repeat
+            << ", \"exclude\": " << output::quoted(treegen::kExcludePattern) << ", \"cold_method\": "
+            << output::quoted(cold_method) << "},\n";
+        out << "  \"runs\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            std::vector<double> seconds, allocations, bytes;
+            long peak_rss = 0;
+            for (const Sample& s : r.samples) {
+                seconds.push_back(s.seconds);
+                allocations.push_back(static_cast<double>(s.allocations));
+                bytes.push_back(static_cast<double>(s.allocated_bytes));
+                peak_rss = std::max(peak_rss, s.peak_rss_kb);
+            }
+            double wall = median(seconds);
+            double fastest = seconds.empty() ? 0 : *std::min_element(seconds.begin(), seconds.end());
+            out << "    {\"command\": " << output::quoted(r.command) << ", \"mode\": " << output::quoted(r.mode)
+                << ", \"runs\": " << r.samples.size() << ", \"wall_s\": " << number(wall)
+                << ", \"wall_min_s\": " << number(fastest) << ", \"entries_per_s\": "
+                << number(wall > 0 ? static_cast<double>(tree.entries()) / wall : 0)
+                << ", \"peak_rss_kb\": " << static_cast<uint64_t>(peak_rss)
+                << ", \"allocations\": " << static_cast<uint64_t>(median(allocations))
+                << ", \"allocated_bytes\": " << static_cast<uint64_t>(median(bytes)) << "}";
+            out << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+    }
+    return close(fd) == 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Config config;
+    config.walk.exclude = {treegen::kExcludePattern};
+
+    std::vector<std::string> args(argv + 1, argv + argc);
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        bool has_value = i + 1 < args.size();
+        if (arg == "-h" || arg == "--help") {
+            print_help();
+            return 0;
+        } else if (!has_value) {
+            fprintf(stderr, "[X] Unknown option or missing value: %s\n", arg.c_str());
+            return 1;
+        } else if (arg == "--dir") {
+            config.dir = args[++i];
+        } else if (arg == "--out") {
+            config.results = args[++i];
+        } else if (arg == "--label") {
+            config.label = args[++i];
+        } else if (arg == "--commands") {
+            config.commands = split(args[++i]);
+        } else if (arg == "--modes") {
+            config.modes = split(args[++i]);
+        } else if (arg == "--repeat") {
+            config.repeat = std::max(1u, static_cast<unsigned>(std::stoul(args[++i])));
+        } else if (arg == "-t" || arg == "--threads") {
+            config.walk.threads = static_cast<unsigned>(std::stoul(args[++i]));
+        } else if (arg == "--backend") {
+            config.walk.backend = args[++i] == "portable" ? backend::Kind::Portable : backend::Kind::Native;
+        } else if (arg == "--io-depth") {
+            config.walk.io_depth = static_cast<unsigned>(std::stoul(args[++i]));
+        } else if (arg == "--depth") {
+            config.shape.depth = std::stoi(args[++i]);
+        } else if (arg == "--fanout") {
+            config.shape.fanout = std::stoi(args[++i]);
+        } else if (arg == "--files") {
+            config.shape.files = std::stoi(args[++i]);
+        } else if (arg == "--min-size") {
+            config.shape.min_size = std::stoull(args[++i]);
+        } else if (arg == "--max-size") {
+            config.shape.max_size = std::stoull(args[++i]);
+        } else if (arg == "--ext") {
+            if (!treegen::parse_extensions(args[++i], config.shape.extensions)) {
+                fprintf(stderr, "[X] Bad extension list: %s\n", args[i].c_str());
+                return 1;
+            }
+        } else if (arg == "--dup-ratio") {
+            config.shape.duplicate_ratio = std::stod(args[++i]);
+        } else if (arg == "--hidden") {
+            config.shape.hidden_ratio = std::stod(args[++i]);
+        } else if (arg == "--excluded") {
+            config.shape.excluded_ratio = std::stod(args[++i]);
+        } else if (arg == "--seed") {
+            config.shape.seed = std::stoull(args[++i]);
+        } else {
+            fprintf(stderr, "[X] Unknown option: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    printf("[>] Tree: %s\n", treegen::describe(config.shape).c_str());
+    treegen::Summary tree;
+    bool reused = false;
+    std::string error;
+    auto start = std::chrono::steady_clock::now();
+    if (!treegen::generate(config.dir, config.shape, tree, reused, error)) {
+        fprintf(stderr, "[X] Could not generate the tree: %s\n", error.c_str());
+        return 1;
+    }
+    printf("    %s %llu files, %llu directories, %llu bytes in %s (%.1f s)\n",
+           reused ? "Reused" : "Generated", static_cast<unsigned long long>(tree.files),
+           static_cast<unsigned long long>(tree.dirs), static_cast<unsigned long long>(tree.bytes),
+           (config.dir / "tree").string().c_str(),
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+    const fs::path root = config.dir / "tree";
+    std::vector<Result> results;
+    std::string cold_method = "none";
+    printf("\n%-8s %-5s %10s %14s %10s %12s\n", "command", "mode", "wall (s)", "entries/s", "rss (KB)", "allocations");
+    for (const auto& mode : config.modes) {
+        const bool cold = mode == "cold";
+        if (!cold && mode != "warm") {
+            fprintf(stderr, "[X] Unknown mode: %s\n", mode.c_str());
+            return 1;
+        }
+        for (const auto& command : config.commands) {
+            Result result{command, mode, {}};
+            // Warm runs start from a cache filled by one untimed run
+            if (!cold) run_once(command, root, config);
+            for (unsigned r = 0; r < config.repeat; ++r) {
+                if (cold) cold_method = drop_caches(root);
+                Sample sample = run_once(command, root, config);
+                if (!sample.ok) {
+                    fprintf(stderr, "[X] %s failed\n", command.c_str());
+                    return 1;
+                }
+                result.samples.push_back(sample);
+            }
+
+            std::vector<double> seconds;
+            for (const Sample& s : result.samples) seconds.push_back(s.seconds);
+            double wall = median(seconds);
+            printf("%-8s %-5s %10.4f %14.0f %10ld %12llu\n", command.c_str(), mode.c_str(), wall,
+                   wall > 0 ? static_cast<double>(tree.entries()) / wall : 0.0, result.samples.back().peak_rss_kb,
+                   static_cast<unsigned long long>(result.samples.back().allocations));
+            results.push_back(std::move(result));
+        }
+    }
+    if (cold_method == "fadvise") {
+        printf("\n[i] Not allowed to drop the page cache; cold runs only evicted file data\n");
+    }
+
+    if (!write_results(config, tree, results, cold_method)) {
+        fprintf(stderr, "[X] Could not write %s\n", config.results.string().c_str());
+        return 1;
+    }
+    printf("\n[OK] Results written to %s\n", config.results.string().c_str());
+    return 0;
+}
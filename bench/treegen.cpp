@@ -0,0 +1,236 @@
+#include "treegen.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace treegen {
+
+namespace {
+
+// Bump when the generator's output for a given shape changes
+constexpr int kGeneratorVersion = 1;
+
+// splitmix64: tiny, fast and the same everywhere
+struct Rng {
+    uint64_t state;
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    uint64_t below(uint64_t n) { return n == 0 ? 0 : next() % n; }
+    // True with probability threshold / 2^32
+    bool chance(uint64_t threshold) { return (next() >> 32) < threshold; }
+};
+
+uint64_t threshold(double ratio) {
+    if (ratio <= 0) return 0;
+    if (ratio >= 1) return 1ULL << 32;
+    return static_cast<uint64_t>(ratio * 4294967296.0);
+}
+
+int bit_width(uint64_t v) {
+    int bits = 0;
+    while (v) {
+        bits++;
+        v >>= 1;
+    }
+    return bits;
+}
+
+class Generator {
+public:
+    Generator(const Shape& shape, Summary& summary)
+        : shape_(shape), summary_(summary), rng_{shape.seed},
+          duplicate_(threshold(shape.duplicate_ratio)), hidden_(threshold(shape.hidden_ratio)),
+          excluded_(threshold(shape.excluded_ratio)), buffer_(8192) {
+        for (const auto& [ext, weight] : shape_.extensions) ext_total_ += weight;
+    }
+
+    bool dir(const fs::path& path, int level, std::string& error) {
+        for (int i = 0; i < shape_.files; ++i) {
+            std::string name = entry_name("f" + std::to_string(i)) + extension();
+            if (!file(path / name, error)) return false;
+        }
+        if (level >= shape_.depth) return true;
+        for (int i = 0; i < shape_.fanout; ++i) {
+            fs::path child = path / entry_name("d" + std::to_string(i));
+            std::error_code ec;
+            fs::create_directory(child, ec);
+            if (ec) {
+                error = child.string() + ": " + ec.message();
+                return false;
+            }
+            summary_.dirs++;
+            if (!dir(child, level + 1, error)) return false;
+        }
+        return true;
+    }
+
+private:
+    struct Original {
+        uint64_t size;
+        uint64_t content;                 // seed of the bytes
+    };
+
+    std::string entry_name(std::string base) {
+        if (rng_.chance(hidden_)) {
+            summary_.hidden++;
+            return "." + base;
+        }
+        if (rng_.chance(excluded_)) {
+            summary_.excluded++;
+            return "skip_" + base;
+        }
+        return base;
+    }
+
+    std::string extension() {
+        if (ext_total_ == 0) return "";
+        uint64_t pick = rng_.below(ext_total_);
+        for (const auto& [ext, weight] : shape_.extensions) {
+            if (pick < weight) return ext.empty() ? "" : "." + ext;
+            pick -= weight;
+        }
+        return "";
+    }
+
+    // Log-uniform: a bit length uniformly in range, then a value with it
+    uint64_t size() {
+        uint64_t lo = shape_.min_size, hi = std::max(shape_.max_size, shape_.min_size);
+        int bits_lo = bit_width(lo), bits_hi = bit_width(hi);
+        int bits = bits_lo + static_cast<int>(rng_.below(static_cast<uint64_t>(bits_hi - bits_lo + 1)));
+        if (bits == 0) return 0;
+        uint64_t from = std::max<uint64_t>(lo, uint64_t{1} << (bits - 1));
+        uint64_t to = std::min<uint64_t>(hi, bits == 64 ? ~uint64_t{0} : (uint64_t{1} << bits) - 1);
+        return from + rng_.below(to - from + 1);
+    }
+
+    bool file(const fs::path& path, std::string& error) {
+        Original content;
+        if (!originals_.empty() && rng_.chance(duplicate_)) {
+            content = originals_[rng_.below(originals_.size())];
+            summary_.duplicates++;
+        } else {
+            content = Original{size(), rng_.next()};
+            originals_.push_back(content);
+        }
+
+        std::ofstream out(path, std::ios::binary);
+        Rng bytes{content.content};
+        uint64_t left = content.size;
+        while (out && left > 0) {
+            for (auto& word : buffer_) word = bytes.next();
+            size_t chunk = static_cast<size_t>(std::min<uint64_t>(left, buffer_.size() * sizeof(uint64_t)));
+            out.write(reinterpret_cast<const char*>(buffer_.data()), static_cast<std::streamsize>(chunk));
+            left -= chunk;
+        }
+        if (!out) {
+            error = path.string() + ": write failed";
+            return false;
+        }
+        summary_.files++;
+        summary_.bytes += content.size;
+        return true;
+    }
+
+    const Shape& shape_;
+    Summary& summary_;
+    Rng rng_;
+    uint64_t duplicate_, hidden_, excluded_;
+    uint64_t ext_total_ = 0;
+    std::vector<Original> originals_;
+    std::vector<uint64_t> buffer_;
+};
+
+} // namespace
+
+bool parse_extensions(const std::string& spec, std::vector<std::pair<std::string, unsigned>>& out) {
+    out.clear();
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t colon = item.rfind(':');
+        if (colon == std::string::npos) return false;
+        char* end = nullptr;
+        unsigned long weight = std::strtoul(item.c_str() + colon + 1, &end, 10);
+        if (end == item.c_str() + colon + 1 || *end != '\0') return false;
+        out.emplace_back(item.substr(0, colon), static_cast<unsigned>(weight));
+    }
+    return !out.empty();
+}
+
+std::string describe(const Shape& shape) {
+    std::string ext;
+    for (const auto& [name, weight] : shape.extensions) {
+        if (!ext.empty()) ext += ',';
+        ext += name + ":" + std::to_string(weight);
+    }
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer),
+             "v%d depth=%d fanout=%d files=%d size=%llu-%llu dup=%.4g hidden=%.4g excluded=%.4g seed=%llu ext=%s",
+             kGeneratorVersion, shape.depth, shape.fanout, shape.files,
+             static_cast<unsigned long long>(shape.min_size), static_cast<unsigned long long>(shape.max_size),
+             shape.duplicate_ratio, shape.hidden_ratio, shape.excluded_ratio,
+             static_cast<unsigned long long>(shape.seed), ext.c_str());
+    return buffer;
+}
+
+bool generate(const fs::path& dir, const Shape& shape, Summary& summary, bool& reused, std::string& error) {
+    const fs::path marker = dir / "shape.txt";
+    const fs::path tree = dir / "tree";
+    const std::string key = describe(shape);
+    std::error_code ec;
+    reused = false;
+
+    if (fs::exists(marker, ec)) {
+        std::ifstream in(marker);
+        std::string line;
+        std::getline(in, line);
+        if (line == key && in >> summary.files >> summary.dirs >> summary.bytes >> summary.duplicates
+                                >> summary.hidden >> summary.excluded) {
+            reused = true;
+            return true;
+        }
+        fs::remove(marker, ec);
+        fs::remove_all(tree, ec);
+        if (ec) {
+            error = tree.string() + ": " + ec.message();
+            return false;
+        }
+    } else if (fs::exists(tree, ec)) {
+        error = tree.string() + " exists and wasn't made by the generator";
+        return false;
+    }
+
+    fs::create_directories(tree, ec);
+    if (ec) {
+        error = tree.string() + ": " + ec.message();
+        return false;
+    }
+    // Claim the tree first; the counts that make it reusable are only
+    // added once it's complete, so an interrupted run starts over
+    {
+        std::ofstream claim(marker);
+        claim << key << '\n';
+    }
+    summary = Summary{};
+    Generator generator(shape, summary);
+    if (!generator.dir(tree, 0, error)) return false;
+
+    std::ofstream out(marker);
+    out << key << '\n'
+        << summary.files << ' ' << summary.dirs << ' ' << summary.bytes << ' ' << summary.duplicates << ' '
+        << summary.hidden << ' ' << summary.excluded << '\n';
+    if (!out) {
+        error = marker.string() + ": write failed";
+        return false;
+    }
+    return true;
+}
+
+} // namespace treegen
@@ -0,0 +1,56 @@
+#pragma once
+#include <filesystem>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Deterministic synthetic directory trees for benchmarking. The same shape
+// and seed give the same names, sizes and contents on every machine: only
+// integer arithmetic on a fixed PRNG is used.
+namespace treegen {
+
+struct Shape {
+    int depth = 4;                        // levels of subdirectories below the root
+    int fanout = 4;                       // subdirectories per directory
+    int files = 24;                       // files per directory
+    uint64_t min_size = 0;                // sizes are log-uniform in [min, max]
+    uint64_t max_size = 64 * 1024;
+    // Extension and relative weight; "" for files without one
+    std::vector<std::pair<std::string, unsigned>> extensions = {
+        {"c", 4}, {"h", 3}, {"txt", 2}, {"log", 2}, {"png", 1}, {"json", 1}, {"", 1}};
+    double duplicate_ratio = 0.1;         // files that copy an earlier file's content
+    double hidden_ratio = 0.05;           // entries named .*
+    double excluded_ratio = 0.05;         // entries named skip_*
+    uint64_t seed = 1;
+};
+
+// What was generated; every entry, hidden and excluded ones included
+struct Summary {
+    uint64_t files = 0;
+    uint64_t dirs = 0;                    // below the root
+    uint64_t bytes = 0;
+    uint64_t duplicates = 0;
+    uint64_t hidden = 0;
+    uint64_t excluded = 0;
+
+    uint64_t entries() const { return files + dirs; }
+};
+
+// Exclude pattern matching the excluded entries
+constexpr const char* kExcludePattern = "skip_*";
+
+// Parse "c:4,h:3,:1" into extension weights
+bool parse_extensions(const std::string& spec, std::vector<std::pair<std::string, unsigned>>& out);
+
+// One line identifying the shape, stored next to a generated tree
+std::string describe(const Shape& shape);
+
+// Create the tree at `dir`/tree. A tree left there by an earlier run with
+// the same shape is reused; anything else in `dir` is only replaced when
+// it was made by this generator.
+bool generate(const fs::path& dir, const Shape& shape, Summary& summary, bool& reused, std::string& error);
+
+} // namespace treegen
@@ -0,0 +1,261 @@
+#include "backend.hpp"
+#include "profile.hpp"
+#include <chrono>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <atomic>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#endif
+
+namespace backend {
+
+bool native_available() {
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+}
+
+// --- std::filesystem ---------------------------------------------------------
+
+// file_time_type has no fixed epoch before C++20; convert through the
+// offset between its clock and the system clock, taken once
+static int64_t unix_seconds(fs::file_time_type time) {
+    using namespace std::chrono;
+    static const auto offset = system_clock::now().time_since_epoch()
+                             - duration_cast<system_clock::duration>(fs::file_time_type::clock::now().time_since_epoch());
+    return duration_cast<seconds>(duration_cast<system_clock::duration>(time.time_since_epoch()) + offset).count();
+}
+
+bool FsReader::open(const fs::path& dir) {
+    std::error_code ec;
+    dir_ = dir;
+    it_ = fs::directory_iterator(dir, fs::directory_options::skip_permission_denied, ec);
+    if (ec) {
+        profile::error(ec.value());
+        it_ = fs::directory_iterator();
+        return false;
+    }
+    profile::count(profile::DirsOpened);
+    return true;
+}
+
+void FsReader::close() {
+    it_ = fs::directory_iterator();
+}
+
+bool FsReader::next(Entry& entry) {
+    std::error_code ec;
+    if (it_ == fs::directory_iterator()) return false;
+
+    current_ = *it_;
+    profile::count(profile::Entries);
+    it_.increment(ec);
+    if (ec) {
+        profile::error(ec.value());
+        it_ = fs::directory_iterator();
+    }
+
+    name_ = current_.path().filename().string();
+    entry.name = name_;
+    // Like DT_LNK: the caller stats symlinks to learn where they lead
+    entry.link = current_.is_symlink(ec);
+    if (entry.link) {
+        entry.type = EntryType::Unknown;
+    } else if (current_.is_regular_file(ec)) {
+        entry.type = EntryType::File;
+    } else if (current_.is_directory(ec)) {
+        entry.type = EntryType::Directory;
+    } else {
+        entry.type = EntryType::Other;
+    }
+    return true;
+}
+
+bool FsReader::stat(const char* name, Stat& out) {
+    std::error_code ec;
+    profile::count(profile::StatCalls);
+    // The current entry may carry cached attributes (e.g. size on Windows)
+    fs::directory_entry entry = (name_ == name) ? current_ : fs::directory_entry(dir_ / name, ec);
+    if (ec) {
+        profile::error(ec.value());
+        return false;
+    }
+
+    if (entry.is_regular_file(ec)) {
+        out.type = EntryType::File;
+        out.size = entry.file_size(ec);
+        if (ec) {
+            profile::error(ec.value());
+            return false;
+        }
+        out.mtime = unix_seconds(entry.last_write_time(ec));
+        // std::filesystem has no allocation size
+        out.allocated = out.size;
+        return true;
+    }
+    out.type = entry.is_directory(ec) ? EntryType::Directory : EntryType::Other;
+    out.size = 0;
+#ifndef _WIN32
+    // std::filesystem has no device number; the walker needs it for
+    // directories reached through symlinks
+    struct stat st;
+    if (out.type == EntryType::Directory && ::stat(entry.path().c_str(), &st) == 0) out.dev = st.st_dev;
+#endif
+    return true;
+}
+
+// --- Linux getdents64/statx --------------------------------------------------
+
+#ifdef __linux__
+
+namespace {
+
+constexpr size_t kBufferSize = 256 * 1024;
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+EntryType type_from_mode(mode_t mode) {
+    if (S_ISREG(mode)) return EntryType::File;
+    if (S_ISDIR(mode)) return EntryType::Directory;
+    return EntryType::Other;
+}
+
+// statx may be missing on old kernels or blocked by seccomp; remember that
+// after the first ENOSYS and use fstatat from then on
+std::atomic<bool> statx_supported{true};
+
+} // namespace
+
+NativeReader::NativeReader() : buffer_(kBufferSize) {}
+
+NativeReader::~NativeReader() {
+    close();
+}
+
+bool NativeReader::open(const fs::path& dir) {
+    close();
+    return open_fd(::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOCTTY));
+}
+
+bool NativeReader::open_fd(int fd) {
+    if (fd < 0) {
+        profile::error(errno);
+    } else {
+        profile::count(profile::DirsOpened);
+    }
+    close();
+    fd_ = fd;
+    pos_ = len_ = 0;
+    eof_ = false;
+    return fd_ >= 0;
+}
+
+void NativeReader::close() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+}
+
+bool NativeReader::next(Entry& entry) {
+    if (fd_ < 0) return false;
+    for (;;) {
+        if (pos_ >= len_) {
+            if (eof_) return false;
+            long n = syscall(SYS_getdents64, fd_, buffer_.data(), buffer_.size());
+            if (n < 0) {
+                // A read error ends the listing early, like an iteration
+                // error in FsReader; it is counted, not taken for the end
+                profile::error(errno);
+                eof_ = true;
+                return false;
+            }
+            if (n == 0) {
+                eof_ = true;
+                return false;
+            }
+            len_ = static_cast<size_t>(n);
+            pos_ = 0;
+        }
+
+        auto* d = reinterpret_cast<const linux_dirent64*>(buffer_.data() + pos_);
+        pos_ += d->d_reclen;
+
+        const char* name = d->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+        entry.name = std::string_view(name);
+        profile::count(profile::Entries);
+        entry.link = d->d_type == DT_LNK;
+        switch (d->d_type) {
+            case DT_REG: entry.type = EntryType::File; break;
+            case DT_DIR: entry.type = EntryType::Directory; break;
+            case DT_LNK:
+            case DT_UNKNOWN: entry.type = EntryType::Unknown; break;
+            default: entry.type = EntryType::Other; break;
+        }
+        return true;
+    }
+}
+
+bool NativeReader::stat(const char* name, Stat& out) {
+    profile::count(profile::StatCalls);
+#ifdef STATX_SIZE
+    if (statx_supported.load(std::memory_order_relaxed)) {
+        struct statx sx;
+        constexpr unsigned mask = STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_BLOCKS | STATX_INO | STATX_ATIME
+                                  | STATX_UID;
+        if (::statx(fd_, name, AT_STATX_SYNC_AS_STAT, mask, &sx) == 0) {
+            out.type = type_from_mode(sx.stx_mode);
+            out.size = out.type == EntryType::File ? sx.stx_size : 0;
+            out.mtime = sx.stx_mtime.tv_sec;
+            out.mtime_nsec = sx.stx_mtime.tv_nsec;
+            out.allocated = sx.stx_blocks * 512;
+            out.dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+            out.ino = sx.stx_ino;
+            out.atime = sx.stx_atime.tv_sec;
+            out.uid = sx.stx_uid;
+            return true;
+        }
+        if (errno != ENOSYS) {
+            profile::error(errno);
+            return false;
+        }
+        statx_supported.store(false, std::memory_order_relaxed);
+    }
+#endif
+    struct stat st;
+    if (::fstatat(fd_, name, &st, 0) != 0) {
+        profile::error(errno);
+        return false;
+    }
+    out.type = type_from_mode(st.st_mode);
+    out.size = out.type == EntryType::File ? static_cast<uint64_t>(st.st_size) : 0;
+    out.mtime = st.st_mtime;
+    out.mtime_nsec = static_cast<uint32_t>(st.st_mtim.tv_nsec);
+    out.allocated = static_cast<uint64_t>(st.st_blocks) * 512;
+    out.dev = st.st_dev;
+    out.ino = st.st_ino;
+    out.atime = st.st_atime;
+    out.uid = st.st_uid;
+    return true;
+}
+
+#endif
+
+} // namespace backend
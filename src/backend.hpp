@@ -0,0 +1,83 @@
+#pragma once
+#include <filesystem>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace backend {
+
+enum class Kind { Native, Portable };
+
+enum class EntryType : uint8_t { File, Directory, Other, Unknown };
+
+// One directory entry; `name` is only valid until the next call to next()
+struct Entry {
+    std::string_view name;
+    EntryType type = EntryType::Unknown;
+    bool link = false;                    // a symlink; false when the filesystem has no d_type
+};
+
+// Result of a stat that follows symlinks, like is_regular_file()/file_size()
+struct Stat {
+    EntryType type = EntryType::Other;
+    uint64_t size = 0;
+    int64_t mtime = 0;                    // seconds since the epoch
+    uint32_t mtime_nsec = 0;              // nanoseconds past `mtime`
+    uint64_t allocated = 0;               // bytes of storage (st_blocks * 512); the size when unknown
+    uint64_t dev = 0;                     // st_dev; 0 when unknown
+    uint64_t ino = 0;                     // st_ino; 0 when unknown
+    int64_t atime = 0;                    // access time; native reader only
+    uint32_t uid = 0;                     // owner; native reader only
+};
+
+// True when this build has a native backend; Kind::Native falls back to
+// Kind::Portable otherwise
+bool native_available();
+
+// Portable reader on top of std::filesystem
+class FsReader {
+public:
+    bool open(const fs::path& dir);
+    void close();
+    bool next(Entry& entry);
+    // Stat a child of the open directory (name must be NUL-terminated)
+    bool stat(const char* name, Stat& out);
+
+private:
+    fs::path dir_;
+    fs::directory_iterator it_;
+    fs::directory_entry current_;
+    std::string name_;
+};
+
+#ifdef __linux__
+// Linux reader: getdents64 into a large reusable buffer, d_type for the
+// entry type, statx relative to the directory fd only when asked
+class NativeReader {
+public:
+    NativeReader();
+    ~NativeReader();
+    NativeReader(const NativeReader&) = delete;
+    NativeReader& operator=(const NativeReader&) = delete;
+
+    bool open(const fs::path& dir);
+    // Take ownership of an already opened directory fd
+    bool open_fd(int fd);
+    void close();
+    bool next(Entry& entry);
+    bool stat(const char* name, Stat& out);
+    int fd() const { return fd_; }
+
+private:
+    std::vector<char> buffer_;
+    int fd_ = -1;
+    size_t pos_ = 0;
+    size_t len_ = 0;
+    bool eof_ = false;
+};
+#endif
+
+} // namespace backend
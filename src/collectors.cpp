@@ -0,0 +1,1363 @@
+#include "collectors.hpp"
+#include "display.hpp"
+#include "colors.hpp"
+#include "pool.hpp"
+#include "profile.hpp"
+#include "progress.hpp"
+#include "traversal.hpp"
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <typeinfo>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace collectors {
+
+// ---------------------------------------------------------------- totals
+
+void Totals::begin(unsigned workers) {
+    partial_.assign(workers, DirStats{});
+    ext_.assign(workers, ExtCounts{});
+}
+
+void Totals::on_file(unsigned worker, const walker::Entry& entry, uint64_t size) {
+    DirStats& local = partial_[worker];
+    local.total_files++;
+    local.total_size += size;
+
+    // Only a file that takes over gets a node; ties are settled by path
+    // before adding one
+    if (size > local.largest_file_size
+        || (size == local.largest_file_size && local.largest_file != paths::kNoNode
+            && table_->less(entry.dir_id, entry.name, local.largest_file))) {
+        paths::NodeId file = table_->add(worker, entry.dir_id, entry.name);
+        if (file != paths::kNoNode) {
+            local.largest_file_size = size;
+            local.largest_file = file;
+        }
+    }
+
+    ExtCounts& ext = ext_[worker];
+    uint32_t id = ext.table.id(entry.name);
+    if (id >= ext.files.size()) ext.files.resize(ext.table.size());
+    ext.files[id]++;
+}
+
+void Totals::on_dir(unsigned worker, const walker::Entry&) {
+    partial_[worker].total_dirs++;
+}
+
+void Totals::gather(unsigned worker) {
+    merge_stats(checkpoint_, partial_[worker], *table_);
+}
+
+void Totals::write_checkpoint(output::Writer& out) {
+    {
+        output::Record record(out, "totals");
+        record.field("files", checkpoint_.total_files)
+            .field("directories", checkpoint_.total_dirs)
+            .field("total_size", checkpoint_.total_size);
+        if (checkpoint_.largest_file != paths::kNoNode) {
+            record.field("largest_file", table_->relative(checkpoint_.largest_file))
+                .field("largest_size", checkpoint_.largest_file_size);
+        }
+    }
+    checkpoint_ = DirStats{};
+}
+
+void Totals::finish(const walker::Options&, bool) {
+    stats_ = DirStats{};
+    for (const auto& local : partial_) merge_stats(stats_, local, *table_);
+    for (const auto& ext : ext_) {
+        for (uint32_t id = 0; id < ext.files.size(); ++id) {
+            if (ext.files[id] > 0) stats_.extensions[ext.table.name(id)] += ext.files[id];
+        }
+    }
+    partial_.clear();
+    ext_.clear();
+}
+
+void Totals::print(const fs::path& root) const {
+    display::show_stats(stats_, *table_, root);
+}
+
+void Totals::write_json(output::Writer& out, const fs::path&, const std::string& indent) const {
+    out << indent << "\"files\": " << stats_.total_files << ",\n";
+    out << indent << "\"directories\": " << stats_.total_dirs << ",\n";
+    out << indent << "\"total_size\": " << stats_.total_size << ",\n";
+    out << indent << "\"total_size_human\": \"" << format_size(stats_.total_size) << "\",\n";
+    if (stats_.largest_file != paths::kNoNode) {
+        out << indent << "\"largest_file\": {\n";
+        out << indent << "  \"path\": " << output::quoted(table_->path(stats_.largest_file).string()) << ",\n";
+        out << indent << "  \"size\": " << stats_.largest_file_size << ",\n";
+        out << indent << "  \"size_human\": \"" << format_size(stats_.largest_file_size) << "\"\n";
+        out << indent << "},\n";
+    }
+    out << indent << "\"extensions\": {\n";
+    bool first = true;
+    for (const auto& [ext, count] : stats_.extensions) {
+        if (!first) out << ",\n";
+        out << indent << "  " << output::quoted(ext) << ": " << count;
+        first = false;
+    }
+    out << "\n" << indent << "}";
+}
+
+// --------------------------------------------------------------- largest
+
+void Largest::begin(unsigned workers) {
+    partial_.assign(workers, {});
+    // -c can be far more than there are files; past this the heap grows
+    // as needed
+    for (auto& local : partial_) local.heap.reserve(std::min<size_t>(count_ + 1, 4096));
+}
+
+void Largest::on_file(unsigned worker, const walker::Entry& entry, uint64_t size) {
+    TopK& local = partial_[worker];
+    local.files++;
+    if (count_ == 0) return;
+
+    // Larger first, equal sizes by path so the output doesn't depend on threading
+    const paths::PathTable& table = *table_;
+    auto ranks_before = [&table](const Item& a, const Item& b) {
+        if (a.first != b.first) return a.first > b.first;
+        return table.less(a.second, b.second);
+    };
+
+    // Once full, anything that doesn't rank before the weakest kept file is
+    // rejected before it gets a node
+    const bool full = local.heap.size() == count_;
+    if (full) {
+        const Item& weakest = local.heap.front();
+        if (size < weakest.first
+            || (size == weakest.first && !table.less(entry.dir_id, entry.name, weakest.second))) {
+            return;
+        }
+    }
+
+    Item item(size, table_->add(worker, entry.dir_id, entry.name));
+    if (item.second == paths::kNoNode) return;
+    if (full) {
+        std::pop_heap(local.heap.begin(), local.heap.end(), ranks_before);
+        local.heap.back() = item;
+    } else {
+        local.heap.push_back(item);
+    }
+    std::push_heap(local.heap.begin(), local.heap.end(), ranks_before);
+}
+
+void Largest::gather(unsigned worker) {
+    const auto& heap = partial_[worker].heap;
+    checkpoint_.insert(checkpoint_.end(), heap.begin(), heap.end());
+}
+
+void Largest::write_checkpoint(output::Writer& out) {
+    const paths::PathTable& table = *table_;
+    size_t keep = std::min(count_, checkpoint_.size());
+    std::partial_sort(checkpoint_.begin(), checkpoint_.begin() + keep, checkpoint_.end(),
+                      [&table](const Item& a, const Item& b) {
+                          if (a.first != b.first) return a.first > b.first;
+                          return table.less(a.second, b.second);
+                      });
+    for (size_t i = 0; i < keep; ++i) {
+        output::Record(out, "file").field("path", table.relative(checkpoint_[i].second))
+            .field("size", checkpoint_[i].first);
+    }
+    checkpoint_.clear();
+}
+
+void Largest::finish(const walker::Options&, bool) {
+    files_.clear();
+    found_ = false;
+    for (auto& local : partial_) {
+        found_ = found_ || local.files > 0;
+        std::move(local.heap.begin(), local.heap.end(), std::back_inserter(files_));
+    }
+    partial_.clear();
+
+    const paths::PathTable& table = *table_;
+    size_t keep = std::min(count_, files_.size());
+    std::partial_sort(files_.begin(), files_.begin() + keep, files_.end(), [&table](const Item& a, const Item& b) {
+        if (a.first != b.first) return a.first > b.first;
+        return table.less(a.second, b.second);
+    });
+    files_.resize(keep);
+}
+
+void Largest::print(const fs::path&) const {
+    output::Writer& out = output::out();
+    out << '\n';
+    out << colors::bold_cyan("[*] Largest Files:") << '\n';
+    out << colors::dim(std::string(60, '-')) << '\n';
+
+    for (size_t i = 0; i < std::min(count_, files_.size()); ++i) {
+        const auto& [size, file] = files_[i];
+        out << colors::yellow(std::to_string(i + 1) + ".") << " "
+            << colors::bold_green(format_size(size)) << " "
+            << colors::white(table_->relative(file)) << '\n';
+    }
+
+    if (!found_) {
+        out << colors::dim("  No files found.") << '\n';
+    }
+}
+
+void Largest::write_json(output::Writer& out, const fs::path&, const std::string& indent) const {
+    out << indent << "\"largest_files\": [\n";
+    size_t shown = std::min(count_, files_.size());
+    for (size_t i = 0; i < shown; ++i) {
+        const auto& [size, file] = files_[i];
+        out << indent << "  {\"path\": " << output::quoted(table_->relative(file)) << ", \"size\": " << size
+            << ", \"size_human\": \"" << format_size(size) << "\"}";
+        if (i + 1 < shown) out << ",";
+        out << "\n";
+    }
+    out << indent << "]";
+}
+
+void Largest::write_records(output::Writer& out) const {
+    for (const auto& [size, file] : files_) {
+        output::Record(out, "file").field("path", table_->relative(file)).field("size", size);
+    }
+}
+
+// ------------------------------------------------------------- dir sizes
+
+void DirSizes::begin(unsigned workers) {
+    partial_.assign(workers, {});
+}
+
+void DirSizes::on_file(unsigned worker, const walker::Entry& entry, uint64_t size) {
+    // A worker reports all files of one directory before it leaves it
+    Local& local = partial_[worker];
+    if (local.current != entry.dir_id) {
+        local.current = entry.dir_id;
+        local.own = {};
+    }
+    local.own.size += size;
+    local.own.files++;
+}
+
+void DirSizes::on_leave_dir(unsigned worker, const walker::Dir& dir) {
+    if (dir.id == paths::kNoNode) return;
+    Local& local = partial_[worker];
+    Record record{dir.id, dir.depth, {}};
+    if (local.current == dir.id) record.totals = local.own;
+    local.records.push_back(record);
+    local.current = paths::kNoNode;
+    local.own = {};
+}
+
+void DirSizes::finish(const walker::Options&, bool) {
+    dirs_.clear();
+    for (auto& local : partial_) {
+        dirs_.insert(dirs_.end(), local.records.begin(), local.records.end());
+    }
+    partial_.clear();
+    std::sort(dirs_.begin(), dirs_.end(), [](const Record& a, const Record& b) { return a.id < b.id; });
+
+    // Deepest first, so every directory is complete before it is added to
+    // its parent
+    std::vector<size_t> order(dirs_.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return dirs_[a].depth > dirs_[b].depth; });
+    for (size_t i : order) {
+        const Record& child = dirs_[i];
+        if (child.depth == 0) continue;
+        paths::NodeId parent = table_->parent(child.id);
+        auto it = std::lower_bound(dirs_.begin(), dirs_.end(), parent,
+                                   [](const Record& r, paths::NodeId id) { return r.id < id; });
+        if (it == dirs_.end() || it->id != parent) continue;
+        it->totals.size += child.totals.size;
+        it->totals.files += child.totals.files;
+        it->totals.dirs += child.totals.dirs + 1;
+    }
+
+    // The root contains everything; rank what's below it
+    const paths::PathTable& table = *table_;
+    top_.clear();
+    for (size_t i = 0; i < dirs_.size(); ++i) {
+        if (dirs_[i].depth > 0) top_.push_back(i);
+    }
+    size_t keep = std::min(count_, top_.size());
+    std::partial_sort(top_.begin(), top_.begin() + keep, top_.end(), [&](size_t a, size_t b) {
+        if (dirs_[a].totals.size != dirs_[b].totals.size) return dirs_[a].totals.size > dirs_[b].totals.size;
+        return table.less(dirs_[a].id, dirs_[b].id);
+    });
+    top_.resize(keep);
+}
+
+std::unordered_map<std::string, DirSizes::Subtree> DirSizes::by_path(int max_depth) const {
+    std::unordered_map<std::string, Subtree> result;
+    for (const Record& r : dirs_) {
+        if (max_depth > 0 && r.depth > max_depth) continue;
+        result.emplace(table_->path(r.id).string(), r.totals);
+    }
+    return result;
+}
+
+bool DirSizes::find(paths::NodeId id, Subtree& out) const {
+    auto it = std::lower_bound(dirs_.begin(), dirs_.end(), id,
+                               [](const Record& r, paths::NodeId key) { return r.id < key; });
+    if (it == dirs_.end() || it->id != id) return false;
+    out = it->totals;
+    return true;
+}
+
+void DirSizes::print(const fs::path&) const {
+    output::Writer& out = output::out();
+    out << '\n';
+    out << colors::bold_cyan("[*] Largest Directories:") << '\n';
+    out << colors::dim(std::string(60, '-')) << '\n';
+
+    for (size_t i = 0; i < top_.size(); ++i) {
+        const Record& r = dirs_[top_[i]];
+        out << colors::yellow(std::to_string(i + 1) + ".") << " "
+            << colors::bold_green(format_size(r.totals.size)) << " "
+            << colors::white(table_->relative(r.id) + "/")
+            << colors::dim(" (" + std::to_string(r.totals.files) + " files)") << '\n';
+    }
+
+    if (top_.empty()) {
+        out << colors::dim("  No directories found.") << '\n';
+    }
+}
+
+void DirSizes::write_json(output::Writer& out, const fs::path&, const std::string& indent) const {
+    out << indent << "\"largest_dirs\": [\n";
+    for (size_t i = 0; i < top_.size(); ++i) {
+        const Record& r = dirs_[top_[i]];
+        out << indent << "  {\"path\": " << output::quoted(table_->relative(r.id)) << ", \"size\": "
+            << r.totals.size << ", \"size_human\": \"" << format_size(r.totals.size) << "\", \"files\": "
+            << r.totals.files << ", \"dirs\": " << r.totals.dirs << "}";
+        if (i + 1 < top_.size()) out << ",";
+        out << "\n";
+    }
+    out << indent << "]";
+}
+
+void DirSizes::write_records(output::Writer& out) const {
+    for (size_t i : top_) {
+        const Record& r = dirs_[i];
+        output::Record(out, "dir")
+            .field("path", table_->relative(r.id))
+            .field("size", r.totals.size)
+            .field("files", r.totals.files)
+            .field("dirs", r.totals.dirs);
+    }
+}
+
+// ----------------------------------------------------------------- types
+
+void Types::begin(unsigned workers) {
+    partial_.assign(workers, {});
+}
+
+void Types::on_file(unsigned worker, const walker::Entry& entry, uint64_t size) {
+    ExtCounts& local = partial_[worker];
+    uint32_t id = local.table.id(entry.name);
+    if (id >= local.totals.size()) local.totals.resize(local.table.size());
+    local.totals[id].first++;
+    local.totals[id].second += size;
+}
+
+void Types::finish(const walker::Options&, bool) {
+    std::map<std::string, std::pair<uint64_t, uint64_t>> ext_stats;
+    for (const auto& local : partial_) {
+        for (uint32_t id = 0; id < local.totals.size(); ++id) {
+            const auto& [files, bytes] = local.totals[id];
+            if (files == 0) continue;
+            auto& merged = ext_stats[local.table.name(id)];
+            merged.first += files;
+            merged.second += bytes;
+        }
+    }
+    partial_.clear();
+
+    sorted_.assign(ext_stats.begin(), ext_stats.end());
+    std::stable_sort(sorted_.begin(), sorted_.end(), [](const auto& a, const auto& b) {
+        return a.second.second > b.second.second;
+    });
+}
+
+void Types::print(const fs::path&) const {
+    output::Writer& out = output::out();
+    out << '\n';
+    out << colors::bold_cyan("[*] File Types by Size:") << '\n';
+    out << colors::dim(std::string(60, '-')) << '\n';
+
+    out << colors::bold_white("Extension         Count   Total Size") << '\n';
+    out << colors::dim(std::string(60, '-')) << '\n';
+
+    for (size_t i = 0; i < std::min(count_, sorted_.size()); ++i) {
+        const auto& [ext, data] = sorted_[i];
+        const auto& [file_count, total_size] = data;
+
+        out << colors::cyan("." + ext);
+        for (size_t j = ext.length() + 1; j < 12; ++j) out << ' ';
+
+        std::string count_str = std::to_string(file_count);
+        for (size_t j = count_str.length(); j < 10; ++j) out << ' ';
+        out << colors::yellow(count_str);
+
+        std::string size_str = format_size(total_size);
+        for (size_t j = size_str.length(); j < 12; ++j) out << ' ';
+        out << colors::green(size_str) << '\n';
+    }
+}
+
+void Types::write_json(output::Writer& out, const fs::path&, const std::string& indent) const {
+    out << indent << "\"file_types\": [\n";
+    size_t shown = std::min(count_, sorted_.size());
+    for (size_t i = 0; i < shown; ++i) {
+        const auto& [ext, data] = sorted_[i];
+        const auto& [file_count, total_size] = data;
+        out << indent << "  {\"extension\": " << output::quoted(ext) << ", \"count\": " << file_count
+            << ", \"total_size\": " << total_size << ", \"total_size_human\": \""
+            << format_size(total_size) << "\"}";
+        if (i + 1 < shown) out << ",";
+        out << "\n";
+    }
+    out << indent << "]";
+}
+
+// ----------------------------------------------------------------- sizes
+
+// Log2 buckets: 0 for empty files, then n for sizes in [2^(n-1), 2^n)
+constexpr size_t kLog2Buckets = 65;
+constexpr size_t kBarWidth = 20;
+
+static size_t log2_bucket(uint64_t size) {
+    if (size == 0) return 0;
+#ifdef _MSC_VER
+    unsigned long bit;
+    _BitScanReverse64(&bit, size);
+    return static_cast<size_t>(bit) + 1;
+#else
+    return 64 - static_cast<size_t>(__builtin_clzll(size));
+#endif
+}
+
+// "512 B", "4 KB", "3 GB"; exact, so bucket edges read as given
+static std::string bound_label(uint64_t bytes) {
+    const char* units[] = {"B", "KB", "MB", "GB", "TB", "PB"};
+    int unit_index = 0;
+    while (bytes >= 1024 && bytes % 1024 == 0 && unit_index < 5) {
+        bytes /= 1024;
+        unit_index++;
+    }
+    return std::to_string(bytes) + " " + units[unit_index];
+}
+
+static void add_bucket(Sizes::Bucket& into, const Sizes::Bucket& from) {
+    into.files += from.files;
+    into.bytes += from.bytes;
+    into.allocated += from.allocated;
+}
+
+Sizes::Sizes(std::vector<uint64_t> bounds, bool by_ext, size_t count)
+    : bounds_(std::move(bounds)), by_ext_(by_ext), count_(count) {
+    std::sort(bounds_.begin(), bounds_.end());
+    bounds_.erase(std::unique(bounds_.begin(), bounds_.end()), bounds_.end());
+    if (!bounds_.empty() && bounds_.front() == 0) bounds_.erase(bounds_.begin());
+    buckets_ = bounds_.empty() ? kLog2Buckets : bounds_.size() + 1;
+}
+
+size_t Sizes::bucket(uint64_t size) const {
+    if (bounds_.empty()) return log2_bucket(size);
+    return static_cast<size_t>(std::upper_bound(bounds_.begin(), bounds_.end(), size) - bounds_.begin());
+}
+
+uint64_t Sizes::lower(size_t i) const {
+    if (bounds_.empty()) return i == 0 ? 0 : uint64_t{1} << (i - 1);
+    return i == 0 ? 0 : bounds_[i - 1];
+}
+
+uint64_t Sizes::upper(size_t i) const {
+    if (bounds_.empty()) return i + 1 < kLog2Buckets ? uint64_t{1} << i : 0;
+    return i < bounds_.size() ? bounds_[i] : 0;
+}
+
+void Sizes::begin(unsigned workers) {
+    partial_.assign(workers, {});
+    for (auto& local : partial_) local.buckets.assign(buckets_, Bucket{});
+}
+
+void Sizes::on_file(unsigned worker, const walker::Entry& entry, uint64_t size) {
+    Local& local = partial_[worker];
+    const size_t b = bucket(size);
+    Bucket& total = local.buckets[b];
+    total.files++;
+    total.bytes += size;
+    total.allocated += entry.allocated;
+    if (!by_ext_) return;
+
+    uint32_t id = local.table.id(entry.name);
+    if ((id + 1) * buckets_ > local.ext.size()) local.ext.resize(local.table.size() * buckets_);
+    Bucket& ext = local.ext[id * buckets_ + b];
+    ext.files++;
+    ext.bytes += size;
+    ext.allocated += entry.allocated;
+}
+
+void Sizes::finish(const walker::Options&, bool) {
+    total_.assign(buckets_, Bucket{});
+    std::map<std::string, std::vector<Bucket>> by_name;
+    for (const auto& local : partial_) {
+        for (size_t b = 0; b < buckets_; ++b) add_bucket(total_[b], local.buckets[b]);
+        for (uint32_t id = 0; id * buckets_ < local.ext.size(); ++id) {
+            const Bucket* from = &local.ext[id * buckets_];
+            std::vector<Bucket>* into = nullptr;
+            for (size_t b = 0; b < buckets_; ++b) {
+                if (from[b].files == 0) continue;
+                if (!into) {
+                    into = &by_name[local.table.name(id)];
+                    into->resize(buckets_);
+                }
+                add_bucket((*into)[b], from[b]);
+            }
+        }
+    }
+    partial_.clear();
+
+    all_ = Histogram{{}, total_, {}};
+    for (const auto& b : total_) add_bucket(all_.sum, b);
+
+    extensions_.clear();
+    for (auto& [ext, buckets] : by_name) {
+        Histogram h{ext, std::move(buckets), {}};
+        for (const auto& b : h.buckets) add_bucket(h.sum, b);
+        extensions_.push_back(std::move(h));
+    }
+    std::stable_sort(extensions_.begin(), extensions_.end(), [](const Histogram& a, const Histogram& b) {
+        return a.sum.files > b.sum.files;
+    });
+    if (extensions_.size() > count_) extensions_.resize(count_);
+}
+
+void Sizes::print_histogram(const Histogram& h) const {
+    output::Writer& out = output::out();
+    // Empty buckets inside the range are shown so the shape stays readable
+    size_t first = 0, last = 0;
+    uint64_t peak = 0;
+    bool any = false;
+    for (size_t i = 0; i < buckets_; ++i) {
+        if (h.buckets[i].files == 0) continue;
+        if (!any) first = i;
+        last = i;
+        any = true;
+        peak = std::max(peak, h.buckets[i].files);
+    }
+    if (!any) {
+        out << colors::dim("  No files found") << '\n';
+        return;
+    }
+
+    char buffer[64];
+    for (size_t i = first; i <= last; ++i) {
+        const Bucket& b = h.buckets[i];
+        std::string range;
+        if (upper(i) == 0) {
+            range = ">= " + bound_label(lower(i));
+        } else if (upper(i) == lower(i) + 1) {
+            range = bound_label(lower(i));
+        } else {
+            range = bound_label(lower(i)) + " - " + bound_label(upper(i));
+        }
+        out << colors::cyan(range);
+        for (size_t j = range.length(); j < 18; ++j) out << ' ';
+
+        std::string files = std::to_string(b.files);
+        for (size_t j = files.length(); j < 10; ++j) out << ' ';
+        out << colors::yellow(files);
+
+        snprintf(buffer, sizeof(buffer), "%7.1f%%", 100.0 * static_cast<double>(b.files)
+                                                    / static_cast<double>(h.sum.files));
+        out << buffer;
+
+        std::string bytes = format_size(b.bytes);
+        for (size_t j = bytes.length(); j < 12; ++j) out << ' ';
+        out << colors::green(bytes);
+
+        std::string allocated = format_size(b.allocated);
+        for (size_t j = allocated.length(); j < 12; ++j) out << ' ';
+        out << allocated << "  ";
+
+        size_t bar = static_cast<size_t>((b.files * kBarWidth + peak - 1) / peak);
+        out << colors::dim(std::string(bar, '#')) << '\n';
+    }
+}
+
+void Sizes::print(const fs::path&) const {
+    output::Writer& out = output::out();
+    out << '\n';
+    out << colors::bold_cyan("[*] File Size Distribution:") << '\n';
+    out << colors::dim(std::string(80, '-')) << '\n';
+    out << colors::bold_white("Size                   Files       %        Size   Allocated") << '\n';
+    out << colors::dim(std::string(80, '-')) << '\n';
+    print_histogram(all_);
+
+    out << colors::dim(std::string(80, '-')) << '\n';
+    out << colors::white("Total:") << ' ' << colors::yellow(std::to_string(all_.sum.files)) << " files, "
+        << colors::green(format_size(all_.sum.bytes)) << " apparent, " << format_size(all_.sum.allocated)
+        << " allocated";
+    // More allocated than stored is block rounding; less is sparse or
+    // compressed files
+    if (all_.sum.allocated > all_.sum.bytes) {
+        out << colors::dim(" (+" + format_size(all_.sum.allocated - all_.sum.bytes) + " in partial blocks)");
+    }
+    out << '\n';
+
+    for (const auto& h : extensions_) {
+        out << '\n';
+        out << colors::bold_white("." + h.ext) << colors::dim(": " + std::to_string(h.sum.files) + " files, "
+                                                             + format_size(h.sum.bytes)) << '\n';
+        print_histogram(h);
+    }
+}
+
+void Sizes::write_buckets(output::Writer& out, const Histogram& h, const std::string& indent) const {
+    out << indent << "\"files\": " << h.sum.files << ",\n";
+    out << indent << "\"bytes\": " << h.sum.bytes << ",\n";
+    out << indent << "\"allocated\": " << h.sum.allocated << ",\n";
+    out << indent << "\"buckets\": [";
+    bool first = true;
+    for (size_t i = 0; i < buckets_; ++i) {
+        const Bucket& b = h.buckets[i];
+        if (b.files == 0) continue;
+        out << (first ? "\n" : ",\n");
+        out << indent << "  {\"min\": " << lower(i);
+        if (upper(i) != 0) out << ", \"max\": " << upper(i);
+        out << ", \"files\": " << b.files << ", \"bytes\": " << b.bytes << ", \"allocated\": " << b.allocated
+            << "}";
+        first = false;
+    }
+    if (!first) out << "\n" << indent;
+    out << "]";
+}
+
+void Sizes::write_json(output::Writer& out, const fs::path&, const std::string& indent) const {
+    // max is exclusive and left out for the open-ended last bucket
+    write_buckets(out, all_, indent);
+    if (!by_ext_) return;
+    out << ",\n" << indent << "\"extensions\": [";
+    for (size_t i = 0; i < extensions_.size(); ++i) {
+        out << (i == 0 ? "\n" : ",\n");
+        out << indent << "  {\n";
+        out << indent << "    \"extension\": " << output::quoted(extensions_[i].ext) << ",\n";
+        write_buckets(out, extensions_[i], indent + "    ");
+        out << "\n" << indent << "  }";
+    }
+    if (!extensions_.empty()) out << "\n" << indent;
+    out << "]";
+}
+
+void Sizes::write_bucket_records(output::Writer& out, const Histogram& h) const {
+    for (size_t i = 0; i < buckets_; ++i) {
+        const Bucket& b = h.buckets[i];
+        if (b.files == 0) continue;
+        output::Record record(out, "size_bucket");
+        if (!h.ext.empty()) record.field("extension", h.ext);
+        record.field("min", lower(i));
+        if (upper(i) != 0) record.field("max", upper(i));
+        record.field("files", b.files).field("bytes", b.bytes).field("allocated", b.allocated);
+    }
+}
+
+void Sizes::write_records(output::Writer& out) const {
+    write_bucket_records(out, all_);
+    for (const auto& h : extensions_) write_bucket_records(out, h);
+    output::Record(out, "sizes")
+        .field("files", all_.sum.files)
+        .field("bytes", all_.sum.bytes)
+        .field("allocated", all_.sum.allocated);
+}
+
+// ----------------------------------------------------------------- dupes
+
+constexpr uint64_t kEdgeBytes = Dupes::kEdgeBytes;
+
+// Groups shown in a report, and files shown per group in text output
+constexpr size_t kGroupsShown = 10;
+constexpr size_t kFilesShown = 5;
+
+// A file that may have a duplicate, with its digest from the latest stage
+struct Candidate {
+    paths::NodeId file;
+    uint64_t size = 0;
+    hashing::Digest digest;
+    bool hashed = false;
+    spill::Origin origin;
+};
+
+// What the hash cache knows a file by
+static spill::Origin origin_of(const walker::Entry& entry) {
+    return {entry.dev, entry.ino, entry.mtime * 1000000000LL + entry.mtime_nsec};
+}
+
+// Hash part of a file, or take the digest from the cache when it has one
+// for this version of the file. path() is only built for a read.
+template <typename Path>
+static bool hash_part(Path path, uint64_t size, const spill::Origin& origin, bool full, hashcache::Cache* cache,
+                      hashing::ReadBuffer& buffer, hashing::Digest& out) {
+    const hashcache::FileId id{origin.dev, origin.ino, size, origin.mtime_ns};
+    const hashcache::Part part = full ? hashcache::Part::Full : hashcache::Part::Edges;
+    if (cache && cache->find(id, part, out)) return true;
+    bool ok = full ? hashing::hash_file(path(), size, buffer, out)
+                   : hashing::hash_edges(path(), size, kEdgeBytes, buffer, out);
+    if (ok && cache) cache->record(id, part, out);
+    return ok;
+}
+
+// Hash `count` files in parallel, a few per task; hash(i, buffer) hashes
+// the i-th
+template <typename Hash>
+static void hash_parallel(size_t count, unsigned threads, Hash hash) {
+    if (count == 0) return;
+    constexpr size_t kBatch = 16;
+
+    pool::WorkStealingPool workers(threads);
+    std::vector<std::unique_ptr<hashing::ReadBuffer>> buffers(workers.size());
+    workers.run([&](unsigned worker) {
+        for (size_t begin = 0; begin < count; begin += kBatch) {
+            workers.submit(worker, [&, begin](unsigned w) {
+                if (!buffers[w]) buffers[w] = std::make_unique<hashing::ReadBuffer>();
+                size_t end = std::min(begin + kBatch, count);
+                for (size_t i = begin; i < end; ++i) hash(i, *buffers[w]);
+            });
+        }
+    });
+}
+
+// Hash candidates in parallel
+static void hash_candidates(std::vector<Candidate>& files, bool full, const paths::PathTable& table,
+                            hashcache::Cache* cache, unsigned threads) {
+    hash_parallel(files.size(), threads, [&](size_t i, hashing::ReadBuffer& buffer) {
+        Candidate& c = files[i];
+        c.hashed = hash_part([&] { return table.path(c.file); }, c.size, c.origin, full, cache, buffer, c.digest);
+    });
+}
+
+// Keep the first name by path of each inode among files of one size;
+// returns how many were dropped. Without inode numbers nothing is.
+template <typename Found>
+static size_t drop_links(std::vector<Found>& files, const paths::PathTable& table) {
+    std::sort(files.begin(), files.end(), [&table](const Found& a, const Found& b) {
+        if (a.origin.ino != b.origin.ino) return a.origin.ino < b.origin.ino;
+        if (a.origin.dev != b.origin.dev) return a.origin.dev < b.origin.dev;
+        return a.origin.ino == 0 ? a.file < b.file : table.less(a.file, b.file);
+    });
+    auto end = std::unique(files.begin(), files.end(), [](const Found& a, const Found& b) {
+        return a.origin.ino != 0 && a.origin.ino == b.origin.ino && a.origin.dev == b.origin.dev;
+    });
+    size_t dropped = static_cast<size_t>(files.end() - end);
+    files.erase(end, files.end());
+    return dropped;
+}
+
+// Keep candidates whose (size, digest) is shared with another candidate,
+// sorted so equal ones are adjacent
+static std::vector<Candidate> keep_matching(std::vector<Candidate> files, const paths::PathTable& table) {
+    files.erase(std::remove_if(files.begin(), files.end(), [](const Candidate& c) { return !c.hashed; }),
+                files.end());
+    std::sort(files.begin(), files.end(), [&table](const Candidate& a, const Candidate& b) {
+        if (a.size != b.size) return a.size < b.size;
+        if (a.digest != b.digest) return a.digest < b.digest;
+        return table.less(a.file, b.file);
+    });
+
+    std::vector<Candidate> kept;
+    for (size_t i = 0; i < files.size();) {
+        size_t j = i + 1;
+        while (j < files.size() && files[j].size == files[i].size && files[j].digest == files[i].digest) j++;
+        if (j - i > 1) {
+            std::move(files.begin() + i, files.begin() + j, std::back_inserter(kept));
+        }
+        i = j;
+    }
+    return kept;
+}
+
+// Relative paths in fs::path order: component by component
+static bool path_less(std::string_view a, std::string_view b) {
+    const char separator = static_cast<char>(fs::path::preferred_separator);
+    for (;;) {
+        size_t end_a = a.find(separator), end_b = b.find(separator);
+        int c = a.substr(0, end_a).compare(b.substr(0, end_b));
+        if (c != 0) return c < 0;
+        if (end_a == std::string_view::npos || end_b == std::string_view::npos) {
+            return end_a == std::string_view::npos && end_b != std::string_view::npos;
+        }
+        a.remove_prefix(end_a + 1);
+        b.remove_prefix(end_b + 1);
+    }
+}
+
+// Hash a batch of spilled files in parallel, set each key's digest and
+// drop the files that couldn't be read
+static void hash_batch(spill::Buffer& batch, bool full, const fs::path& root, hashcache::Cache* cache,
+                       unsigned threads) {
+    std::vector<char> hashed(batch.items.size());
+    hash_parallel(batch.items.size(), threads, [&](size_t i, hashing::ReadBuffer& buffer) {
+        spill::Buffer::Item& item = batch.items[i];
+        hashed[i] = hash_part([&] { return root / fs::path(batch.path(item)); }, item.key.size, item.origin, full,
+                              cache, buffer, item.key.digest);
+    });
+    size_t kept = 0;
+    for (size_t i = 0; i < batch.items.size(); ++i) {
+        if (hashed[i]) batch.items[kept++] = batch.items[i];
+    }
+    batch.items.resize(kept);
+}
+
+// Passes on merged records whose key another record shares (by `same`).
+// The first of each run of keys is held back until a second one arrives,
+// so unique files cost nothing. member(record, first): first is set for
+// the record that opens a run.
+template <typename Same, typename Member>
+class Shared {
+public:
+    Shared(Same same, Member member) : same_(same), member_(member) {}
+
+    bool operator()(const spill::Record& r) {
+        if (!held_ || !same_(first_.key, r.key)) {
+            held_ = true;
+            first_.key = r.key;
+            first_.origin = r.origin;
+            path_.assign(r.path);
+            seen_ = 1;
+            return true;
+        }
+        if (seen_++ == 1) {
+            first_.path = path_;
+            if (!member_(first_, true)) return false;
+        }
+        return member_(r, false);
+    }
+
+private:
+    Same same_;
+    Member member_;
+    bool held_ = false;
+    spill::Record first_;
+    std::string path_;
+    size_t seen_ = 0;
+};
+
+template <typename Same, typename Member>
+static bool for_each_shared(spill::Runs& runs, size_t memory, Same same, Member member) {
+    Shared<Same, Member> shared(same, member);
+    return runs.merge(memory, [&shared](const spill::Record& r) { return shared(r); });
+}
+
+// Path below the root of a walk record: its directory's node rides in the
+// key's digest until stage 1 turns it into a path
+static std::string stage1_path(const paths::PathTable& table, const spill::Record& r) {
+    std::string relative = table.relative(static_cast<paths::NodeId>(r.key.digest.hi));
+    if (!relative.empty()) relative.push_back(static_cast<char>(fs::path::preferred_separator));
+    relative.append(r.path);
+    return relative;
+}
+
+// One name per inode in the stage 1 merge. Records sharing (size, inode)
+// arrive together; they are held until the run ends, then each (device,
+// inode) is passed on once, under its first name by path.
+class FirstNames {
+public:
+    explicit FirstNames(const paths::PathTable& table) : table_(table) {}
+
+    template <typename Next>
+    bool operator()(const spill::Record& r, Next& next) {
+        if (count_ > 0 && (r.origin.ino == 0 || r.key.size != held_[0].key.size
+                           || r.origin.ino != held_[0].origin.ino)) {
+            if (!flush(next)) return false;
+        }
+        if (count_ == held_.size()) held_.emplace_back();
+        Held& h = held_[count_++];
+        h.key = r.key;
+        h.origin = r.origin;
+        h.name.assign(r.path);
+        return true;
+    }
+
+    template <typename Next>
+    bool flush(Next& next) {
+        size_t count = count_;
+        count_ = 0;
+        if (count == 1) return next(record(0));
+        for (size_t i = 0; i < count; ++i) held_[i].path = stage1_path(table_, record(i));
+        order_.resize(count);
+        for (size_t i = 0; i < count; ++i) order_[i] = i;
+        std::sort(order_.begin(), order_.end(), [this](size_t a, size_t b) {
+            if (held_[a].origin.dev != held_[b].origin.dev) return held_[a].origin.dev < held_[b].origin.dev;
+            return path_less(held_[a].path, held_[b].path);
+        });
+        for (size_t k = 0; k < count; ++k) {
+            if (k > 0 && held_[order_[k]].origin.dev == held_[order_[k - 1]].origin.dev) {
+                profile::count(profile::HardLinks);
+            } else if (!next(record(order_[k]))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    struct Held {
+        spill::Key key;
+        spill::Origin origin;
+        std::string name;
+        std::string path;
+    };
+
+    spill::Record record(size_t i) const { return spill::Record{held_[i].key, held_[i].origin, held_[i].name}; }
+
+    const paths::PathTable& table_;
+    std::vector<Held> held_;
+    std::vector<size_t> order_;
+    size_t count_ = 0;
+};
+
+void Dupes::begin(unsigned workers) {
+    partial_.assign(workers, {});
+    if (mem_limit_ == 0) return;
+    // Half of the limit is for the walk's run buffers
+    buffers_.assign(workers, {});
+    buffer_limit_ = static_cast<size_t>(mem_limit_ / 2 / workers);
+    std::error_code ec;
+    fs::path temp = fs::temp_directory_path(ec);
+    runs_ = std::make_unique<spill::Runs>(ec ? fs::path(".") : temp);
+}
+
+void Dupes::on_file(unsigned worker, const walker::Entry& entry, uint64_t size) {
+    if (size < min_size_) return;
+    if (runs_) {
+        // Sorted by inode within a size, so the names of one inode are
+        // adjacent; the directory's node goes where later stages keep the
+        // digest
+        spill::Buffer& buffer = buffers_[worker];
+        buffer.add({size, {entry.ino, entry.dir_id}}, origin_of(entry), entry.name);
+        if (buffer.bytes() >= buffer_limit_ && !runs_->write(buffer)) spill_failed_ = true;
+        return;
+    }
+    paths::NodeId file = table_->add(worker, entry.dir_id, entry.name);
+    if (file != paths::kNoNode) partial_[worker][size].push_back(Found{file, origin_of(entry)});
+}
+
+void Dupes::finish(const walker::Options& walk, bool verbose) {
+    groups_.clear();
+    group_count_ = 0;
+    total_wasted_ = 0;
+    if (runs_) {
+        finish_external(walk, verbose);
+        return;
+    }
+
+    std::map<uint64_t, std::vector<Found>> size_map;
+    for (auto& local : partial_) {
+        for (auto& [size, files] : local) {
+            auto& merged = size_map[size];
+            merged.insert(merged.end(), files.begin(), files.end());
+        }
+    }
+    partial_.clear();
+
+    // Stage 1: only files sharing their size with another file can match
+    std::vector<Candidate> candidates;
+    size_t size_groups = 0;
+    for (auto& [size, files] : size_map) {
+        if (files.size() < 2) continue;
+        profile::count(profile::HardLinks, drop_links(files, *table_));
+        if (files.size() < 2) continue;
+        size_groups++;
+        for (const Found& f : files) candidates.push_back(Candidate{f.file, size, {}, false, f.origin});
+    }
+    size_map.clear();
+
+    if (verbose) {
+        output::Writer& out = output::out();
+        out << colors::dim("    Comparing " + std::to_string(candidates.size()) + " files in "
+                           + std::to_string(size_groups) + " size groups...") << '\n';
+        out.flush();
+    }
+
+    // Stage 2: hash both ends of every candidate; small files are hashed
+    // whole here and are final after this stage
+    unsigned threads = walker::thread_count(walk);
+    {
+        profile::Phase phase("hash edges");
+        hash_candidates(candidates, false, *table_, cache_, threads);
+    }
+    candidates = keep_matching(std::move(candidates), *table_);
+
+    std::vector<Candidate> small, large;
+    for (auto& c : candidates) {
+        (c.size > 2 * kEdgeBytes ? large : small).push_back(std::move(c));
+    }
+    add_groups(small);
+
+    // Stage 3: full-content hash, only for the survivors that need it
+    {
+        profile::Phase phase("hash full");
+        hash_candidates(large, true, *table_, cache_, threads);
+    }
+    add_groups(keep_matching(std::move(large), *table_));
+
+    // Most reclaimable space first
+    std::sort(groups_.begin(), groups_.end(), [this](const Group& a, const Group& b) { return ranks_before(a, b); });
+}
+
+void Dupes::finish_external(const walker::Options& walk, bool verbose) {
+    for (auto& buffer : buffers_) {
+        if (!runs_->write(buffer)) spill_failed_ = true;
+    }
+    buffers_ = {};
+
+    // The other half of the limit: a quarter for the merge's read buffers,
+    // a quarter for the batch being hashed
+    const auto merge_memory = static_cast<size_t>(mem_limit_ / 4);
+    const auto batch_memory = static_cast<size_t>(mem_limit_ / 4);
+    const unsigned threads = walker::thread_count(walk);
+    const fs::path temp = runs_->parent();
+    spill::Runs edges(temp), full(temp);
+    spill::Buffer batch;
+    fs::path root;
+    bool ok = !spill_failed_;
+
+    auto hash_into = [&](spill::Runs& runs, bool whole) {
+        hash_batch(batch, whole, root, cache_, threads);
+        return runs.write(batch);
+    };
+    auto same_size = [](const spill::Key& a, const spill::Key& b) { return a.size == b.size; };
+    auto same_key = [](const spill::Key& a, const spill::Key& b) { return a == b; };
+
+    // Stage 1: runs sorted by size; files sharing one are edge-hashed a
+    // batch at a time into runs sorted by (size, edge digest)
+    uint64_t candidates = 0, size_groups = 0;
+    if (ok) {
+        profile::Phase phase("hash edges");
+        Shared shared(same_size, [&](const spill::Record& r, bool first) {
+            if (root.empty()) {
+                paths::NodeId top = static_cast<paths::NodeId>(r.key.digest.hi);
+                while (table_->parent(top) != paths::kNoNode) top = table_->parent(top);
+                root = table_->path(top);
+            }
+            batch.add({r.key.size, {}}, r.origin, stage1_path(*table_, r));
+            candidates++;
+            if (first) size_groups++;
+            return batch.bytes() < batch_memory || hash_into(edges, false);
+        });
+        FirstNames names(*table_);
+        ok = runs_->merge(merge_memory, [&](const spill::Record& r) { return names(r, shared); })
+             && names.flush(shared) && hash_into(edges, false);
+    }
+    runs_.reset();
+
+    if (verbose && ok) {
+        output::Writer& out = output::out();
+        out << colors::dim("    Compared " + std::to_string(candidates) + " files in " + std::to_string(size_groups)
+                           + " size groups...") << '\n';
+        out.flush();
+    }
+
+    // A confirmed group grows until the merge moves on to the next key
+    Group group{0, {}, {}};
+    auto confirm = [&](const spill::Record& r, bool first) {
+        if (first && !group.paths.empty()) add_group(std::move(group));
+        if (first) group = Group{r.key.size, {}, {}};
+        group.paths.emplace_back(r.path);
+        return true;
+    };
+
+    // Stage 2: equal edges are final for small files; large ones get a
+    // full-content hash into runs sorted by (size, digest)
+    if (ok) {
+        profile::Phase phase("hash full");
+        ok = for_each_shared(edges, merge_memory, same_key, [&](const spill::Record& r, bool first) {
+            if (r.key.size <= 2 * kEdgeBytes) return confirm(r, first);
+            batch.add({r.key.size, {}}, r.origin, r.path);
+            return batch.bytes() < batch_memory || hash_into(full, true);
+        }) && hash_into(full, true);
+    }
+    if (!group.paths.empty()) add_group(std::move(group));
+    group = Group{0, {}, {}};
+
+    // Stage 3: equal full digests
+    if (ok) ok = for_each_shared(full, merge_memory, same_key, confirm);
+    if (!group.paths.empty()) add_group(std::move(group));
+
+    if (!ok) error_ = "Cannot use temporary files in " + temp.string() + "; duplicates are incomplete";
+}
+
+bool Dupes::ranks_before(const Group& a, const Group& b) const {
+    if (a.wasted() != b.wasted()) return a.wasted() > b.wasted();
+    if (a.size != b.size) return a.size > b.size;
+    if (!a.files.empty() && !b.files.empty()) return table_->less(a.files.front(), b.files.front());
+    return path_less(a.paths.front(), b.paths.front());
+}
+
+// Candidates arrive sorted with equal (size, digest) adjacent; each run is
+// a confirmed group
+void Dupes::add_groups(const std::vector<Candidate>& candidates) {
+    for (size_t i = 0; i < candidates.size();) {
+        size_t j = i;
+        Group group{candidates[i].size, {}, {}};
+        while (j < candidates.size() && candidates[j].size == candidates[i].size
+               && candidates[j].digest == candidates[i].digest) {
+            group.files.push_back(candidates[j].file);
+            j++;
+        }
+        group_count_++;
+        total_wasted_ += group.wasted();
+        if (stream_) write_group(*stream_, group);
+        groups_.push_back(std::move(group));
+        i = j;
+    }
+}
+
+void Dupes::add_group(Group group) {
+    std::sort(group.paths.begin(), group.paths.end(),
+              [](const std::string& a, const std::string& b) { return path_less(a, b); });
+    group_count_++;
+    total_wasted_ += group.wasted();
+    if (stream_) write_group(*stream_, group);
+
+    // Reports show the first kGroupsShown; keep just those
+    auto at = std::upper_bound(groups_.begin(), groups_.end(), group,
+                               [this](const Group& a, const Group& b) { return ranks_before(a, b); });
+    if (at - groups_.begin() >= static_cast<std::ptrdiff_t>(kGroupsShown)) return;
+    groups_.insert(at, std::move(group));
+    if (groups_.size() > kGroupsShown) groups_.pop_back();
+}
+
+std::string Dupes::file_path(const Group& group, size_t i) const {
+    return group.files.empty() ? group.paths[i] : table_->relative(group.files[i]);
+}
+
+void Dupes::write_group(output::Writer& out, const Group& group) const {
+    output::Record record(out, "group");
+    record.field("size", group.size).field("count", group.count()).field("wasted", group.wasted());
+    record.key("files") << '[';
+    for (size_t i = 0; i < group.count(); ++i) {
+        if (i > 0) out << ',';
+        out << output::quoted(file_path(group, i));
+    }
+    out << ']';
+}
+
+void Dupes::print(const fs::path&) const {
+    output::Writer& out = output::out();
+    out << '\n';
+    out << colors::bold_cyan("[*] Duplicates (identical content):") << '\n';
+    out << colors::dim(std::string(60, '-')) << '\n';
+
+    if (groups_.empty()) {
+        out << colors::dim("  No duplicates found.") << '\n';
+        return;
+    }
+
+    size_t shown = 0;
+    for (const auto& group : groups_) {
+        if (shown++ >= kGroupsShown) break;
+
+        out << '\n';
+        out << colors::bold_green(format_size(group.size)) << " x "
+            << colors::yellow(std::to_string(group.count())) << " files ("
+            << colors::red(format_size(group.wasted())) << " wasted):" << '\n';
+
+        for (size_t i = 0; i < group.count(); ++i) {
+            if (i >= kFilesShown) {
+                out << colors::dim("    ... and " + std::to_string(group.count() - kFilesShown)
+                                   + " more...") << '\n';
+                break;
+            }
+            out << "    " << colors::white(file_path(group, i)) << '\n';
+        }
+    }
+
+    out << '\n';
+    out << colors::dim(std::string(60, '-')) << '\n';
+    out << "  " << colors::white("Wasted:") << " " << colors::bold_green(format_size(total_wasted_))
+        << " in " << colors::yellow(std::to_string(group_count_)) << " groups" << '\n';
+}
+
+void Dupes::write_json(output::Writer& out, const fs::path&, const std::string& indent) const {
+    out << indent << "\"duplicates\": [\n";
+    size_t shown = std::min(kGroupsShown, groups_.size());
+    for (size_t g = 0; g < shown; ++g) {
+        const Group& group = groups_[g];
+        out << indent << "  {\"size\": " << group.size << ", \"size_human\": \"" << format_size(group.size)
+            << "\", \"count\": " << group.count() << ", \"wasted\": " << group.wasted()
+            << ", \"wasted_human\": \"" << format_size(group.wasted()) << "\", \"files\": [";
+        for (size_t i = 0; i < group.count(); ++i) {
+            out << output::quoted(file_path(group, i));
+            if (i + 1 < group.count()) out << ", ";
+        }
+        out << "]}";
+        if (g + 1 < shown) out << ",";
+        out << "\n";
+    }
+    out << indent << "],\n";
+    out << indent << "\"groups\": " << group_count_ << ",\n";
+    out << indent << "\"total_wasted\": " << total_wasted_ << ",\n";
+    out << indent << "\"total_wasted_human\": \"" << format_size(total_wasted_) << "\"";
+}
+
+void Dupes::write_records(output::Writer& out) const {
+    // Streamed groups already went out while they were confirmed; with a
+    // mem_limit only the top ones were kept to write here
+    if (!stream_) {
+        for (const Group& group : groups_) write_group(out, group);
+    }
+    output::Record(out, "summary").field("groups", group_count_).field("total_wasted", total_wasted_);
+}
+
+// ------------------------------------------------------------------- run
+
+namespace {
+
+// A single built-in collector as a walker visitor (traversal.hpp): with its
+// type known, the walker's per-entry loop calls it directly, with no
+// std::function, virtual call or lock in between
+template <typename C>
+struct Only {
+    C& collector;
+    paths::PathTable* table;
+    const std::atomic<bool>* stop;
+
+    bool wants_files() const { return true; }
+    void on_file(unsigned worker, const walker::Entry& entry, uint64_t size) {
+        collector.C::on_file(worker, entry, size);
+    }
+    void on_dir(unsigned worker, const walker::Entry& entry) { collector.C::on_dir(worker, entry); }
+    bool on_enter_dir(unsigned, const walker::Dir&, std::vector<std::string>&) { return false; }
+    void on_leave_dir(unsigned worker, const walker::Dir& dir) { collector.C::on_leave_dir(worker, dir); }
+    paths::PathTable* paths() const { return table; }
+    const std::atomic<bool>* cancel() const { return stop; }
+};
+
+template <typename C>
+bool visit_only(const fs::path& root, const walker::Options& walk, Collector& c, paths::PathTable* table,
+                const std::atomic<bool>* cancel, walker::Stats& stats) {
+    // Exactly C: a subclass may override what C's calls would skip
+    if (typeid(c) != typeid(C)) return false;
+    Only<C> visitor{static_cast<C&>(c), table, cancel};
+    stats = walker::visit(root, walk, visitor);
+    return true;
+}
+
+// Walk with a kernel of the list's own when it has one: only the default
+// scan (Totals alone) does. False otherwise; every other list goes through
+// Callbacks.
+bool walk_direct(const fs::path& root, const walker::Options& walk, const std::vector<Collector*>& list,
+                 paths::PathTable* table, const std::atomic<bool>* cancel, walker::Stats& stats) {
+    return list.size() == 1 && visit_only<Totals>(root, walk, *list[0], table, cancel, stats);
+}
+
+// Callbacks feeding every collector of `list`, then the hooks. held: a
+// lock per worker, taken around every call; report: counts the progress
+walker::Callbacks feed(const std::vector<Collector*>& list, std::mutex* held, progress::Reporter* report,
+                       walker::Callbacks hooks, paths::PathTable* table) {
+    auto hold = [held](unsigned worker) {
+        return held ? std::unique_lock<std::mutex>(held[worker]) : std::unique_lock<std::mutex>();
+    };
+
+    walker::Callbacks callbacks;
+    callbacks.on_file = [&list, hold, report, extra = std::move(hooks.on_file)](
+                            unsigned worker, const walker::Entry& entry, uint64_t size) {
+        auto lock = hold(worker);
+        for (Collector* c : list) c->on_file(worker, entry, size);
+        if (extra) extra(worker, entry, size);
+        if (report) {
+            progress::Counters& counters = report->counters(worker);
+            progress::Counters::add(counters.files, 1);
+            progress::Counters::add(counters.bytes, size);
+        }
+    };
+    callbacks.on_dir = [&list, hold, extra = std::move(hooks.on_dir)](unsigned worker,
+                                                                     const walker::Entry& entry) {
+        auto lock = hold(worker);
+        for (Collector* c : list) c->on_dir(worker, entry);
+        if (extra) extra(worker, entry);
+    };
+    callbacks.on_leave_dir = [&list, hold, report, extra = std::move(hooks.on_leave_dir)](
+                                 unsigned worker, const walker::Dir& dir) {
+        auto lock = hold(worker);
+        for (Collector* c : list) c->on_leave_dir(worker, dir);
+        if (extra) extra(worker, dir);
+        if (report) {
+            progress::Counters& counters = report->counters(worker);
+            progress::Counters::add(counters.dirs, 1);
+            counters.current.store(dir.id, std::memory_order_release);
+        }
+    };
+    if (hooks.on_enter_dir && held) {
+        callbacks.on_enter_dir = [hold, enter = std::move(hooks.on_enter_dir)](
+                                     unsigned worker, const walker::Dir& dir, std::vector<std::string>& children) {
+            auto lock = hold(worker);
+            return enter(worker, dir, children);
+        };
+    } else {
+        callbacks.on_enter_dir = std::move(hooks.on_enter_dir);
+    }
+    callbacks.paths = table;
+    callbacks.cancel = hooks.cancel;
+    return callbacks;
+}
+
+} // namespace
+
+walker::Stats run(const fs::path& root, const walker::Options& walk, const std::vector<Collector*>& list,
+                  bool verbose, walker::Callbacks hooks, progress::Listener listener) {
+    unsigned workers = walker::thread_count(walk);
+    auto table = std::make_shared<paths::PathTable>(workers);
+    for (Collector* c : list) {
+        c->attach(table);
+        c->begin(workers);
+    }
+
+    // With checkpoints, each worker holds its own lock through every
+    // callback so a checkpoint can read its partial results between them.
+    // Without any reporting nothing is locked or counted.
+    std::unique_ptr<std::mutex[]> locks;
+    std::optional<progress::Reporter> reporter;
+    if (progress::active()) {
+        locks.reset(new std::mutex[workers]);
+        reporter.emplace(workers, *table, [&list, &locks, workers](output::Writer& out) {
+            for (unsigned w = 0; w < workers; ++w) {
+                std::lock_guard<std::mutex> lock(locks[w]);
+                for (Collector* c : list) c->gather(w);
+            }
+            for (Collector* c : list) c->write_checkpoint(out);
+        }, std::move(listener));
+    } else if (listener) {
+        reporter.emplace(workers, *table, nullptr, std::move(listener));
+    }
+    std::mutex* held = locks.get();
+    progress::Reporter* report = reporter ? &*reporter : nullptr;
+    // Without hooks or reporting nothing needs to stand between the walker
+    // and the collectors
+    const bool plain = !held && !report && !hooks.on_file && !hooks.on_dir && !hooks.on_leave_dir
+                       && !hooks.on_enter_dir;
+    walker::Stats stats;
+    {
+        profile::Phase phase("walk");
+        if (!plain || !walk_direct(root, walk, list, table.get(), hooks.cancel, stats)) {
+            stats = walker::walk(root, walk, feed(list, held, report, std::move(hooks), table.get()));
+        }
+    }
+    // Stop reporting before the collectors merge what the workers left
+    reporter.reset();
+    for (Collector* c : list) {
+        profile::Phase phase(std::string("finish ") + c->name());
+        c->finish(walk, verbose);
+    }
+    return stats;
+}
+
+} // namespace collectors
@@ -0,0 +1,350 @@
+#pragma once
+#include "stats.hpp"
+#include "walker.hpp"
+#include "hash.hpp"
+#include "paths.hpp"
+#include "extensions.hpp"
+#include "output.hpp"
+#include "progress.hpp"
+#include "spill.hpp"
+#include "hashcache.hpp"
+#include <filesystem>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Report collectors. Each collector keeps per-worker state fed by a shared
+// traversal, merges it once the walk is done and renders its own section,
+// so any set of reports can be produced from a single pass over the tree.
+namespace collectors {
+
+class Collector {
+public:
+    virtual ~Collector() = default;
+
+    // Section name in a combined JSON report
+    virtual const char* name() const = 0;
+
+    // The table the walk records directories in; collectors add the files
+    // they keep and render paths from it
+    void attach(std::shared_ptr<paths::PathTable> table) { table_ = std::move(table); }
+
+    // Called before the walk with the number of workers
+    virtual void begin(unsigned workers) = 0;
+    virtual void on_file(unsigned worker, const walker::Entry& entry, uint64_t size) = 0;
+    virtual void on_dir(unsigned, const walker::Entry&) {}
+    // Once everything directly inside `dir` has been reported
+    virtual void on_leave_dir(unsigned, const walker::Dir&) {}
+
+    // Merge per-worker results and do any work left after the walk.
+    // verbose: progress lines may be printed
+    virtual void finish(const walker::Options& walk, bool verbose) = 0;
+
+    // Checkpoints while the walk runs (see progress.hpp): gather() is called
+    // for each worker while that worker is held between callbacks, then
+    // write_checkpoint() writes what was gathered as NDJSON records and
+    // drops it. Collectors without partial results ignore both.
+    virtual void gather(unsigned) {}
+    virtual void write_checkpoint(output::Writer&) {}
+
+    virtual void print(const fs::path& root) const = 0;
+    // JSON members of the section without the surrounding braces, each line
+    // prefixed with `indent`, no trailing newline
+    virtual void write_json(output::Writer& out, const fs::path& root, const std::string& indent) const = 0;
+
+protected:
+    std::shared_ptr<paths::PathTable> table_;
+};
+
+// File/directory counts, total size, largest file and extension counts
+class Totals : public Collector {
+public:
+    const char* name() const override { return "totals"; }
+    void begin(unsigned workers) override;
+    void on_file(unsigned worker, const walker::Entry& entry, uint64_t size) override;
+    void on_dir(unsigned worker, const walker::Entry& entry) override;
+    void gather(unsigned worker) override;
+    void write_checkpoint(output::Writer& out) override;
+    void finish(const walker::Options& walk, bool verbose) override;
+    void print(const fs::path& root) const override;
+    void write_json(output::Writer& out, const fs::path& root, const std::string& indent) const override;
+
+    // Per-worker stats, for callers that add results without a file entry
+    DirStats& local(unsigned worker) { return partial_[worker]; }
+    const DirStats& result() const { return stats_; }
+    paths::PathTable& table() { return *table_; }
+
+private:
+    // Files per extension ID, names resolved once in finish()
+    struct ExtCounts {
+        extensions::Table table;
+        std::vector<uint64_t> files;
+    };
+
+    std::vector<DirStats> partial_;
+    std::vector<ExtCounts> ext_;
+    DirStats stats_;
+    DirStats checkpoint_;
+};
+
+// The `count` largest files. Each worker keeps a bounded min-heap of its
+// best candidates, so memory stays O(count) however many files are seen.
+class Largest : public Collector {
+public:
+    explicit Largest(size_t count) : count_(count) {}
+    const char* name() const override { return "largest"; }
+    void begin(unsigned workers) override;
+    void on_file(unsigned worker, const walker::Entry& entry, uint64_t size) override;
+    void gather(unsigned worker) override;
+    void write_checkpoint(output::Writer& out) override;
+    void finish(const walker::Options& walk, bool verbose) override;
+    void print(const fs::path& root) const override;
+    void write_json(output::Writer& out, const fs::path& root, const std::string& indent) const override;
+    // One NDJSON record per file; the ranking is only final after the walk
+    void write_records(output::Writer& out) const;
+
+private:
+    using Item = std::pair<uint64_t, paths::NodeId>;
+
+    // Heap ordered so the front is the weakest kept file
+    struct TopK {
+        std::vector<Item> heap;
+        uint64_t files = 0;
+    };
+
+    size_t count_;
+    std::vector<TopK> partial_;
+    std::vector<Item> files_;
+    std::vector<Item> checkpoint_;
+    bool found_ = false;
+};
+
+// Recursive size, file and subdirectory count of every directory. Workers
+// record each directory's own files as it is left; finish() adds every
+// directory into its parent deepest first, so nothing is shared during the
+// walk and memory is one record per directory, however many files there
+// are. The `count` largest directories below the root are ranked.
+class DirSizes : public Collector {
+public:
+    struct Subtree {
+        uint64_t size = 0;
+        uint64_t files = 0;
+        uint64_t dirs = 0;
+    };
+
+    explicit DirSizes(size_t count) : count_(count) {}
+    const char* name() const override { return "largest_dirs"; }
+    void begin(unsigned workers) override;
+    void on_file(unsigned worker, const walker::Entry& entry, uint64_t size) override;
+    void on_leave_dir(unsigned worker, const walker::Dir& dir) override;
+    void finish(const walker::Options& walk, bool verbose) override;
+    void print(const fs::path& root) const override;
+    void write_json(output::Writer& out, const fs::path& root, const std::string& indent) const override;
+    void write_records(output::Writer& out) const;
+
+    // Totals of the directories at most `max_depth` below the root (0 =
+    // all), by full path as the walker built it
+    std::unordered_map<std::string, Subtree> by_path(int max_depth) const;
+    // Totals of one directory the walk opened
+    bool find(paths::NodeId id, Subtree& out) const;
+
+private:
+    struct Record {
+        paths::NodeId id;
+        int depth;
+        Subtree totals;                   // own files first, subtree after finish()
+    };
+
+    // The directory a worker is listing and its files so far
+    struct Local {
+        std::vector<Record> records;
+        paths::NodeId current = paths::kNoNode;
+        Subtree own;
+    };
+
+    size_t count_;
+    std::vector<Local> partial_;
+    std::vector<Record> dirs_;            // by node ID
+    std::vector<size_t> top_;             // indices into dirs_
+};
+
+// File count and total size per extension, the `count` largest shown
+class Types : public Collector {
+public:
+    explicit Types(size_t count) : count_(count) {}
+    const char* name() const override { return "types"; }
+    void begin(unsigned workers) override;
+    void on_file(unsigned worker, const walker::Entry& entry, uint64_t size) override;
+    void finish(const walker::Options& walk, bool verbose) override;
+    void print(const fs::path& root) const override;
+    void write_json(output::Writer& out, const fs::path& root, const std::string& indent) const override;
+
+private:
+    // (files, bytes) per extension ID
+    struct ExtCounts {
+        extensions::Table table;
+        std::vector<std::pair<uint64_t, uint64_t>> totals;
+    };
+
+    size_t count_;
+    std::vector<ExtCounts> partial_;
+    std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>> sorted_;
+};
+
+// File-size distribution: files, apparent bytes and allocated bytes per
+// size bucket, for the whole tree and optionally per extension. Buckets are
+// powers of two unless bounds are given. Each worker counts into its own
+// fixed array of buckets, summed in finish().
+class Sizes : public Collector {
+public:
+    struct Bucket {
+        uint64_t files = 0;
+        uint64_t bytes = 0;
+        uint64_t allocated = 0;
+    };
+
+    // bounds: ascending upper limits (exclusive) of every bucket but the
+    // last, which is unbounded; empty = [0], [1], [2, 4), [4, 8), ...
+    // by_ext: the `count` extensions with most files get a histogram each
+    Sizes(std::vector<uint64_t> bounds, bool by_ext, size_t count);
+    const char* name() const override { return "sizes"; }
+    void begin(unsigned workers) override;
+    void on_file(unsigned worker, const walker::Entry& entry, uint64_t size) override;
+    void finish(const walker::Options& walk, bool verbose) override;
+    void print(const fs::path& root) const override;
+    void write_json(output::Writer& out, const fs::path& root, const std::string& indent) const override;
+    // One record per non-empty bucket, extension buckets after the total
+    void write_records(output::Writer& out) const;
+
+    size_t bucket_count() const { return buckets_; }
+    // [lower, upper) of bucket i; upper is 0 for the last one
+    uint64_t lower(size_t i) const;
+    uint64_t upper(size_t i) const;
+    const std::vector<Bucket>& result() const { return total_; }
+
+private:
+    struct Histogram {
+        std::string ext;                  // empty for the whole tree
+        std::vector<Bucket> buckets;
+        Bucket sum;
+    };
+
+    // Extensions are counted in one flat array, buckets_ slots per ID
+    struct Local {
+        std::vector<Bucket> buckets;
+        extensions::Table table;
+        std::vector<Bucket> ext;
+    };
+
+    size_t bucket(uint64_t size) const;
+    void print_histogram(const Histogram& h) const;
+    void write_buckets(output::Writer& out, const Histogram& h, const std::string& indent) const;
+    void write_bucket_records(output::Writer& out, const Histogram& h) const;
+
+    std::vector<uint64_t> bounds_;
+    bool by_ext_;
+    size_t count_;
+    size_t buckets_;
+    std::vector<Local> partial_;
+    std::vector<Bucket> total_;
+    Histogram all_;
+    std::vector<Histogram> extensions_;   // by file count, at most count_
+};
+
+// A file in the dupes pipeline, defined in collectors.cpp
+struct Candidate;
+
+// Files of at least `min_size` bucketed by size during the walk, then
+// verified by edge and full-content hashes. Further names of an inode
+// (hard links, symlinks to a file in the tree) are the same file, not
+// duplicates of it: only its first name by path is hashed and reported.
+//
+// With a mem_limit (bytes), nothing grows with the file count. The walk
+// writes (size, directory, name) records to sorted run files in a
+// temporary directory instead of keeping files in memory. A k-way merge
+// streams them back in size order. Files sharing a size are edge-hashed in
+// bounded batches into runs sorted by (size, digest), which are merged the
+// same way for the full-content hash. Only the groups a report shows are
+// kept; with stream() every group is written as it is confirmed.
+class Dupes : public Collector {
+public:
+    // Edge hashes cover this much at each end of a file
+    static constexpr uint64_t kEdgeBytes = 4096;
+
+    explicit Dupes(uint64_t min_size, uint64_t mem_limit = 0) : min_size_(min_size), mem_limit_(mem_limit) {}
+    const char* name() const override { return "dupes"; }
+    void begin(unsigned workers) override;
+    void on_file(unsigned worker, const walker::Entry& entry, uint64_t size) override;
+    void finish(const walker::Options& walk, bool verbose) override;
+    void print(const fs::path& root) const override;
+    void write_json(output::Writer& out, const fs::path& root, const std::string& indent) const override;
+
+    // Write each group as an NDJSON record from finish() as soon as its
+    // hashes confirm it, in confirmation order
+    void stream(output::Writer* out) { stream_ = out; }
+    // NDJSON records not streamed yet, then a summary record
+    void write_records(output::Writer& out) const;
+    // Take digests of unchanged files from `cache` and record the ones
+    // computed; it must outlive finish()
+    void cache(hashcache::Cache* cache) { cache_ = cache; }
+
+    // Why the result is incomplete: the run files of a mem_limit couldn't
+    // be written or read back. Empty when all went well.
+    const std::string& error() const { return error_; }
+
+    struct Group {
+        uint64_t size;
+        std::vector<paths::NodeId> files;
+        std::vector<std::string> paths;   // relative paths instead, with a mem_limit
+        size_t count() const { return files.empty() ? paths.size() : files.size(); }
+        uint64_t wasted() const { return size * (count() - 1); }
+    };
+
+private:
+    void finish_external(const walker::Options& walk, bool verbose);
+    void add_groups(const std::vector<Candidate>& candidates);
+    // Count, stream and (if it ranks) keep a group found with a mem_limit
+    void add_group(Group group);
+    bool ranks_before(const Group& a, const Group& b) const;
+    std::string file_path(const Group& group, size_t i) const;
+    void write_group(output::Writer& out, const Group& group) const;
+
+    // A file of at least min_size as the walk found it
+    struct Found {
+        paths::NodeId file;
+        spill::Origin origin;
+    };
+
+    output::Writer* stream_ = nullptr;
+    hashcache::Cache* cache_ = nullptr;
+    uint64_t min_size_;
+    uint64_t mem_limit_;
+    std::vector<std::map<uint64_t, std::vector<Found>>> partial_;
+    std::vector<Group> groups_;
+    size_t group_count_ = 0;
+    uint64_t total_wasted_ = 0;
+
+    // mem_limit only
+    std::unique_ptr<spill::Runs> runs_;
+    std::vector<spill::Buffer> buffers_;  // per worker
+    size_t buffer_limit_ = 0;
+    std::atomic<bool> spill_failed_{false};
+    std::string error_;
+};
+
+// Walk `root` once, feeding every collector, then finish them in order.
+// hooks: extra callbacks; on_enter_dir and cancel are used as given and
+// on_file/on_dir/on_leave_dir, when set, run after the collectors have seen
+// the entry. listener: gets the walk's progress a few times a second.
+walker::Stats run(const fs::path& root, const walker::Options& walk, const std::vector<Collector*>& list,
+                  bool verbose, walker::Callbacks hooks = {}, progress::Listener listener = {});
+
+} // namespace collectors
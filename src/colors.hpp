@@ -1,58 +1,96 @@
 #pragma once
-#include <string>
-
-namespace colors {
+#include <cstdlib>
+#include <ostream>
+#include <string_view>
 
 #ifdef _WIN32
 #include <windows.h>
+#include <io.h>
+#include <cstdio>
+#else
+#include <unistd.h>
+#endif
+
+namespace colors {
+
+// Where escape codes are written; off for anything that isn't a terminal
+// and when NO_COLOR is set
+struct State {
+    bool out = false;                     // stdout
+    bool err = false;                     // stderr
+};
+
+inline State& state() {
+    static State s;
+    return s;
+}
 
 inline void enable_colors() {
+#ifdef _WIN32
     HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
     DWORD dwMode = 0;
     GetConsoleMode(hOut, &dwMode);
     SetConsoleMode(hOut, dwMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
-}
+    state().out = _isatty(_fileno(stdout)) != 0;
+    state().err = _isatty(_fileno(stderr)) != 0;
 #else
-inline void enable_colors() {}
+    state().out = isatty(STDOUT_FILENO) == 1;
+    state().err = isatty(STDERR_FILENO) == 1;
 #endif
+    const char* no_color = std::getenv("NO_COLOR");
+    if (no_color && *no_color) state() = State{};
+}
 
 // Reset
-const std::string RESET = "\033[0m";
+constexpr std::string_view RESET = "\033[0m";
 
 // Regular colors
-const std::string BLACK = "\033[30m";
-const std::string RED = "\033[31m";
-const std::string GREEN = "\033[32m";
-const std::string YELLOW = "\033[33m";
-const std::string BLUE = "\033[34m";
-const std::string MAGENTA = "\033[35m";
-const std::string CYAN = "\033[36m";
-const std::string WHITE = "\033[37m";
+constexpr std::string_view BLACK = "\033[30m";
+constexpr std::string_view RED = "\033[31m";
+constexpr std::string_view GREEN = "\033[32m";
+constexpr std::string_view YELLOW = "\033[33m";
+constexpr std::string_view BLUE = "\033[34m";
+constexpr std::string_view MAGENTA = "\033[35m";
+constexpr std::string_view CYAN = "\033[36m";
+constexpr std::string_view WHITE = "\033[37m";
 
 // Bold
-const std::string BOLD = "\033[1m";
-const std::string DIM = "\033[2m";
+constexpr std::string_view BOLD = "\033[1m";
+constexpr std::string_view DIM = "\033[2m";
 
 // Bold colors
-const std::string BOLD_GREEN = "\033[1;32m";
-const std::string BOLD_YELLOW = "\033[1;33m";
-const std::string BOLD_CYAN = "\033[1;36m";
-const std::string BOLD_WHITE = "\033[1;37m";
-const std::string BOLD_BLUE = "\033[1;34m";
+constexpr std::string_view BOLD_GREEN = "\033[1;32m";
+constexpr std::string_view BOLD_YELLOW = "\033[1;33m";
+constexpr std::string_view BOLD_CYAN = "\033[1;36m";
+constexpr std::string_view BOLD_WHITE = "\033[1;37m";
+constexpr std::string_view BOLD_BLUE = "\033[1;34m";
+
+// Text with the code to show it in. Only a view: write it out in the
+// expression that made it, the codes are added (or not) by the writer.
+struct Painted {
+    std::string_view code;
+    std::string_view text;
+};
 
 // Helper functions
-inline std::string red(const std::string& s) { return RED + s + RESET; }
-inline std::string green(const std::string& s) { return GREEN + s + RESET; }
-inline std::string yellow(const std::string& s) { return YELLOW + s + RESET; }
-inline std::string blue(const std::string& s) { return BLUE + s + RESET; }
-inline std::string cyan(const std::string& s) { return CYAN + s + RESET; }
-inline std::string white(const std::string& s) { return WHITE + s + RESET; }
-inline std::string dim(const std::string& s) { return DIM + s + RESET; }
-inline std::string bold(const std::string& s) { return BOLD + s + RESET; }
-inline std::string bold_green(const std::string& s) { return BOLD_GREEN + s + RESET; }
-inline std::string bold_cyan(const std::string& s) { return BOLD_CYAN + s + RESET; }
-inline std::string bold_yellow(const std::string& s) { return BOLD_YELLOW + s + RESET; }
-inline std::string bold_blue(const std::string& s) { return BOLD_BLUE + s + RESET; }
-inline std::string bold_white(const std::string& s) { return BOLD_WHITE + s + RESET; }
+inline Painted red(std::string_view s) { return {RED, s}; }
+inline Painted green(std::string_view s) { return {GREEN, s}; }
+inline Painted yellow(std::string_view s) { return {YELLOW, s}; }
+inline Painted blue(std::string_view s) { return {BLUE, s}; }
+inline Painted cyan(std::string_view s) { return {CYAN, s}; }
+inline Painted white(std::string_view s) { return {WHITE, s}; }
+inline Painted dim(std::string_view s) { return {DIM, s}; }
+inline Painted bold(std::string_view s) { return {BOLD, s}; }
+inline Painted bold_green(std::string_view s) { return {BOLD_GREEN, s}; }
+inline Painted bold_cyan(std::string_view s) { return {BOLD_CYAN, s}; }
+inline Painted bold_yellow(std::string_view s) { return {BOLD_YELLOW, s}; }
+inline Painted bold_blue(std::string_view s) { return {BOLD_BLUE, s}; }
+inline Painted bold_white(std::string_view s) { return {BOLD_WHITE, s}; }
+
+// Streams are only used for diagnostics on stderr
+inline std::ostream& operator<<(std::ostream& os, const Painted& p) {
+    if (state().err) return os << p.code << p.text << RESET;
+    return os << p.text;
+}
 
 } // namespace colors
@@ -0,0 +1,353 @@
+#include "dirindex.hpp"
+#include "backend.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <chrono>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace dirindex {
+
+namespace {
+
+constexpr char kMagic[8] = {'D', 'S', 'T', 'I', 'D', 'X', '\0', '\0'};
+constexpr uint32_t kVersion = 3;
+constexpr uint32_t kNoString = 0xFFFFFFFFu;
+
+// On-disk layout: header, DiskDir[dir_count] sorted by (dev, ino),
+// uint32 child name offsets, DiskExt[ext_count], DiskFile[file_count],
+// NUL-terminated strings.
+// Every section starts 8-byte aligned so the file can be used in place.
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t options_hash;
+    uint64_t dir_count;
+    uint64_t child_count;
+    uint64_t ext_count;
+    uint64_t file_count;
+    uint64_t string_bytes;
+};
+
+struct DiskDir {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_ns;
+    uint64_t files;
+    uint64_t size;
+    uint64_t largest_size;
+    uint32_t largest_name;
+    uint32_t child_begin;
+    uint32_t child_count;
+    uint32_t ext_begin;
+    uint32_t ext_count;
+    uint32_t file_begin;
+    uint32_t file_count;
+    uint32_t reserved;
+};
+
+struct DiskExt {
+    uint32_t name;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+struct DiskFile {
+    uint32_t name;
+    uint32_t mtime_nsec;
+    uint64_t size;
+    int64_t mtime;
+};
+
+constexpr size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+struct Layout {
+    size_t dirs, children, exts, files, strings, total;
+};
+
+Layout layout_for(const FileHeader& h) {
+    Layout l;
+    l.dirs = align8(sizeof(FileHeader));
+    l.children = l.dirs + align8(h.dir_count * sizeof(DiskDir));
+    l.exts = l.children + align8(h.child_count * sizeof(uint32_t));
+    l.files = l.exts + align8(h.ext_count * sizeof(DiskExt));
+    l.strings = l.files + align8(h.file_count * sizeof(DiskFile));
+    l.total = l.strings + h.string_bytes;
+    return l;
+}
+
+bool key_less(uint64_t dev_a, uint64_t ino_a, uint64_t dev_b, uint64_t ino_b) {
+    return dev_a != dev_b ? dev_a < dev_b : ino_a < ino_b;
+}
+
+uint64_t fnv1a(uint64_t h, const void* data, size_t len) {
+    auto* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+} // namespace
+
+bool identify(const fs::path& dir, DirId& out) {
+#ifdef _WIN32
+    // No inode numbers through the standard library; the path stands in
+    std::error_code ec;
+    auto mtime = fs::last_write_time(dir, ec);
+    if (ec) return false;
+    std::string key = dir.generic_string();
+    out.dev = 0;
+    out.ino = fnv1a(0xCBF29CE484222325ULL, key.data(), key.size());
+    out.mtime_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+    return true;
+#else
+    struct stat st;
+    if (::stat(dir.c_str(), &st) != 0) return false;
+    out.dev = static_cast<uint64_t>(st.st_dev);
+    out.ino = static_cast<uint64_t>(st.st_ino);
+    out.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+    return true;
+#endif
+}
+
+uint64_t options_hash(const walker::Options& opts) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    h = fnv1a(h, &kVersion, sizeof(kVersion));
+    h = fnv1a(h, &opts.show_hidden, sizeof(opts.show_hidden));
+    h = fnv1a(h, &opts.max_depth, sizeof(opts.max_depth));
+    h = fnv1a(h, &opts.ignore_files, sizeof(opts.ignore_files));
+    for (const auto& pattern : opts.exclude) {
+        h = fnv1a(h, pattern.data(), pattern.size() + 1);
+    }
+    // A filter with ages (mtime < 30d) carries the time they count back
+    // from, so its index is only reused within the same second
+    if (opts.where) {
+        const std::string key = opts.where->key();
+        h = fnv1a(h, key.data(), key.size() + 1);
+    }
+    return h;
+}
+
+Index::~Index() {
+#ifndef _WIN32
+    if (mapped_) munmap(const_cast<char*>(data_), length_);
+#endif
+}
+
+bool Index::load(const fs::path& file, uint64_t options_hash) {
+#ifdef _WIN32
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    if (!in) return false;
+    owned_.resize(static_cast<size_t>(in.tellg()));
+    in.seekg(0);
+    if (!in.read(owned_.data(), static_cast<std::streamsize>(owned_.size()))) return false;
+    data_ = owned_.data();
+    length_ = owned_.size();
+#else
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(FileHeader))) {
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    data_ = static_cast<const char*>(p);
+    length_ = static_cast<size_t>(st.st_size);
+    mapped_ = true;
+#endif
+
+    if (length_ < sizeof(FileHeader)) return false;
+    const auto* header = reinterpret_cast<const FileHeader*>(data_);
+    if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->version != kVersion) return false;
+    if (header->options_hash != options_hash || !valid()) return false;
+    dir_count_ = header->dir_count;
+    return true;
+}
+
+// Every range a record points to lies inside the file, so a truncated or
+// corrupt index is refused instead of read past its end
+bool Index::valid() const {
+    const auto* header = reinterpret_cast<const FileHeader*>(data_);
+    // Bound the counts first so the layout can't overflow
+    if (header->dir_count > length_ / sizeof(DiskDir) || header->child_count > length_ / sizeof(uint32_t)
+        || header->ext_count > length_ / sizeof(DiskExt) || header->file_count > length_ / sizeof(DiskFile)
+        || header->string_bytes > length_) {
+        return false;
+    }
+    Layout l = layout_for(*header);
+    if (l.total != length_) return false;
+    // Strings are read up to their NUL; string_at checks where they start
+    if (header->string_bytes > 0 && data_[length_ - 1] != '\0') return false;
+
+    const auto* dirs = reinterpret_cast<const DiskDir*>(data_ + l.dirs);
+    for (uint64_t i = 0; i < header->dir_count; ++i) {
+        const DiskDir& d = dirs[i];
+        if (i > 0 && !key_less(dirs[i - 1].dev, dirs[i - 1].ino, d.dev, d.ino)) return false;
+        if (uint64_t(d.child_begin) + d.child_count > header->child_count
+            || uint64_t(d.ext_begin) + d.ext_count > header->ext_count
+            || uint64_t(d.file_begin) + d.file_count > header->file_count) {
+            return false;
+        }
+        if (d.largest_name != kNoString && d.largest_name >= header->string_bytes) return false;
+    }
+    return true;
+}
+
+const char* Index::string_at(uint32_t offset) const {
+    const auto* header = reinterpret_cast<const FileHeader*>(data_);
+    if (offset >= header->string_bytes) return "";
+    Layout l = layout_for(*header);
+    return data_ + l.strings + offset;
+}
+
+bool Index::find(const DirId& id, DirRecord& out, bool stamps) const {
+    if (dir_count_ == 0) return false;
+    const auto* header = reinterpret_cast<const FileHeader*>(data_);
+    Layout l = layout_for(*header);
+    const auto* dirs = reinterpret_cast<const DiskDir*>(data_ + l.dirs);
+    const auto* children = reinterpret_cast<const uint32_t*>(data_ + l.children);
+    const auto* exts = reinterpret_cast<const DiskExt*>(data_ + l.exts);
+    const auto* files = reinterpret_cast<const DiskFile*>(data_ + l.files);
+
+    const DiskDir* end = dirs + dir_count_;
+    const DiskDir* it = std::lower_bound(dirs, end, id, [](const DiskDir& d, const DirId& key) {
+        return key_less(d.dev, d.ino, key.dev, key.ino);
+    });
+    if (it == end || it->dev != id.dev || it->ino != id.ino || it->mtime_ns != id.mtime_ns) return false;
+
+    out.id = id;
+    out.files = it->files;
+    out.size = it->size;
+    out.largest_size = it->largest_size;
+    out.largest_name = it->largest_name == kNoString ? std::string() : std::string(string_at(it->largest_name));
+    out.children.clear();
+    for (uint32_t i = 0; i < it->child_count; ++i) {
+        out.children.emplace_back(string_at(children[it->child_begin + i]));
+    }
+    out.extensions.clear();
+    for (uint32_t i = 0; i < it->ext_count; ++i) {
+        const DiskExt& e = exts[it->ext_begin + i];
+        out.extensions.emplace(string_at(e.name), e.count);
+    }
+    out.stamps.clear();
+    if (!stamps) return true;
+    for (uint32_t i = 0; i < it->file_count; ++i) {
+        const DiskFile& f = files[it->file_begin + i];
+        out.stamps.push_back(FileStamp{string_at(f.name), f.size, f.mtime, f.mtime_nsec});
+    }
+    return true;
+}
+
+bool files_unchanged(const fs::path& dir, const DirRecord& record) {
+#ifdef __linux__
+    backend::NativeReader reader;
+#else
+    backend::FsReader reader;
+#endif
+    if (!reader.open(dir)) return false;
+    backend::Stat st;
+    for (const FileStamp& f : record.stamps) {
+        if (!reader.stat(f.name.c_str(), st) || st.type != backend::EntryType::File || st.size != f.size
+            || st.mtime != f.mtime) {
+            return false;
+        }
+        // Stamps from the portable backend only have whole seconds
+        if (f.mtime_nsec != 0 && st.mtime_nsec != f.mtime_nsec) return false;
+    }
+    return true;
+}
+
+bool save(const fs::path& file, uint64_t options_hash, std::vector<DirRecord>& records) {
+    std::sort(records.begin(), records.end(), [](const DirRecord& a, const DirRecord& b) {
+        return key_less(a.id.dev, a.id.ino, b.id.dev, b.id.ino);
+    });
+    // The same directory can be reached twice (e.g. through a symlink)
+    records.erase(std::unique(records.begin(), records.end(), [](const DirRecord& a, const DirRecord& b) {
+        return a.id.dev == b.id.dev && a.id.ino == b.id.ino;
+    }), records.end());
+
+    std::string strings;
+    std::unordered_map<std::string, uint32_t> interned;
+    auto intern = [&](const std::string& s) {
+        auto [it, inserted] = interned.emplace(s, static_cast<uint32_t>(strings.size()));
+        if (inserted) {
+            strings.append(s);
+            strings.push_back('\0');
+        }
+        return it->second;
+    };
+
+    std::vector<DiskDir> dirs;
+    std::vector<uint32_t> children;
+    std::vector<DiskExt> exts;
+    std::vector<DiskFile> files;
+    dirs.reserve(records.size());
+    for (const auto& r : records) {
+        DiskDir d{};
+        d.dev = r.id.dev;
+        d.ino = r.id.ino;
+        d.mtime_ns = r.id.mtime_ns;
+        d.files = r.files;
+        d.size = r.size;
+        d.largest_size = r.largest_size;
+        d.largest_name = r.largest_name.empty() ? kNoString : intern(r.largest_name);
+        d.child_begin = static_cast<uint32_t>(children.size());
+        d.child_count = static_cast<uint32_t>(r.children.size());
+        for (const auto& c : r.children) children.push_back(intern(c));
+        d.ext_begin = static_cast<uint32_t>(exts.size());
+        d.ext_count = static_cast<uint32_t>(r.extensions.size());
+        for (const auto& [ext, count] : r.extensions) exts.push_back(DiskExt{intern(ext), 0, count});
+        d.file_begin = static_cast<uint32_t>(files.size());
+        d.file_count = static_cast<uint32_t>(r.stamps.size());
+        for (const auto& f : r.stamps) files.push_back(DiskFile{intern(f.name), f.mtime_nsec, f.size, f.mtime});
+        dirs.push_back(d);
+    }
+
+    FileHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.options_hash = options_hash;
+    header.dir_count = dirs.size();
+    header.child_count = children.size();
+    header.ext_count = exts.size();
+    header.file_count = files.size();
+    header.string_bytes = strings.size();
+    Layout l = layout_for(header);
+
+    std::vector<char> image(l.total, 0);
+    std::memcpy(image.data(), &header, sizeof(header));
+    if (!dirs.empty()) std::memcpy(image.data() + l.dirs, dirs.data(), dirs.size() * sizeof(DiskDir));
+    if (!children.empty()) std::memcpy(image.data() + l.children, children.data(), children.size() * sizeof(uint32_t));
+    if (!exts.empty()) std::memcpy(image.data() + l.exts, exts.data(), exts.size() * sizeof(DiskExt));
+    if (!files.empty()) std::memcpy(image.data() + l.files, files.data(), files.size() * sizeof(DiskFile));
+    if (!strings.empty()) std::memcpy(image.data() + l.strings, strings.data(), strings.size());
+
+    // Write next to the target and rename, so a crash never leaves a torn index
+    fs::path tmp = file;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(image.data(), static_cast<std::streamsize>(image.size()));
+        if (!out) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, file, ec);
+    return !ec;
+}
+
+} // namespace dirindex
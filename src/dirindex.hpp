@@ -0,0 +1,86 @@
+#pragma once
+#include "walker.hpp"
+#include <filesystem>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Persistent per-directory scan index (--index PATH). Each record holds the
+// aggregates of the files directly inside one directory, keyed by the
+// directory's device/inode and validated by its mtime: if the mtime is
+// unchanged, no entry was added, removed or renamed. Files rewritten in
+// place don't touch the directory, so each file's size and mtime are kept
+// too; --index-verify checks them with a stat before a record is reused.
+namespace dirindex {
+
+// Identity and modification time of a directory
+struct DirId {
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+    int64_t mtime_ns = 0;
+};
+
+bool identify(const fs::path& dir, DirId& out);
+
+// A counted file as it was when the record was made
+struct FileStamp {
+    std::string name;
+    uint64_t size = 0;
+    int64_t mtime = 0;                    // seconds since the epoch
+    uint32_t mtime_nsec = 0;              // 0 when the backend didn't report them
+};
+
+// Aggregates for the files directly inside one directory
+struct DirRecord {
+    DirId id;
+    uint64_t files = 0;
+    uint64_t size = 0;
+    uint64_t largest_size = 0;
+    std::string largest_name;             // empty when there is no file
+    std::vector<std::string> children;    // subdirectories, not filtered by depth
+    std::map<std::string, uint64_t> extensions;
+    std::vector<FileStamp> stamps;        // every file counted above
+};
+
+// Whether every file of `record` still has the size and mtime it was
+// recorded with; one stat per file, no listing
+bool files_unchanged(const fs::path& dir, const DirRecord& record);
+
+// Fingerprint of the options that change what a record contains; an index
+// written with different options is ignored
+uint64_t options_hash(const walker::Options& opts);
+
+// Read-only view of an index file, mmap'd where possible. Records are
+// stored sorted by (dev, ino), so loading doesn't build anything.
+class Index {
+public:
+    Index() = default;
+    ~Index();
+    Index(const Index&) = delete;
+    Index& operator=(const Index&) = delete;
+
+    bool load(const fs::path& file, uint64_t options_hash);
+    size_t size() const { return dir_count_; }
+
+    // Copy out the record for a directory if present and unchanged; its
+    // stamps only when asked for
+    bool find(const DirId& id, DirRecord& out, bool stamps = true) const;
+
+private:
+    bool valid() const;
+    const char* string_at(uint32_t offset) const;
+
+    const char* data_ = nullptr;
+    size_t length_ = 0;
+    bool mapped_ = false;
+    std::vector<char> owned_;
+    size_t dir_count_ = 0;
+};
+
+// Write records (in any order) as a new index, replacing the file atomically
+bool save(const fs::path& file, uint64_t options_hash, std::vector<DirRecord>& records);
+
+} // namespace dirindex
@@ -0,0 +1,56 @@
+#include "dirstat.hpp"
+
+namespace dirstat {
+
+Scan::Scan(fs::path root, walker::Options options) : root_(std::move(root)), options_(std::move(options)) {}
+
+template <typename T, typename... Args>
+T& Scan::builtin(Args&&... args) {
+    for (const auto& c : owned_) {
+        if (auto* existing = dynamic_cast<T*>(c.get())) return *existing;
+    }
+    owned_.push_back(std::make_unique<T>(std::forward<Args>(args)...));
+    list_.push_back(owned_.back().get());
+    return static_cast<T&>(*owned_.back());
+}
+
+collectors::Totals& Scan::totals() { return builtin<collectors::Totals>(); }
+collectors::Largest& Scan::largest(size_t count) { return builtin<collectors::Largest>(count); }
+collectors::DirSizes& Scan::dir_sizes(size_t count) { return builtin<collectors::DirSizes>(count); }
+collectors::Types& Scan::types(size_t count) { return builtin<collectors::Types>(count); }
+collectors::Dupes& Scan::dupes(uint64_t min_size, uint64_t mem_limit) {
+    return builtin<collectors::Dupes>(min_size, mem_limit);
+}
+collectors::Sizes& Scan::sizes(std::vector<uint64_t> bounds, bool by_ext, size_t count) {
+    return builtin<collectors::Sizes>(std::move(bounds), by_ext, count);
+}
+
+void Scan::add(collectors::Collector& collector) {
+    list_.push_back(&collector);
+}
+
+Result Scan::run(bool verbose) {
+    walker::Callbacks callbacks = hooks_;
+    if (visitor_) {
+        // The visitor sees each entry before the caller's own hooks
+        callbacks.on_file = [visit = visitor_, extra = std::move(callbacks.on_file)](
+                                unsigned worker, const walker::Entry& entry, uint64_t size) {
+            visit(worker, EntryView{entry.dir, entry.name, EntryType::File, entry.depth, size, entry.mtime,
+                            entry.allocated});
+            if (extra) extra(worker, entry, size);
+        };
+        callbacks.on_dir = [visit = visitor_, extra = std::move(callbacks.on_dir)](unsigned worker,
+                                                                                 const walker::Entry& entry) {
+            visit(worker, EntryView{entry.dir, entry.name, EntryType::Directory, entry.depth});
+            if (extra) extra(worker, entry);
+        };
+    }
+    callbacks.cancel = &cancel_;
+
+    Result result;
+    result.walk = collectors::run(root_, options_, list_, verbose, std::move(callbacks), listener_);
+    result.cancelled = cancel_.load(std::memory_order_relaxed);
+    return result;
+}
+
+} // namespace dirstat
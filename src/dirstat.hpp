@@ -0,0 +1,103 @@
+#pragma once
+#include "collectors.hpp"
+#include "progress.hpp"
+#include "walker.hpp"
+#include <atomic>
+#include <filesystem>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// libdirstat entry point. A Scan walks one tree once in parallel, feeding
+// the collectors registered on it and an optional visitor; results are
+// read from the collectors once run() returns. The dirstat CLI is a client
+// of this API.
+//
+//     dirstat::Scan scan("/data");
+//     auto& largest = scan.largest(20);
+//     scan.visit([](unsigned, const dirstat::EntryView& e) { ... });
+//     scan.run();
+namespace dirstat {
+
+enum class EntryType : uint8_t { File, Directory };
+
+// An entry as the walk reports it. Views into the walker's buffers, valid
+// only during the call; nothing is copied to make one.
+struct EntryView {
+    const fs::path& dir;                  // the directory being listed
+    std::string_view name;
+    EntryType type;
+    int depth;                            // of `dir`; the root is 1
+    uint64_t size = 0;                    // files
+    int64_t mtime = 0;                    // files: seconds since the epoch
+    uint64_t allocated = 0;               // files: bytes of storage (st_blocks * 512)
+
+    fs::path path() const { return dir / name; }
+};
+
+// Called from the walk's worker threads, concurrently; `worker` is below
+// Scan::workers() and suits indexing per-thread state
+using Visitor = std::function<void(unsigned worker, const EntryView& entry)>;
+
+struct Result {
+    walker::Stats walk;
+    bool cancelled = false;               // results cover the part of the tree walked
+};
+
+class Scan {
+public:
+    explicit Scan(fs::path root, walker::Options options = {});
+    Scan(const Scan&) = delete;
+    Scan& operator=(const Scan&) = delete;
+
+    // Built-in collectors, owned by the scan. Each kind is registered once;
+    // asking again returns the same one.
+    collectors::Totals& totals();
+    collectors::Largest& largest(size_t count);
+    collectors::DirSizes& dir_sizes(size_t count);
+    collectors::Types& types(size_t count);
+    // mem_limit: see collectors::Dupes
+    collectors::Dupes& dupes(uint64_t min_size, uint64_t mem_limit = 0);
+    collectors::Sizes& sizes(std::vector<uint64_t> bounds = {}, bool by_ext = false, size_t count = 10);
+    // A caller's collector; it must outlive run(). Collectors are fed and
+    // finished in the order they were registered.
+    void add(collectors::Collector& collector);
+
+    void visit(Visitor visitor) { visitor_ = std::move(visitor); }
+    // Called from a timer thread a few times a second while walking
+    void on_progress(progress::Listener listener) { listener_ = std::move(listener); }
+    // Lower-level walker hooks (e.g. to reuse directories from an index);
+    // they run after the collectors and the visitor
+    walker::Callbacks& hooks() { return hooks_; }
+
+    // Stop listing new directories; safe from any thread, including the
+    // visitor and the progress listener
+    void cancel() { cancel_.store(true, std::memory_order_relaxed); }
+
+    // Walk and finish every collector. verbose: collectors may print
+    // progress lines while finishing.
+    Result run(bool verbose = false);
+
+    const fs::path& root() const { return root_; }
+    const walker::Options& options() const { return options_; }
+    unsigned workers() const { return walker::thread_count(options_); }
+
+private:
+    template <typename T, typename... Args>
+    T& builtin(Args&&... args);
+
+    fs::path root_;
+    walker::Options options_;
+    std::vector<std::unique_ptr<collectors::Collector>> owned_;
+    std::vector<collectors::Collector*> list_;
+    Visitor visitor_;
+    progress::Listener listener_;
+    walker::Callbacks hooks_;
+    std::atomic<bool> cancel_{false};
+};
+
+} // namespace dirstat
@@ -1,37 +1,43 @@
 #include "display.hpp"
 #include "colors.hpp"
+#include "collectors.hpp"
+#include "dirstat.hpp"
+#include "ignore.hpp"
+#include "output.hpp"
+#include "profile.hpp"
+#include "where.hpp"
 #include <iostream>
 #include <vector>
 #include <algorithm>
 #include <functional>
+#include <deque>
+#include <optional>
+#include <unordered_map>
 
 namespace display {
 
-void show_stats(const DirStats& stats, const fs::path& path) {
-    std::cout << std::endl;
-    std::cout << colors::bold_cyan("[*] Directory Statistics") << std::endl;
-    std::cout << colors::dim(std::string(50, '-')) << std::endl;
+void show_stats(const DirStats& stats, const paths::PathTable& table, const fs::path& path) {
+    output::Writer& out = output::out();
+    out << '\n';
+    out << colors::bold_cyan("[*] Directory Statistics") << '\n';
+    out << colors::dim(std::string(50, '-')) << '\n';
     
-    std::cout << "  " << colors::white("Path:") << " " << colors::cyan(path.string()) << std::endl;
-    std::cout << "  " << colors::white("Files:") << " " << colors::bold_green(std::to_string(stats.total_files)) << std::endl;
-    std::cout << "  " << colors::white("Directories:") << " " << colors::yellow(std::to_string(stats.total_dirs)) << std::endl;
-    std::cout << "  " << colors::white("Total Size:") << " " << colors::bold_green(format_size(stats.total_size)) << std::endl;
+    out << "  " << colors::white("Path:") << " " << colors::cyan(path.string()) << '\n';
+    out << "  " << colors::white("Files:") << " " << colors::bold_green(std::to_string(stats.total_files)) << '\n';
+    out << "  " << colors::white("Directories:") << " " << colors::yellow(std::to_string(stats.total_dirs)) << '\n';
+    out << "  " << colors::white("Total Size:") << " " << colors::bold_green(format_size(stats.total_size)) << '\n';
     
-    if (stats.largest_file_path.has_value()) {
-        std::cout << std::endl;
-        std::cout << colors::bold_cyan("[*] Largest File:") << std::endl;
+    if (stats.largest_file != paths::kNoNode) {
+        out << '\n';
+        out << colors::bold_cyan("[*] Largest File:") << '\n';
         
-        std::error_code ec;
-        fs::path relative = fs::relative(stats.largest_file_path.value(), path, ec);
-        if (ec) relative = stats.largest_file_path.value();
-        
-        std::cout << "    " << colors::white(relative.string()) 
-                  << " (" << colors::green(format_size(stats.largest_file_size)) << ")" << std::endl;
+        out << "    " << colors::white(table.relative(stats.largest_file)) 
+            << " (" << colors::green(format_size(stats.largest_file_size)) << ")" << '\n';
     }
     
     if (!stats.extensions.empty()) {
-        std::cout << std::endl;
-        std::cout << colors::bold_cyan("[*] Top File Types:") << std::endl;
+        out << '\n';
+        out << colors::bold_cyan("[*] Top File Types:") << '\n';
         
         std::vector<std::pair<std::string, uint64_t>> sorted_ext(
             stats.extensions.begin(), stats.extensions.end());
@@ -46,84 +52,301 @@ void show_stats(const DirStats& stats, const fs::path& path) {
             bar_len = std::max(bar_len, size_t(1));
             std::string bar(bar_len, '#');
             
-            std::cout << "    " << colors::cyan("." + ext);
-            for (size_t j = ext.length() + 1; j < 10; ++j) std::cout << ' ';
+            out << "    " << colors::cyan("." + ext);
+            for (size_t j = ext.length() + 1; j < 10; ++j) out << ' ';
             
             std::string count_str = std::to_string(count);
-            for (size_t j = count_str.length(); j < 6; ++j) std::cout << ' ';
-            std::cout << colors::yellow(count_str) << " " << colors::green(bar) << std::endl;
+            for (size_t j = count_str.length(); j < 6; ++j) out << ' ';
+            out << colors::yellow(count_str) << " " << colors::green(bar) << '\n';
         }
     }
     
-    std::cout << std::endl;
-    std::cout << colors::dim(std::string(50, '-')) << std::endl;
-    std::cout << colors::green("[OK] Scan complete!") << std::endl;
+    out << '\n';
+    out << colors::dim(std::string(50, '-')) << '\n';
+    out << colors::green("[OK] Scan complete!") << '\n';
 }
 
-// Helper to check exclusions
-bool is_excluded_display(const fs::path& path, const std::vector<std::string>& exclude) {
-    std::string name = path.filename().string();
-    for (const auto& pattern : exclude) {
-        if (name == pattern || name.find(pattern) != std::string::npos) {
-            return true;
+namespace {
+
+using Subtree = collectors::DirSizes::Subtree;
+using DirTotals = std::unordered_map<std::string, Subtree>;
+
+struct TreeEntry {
+    uint32_t name;                        // offset into Listing::names
+    uint32_t length;
+    bool is_dir = false;
+    bool has_size = false;
+    uint64_t size = 0;                    // a directory's is its total
+    const Subtree* totals = nullptr;      // directories the size walk reached
+};
+
+// The entries of one directory. There is one listing per depth, reused for
+// every directory at that depth, and names share one buffer, so listing
+// doesn't allocate once the buffers have grown.
+struct Listing {
+    std::string names;
+    std::string spare;
+    std::vector<TreeEntry> entries;
+    uint64_t more = 0;                    // entries left out by the cap
+    uint64_t more_size = 0;
+
+    std::string_view name(const TreeEntry& e) const { return {names.data() + e.name, e.length}; }
+
+    void clear() {
+        names.clear();
+        entries.clear();
+        more = more_size = 0;
+    }
+
+    // Keep the `keep` entries that come first, counting the others
+    template <typename Before>
+    void select(size_t keep, Before before) {
+        if (entries.size() <= keep) return;
+        std::nth_element(entries.begin(), entries.begin() + static_cast<std::ptrdiff_t>(keep), entries.end(), before);
+        for (size_t i = keep; i < entries.size(); ++i) {
+            more++;
+            more_size += entries[i].size;
+        }
+        entries.resize(keep);
+        spare.clear();
+        for (TreeEntry& e : entries) {
+            std::string_view n = name(e);
+            e.name = static_cast<uint32_t>(spare.size());
+            spare.append(n);
         }
+        names.swap(spare);
+    }
+};
+
+// dir / name as a string, the way fs::path builds it
+void child_key(std::string& key, const std::string& dir, std::string_view name) {
+    key.assign(dir);
+    if (!key.empty() && key.back() != '/' && key.back() != static_cast<char>(fs::path::preferred_separator)) {
+        key += static_cast<char>(fs::path::preferred_separator);
     }
-    return false;
+    key.append(name);
+}
+
+// " (12.3 MB, 45 files)"
+void dir_summary(std::string& label, const Subtree& totals) {
+    label.assign(" (");
+    label += format_size(totals.size);
+    label += ", ";
+    label += std::to_string(totals.files);
+    label += " files)";
 }
 
-void show_tree(const fs::path& path, int max_depth, bool show_hidden, const std::vector<std::string>& exclude) {
+template <typename Reader>
+void print_tree(const fs::path& root, const walker::Options& opts, const TreeOptions& tree, output::Format format,
+                const DirTotals& totals) {
+    Reader reader;
+    output::Writer& out = output::out();
+    const bool records = format == output::Format::Ndjson;
+    const ignore::Matcher matcher(root, opts.exclude, opts.ignore_files);
+    const bool filter = matcher.active();
+    const bool by_size = tree.sort == TreeSort::Size;
+    const size_t cap = tree.max_entries;
+
+    // Shared buffers, grown and shrunk back around each recursive call:
+    // prefix is the tree drawing (text), rel the path below the root
+    // (records)
+    std::string prefix, rel, key, label;
+    std::deque<Listing> levels;
+
+    using ScopePtr = std::shared_ptr<const ignore::Scope>;
+    std::function<void(const fs::path&, int, const ScopePtr&)> print_dir;
+    print_dir = [&](const fs::path& dir, int depth, const ScopePtr& outer) {
+        if (opts.max_depth > 0 && depth > opts.max_depth) return;
+        const ScopePtr scope = matcher.enter(outer, dir);
+        if (levels.size() < static_cast<size_t>(depth)) levels.resize(static_cast<size_t>(depth));
+        Listing& list = levels[static_cast<size_t>(depth) - 1];
+        list.clear();
+        auto before = [&list, by_size](const TreeEntry& a, const TreeEntry& b) {
+            if (by_size && a.size != b.size) return a.size > b.size;
+            return list.name(a) < list.name(b);
+        };
+
+        // Read the directory (and file sizes) up front so the reader can be
+        // reused by the recursive calls below. With a cap, the list is cut
+        // back whenever it doubles, so huge directories take O(cap) memory.
+        std::optional<profile::Phase> phase(std::in_place, "list");
+        const std::string dir_string = dir.string();
+        if (reader.open(dir)) {
+            backend::Entry raw;
+            while (reader.next(raw)) {
+                if (walker::is_hidden(raw.name, opts)) continue;
+                
+                backend::Stat st;
+                bool have_stat = false;
+                if (raw.type == backend::EntryType::Unknown) {
+                    have_stat = reader.stat(raw.name.data(), st);
+                    raw.type = have_stat ? st.type : backend::EntryType::Other;
+                }
+                TreeEntry entry{static_cast<uint32_t>(list.names.size()), static_cast<uint32_t>(raw.name.size())};
+                entry.is_dir = raw.type == backend::EntryType::Directory;
+                if (filter && matcher.excluded(scope.get(), dir, raw.name, entry.is_dir)) continue;
+                if (raw.type == backend::EntryType::File && opts.where
+                    && !where::select(*opts.where, reader, {dir, raw.name, depth, raw.link}, st, have_stat)) {
+                    continue;
+                }
+                if (raw.type == backend::EntryType::File && (have_stat || reader.stat(raw.name.data(), st))) {
+                    entry.has_size = true;
+                    entry.size = st.size;
+                } else if (entry.is_dir) {
+                    child_key(key, dir_string, raw.name);
+                    auto it = totals.find(key);
+                    if (it != totals.end()) {
+                        entry.totals = &it->second;
+                        entry.size = it->second.size;
+                    }
+                }
+                list.names.append(raw.name);
+                list.entries.push_back(entry);
+                if (cap > 0 && list.entries.size() >= 2 * cap) list.select(cap, before);
+            }
+            reader.close();
+        }
+        
+        phase.emplace("sort");
+        if (cap > 0) list.select(cap, before);
+        std::sort(list.entries.begin(), list.entries.end(), before);
+        phase.reset();
+        
+        const size_t count = list.entries.size();
+        for (size_t i = 0; i < count; ++i) {
+            const TreeEntry& entry = list.entries[i];
+            const std::string_view name = list.name(entry);
+            if (records) {
+                const size_t rel_length = rel.size();
+                if (!rel.empty()) rel += '/';
+                rel.append(name);
+                {
+                    output::Record record(out, entry.is_dir ? "dir" : "file");
+                    record.field("path", rel).field("depth", static_cast<uint64_t>(depth));
+                    if (entry.has_size) record.field("size", entry.size);
+                    if (entry.totals) record.field("size", entry.totals->size).field("files", entry.totals->files);
+                }
+                if (entry.is_dir) print_dir(dir / name, depth + 1, scope);
+                rel.resize(rel_length);
+                continue;
+            }
+
+            const bool is_last = i + 1 == count && list.more == 0;
+            const size_t prefix_length = prefix.size();
+            prefix += is_last ? "+-- " : "|-- ";
+            out << colors::dim(prefix);
+            prefix.resize(prefix_length);
+            
+            if (entry.is_dir) {
+                label.assign(name);
+                label += '/';
+                out << colors::bold_blue(label);
+                if (entry.totals) {
+                    dir_summary(label, *entry.totals);
+                    out << colors::dim(label);
+                }
+                out << '\n';
+                prefix += is_last ? "    " : "|   ";
+                print_dir(dir / name, depth + 1, scope);
+                prefix.resize(prefix_length);
+            } else {
+                out << colors::white(name);
+                if (entry.has_size) {
+                    label.assign(" (");
+                    label += format_size(entry.size);
+                    label += ')';
+                    out << colors::dim(label);
+                }
+                out << '\n';
+            }
+        }
+
+        // The recursive calls above reused deeper listings only
+        if (list.more > 0) {
+            if (records) {
+                output::Record(out, "more")
+                    .field("path", rel)
+                    .field("depth", static_cast<uint64_t>(depth))
+                    .field("entries", list.more)
+                    .field("size", list.more_size);
+            } else {
+                label.assign("... ");
+                label += format_count(list.more);
+                label += " more, ";
+                label += format_size(list.more_size);
+                prefix += "+-- ";
+                out << colors::dim(prefix) << colors::dim(label) << '\n';
+                prefix.resize(prefix.size() - 4);
+            }
+        }
+        out.tick();
+    };
+    
+    // Whatever "tree" spends outside list and sort is output
+    profile::Phase phase("tree");
+    print_dir(root, 1, nullptr);
+}
+
+} // namespace
+
+void show_tree(const fs::path& path, const walker::Options& opts, const TreeOptions& tree,
+               output::Format format) {
     std::error_code ec;
     fs::path abs_path = fs::absolute(path, ec);
     
+    output::Writer& out = output::out();
     if (!fs::exists(abs_path, ec)) {
-        std::cerr << colors::red("[X]") << " Cannot access path: " << path << std::endl;
+        if (format == output::Format::Ndjson) {
+            out << "{\"error\": \"Cannot access path\"}" << '\n';
+            out.flush();
+        } else {
+            std::cerr << colors::red("[X]") << " Cannot access path: " << path << std::endl;
+        }
         return;
     }
     
-    std::cout << colors::yellow("[>]") << " Directory Tree: " << colors::cyan(abs_path.string()) << std::endl;
-    std::cout << std::endl;
-    
-    std::string root_name = abs_path.filename().string();
-    if (root_name.empty()) root_name = abs_path.string();
-    std::cout << colors::bold_cyan(root_name) << std::endl;
-    
-    std::function<void(const fs::path&, const std::string&, int)> print_tree;
-    print_tree = [&](const fs::path& dir, const std::string& prefix, int depth) {
-        if (max_depth > 0 && depth > max_depth) return;
-        
-        std::vector<fs::directory_entry> entries;
-        for (const auto& entry : fs::directory_iterator(dir, fs::directory_options::skip_permission_denied, ec)) {
-            std::string name = entry.path().filename().string();
-            if (!show_hidden && !name.empty() && name[0] == '.') continue;
-            if (is_excluded_display(entry.path(), exclude)) continue;
-            entries.push_back(entry);
+    if (format != output::Format::Ndjson) {
+        out << colors::yellow("[>]") << " Directory Tree: " << colors::cyan(abs_path.string()) << '\n';
+        out << '\n';
+        out.flush();
+    }
+
+    // Totals need everything below each directory, not just the levels
+    // shown, so the whole tree is walked (in parallel) first
+    walker::Options all = opts;
+    all.max_depth = 0;
+    dirstat::Scan scan(abs_path, all);
+    collectors::DirSizes& sizes = scan.dir_sizes(0);
+    scan.run();
+    const DirTotals totals = sizes.by_path(opts.max_depth);
+    auto root_totals = totals.find(abs_path.string());
+
+    if (format == output::Format::Ndjson) {
+        output::Record record(out, "root");
+        record.field("path", abs_path.string());
+        if (root_totals != totals.end()) {
+            record.field("size", root_totals->second.size).field("files", root_totals->second.files);
         }
-        
-        std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
-            return a.path().filename() < b.path().filename();
-        });
-        
-        for (size_t i = 0; i < entries.size(); ++i) {
-            const auto& entry = entries[i];
-            bool is_last = (i == entries.size() - 1);
-            std::string connector = is_last ? "+-- " : "|-- ";
-            std::string name = entry.path().filename().string();
-            
-            if (entry.is_directory(ec)) {
-                std::cout << colors::dim(prefix + connector) << colors::bold_blue(name + "/") << std::endl;
-                std::string new_prefix = prefix + (is_last ? "    " : "|   ");
-                print_tree(entry.path(), new_prefix, depth + 1);
-            } else {
-                uint64_t size = entry.file_size(ec);
-                std::string size_str = ec ? "" : " (" + format_size(size) + ")";
-                std::cout << colors::dim(prefix + connector) << colors::white(name) 
-                          << colors::dim(size_str) << std::endl;
-            }
+    } else {
+        std::string root_name = abs_path.filename().string();
+        if (root_name.empty()) root_name = abs_path.string();
+        out << colors::bold_cyan(root_name);
+        if (root_totals != totals.end()) {
+            std::string label;
+            dir_summary(label, root_totals->second);
+            out << colors::dim(label);
         }
-    };
+        out << '\n';
+    }
     
-    print_tree(abs_path, "", 1);
-    std::cout << std::endl;
+#ifdef __linux__
+    if (opts.backend == backend::Kind::Native) {
+        print_tree<backend::NativeReader>(abs_path, opts, tree, format, totals);
+    } else
+#endif
+    print_tree<backend::FsReader>(abs_path, opts, tree, format, totals);
+    if (format != output::Format::Ndjson) out << '\n';
+    out.flush();
 }
 
 } // namespace display
@@ -1,6 +1,10 @@
 #pragma once
 #include "stats.hpp"
+#include "walker.hpp"
+#include "output.hpp"
 #include <filesystem>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 #include <string>
 
@@ -8,7 +12,16 @@ namespace fs = std::filesystem;
 
 namespace display {
 
-void show_stats(const DirStats& stats, const fs::path& path);
-void show_tree(const fs::path& path, int max_depth, bool show_hidden, const std::vector<std::string>& exclude);
+enum class TreeSort : uint8_t { Name, Size };
+
+struct TreeOptions {
+    size_t max_entries = 0;               // per directory, 0 = all; the rest is summarized
+    TreeSort sort = TreeSort::Name;       // Size: largest first, directories by their total
+};
+
+void show_stats(const DirStats& stats, const paths::PathTable& table, const fs::path& path);
+// Ndjson: one record per entry, written as the tree is read
+void show_tree(const fs::path& path, const walker::Options& opts, const TreeOptions& tree,
+               output::Format format);
 
 } // namespace display
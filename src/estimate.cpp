@@ -0,0 +1,416 @@
+#include "estimate.hpp"
+#include "backend.hpp"
+#include "extensions.hpp"
+#include "ignore.hpp"
+#include "mounts.hpp"
+#include "profile.hpp"
+#include "where.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+namespace estimate {
+
+namespace {
+
+constexpr double kZ = 1.96;               // two-sided 95%
+// Fewer probes than this can agree by luck on a skewed tree
+constexpr uint64_t kMinProbes = 64;
+constexpr auto kTick = std::chrono::milliseconds(100);
+constexpr auto kReportInterval = std::chrono::seconds(1);
+// Directories a worker keeps listed; past this its cache starts over
+constexpr size_t kMaxCached = 1 << 18;
+
+std::atomic<bool> g_stop{false};
+
+using ScopePtr = std::shared_ptr<const ignore::Scope>;
+
+struct ExtCount {
+    uint32_t id;
+    uint64_t files;
+    uint64_t bytes;
+};
+
+// A directory's own contents, listed once per worker and kept for the
+// probes that pass through it again
+struct Node {
+    bool listed = false;
+    int mount = -1;
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    uint64_t dirs = 0;                    // subdirectories, whether descended into or not
+    std::vector<ExtCount> ext;
+    std::vector<std::string> children;    // the subdirectories a walk would enter
+    std::vector<int> child_mounts;
+    std::vector<std::unique_ptr<Node>> below;   // parallel to children, created on first visit
+    ScopePtr scope;
+};
+
+// Sums over probes of each per-probe estimate and its square, so means
+// and variances come out of any merge of them
+struct Moments {
+    double sum = 0;
+    double sum2 = 0;
+
+    void add(double x) {
+        sum += x;
+        sum2 += x * x;
+    }
+};
+
+struct ExtMoments {
+    Moments files;
+    Moments bytes;
+    double cross = 0;                     // sum of extension bytes * total bytes, for the share's variance
+};
+
+struct Tally {
+    uint64_t probes = 0;
+    uint64_t dirs_read = 0;
+    Moments files;
+    Moments dirs;
+    Moments bytes;
+    std::vector<ExtMoments> ext;          // by the worker's extension ID
+    std::vector<std::string> names;       // copied from its table, which only the worker may touch
+};
+
+// One probe's estimates
+struct Sample {
+    double files = 0;
+    double dirs = 0;
+    double bytes = 0;
+};
+
+struct Worker {
+    extensions::Table table;
+    std::mt19937_64 rng;
+    Node root;
+    size_t nodes = 0;
+    uint64_t listed = 0;                  // since the last record()
+    // The probe's estimates per extension ID, and the IDs it touched
+    std::vector<double> ext_files;
+    std::vector<double> ext_bytes;
+    std::vector<uint32_t> touched;
+    // The listing's counts per extension ID
+    std::vector<ExtCount> counts;
+
+    std::mutex mutex;                     // guards tally
+    Tally tally;
+};
+
+struct Context {
+    const fs::path& root;
+    const walker::Options& walk;
+    const ignore::Matcher& matcher;
+    const mounts::Table& mounts;
+    const std::atomic<bool>& done;
+};
+
+bool halted(const Context& ctx) {
+    return ctx.done.load(std::memory_order_relaxed) || g_stop.load(std::memory_order_relaxed);
+}
+
+void forget(Node& node) {
+    int mount = node.mount;
+    node = Node{};
+    node.mount = mount;
+}
+
+// Read a directory's own files and subdirectories the way a walk counts
+// them. False when the estimate ended halfway through.
+template <typename Reader>
+bool list(const Context& ctx, Worker& w, Reader& reader, Node& node, const fs::path& path, int depth,
+          const ScopePtr& outer) {
+    node.listed = true;
+    node.scope = ctx.matcher.enter(outer, path);
+    w.listed++;
+    // Unreadable directories count as empty, as in a walk
+    if (!reader.open(path)) return true;
+
+    const bool filter = ctx.matcher.active();
+    const bool leaf = ctx.walk.max_depth > 0 && depth + 1 > ctx.walk.max_depth;
+    backend::Entry raw;
+    while (reader.next(raw)) {
+        if (walker::is_hidden(raw.name, ctx.walk)) continue;
+        if (halted(ctx)) {
+            reader.close();
+            forget(node);
+            return false;
+        }
+
+        backend::Stat st;
+        bool have_stat = false;
+        if (raw.type == backend::EntryType::Unknown) {
+            if (!reader.stat(raw.name.data(), st)) continue;
+            raw.type = st.type;
+            have_stat = true;
+        }
+        if (filter && ctx.matcher.excluded(node.scope.get(), path, raw.name,
+                                           raw.type == backend::EntryType::Directory)) {
+            continue;
+        }
+
+        if (raw.type == backend::EntryType::File) {
+            if (ctx.walk.where
+                && !where::select(*ctx.walk.where, reader, {path, raw.name, depth + 1, raw.link}, st, have_stat)) {
+                continue;
+            }
+            if (!have_stat && !reader.stat(raw.name.data(), st)) continue;
+            node.files++;
+            node.bytes += st.size;
+            uint32_t id = w.table.id(raw.name);
+            if (id >= w.counts.size()) w.counts.resize(id + 1, ExtCount{0, 0, 0});
+            w.counts[id].files++;
+            w.counts[id].bytes += st.size;
+        } else if (raw.type == backend::EntryType::Directory) {
+            node.dirs++;
+            if (leaf) continue;
+            int mount = ctx.mounts.descend(node.mount, path, raw.name, have_stat ? st.dev : 0,
+                                           ctx.walk.one_file_system, ctx.walk.pseudo_filesystems);
+            if (mount == mounts::Table::kSkip) continue;
+            node.children.emplace_back(raw.name);
+            node.child_mounts.push_back(mount);
+        }
+    }
+    reader.close();
+
+    for (uint32_t id = 0; id < w.counts.size(); ++id) {
+        ExtCount& c = w.counts[id];
+        if (c.files == 0) continue;
+        node.ext.push_back({id, c.files, c.bytes});
+        c = ExtCount{0, 0, 0};
+    }
+    node.below.resize(node.children.size());
+    return true;
+}
+
+// One random path from the root to a directory without subdirectories.
+// Every directory on it stands for as many as there were choices on the
+// way down, so its counts are weighted by their product. False when the
+// estimate ended before the probe did.
+template <typename Reader>
+bool probe(const Context& ctx, Worker& w, Reader& reader, Sample& sample) {
+    if (w.nodes > kMaxCached) {
+        forget(w.root);
+        w.nodes = 0;
+    }
+    sample = Sample{};
+    fs::path path = ctx.root;
+    Node* node = &w.root;
+    ScopePtr outer;
+    double weight = 1;
+    for (int depth = 0;; ++depth) {
+        if (!node->listed && !list(ctx, w, reader, *node, path, depth, outer)) {
+            for (uint32_t id : w.touched) w.ext_files[id] = w.ext_bytes[id] = 0;
+            w.touched.clear();
+            return false;
+        }
+
+        sample.files += weight * static_cast<double>(node->files);
+        sample.dirs += weight * static_cast<double>(node->dirs);
+        sample.bytes += weight * static_cast<double>(node->bytes);
+        for (const ExtCount& c : node->ext) {
+            if (c.id >= w.ext_files.size()) {
+                w.ext_files.resize(c.id + 1, 0);
+                w.ext_bytes.resize(c.id + 1, 0);
+            }
+            if (w.ext_files[c.id] == 0) w.touched.push_back(c.id);
+            w.ext_files[c.id] += weight * static_cast<double>(c.files);
+            w.ext_bytes[c.id] += weight * static_cast<double>(c.bytes);
+        }
+
+        if (node->children.empty()) return true;
+        size_t k = std::uniform_int_distribution<size_t>(0, node->children.size() - 1)(w.rng);
+        weight *= static_cast<double>(node->children.size());
+        if (!node->below[k]) {
+            node->below[k] = std::make_unique<Node>();
+            node->below[k]->mount = node->child_mounts[k];
+            w.nodes++;
+        }
+        path /= node->children[k];
+        outer = node->scope;
+        node = node->below[k].get();
+    }
+}
+
+void record(Worker& w, const Sample& sample) {
+    std::lock_guard<std::mutex> lock(w.mutex);
+    Tally& t = w.tally;
+    t.probes++;
+    t.dirs_read += w.listed;
+    w.listed = 0;
+    t.files.add(sample.files);
+    t.dirs.add(sample.dirs);
+    t.bytes.add(sample.bytes);
+    while (t.names.size() < w.table.size()) t.names.push_back(w.table.name(static_cast<uint32_t>(t.names.size())));
+    t.ext.resize(t.names.size());
+    for (uint32_t id : w.touched) {
+        ExtMoments& e = t.ext[id];
+        e.files.add(w.ext_files[id]);
+        e.bytes.add(w.ext_bytes[id]);
+        e.cross += w.ext_bytes[id] * sample.bytes;
+        w.ext_files[id] = w.ext_bytes[id] = 0;
+    }
+    w.touched.clear();
+}
+
+Interval interval(const Moments& m, double n) {
+    Interval out;
+    if (n == 0) return out;
+    out.value = m.sum / n;
+    // A single probe says nothing about the spread
+    double half = out.value;
+    if (n > 1) {
+        double variance = std::max(0.0, (m.sum2 - n * out.value * out.value) / (n - 1));
+        half = kZ * std::sqrt(variance / n);
+    }
+    out.low = std::max(0.0, out.value - half);
+    out.high = out.value + half;
+    return out;
+}
+
+// Ratio of two estimated totals; its variance from the residuals
+// y - R x of the probes (the usual ratio-estimator approximation)
+Interval share(const ExtMoments& e, const Moments& total, double n) {
+    Interval out;
+    if (n == 0 || total.sum <= 0) return out;
+    double r = e.bytes.sum / total.sum;
+    out.value = r;
+    double half = r;
+    if (n > 1) {
+        double residual = e.bytes.sum2 - 2 * r * e.cross + r * r * total.sum2;
+        double mean = total.sum / n;
+        half = kZ * std::sqrt(std::max(0.0, residual) / ((n - 1) * n)) / mean;
+    }
+    out.low = std::max(0.0, r - half);
+    out.high = std::min(1.0, r + half);
+    return out;
+}
+
+// The estimate from every probe recorded so far; extensions only when asked
+void summarize(const std::vector<std::unique_ptr<Worker>>& workers, const Options& opts, bool extensions,
+               Result& out) {
+    Tally sum;
+    std::unordered_map<std::string, ExtMoments> by_name;
+    for (const auto& w : workers) {
+        std::lock_guard<std::mutex> lock(w->mutex);
+        const Tally& t = w->tally;
+        sum.probes += t.probes;
+        sum.dirs_read += t.dirs_read;
+        for (auto [into, from] : {std::pair{&sum.files, &t.files}, {&sum.dirs, &t.dirs}, {&sum.bytes, &t.bytes}}) {
+            into->sum += from->sum;
+            into->sum2 += from->sum2;
+        }
+        if (!extensions) continue;
+        for (size_t id = 0; id < t.ext.size(); ++id) {
+            ExtMoments& e = by_name[t.names[id]];
+            e.files.sum += t.ext[id].files.sum;
+            e.files.sum2 += t.ext[id].files.sum2;
+            e.bytes.sum += t.ext[id].bytes.sum;
+            e.bytes.sum2 += t.ext[id].bytes.sum2;
+            e.cross += t.ext[id].cross;
+        }
+    }
+
+    const auto n = static_cast<double>(sum.probes);
+    out.probes = sum.probes;
+    out.dirs_read = sum.dirs_read;
+    out.files = interval(sum.files, n);
+    out.dirs = interval(sum.dirs, n);
+    out.bytes = interval(sum.bytes, n);
+    out.converged = sum.probes >= kMinProbes && out.files.relative() <= opts.target
+                 && out.bytes.relative() <= opts.target;
+
+    out.extensions.clear();
+    for (const auto& [name, e] : by_name) {
+        if (e.files.sum == 0) continue;
+        out.extensions.push_back({name, interval(e.files, n), interval(e.bytes, n), share(e, sum.bytes, n)});
+    }
+    std::sort(out.extensions.begin(), out.extensions.end(), [](const Extension& a, const Extension& b) {
+        if (a.bytes.value != b.bytes.value) return a.bytes.value > b.bytes.value;
+        return a.name < b.name;
+    });
+    if (out.extensions.size() > opts.count) out.extensions.resize(opts.count);
+}
+
+template <typename Reader>
+bool run_with(const fs::path& root, const walker::Options& walk, const Options& opts, Result& out,
+              const Listener& listener) {
+    {
+        Reader reader;
+        if (!reader.open(root)) return false;
+        reader.close();
+    }
+
+    mounts::Table table;
+    table.load(root);
+    const ignore::Matcher matcher(root, walk.exclude, walk.ignore_files);
+    std::atomic<bool> done{false};
+    const Context ctx{root, walk, matcher, table, done};
+
+    std::random_device seed;
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (unsigned i = 0; i < walker::thread_count(walk); ++i) {
+        workers.push_back(std::make_unique<Worker>());
+        workers.back()->rng.seed((static_cast<uint64_t>(seed()) << 32) ^ seed() ^ i);
+        workers.back()->root.mount = table.root();
+    }
+
+    g_stop.store(false, std::memory_order_relaxed);
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back([&ctx, &w = *worker] {
+            Reader reader;
+            Sample sample;
+            while (!halted(ctx) && probe(ctx, w, reader, sample)) record(w, sample);
+        });
+    }
+
+    auto next_report = start + kReportInterval;
+    for (;;) {
+        std::this_thread::sleep_for(kTick);
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        Result current;
+        summarize(workers, opts, false, current);
+        // The budget never ends an estimate before its first probe
+        bool spent = opts.time_budget > 0 && elapsed >= opts.time_budget && current.probes > 0;
+        if (current.converged || spent || g_stop.load(std::memory_order_relaxed)) break;
+        if (listener && now >= next_report) {
+            summarize(workers, opts, true, current);
+            current.seconds = elapsed;
+            listener(current);
+            next_report += kReportInterval;
+        }
+    }
+    done.store(true, std::memory_order_relaxed);
+    for (auto& thread : threads) thread.join();
+
+    summarize(workers, opts, true, out);
+    out.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+} // namespace
+
+bool run(const fs::path& root, const walker::Options& walk, const Options& opts, Result& out,
+         Listener listener) {
+    profile::Phase phase("estimate");
+#ifdef __linux__
+    if (walk.backend == backend::Kind::Native) return run_with<backend::NativeReader>(root, walk, opts, out, listener);
+#endif
+    return run_with<backend::FsReader>(root, walk, opts, out, listener);
+}
+
+void stop() {
+    g_stop.store(true, std::memory_order_relaxed);
+}
+
+} // namespace estimate
@@ -0,0 +1,68 @@
+#pragma once
+#include "walker.hpp"
+#include <filesystem>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Fast estimates of a tree's totals without walking all of it
+// (`--estimate`). Each probe is a random path from the root down to a
+// directory without subdirectories, picking a child uniformly at every
+// level (Knuth's estimator): what a directory holds, multiplied by the
+// number of choices made on the way to it, is an unbiased estimate of the
+// total. Workers run probes independently until the time budget is spent
+// or the confidence intervals are narrow enough, keeping every directory
+// they have listed so later probes only read what is new.
+namespace estimate {
+
+struct Options {
+    double time_budget = 10;              // seconds; 0 = until converged or stopped
+    double target = 0.01;                 // converged once files and bytes are within ±1%
+    size_t count = 10;                    // extensions reported
+};
+
+// An estimate with its 95% confidence interval
+struct Interval {
+    double value = 0;
+    double low = 0;
+    double high = 0;
+
+    // Half-width of the interval relative to the value
+    double relative() const { return value > 0 ? (high - low) / (2 * value) : 0; }
+};
+
+struct Extension {
+    std::string name;
+    Interval files;
+    Interval bytes;
+    Interval share;                       // fraction of all bytes
+};
+
+struct Result {
+    uint64_t probes = 0;
+    uint64_t dirs_read = 0;               // directories listed, over all workers
+    double seconds = 0;
+    bool converged = false;
+    Interval files;
+    Interval dirs;
+    Interval bytes;
+    std::vector<Extension> extensions;    // largest share first, at most Options::count
+};
+
+// Called about once a second with the estimate so far, from the thread
+// that called run()
+using Listener = std::function<void(const Result& result)>;
+
+// Estimate the totals below `root` as a walk with `walk` would count them
+// (hidden files, exclusions, depth and filesystem options apply; io_depth
+// doesn't). False when the root can't be listed.
+bool run(const fs::path& root, const walker::Options& walk, const Options& opts, Result& out,
+         Listener listener = {});
+
+// Make a running estimate finish with what it has; safe in a signal handler
+void stop();
+
+} // namespace estimate
@@ -0,0 +1,114 @@
+#include "extensions.hpp"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DIRSTAT_EXT_SSE2 1
+#endif
+
+namespace extensions {
+
+namespace {
+
+// Extensions are short; longer ones take the slow path through a string
+constexpr size_t kMaxInline = 256;
+
+uint32_t hash_bytes(const char* data, size_t len) {
+    uint32_t h = 0x811C9DC5u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 0x01000193u;
+    }
+    return h;
+}
+
+} // namespace
+
+bool find(std::string_view name, std::string_view& ext) {
+    size_t dot = name.rfind('.');
+    if (dot == std::string_view::npos || dot == 0) return false;
+    ext = name.substr(dot + 1);
+    return true;
+}
+
+void to_lower(const char* in, size_t len, char* out) {
+    size_t i = 0;
+#ifdef DIRSTAT_EXT_SSE2
+    // Bytes >= 0x80 are negative as signed chars, so they fall outside
+    // the 'A'..'Z' range and are left alone, like ::tolower in the C locale
+    const __m128i below = _mm_set1_epi8('A' - 1);
+    const __m128i above = _mm_set1_epi8('Z' + 1);
+    const __m128i bit = _mm_set1_epi8(0x20);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, below), _mm_cmplt_epi8(v, above));
+        v = _mm_or_si128(v, _mm_and_si128(upper, bit));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+    }
+#endif
+    for (; i < len; ++i) {
+        char c = in[i];
+        out[i] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c | 0x20) : c;
+    }
+}
+
+std::string key(std::string_view name) {
+    std::string_view ext;
+    if (!find(name, ext)) return "(no ext)";
+    std::string lowered(ext.size(), '\0');
+    to_lower(ext.data(), ext.size(), lowered.data());
+    return lowered;
+}
+
+Table::Table() : slots_(64, Slot{0, kEmpty}), mask_(63) {
+    names_.emplace_back("(no ext)");
+}
+
+uint32_t Table::id(std::string_view file_name) {
+    std::string_view ext;
+    if (!find(file_name, ext)) return kNoExtension;
+
+    char inline_buffer[kMaxInline];
+    std::string heap_buffer;
+    char* lowered = inline_buffer;
+    if (ext.size() > kMaxInline) {
+        heap_buffer.resize(ext.size());
+        lowered = heap_buffer.data();
+    }
+    to_lower(ext.data(), ext.size(), lowered);
+    return intern(std::string_view(lowered, ext.size()), hash_bytes(lowered, ext.size()));
+}
+
+// Linear probing; the table is kept at most half full
+uint32_t Table::intern(std::string_view lowered, uint32_t hash) {
+    for (size_t i = hash & mask_;; i = (i + 1) & mask_) {
+        Slot& slot = slots_[i];
+        if (slot.id == kEmpty) {
+            slot.hash = hash;
+            slot.id = static_cast<uint32_t>(names_.size());
+            names_.emplace_back(lowered);
+            if (names_.size() * 2 > slots_.size()) grow();
+            return static_cast<uint32_t>(names_.size() - 1);
+        }
+        if (slot.hash == hash) {
+            const std::string& known = names_[slot.id];
+            if (known.size() == lowered.size() && std::memcmp(known.data(), lowered.data(), lowered.size()) == 0) {
+                return slot.id;
+            }
+        }
+    }
+}
+
+void Table::grow() {
+    std::vector<Slot> old = std::move(slots_);
+    slots_.assign(old.size() * 2, Slot{0, kEmpty});
+    mask_ = slots_.size() - 1;
+    for (const Slot& slot : old) {
+        if (slot.id == kEmpty) continue;
+        size_t i = slot.hash & mask_;
+        while (slots_[i].id != kEmpty) i = (i + 1) & mask_;
+        slots_[i] = slot;
+    }
+}
+
+} // namespace extensions
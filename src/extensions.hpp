@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// File extension classification on raw name bytes. Each worker interns the
+// extensions it sees into a small open-addressing table and counts into
+// arrays indexed by extension ID; names are only materialised when the
+// per-worker counts are merged at the end.
+namespace extensions {
+
+// ID of "(no ext)" in every table
+constexpr uint32_t kNoExtension = 0;
+
+// Extension of a file name without the dot. Same rules as
+// fs::path::extension(): a leading dot doesn't start one. Returns false
+// when there is none ("name." has an empty one).
+bool find(std::string_view name, std::string_view& ext);
+
+// ASCII lowercase of `len` bytes from `in` into `out`
+void to_lower(const char* in, size_t len, char* out);
+
+// Report label for a file name: the lowercased extension, "(no ext)" when
+// there is none
+std::string key(std::string_view name);
+
+class Table {
+public:
+    Table();
+
+    // ID of the file name's extension, interned on first sight
+    uint32_t id(std::string_view file_name);
+
+    size_t size() const { return names_.size(); }
+    const std::string& name(uint32_t id) const { return names_[id]; }
+
+private:
+    static constexpr uint32_t kEmpty = 0xFFFFFFFFu;
+
+    struct Slot {
+        uint32_t hash;
+        uint32_t id;
+    };
+
+    uint32_t intern(std::string_view lowered, uint32_t hash);
+    void grow();
+
+    std::vector<Slot> slots_;
+    std::vector<std::string> names_;
+    size_t mask_ = 0;
+};
+
+} // namespace extensions
@@ -0,0 +1,331 @@
+#include "hash.hpp"
+#include "profile.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DIRSTAT_HASH_SSE2 1
+#endif
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace hashing {
+
+namespace {
+
+constexpr uint64_t kPrime32_1 = 0x9E3779B1U;
+constexpr uint64_t kPrime64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t kPrime64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr size_t kSecretSize = 192;
+constexpr size_t kReadBufferSize = 1 << 20;
+
+struct Secret {
+    alignas(16) unsigned char bytes[kSecretSize];
+};
+
+// Fixed pseudo-random key material (splitmix64), in place of XXH3's kSecret
+constexpr Secret make_secret() {
+    Secret s{};
+    uint64_t x = 0x243F6A8885A308D3ULL;
+    for (size_t i = 0; i < kSecretSize; i += 8) {
+        x += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        for (size_t b = 0; b < 8; ++b) {
+            s.bytes[i + b] = static_cast<unsigned char>(z >> (8 * b));
+        }
+    }
+    return s;
+}
+
+constexpr Secret kSecret = make_secret();
+
+inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t mul128_fold64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t hi;
+    uint64_t lo = _umul128(a, b, &hi);
+    return lo ^ hi;
+#else
+    uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return lower ^ upper;
+#endif
+}
+
+inline uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+// acc[i ^ 1] += data[i]; acc[i] += lo32(data[i] ^ key[i]) * hi32(data[i] ^ key[i])
+inline void accumulate_512(uint64_t* acc, const unsigned char* input, const unsigned char* secret) {
+#ifdef DIRSTAT_HASH_SSE2
+    auto* xacc = reinterpret_cast<__m128i*>(acc);
+    for (int i = 0; i < 4; ++i) {
+        __m128i data_vec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input) + i);
+        __m128i key_vec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(secret) + i);
+        __m128i data_key = _mm_xor_si128(data_vec, key_vec);
+        __m128i data_key_hi = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i product = _mm_mul_epu32(data_key, data_key_hi);
+        __m128i data_swap = _mm_shuffle_epi32(data_vec, _MM_SHUFFLE(1, 0, 3, 2));
+        xacc[i] = _mm_add_epi64(product, _mm_add_epi64(xacc[i], data_swap));
+    }
+#else
+    for (int i = 0; i < 8; ++i) {
+        uint64_t data_val = read64(input + 8 * i);
+        uint64_t data_key = data_val ^ read64(secret + 8 * i);
+        acc[i ^ 1] += data_val;
+        acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+    }
+#endif
+}
+
+// acc ^= acc >> 47; acc ^= key; acc *= PRIME32_1
+inline void scramble(uint64_t* acc, const unsigned char* secret) {
+#ifdef DIRSTAT_HASH_SSE2
+    auto* xacc = reinterpret_cast<__m128i*>(acc);
+    const __m128i prime32 = _mm_set1_epi32(static_cast<int>(kPrime32_1));
+    for (int i = 0; i < 4; ++i) {
+        __m128i acc_vec = xacc[i];
+        __m128i data_vec = _mm_xor_si128(acc_vec, _mm_srli_epi64(acc_vec, 47));
+        __m128i key_vec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(secret) + i);
+        __m128i data_key = _mm_xor_si128(data_vec, key_vec);
+        __m128i data_key_hi = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i prod_lo = _mm_mul_epu32(data_key, prime32);
+        __m128i prod_hi = _mm_mul_epu32(data_key_hi, prime32);
+        xacc[i] = _mm_add_epi64(prod_lo, _mm_slli_epi64(prod_hi, 32));
+    }
+#else
+    for (int i = 0; i < 8; ++i) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= read64(secret + 8 * i);
+        acc[i] = a * kPrime32_1;
+    }
+#endif
+}
+
+uint64_t merge_accs(const uint64_t* acc, const unsigned char* secret, uint64_t start) {
+    uint64_t result = start;
+    for (int i = 0; i < 4; ++i) {
+        result += mul128_fold64(acc[2 * i] ^ read64(secret + 16 * i),
+                                acc[2 * i + 1] ^ read64(secret + 16 * i + 8));
+    }
+    return avalanche(result);
+}
+
+} // namespace
+
+Hasher::Hasher() {
+    const uint64_t init[8] = {
+        0xC2B2AE3DU, 0x9E3779B185EBCA87ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL,
+        0x85EBCA77C2B2AE63ULL, 0x85EBCA77U, 0x27D4EB2F165667C5ULL, 0x9E3779B1U,
+    };
+    std::memcpy(acc_, init, sizeof(acc_));
+}
+
+void Hasher::consume_stripes(uint64_t* acc, const unsigned char* data, size_t stripes, size_t first) const {
+    for (size_t s = 0; s < stripes; ++s) {
+        accumulate_512(acc, data + s * kStripe, kSecret.bytes + (first + s) * 8);
+    }
+}
+
+void Hasher::consume_block(const unsigned char* block) {
+    consume_stripes(acc_, block, kStripesPerBlock, 0);
+    scramble(acc_, kSecret.bytes + kSecretSize - kStripe);
+}
+
+void Hasher::update(const void* data, size_t len) {
+    auto* p = static_cast<const unsigned char*>(data);
+    total_ += len;
+
+    if (buffered_ > 0) {
+        size_t take = std::min(len, kBlock - buffered_);
+        std::memcpy(buffer_ + buffered_, p, take);
+        buffered_ += take;
+        p += take;
+        len -= take;
+        if (buffered_ < kBlock) return;
+        consume_block(buffer_);
+        buffered_ = 0;
+    }
+
+    // Whole blocks straight from the caller's buffer, keep the rest
+    while (len >= kBlock) {
+        consume_block(p);
+        p += kBlock;
+        len -= kBlock;
+    }
+    std::memcpy(buffer_, p, len);
+    buffered_ = len;
+}
+
+Digest Hasher::finish() const {
+    alignas(16) uint64_t acc[8];
+    std::memcpy(acc, acc_, sizeof(acc));
+
+    size_t full = buffered_ / kStripe;
+    consume_stripes(acc, buffer_, full, 0);
+
+    // Zero-padded last stripe; the length folded in below keeps inputs that
+    // only differ by trailing zero bytes apart
+    size_t rest = buffered_ % kStripe;
+    if (rest > 0) {
+        unsigned char last[kStripe] = {};
+        std::memcpy(last, buffer_ + full * kStripe, rest);
+        accumulate_512(acc, last, kSecret.bytes + full * 8);
+    }
+
+    Digest d;
+    d.lo = merge_accs(acc, kSecret.bytes + 11, total_ * kPrime64_1);
+    d.hi = merge_accs(acc, kSecret.bytes + kSecretSize - kStripe - 11, ~(total_ * kPrime64_2));
+    return d;
+}
+
+ReadBuffer::ReadBuffer() : data(kReadBufferSize) {}
+
+#ifdef _WIN32
+
+bool hash_edges(const fs::path& path, uint64_t size, uint64_t edge, ReadBuffer& buffer, Digest& out) {
+    if (size <= 2 * edge) return hash_file(path, size, buffer, out);
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        profile::error(0);
+        return false;
+    }
+    Hasher hasher;
+    auto* data = reinterpret_cast<char*>(buffer.data.data());
+    if (!in.read(data, static_cast<std::streamsize>(edge))) return false;
+    hasher.update(data, edge);
+    in.seekg(static_cast<std::streamoff>(size - edge));
+    if (!in.read(data, static_cast<std::streamsize>(edge))) return false;
+    hasher.update(data, edge);
+    profile::count(profile::BytesHashed, 2 * edge);
+    out = hasher.finish();
+    return true;
+}
+
+bool hash_file(const fs::path& path, uint64_t size, ReadBuffer& buffer, Digest& out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        profile::error(0);
+        return false;
+    }
+    Hasher hasher;
+    auto* data = reinterpret_cast<char*>(buffer.data.data());
+    uint64_t total = 0;
+    while (in) {
+        in.read(data, static_cast<std::streamsize>(buffer.data.size()));
+        std::streamsize n = in.gcount();
+        if (n <= 0) break;
+        hasher.update(data, static_cast<size_t>(n));
+        total += static_cast<uint64_t>(n);
+    }
+    profile::count(profile::BytesHashed, total);
+    if (total != size) return false;
+    out = hasher.finish();
+    return true;
+}
+
+#else
+
+namespace {
+
+bool read_at(int fd, unsigned char* data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, data, len, static_cast<off_t>(offset));
+        if (n <= 0) return false;
+        data += n;
+        len -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+bool hash_edges(const fs::path& path, uint64_t size, uint64_t edge, ReadBuffer& buffer, Digest& out) {
+    if (size <= 2 * edge) return hash_file(path, size, buffer, out);
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOCTTY);
+    if (fd < 0) {
+        profile::error(errno);
+        return false;
+    }
+#ifdef POSIX_FADV_RANDOM
+    // Two small reads; don't let readahead pull in the middle of the file
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+    Hasher hasher;
+    bool ok = read_at(fd, buffer.data.data(), edge, 0);
+    if (ok) hasher.update(buffer.data.data(), edge);
+    ok = ok && read_at(fd, buffer.data.data(), edge, size - edge);
+    if (ok) hasher.update(buffer.data.data(), edge);
+    ::close(fd);
+    if (ok) {
+        profile::count(profile::BytesHashed, 2 * edge);
+        out = hasher.finish();
+    }
+    return ok;
+}
+
+bool hash_file(const fs::path& path, uint64_t size, ReadBuffer& buffer, Digest& out) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOCTTY);
+    if (fd < 0) {
+        profile::error(errno);
+        return false;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    Hasher hasher;
+    uint64_t total = 0;
+    for (;;) {
+        ssize_t n = ::read(fd, buffer.data.data(), buffer.data.size());
+        if (n <= 0) break;
+        hasher.update(buffer.data.data(), static_cast<size_t>(n));
+        total += static_cast<uint64_t>(n);
+    }
+#ifdef POSIX_FADV_DONTNEED
+    // Whole-file hashing streams through a lot of data; don't let it evict
+    // everything else from the page cache
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    ::close(fd);
+    profile::count(profile::BytesHashed, total);
+    if (total != size) return false;
+    out = hasher.finish();
+    return true;
+}
+
+#endif
+
+} // namespace hashing
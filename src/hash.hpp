@@ -0,0 +1,58 @@
+#pragma once
+#include <filesystem>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace hashing {
+
+// 128-bit content digest
+struct Digest {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    bool operator==(const Digest& o) const { return lo == o.lo && hi == o.hi; }
+    bool operator!=(const Digest& o) const { return !(*this == o); }
+    bool operator<(const Digest& o) const { return lo != o.lo ? lo < o.lo : hi < o.hi; }
+};
+
+// Streaming hash built on the XXH3 long-input kernel: 64-byte stripes fed
+// into eight 64-bit lanes (SSE2 when available), scrambled every 1 KiB
+// block and folded into 128 bits at the end. Not output-compatible with
+// XXH3 itself, only meant for comparing files within one run.
+class Hasher {
+public:
+    Hasher();
+    void update(const void* data, size_t len);
+    Digest finish() const;
+
+private:
+    static constexpr size_t kStripe = 64;
+    static constexpr size_t kStripesPerBlock = 16;
+    static constexpr size_t kBlock = kStripe * kStripesPerBlock;
+
+    void consume_block(const unsigned char* block);
+    void consume_stripes(uint64_t* acc, const unsigned char* data, size_t stripes, size_t first) const;
+
+    alignas(16) uint64_t acc_[8];
+    unsigned char buffer_[kBlock];
+    size_t buffered_ = 0;
+    uint64_t total_ = 0;
+};
+
+// Per-thread scratch space for file reads
+struct ReadBuffer {
+    std::vector<unsigned char> data;
+    ReadBuffer();
+};
+
+// Hash the first and last `edge` bytes of a file (the whole file when it
+// is no larger than 2 * edge)
+bool hash_edges(const fs::path& path, uint64_t size, uint64_t edge, ReadBuffer& buffer, Digest& out);
+
+// Hash the whole file with large sequential reads
+bool hash_file(const fs::path& path, uint64_t size, ReadBuffer& buffer, Digest& out);
+
+} // namespace hashing
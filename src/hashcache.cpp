@@ -0,0 +1,309 @@
+#include "hashcache.hpp"
+#include "profile.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace hashcache {
+
+namespace {
+
+constexpr char kMagic[8] = {'D', 'S', 'T', 'H', 'S', 'H', '\0', '\0'};
+// Bump when the digests change (hashing::Hasher) or the layout does
+constexpr uint32_t kVersion = 1;
+
+// On-disk layout: header, DiskEntry[base_count] sorted by (dev, ino), then
+// the log: DiskEntry records in the order they were appended
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t edge;                        // bytes at each end of an edge digest
+    uint64_t base_count;
+};
+
+struct DiskEntry {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t edges_lo;
+    uint64_t edges_hi;
+    uint64_t full_lo;
+    uint64_t full_hi;
+    uint32_t parts;
+    uint32_t check;                       // of the fields above; catches torn appends
+};
+
+constexpr uint32_t bit(Part part) { return part == Part::Edges ? 1u : 2u; }
+
+uint32_t checksum(const DiskEntry& d) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    auto* p = reinterpret_cast<const unsigned char*>(&d);
+    for (size_t i = 0; i < offsetof(DiskEntry, check); ++i) {
+        h ^= p[i];
+        h *= 0x100000001B3ULL;
+    }
+    return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+bool key_less(const DiskEntry& a, const DiskEntry& b) {
+    return a.dev != b.dev ? a.dev < b.dev : a.ino < b.ino;
+}
+
+// What a file turned out to hold
+enum class Contents { Cache, Foreign };
+
+// A hash cache file's header, base and readable log records. `clean` is
+// false when the log ends in a torn or damaged record, so appending to it
+// would put new records out of reach.
+struct View {
+    const FileHeader* header = nullptr;
+    const DiskEntry* base = nullptr;
+    const DiskEntry* log = nullptr;
+    size_t log_count = 0;
+    bool clean = true;
+};
+
+Contents parse(const char* data, size_t length, View& out) {
+    if (length < sizeof(FileHeader)) return Contents::Foreign;
+    const auto* header = reinterpret_cast<const FileHeader*>(data);
+    if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0) return Contents::Foreign;
+    out.header = header;
+    if (header->version != kVersion || header->base_count > (length - sizeof(FileHeader)) / sizeof(DiskEntry)) {
+        out.clean = false;
+        return Contents::Cache;
+    }
+    size_t log_begin = sizeof(FileHeader) + header->base_count * sizeof(DiskEntry);
+    out.base = reinterpret_cast<const DiskEntry*>(data + sizeof(FileHeader));
+    out.log = reinterpret_cast<const DiskEntry*>(data + log_begin);
+    size_t available = (length - log_begin) / sizeof(DiskEntry);
+    while (out.log_count < available && checksum(out.log[out.log_count]) == out.log[out.log_count].check) {
+        out.log_count++;
+    }
+    out.clean = out.log_count * sizeof(DiskEntry) == length - log_begin;
+    return Contents::Cache;
+}
+
+// Write `records` (oldest first) as a base with the newest record of each
+// inode, replacing `file` atomically
+bool write_file(const fs::path& file, uint64_t edge, std::vector<DiskEntry>& records) {
+    std::stable_sort(records.begin(), records.end(), key_less);
+    size_t kept = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (i + 1 < records.size() && !key_less(records[i], records[i + 1])) continue;
+        records[kept++] = records[i];
+    }
+    records.resize(kept);
+
+    FileHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.edge = edge;
+    header.base_count = records.size();
+
+    // Write next to the target and rename, so a crash never leaves a torn cache
+    fs::path tmp = file;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(records.data()),
+                  static_cast<std::streamsize>(records.size() * sizeof(DiskEntry)));
+        if (!out) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, file, ec);
+    return !ec;
+}
+
+} // namespace
+
+Cache::~Cache() {
+#ifndef _WIN32
+    if (mapped_) munmap(const_cast<char*>(data_), length_);
+#endif
+}
+
+bool Cache::load(const fs::path& file, uint64_t edge) {
+    file_ = file;
+    edge_ = edge;
+    std::error_code ec;
+    if (!fs::exists(file, ec) || fs::file_size(file, ec) == 0) return false;
+    foreign_ = true;
+#ifdef _WIN32
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    if (!in) return false;
+    owned_.resize(static_cast<size_t>(in.tellg()));
+    in.seekg(0);
+    if (!in.read(owned_.data(), static_cast<std::streamsize>(owned_.size()))) return false;
+    data_ = owned_.data();
+    length_ = owned_.size();
+#else
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(FileHeader))) {
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    data_ = static_cast<const char*>(p);
+    length_ = static_cast<size_t>(st.st_size);
+    mapped_ = true;
+#endif
+
+    View view;
+    if (parse(data_, length_, view) != Contents::Cache) return false;
+    // Another version or edge size: replaced by save()
+    foreign_ = false;
+    if (view.header->version != kVersion || view.header->edge != edge) return false;
+    base_count_ = view.header->base_count;
+    for (size_t i = 0; i < view.log_count; ++i) {
+        const DiskEntry& d = view.log[i];
+        Entry& e = log_[{d.dev, d.ino}];
+        e.id = FileId{d.dev, d.ino, d.size, d.mtime_ns};
+        e.edges = hashing::Digest{d.edges_lo, d.edges_hi};
+        e.full = hashing::Digest{d.full_lo, d.full_hi};
+        e.parts = d.parts;
+    }
+    loaded_ = view.clean;
+    return true;
+}
+
+const Cache::Entry* Cache::lookup(uint64_t dev, uint64_t ino, Entry& scratch) const {
+    auto it = log_.find({dev, ino});
+    if (it != log_.end()) return &it->second;
+    if (base_count_ == 0) return nullptr;
+    const auto* base = reinterpret_cast<const DiskEntry*>(data_ + sizeof(FileHeader));
+    DiskEntry key{};
+    key.dev = dev;
+    key.ino = ino;
+    const DiskEntry* d = std::lower_bound(base, base + base_count_, key, key_less);
+    if (d == base + base_count_ || d->dev != dev || d->ino != ino) return nullptr;
+    scratch.id = FileId{d->dev, d->ino, d->size, d->mtime_ns};
+    scratch.edges = hashing::Digest{d->edges_lo, d->edges_hi};
+    scratch.full = hashing::Digest{d->full_lo, d->full_hi};
+    scratch.parts = d->parts;
+    return &scratch;
+}
+
+bool Cache::find(const FileId& id, Part part, hashing::Digest& out) {
+    if (id.ino == 0) return false;
+    lookups_.fetch_add(1, std::memory_order_relaxed);
+    Entry scratch;
+    const Entry* e = lookup(id.dev, id.ino, scratch);
+    if (!e || e->id.size != id.size || e->id.mtime_ns != id.mtime_ns || !(e->parts & bit(part))) {
+        profile::count(profile::CacheMisses);
+        return false;
+    }
+    out = part == Part::Edges ? e->edges : e->full;
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    bytes_saved_.fetch_add(part == Part::Full ? id.size : std::min(id.size, 2 * edge_), std::memory_order_relaxed);
+    profile::count(profile::CacheHits);
+    return true;
+}
+
+void Cache::record(const FileId& id, Part part, const hashing::Digest& digest) {
+    if (id.ino == 0) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry& e = pending_[{id.dev, id.ino}];
+    if (e.parts == 0 || e.id.size != id.size || e.id.mtime_ns != id.mtime_ns) e = Entry{id, {}, {}, 0};
+    (part == Part::Edges ? e.edges : e.full) = digest;
+    e.parts |= bit(part);
+}
+
+bool Cache::save() {
+    if (foreign_) return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<DiskEntry> records;
+    records.reserve(pending_.size());
+    for (auto& [key, e] : pending_) {
+        // Keep the other digest when it is still valid
+        Entry scratch;
+        const Entry* old = lookup(key.first, key.second, scratch);
+        if (old && old->id.size == e.id.size && old->id.mtime_ns == e.id.mtime_ns) {
+            if (!(e.parts & bit(Part::Edges)) && (old->parts & bit(Part::Edges))) e.edges = old->edges;
+            if (!(e.parts & bit(Part::Full)) && (old->parts & bit(Part::Full))) e.full = old->full;
+            e.parts |= old->parts;
+        }
+        DiskEntry d{};
+        d.dev = e.id.dev;
+        d.ino = e.id.ino;
+        d.size = e.id.size;
+        d.mtime_ns = e.id.mtime_ns;
+        d.edges_lo = e.edges.lo;
+        d.edges_hi = e.edges.hi;
+        d.full_lo = e.full.lo;
+        d.full_hi = e.full.hi;
+        d.parts = e.parts;
+        d.check = checksum(d);
+        records.push_back(d);
+    }
+    pending_.clear();
+    added_ = records.size();
+
+    if (loaded_) {
+        if (records.empty()) return true;
+        std::ofstream out(file_, std::ios::binary | std::ios::app);
+        out.write(reinterpret_cast<const char*>(records.data()),
+                  static_cast<std::streamsize>(records.size() * sizeof(DiskEntry)));
+        return static_cast<bool>(out);
+    }
+
+    // Missing, damaged or from another version: start over, keeping what
+    // is still readable ahead of this run's records
+    std::vector<DiskEntry> all;
+    View view;
+    if (data_ && parse(data_, length_, view) == Contents::Cache && view.base
+        && view.header->edge == edge_) {
+        all.assign(view.base, view.base + view.header->base_count);
+        all.insert(all.end(), view.log, view.log + view.log_count);
+    }
+    all.insert(all.end(), records.begin(), records.end());
+    return write_file(file_, edge_, all);
+}
+
+Stats Cache::stats() const {
+    Stats s;
+    s.lookups = lookups_.load(std::memory_order_relaxed);
+    s.hits = hits_.load(std::memory_order_relaxed);
+    s.bytes_saved = bytes_saved_.load(std::memory_order_relaxed);
+    s.added = added_;
+    return s;
+}
+
+bool compact(const fs::path& file, Compaction& out) {
+    // Read whole: the file is replaced while the records are still needed
+    std::vector<char> data;
+    {
+        std::ifstream in(file, std::ios::binary | std::ios::ate);
+        if (!in) return false;
+        data.resize(static_cast<size_t>(in.tellg()));
+        in.seekg(0);
+        if (!in.read(data.data(), static_cast<std::streamsize>(data.size()))) return false;
+    }
+    View view;
+    if (parse(data.data(), data.size(), view) != Contents::Cache || !view.base) return false;
+    uint64_t edge = view.header->edge;
+    std::vector<DiskEntry> records(view.base, view.base + view.header->base_count);
+    records.insert(records.end(), view.log, view.log + view.log_count);
+    out.bytes_before = data.size();
+    out.records_before = records.size();
+    if (!write_file(file, edge, records)) return false;
+    out.records_after = records.size();
+    out.bytes_after = sizeof(FileHeader) + records.size() * sizeof(DiskEntry);
+    return true;
+}
+
+} // namespace hashcache
@@ -0,0 +1,116 @@
+#pragma once
+#include "hash.hpp"
+#include <filesystem>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Persistent content digests for dupes (--hash-cache FILE), so a rerun
+// only reads files that are new or changed. Digests are keyed by the
+// file's device and inode and are valid while its size and mtime (to the
+// nanosecond) are unchanged. The file is a base of records sorted by
+// (dev, ino), used in place through mmap, followed by an append log that
+// each run extends with what it hashed; the newest record of an inode
+// wins. compact() folds the log into the base.
+namespace hashcache {
+
+// Which version of which file a digest belongs to. ino 0 means the
+// backend doesn't know, and such files are never cached.
+struct FileId {
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+};
+
+// The two digests dupes computes: both ends of a file, and all of it
+enum class Part { Edges, Full };
+
+struct Stats {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+    uint64_t bytes_saved = 0;             // file bytes the hits didn't read
+    uint64_t added = 0;                   // records written by save()
+
+    double hit_rate() const { return lookups ? static_cast<double>(hits) / static_cast<double>(lookups) : 0; }
+};
+
+class Cache {
+public:
+    Cache() = default;
+    ~Cache();
+    Cache(const Cache&) = delete;
+    Cache& operator=(const Cache&) = delete;
+
+    // Use `file`, whose edge digests cover `edge` bytes at each end. False
+    // when it doesn't exist or can't be used (another version, another
+    // edge size); the cache then starts empty and save() replaces the file.
+    bool load(const fs::path& file, uint64_t edge);
+    // Records in the base and the log
+    size_t size() const { return base_count_ + log_.size(); }
+
+    // The cached digest of a file, if it was recorded for this version of
+    // it. Safe to call from several threads.
+    bool find(const FileId& id, Part part, hashing::Digest& out);
+    // Remember a digest for save(); safe to call from several threads
+    void record(const FileId& id, Part part, const hashing::Digest& digest);
+
+    // Append what was recorded to the log, or write the whole file when it
+    // couldn't be loaded. False when it couldn't be written.
+    bool save();
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        FileId id;
+        hashing::Digest edges;
+        hashing::Digest full;
+        uint32_t parts = 0;               // bit per Part
+    };
+    struct KeyHash {
+        size_t operator()(const std::pair<uint64_t, uint64_t>& k) const {
+            return static_cast<size_t>(k.first * 0x9E3779B97F4A7C15ULL ^ k.second);
+        }
+    };
+    using Map = std::unordered_map<std::pair<uint64_t, uint64_t>, Entry, KeyHash>;
+
+    const Entry* lookup(uint64_t dev, uint64_t ino, Entry& scratch) const;
+
+    fs::path file_;
+    uint64_t edge_ = 0;
+    const char* data_ = nullptr;
+    size_t length_ = 0;
+    bool mapped_ = false;
+    std::vector<char> owned_;
+    size_t base_count_ = 0;
+    bool loaded_ = false;                 // save() can append to the log
+    bool foreign_ = false;                // not a hash cache: never overwritten
+    Map log_;                             // latest log record of each inode
+
+    std::mutex mutex_;
+    Map pending_;                         // recorded during this run
+    std::atomic<uint64_t> lookups_{0};
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> bytes_saved_{0};
+    uint64_t added_ = 0;
+};
+
+struct Compaction {
+    uint64_t records_before = 0;
+    uint64_t records_after = 0;           // one per inode
+    uint64_t bytes_before = 0;
+    uint64_t bytes_after = 0;
+};
+
+// Rewrite `file` as a base holding the newest record of each inode and an
+// empty log, replacing it atomically. False when it isn't a hash cache or
+// can't be rewritten.
+bool compact(const fs::path& file, Compaction& out);
+
+} // namespace hashcache
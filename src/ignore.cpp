@@ -0,0 +1,349 @@
+#include "ignore.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace ignore {
+
+// ------------------------------------------------------------- automaton
+
+void Automaton::build(const std::vector<std::pair<std::string, uint32_t>>& literals) {
+    constexpr uint32_t kNone = 0xFFFFFFFFu;
+
+    // Bytes that never occur in a literal share class 0, which keeps the
+    // transition table small
+    classes_.fill(0);
+    class_count_ = 1;
+    for (const auto& [literal, id] : literals) {
+        for (unsigned char c : literal) {
+            if (classes_[c] == 0) classes_[c] = static_cast<uint16_t>(class_count_++);
+        }
+    }
+
+    // Trie of the literals
+    std::vector<uint32_t> go;
+    std::vector<std::vector<uint32_t>> outs;
+    auto new_state = [&]() {
+        go.resize(go.size() + class_count_, kNone);
+        outs.emplace_back();
+        return static_cast<uint32_t>(outs.size() - 1);
+    };
+    new_state();
+    for (const auto& [literal, id] : literals) {
+        uint32_t state = 0;
+        for (unsigned char c : literal) {
+            uint32_t& edge = go[state * class_count_ + classes_[c]];
+            if (edge == kNone) {
+                uint32_t created = new_state();
+                go[state * class_count_ + classes_[c]] = created;
+                state = created;
+            } else {
+                state = edge;
+            }
+        }
+        outs[state].push_back(id);
+    }
+    states_ = static_cast<uint32_t>(outs.size());
+
+    // Breadth-first pass: failure links become direct transitions, and each
+    // state also reports the literals of its failure state
+    std::vector<uint32_t> fail(states_, 0);
+    std::vector<uint32_t> queue;
+    for (uint32_t cls = 0; cls < class_count_; ++cls) {
+        uint32_t& target = go[cls];
+        if (target == kNone) {
+            target = 0;
+        } else {
+            queue.push_back(target);
+        }
+    }
+    for (size_t head = 0; head < queue.size(); ++head) {
+        uint32_t state = queue[head];
+        const auto& inherited = outs[fail[state]];
+        outs[state].insert(outs[state].end(), inherited.begin(), inherited.end());
+        for (uint32_t cls = 0; cls < class_count_; ++cls) {
+            uint32_t& target = go[state * class_count_ + cls];
+            uint32_t via_fail = go[fail[state] * class_count_ + cls];
+            if (target == kNone) {
+                target = via_fail;
+            } else {
+                fail[target] = via_fail;
+                queue.push_back(target);
+            }
+        }
+    }
+
+    next_ = std::move(go);
+    out_begin_.assign(states_ + 1, 0);
+    out_.clear();
+    for (uint32_t s = 0; s < states_; ++s) {
+        out_begin_[s] = static_cast<uint32_t>(out_.size());
+        out_.insert(out_.end(), outs[s].begin(), outs[s].end());
+    }
+    out_begin_[states_] = static_cast<uint32_t>(out_.size());
+}
+
+// --------------------------------------------------------------- rules
+
+void RuleSet::add(std::string_view line) {
+    std::string p(line);
+    if (!p.empty() && p.back() == '\r') p.pop_back();
+    // Trailing spaces don't count unless escaped
+    while (!p.empty() && p.back() == ' ' && !(p.size() >= 2 && p[p.size() - 2] == '\\')) p.pop_back();
+    if (p.empty() || p[0] == '#') return;
+
+    Rule rule;
+    std::string body = p;
+    if (body[0] == '!') {
+        rule.negate = true;
+        body.erase(0, 1);
+    }
+    if (!body.empty() && body.back() == '/') {
+        rule.dir_only = true;
+        body.pop_back();
+    }
+    if (body.find('/') != std::string::npos) {
+        rule.anchored = true;
+        if (body[0] == '/') body.erase(0, 1);
+    }
+    if (body.empty()) return;
+
+    auto literal = [&](char c) {
+        if (rule.tokens.empty() || rule.tokens.back().kind != Token::Literal) {
+            rule.tokens.push_back(Token{Token::Literal, {}, {}});
+        }
+        rule.tokens.back().text.push_back(c);
+    };
+
+    for (size_t k = 0; k < body.size();) {
+        char c = body[k];
+        if (c == '\\' && k + 1 < body.size()) {
+            literal(body[k + 1]);
+            k += 2;
+        } else if (c == '*') {
+            size_t end = k;
+            while (end < body.size() && body[end] == '*') end++;
+            bool whole_segment = (k == 0 || body[k - 1] == '/') && end - k >= 2;
+            if (whole_segment && end < body.size() && body[end] == '/') {
+                rule.tokens.push_back(Token{Token::AnyDirs, {}, {}});
+                k = end + 1;
+            } else if (whole_segment && end == body.size()) {
+                rule.tokens.push_back(Token{Token::GlobStar, {}, {}});
+                k = end;
+            } else {
+                rule.tokens.push_back(Token{Token::Star, {}, {}});
+                k = end;
+            }
+        } else if (c == '?') {
+            rule.tokens.push_back(Token{Token::Any, {}, {}});
+            k++;
+        } else if (c == '[') {
+            // [abc], [a-z], [!x] / [^x]; an unterminated [ is literal
+            size_t j = k + 1;
+            bool negate = j < body.size() && (body[j] == '!' || body[j] == '^');
+            if (negate) j++;
+            std::bitset<256> set;
+            bool first = true, closed = false;
+            while (j < body.size()) {
+                unsigned char lo = static_cast<unsigned char>(body[j]);
+                if (lo == ']' && !first) {
+                    closed = true;
+                    break;
+                }
+                if (lo == '\\' && j + 1 < body.size()) lo = static_cast<unsigned char>(body[++j]);
+                first = false;
+                if (j + 2 < body.size() && body[j + 1] == '-' && body[j + 2] != ']') {
+                    unsigned char hi = static_cast<unsigned char>(body[j + 2]);
+                    for (unsigned v = lo; v <= hi; ++v) set.set(v);
+                    j += 3;
+                } else {
+                    set.set(lo);
+                    j++;
+                }
+            }
+            if (!closed) {
+                literal('[');
+                k++;
+                continue;
+            }
+            if (negate) set.flip();
+            set.reset('/');
+            rule.tokens.push_back(Token{Token::Class, {}, set});
+            k = j + 1;
+        } else {
+            literal(c);
+            k++;
+        }
+    }
+    rules_.push_back(std::move(rule));
+}
+
+void RuleSet::compile() {
+    std::vector<std::pair<std::string, uint32_t>> name_literals, path_literals;
+    always_.clear();
+    anchored_ = false;
+    for (uint32_t i = 0; i < rules_.size(); ++i) {
+        const Rule& rule = rules_[i];
+        anchored_ = anchored_ || rule.anchored;
+        // Any match has to contain the rule's longest literal
+        const std::string* longest = nullptr;
+        for (const Token& token : rule.tokens) {
+            if (token.kind == Token::Literal && (!longest || token.text.size() > longest->size())) {
+                longest = &token.text;
+            }
+        }
+        if (!longest) {
+            always_.push_back(i);
+        } else {
+            (rule.anchored ? path_literals : name_literals).emplace_back(*longest, i);
+        }
+    }
+    names_ = Automaton{};
+    paths_ = Automaton{};
+    if (!name_literals.empty()) names_.build(name_literals);
+    if (!path_literals.empty()) paths_.build(path_literals);
+}
+
+bool RuleSet::glob(const std::vector<Token>& tokens, size_t t, std::string_view text, size_t pos) {
+    while (t < tokens.size()) {
+        const Token& token = tokens[t];
+        switch (token.kind) {
+        case Token::Literal:
+            if (text.size() - pos < token.text.size()
+                || std::memcmp(text.data() + pos, token.text.data(), token.text.size()) != 0) {
+                return false;
+            }
+            pos += token.text.size();
+            break;
+        case Token::Any:
+            if (pos >= text.size() || text[pos] == '/') return false;
+            pos++;
+            break;
+        case Token::Class:
+            if (pos >= text.size() || !token.set.test(static_cast<unsigned char>(text[pos]))) return false;
+            pos++;
+            break;
+        case Token::Star:
+            // Anything within one path segment
+            if (t + 1 == tokens.size()) return text.find('/', pos) == std::string_view::npos;
+            for (size_t p = pos;; ++p) {
+                if (glob(tokens, t + 1, text, p)) return true;
+                if (p >= text.size() || text[p] == '/') return false;
+            }
+        case Token::GlobStar:
+            // Everything below, across segments
+            if (t + 1 == tokens.size()) return true;
+            for (size_t p = pos; p <= text.size(); ++p) {
+                if (glob(tokens, t + 1, text, p)) return true;
+            }
+            return false;
+        case Token::AnyDirs:
+            // Zero or more whole directories
+            if (glob(tokens, t + 1, text, pos)) return true;
+            for (size_t p = pos; p < text.size(); ++p) {
+                if (text[p] == '/' && glob(tokens, t + 1, text, p + 1)) return true;
+            }
+            return false;
+        }
+        t++;
+    }
+    return pos == text.size();
+}
+
+Verdict RuleSet::match(std::string_view name, std::string_view rel, bool is_dir) const {
+    thread_local std::vector<uint32_t> candidates;
+    candidates.clear();
+    auto hit = [](uint32_t rule) { candidates.push_back(rule); };
+    if (!names_.empty()) names_.scan(name, hit);
+    if (anchored_ && !paths_.empty()) paths_.scan(rel, hit);
+    candidates.insert(candidates.end(), always_.begin(), always_.end());
+    if (candidates.empty()) return Verdict::None;
+
+    // The last matching rule decides
+    std::sort(candidates.begin(), candidates.end(), std::greater<uint32_t>());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    for (uint32_t index : candidates) {
+        const Rule& rule = rules_[index];
+        if (rule.dir_only && !is_dir) continue;
+        if (glob(rule.tokens, 0, rule.anchored ? rel : name, 0)) {
+            return rule.negate ? Verdict::Include : Verdict::Exclude;
+        }
+    }
+    return Verdict::None;
+}
+
+// --------------------------------------------------------------- matcher
+
+Matcher::Matcher(const fs::path& root, const std::vector<std::string>& patterns, bool ignore_files)
+    : ignore_files_(ignore_files) {
+    for (const auto& pattern : patterns) command_line_.add(pattern);
+    command_line_.compile();
+
+    std::string root_string = root.generic_string();
+    root_length_ = root_string.size();
+    root_separator_ = !root_string.empty() && root_string.back() == '/' ? 0 : 1;
+}
+
+std::string_view Matcher::below_root(const fs::path& dir, std::string& scratch) const {
+#ifdef _WIN32
+    scratch = dir.generic_string();
+    std::string_view full(scratch);
+#else
+    (void)scratch;
+    std::string_view full(dir.native());
+#endif
+    if (full.size() <= root_length_) return {};
+    return full.substr(root_length_ + root_separator_);
+}
+
+std::shared_ptr<const Scope> Matcher::enter(const std::shared_ptr<const Scope>& parent, const fs::path& dir) const {
+    if (!ignore_files_) return parent;
+
+    // .dirstatignore comes second so its patterns win over .gitignore's
+    RuleSet rules;
+    for (const char* file : {".gitignore", ".dirstatignore"}) {
+        std::ifstream in(dir / file);
+        if (!in) continue;
+        std::string line;
+        while (std::getline(in, line)) rules.add(line);
+    }
+    if (rules.empty()) return parent;
+    rules.compile();
+
+    auto scope = std::make_shared<Scope>();
+    scope->parent = parent;
+    scope->rules = std::move(rules);
+    std::string scratch;
+    std::string_view below = below_root(dir, scratch);
+    scope->offset = below.empty() ? 0 : below.size() + 1;
+    return scope;
+}
+
+bool Matcher::excluded(const Scope* scope, const fs::path& dir, std::string_view name, bool is_dir) const {
+    bool need_path = command_line_.anchored();
+    for (const Scope* s = scope; s && !need_path; s = s->parent.get()) need_path = s->rules.anchored();
+
+    // Root-relative path of the entry, only built when a pattern needs it
+    thread_local std::string rel;
+    rel.clear();
+    if (need_path) {
+        std::string scratch;
+        rel.append(below_root(dir, scratch));
+        if (!rel.empty()) rel.push_back('/');
+        rel.append(name);
+    }
+
+    // Command-line patterns take precedence, then the innermost ignore file
+    if (!command_line_.empty()) {
+        Verdict v = command_line_.match(name, rel, is_dir);
+        if (v != Verdict::None) return v == Verdict::Exclude;
+    }
+    for (const Scope* s = scope; s; s = s->parent.get()) {
+        std::string_view relative = std::string_view(rel).substr(std::min(s->offset, rel.size()));
+        Verdict v = s->rules.match(name, relative, is_dir);
+        if (v != Verdict::None) return v == Verdict::Exclude;
+    }
+    return false;
+}
+
+} // namespace ignore
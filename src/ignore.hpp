@@ -0,0 +1,121 @@
+#pragma once
+#include <filesystem>
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Exclude patterns with gitignore semantics: globs (*, ?, [a-z], **),
+// negation with !, trailing / for directories only, and patterns containing
+// a / anchored to the directory they were given for. Patterns are compiled
+// once; an Aho-Corasick automaton over their literal parts picks the few
+// that can match an entry before any glob is run.
+namespace ignore {
+
+enum class Verdict : uint8_t { None, Exclude, Include };
+
+// Multi-literal search: reports every literal that occurs in a text
+class Automaton {
+public:
+    void build(const std::vector<std::pair<std::string, uint32_t>>& literals);
+    bool empty() const { return states_ == 0; }
+
+    template <typename Hit>
+    void scan(std::string_view text, Hit&& hit) const {
+        uint32_t state = 0;
+        for (unsigned char c : text) {
+            state = next_[state * class_count_ + classes_[c]];
+            for (uint32_t i = out_begin_[state]; i < out_begin_[state + 1]; ++i) hit(out_[i]);
+        }
+    }
+
+private:
+    std::array<uint16_t, 256> classes_{};
+    uint32_t class_count_ = 1;
+    uint32_t states_ = 0;
+    std::vector<uint32_t> next_;          // states x classes, a full DFA
+    std::vector<uint32_t> out_begin_;     // per state, into out_
+    std::vector<uint32_t> out_;
+};
+
+// One list of patterns sharing a base directory (the command line, or one
+// directory's ignore files). Later patterns win over earlier ones.
+class RuleSet {
+public:
+    // One line of gitignore syntax; blank lines and # comments are skipped
+    void add(std::string_view line);
+    // Build the prefilter; call once after the last add()
+    void compile();
+
+    bool empty() const { return rules_.empty(); }
+    // Some pattern needs the path below the base, not just the name
+    bool anchored() const { return anchored_; }
+
+    // rel: '/'-separated path of the entry below the base; only read when
+    // anchored()
+    Verdict match(std::string_view name, std::string_view rel, bool is_dir) const;
+
+private:
+    struct Token {
+        enum Kind : uint8_t { Literal, Any, Star, GlobStar, AnyDirs, Class } kind;
+        std::string text;                 // Literal
+        std::bitset<256> set;             // Class
+    };
+
+    struct Rule {
+        std::vector<Token> tokens;
+        bool negate = false;
+        bool dir_only = false;
+        bool anchored = false;
+    };
+
+    static bool glob(const std::vector<Token>& tokens, size_t t, std::string_view text, size_t pos);
+
+    std::vector<Rule> rules_;
+    bool anchored_ = false;
+    Automaton names_;                     // literals of name patterns
+    Automaton paths_;                     // literals of anchored patterns
+    std::vector<uint32_t> always_;        // rules without a literal
+};
+
+// Patterns in effect inside one directory: its own ignore files, then
+// those of its ancestors
+struct Scope {
+    std::shared_ptr<const Scope> parent;
+    RuleSet rules;
+    size_t offset = 0;                    // where the base starts in a root-relative path
+};
+
+class Matcher {
+public:
+    // patterns: command-line patterns, anchored at root. ignore_files: also
+    // read .gitignore and .dirstatignore in every directory walked.
+    Matcher(const fs::path& root, const std::vector<std::string>& patterns, bool ignore_files);
+
+    // Anything to check at all; callers skip excluded() when not
+    bool active() const { return !command_line_.empty() || ignore_files_; }
+    bool reads_files() const { return ignore_files_; }
+
+    // Scope for the entries of `dir`, adding its ignore files (if any and
+    // enabled) in front of the parent scope
+    std::shared_ptr<const Scope> enter(const std::shared_ptr<const Scope>& parent, const fs::path& dir) const;
+
+    bool excluded(const Scope* scope, const fs::path& dir, std::string_view name, bool is_dir) const;
+
+private:
+    // Path of dir below the root, '/'-separated, "" for the root itself
+    std::string_view below_root(const fs::path& dir, std::string& scratch) const;
+
+    RuleSet command_line_;
+    bool ignore_files_;
+    size_t root_length_ = 0;
+    size_t root_separator_ = 0;
+};
+
+} // namespace ignore
@@ -1,52 +1,126 @@
 #include "scanner.hpp"
 #include "display.hpp"
 #include "colors.hpp"
+#include "output.hpp"
+#include "profile.hpp"
+#include "progress.hpp"
+#include "stats.hpp"
+#include "where.hpp"
 #include <iostream>
 #include <string>
 #include <vector>
 #include <filesystem>
+#include <memory>
 #include <sstream>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
 
 namespace fs = std::filesystem;
 
+// Below this the merge can't keep enough runs open to be worth it
+constexpr uint64_t kMinMemLimit = 4 << 20;
+
 // Global options
 struct Options {
-    std::string command = "scan";
+    std::vector<std::string> commands;   // several = one combined report
     fs::path path = ".";
+    std::vector<fs::path> operands;      // every path given, in order (diff)
+    fs::path output_file = "dirstat.snap";
     bool show_hidden = false;
-    bool json_output = false;
+    output::Format format = output::Format::Text;
     int depth = 0;
     size_t count = 10;
+    bool dirs = false;                   // large: rank directories
+    display::TreeOptions tree;
     uint64_t min_size = 1024;
+    uint64_t mem_limit = 0;              // dupes: bound memory with run files, 0 = no bound
+    fs::path hash_cache;                 // dupes: persistent digests, empty = none
+    std::vector<uint64_t> buckets;       // sizes: bucket limits, empty = powers of two
+    bool by_ext = false;
     std::vector<std::string> exclude_patterns;
+    std::string where;                   // --where expression, empty = every file
+    bool ignore_files = false;
+    bool one_file_system = false;
+    bool device_limits = true;
+    unsigned threads = 0;
+    backend::Kind backend = backend::Kind::Native;
+    unsigned io_depth = 0;
+    fs::path index_file;
+    bool index_verify = false;           // stat each file before reusing its directory
+    bool profile = false;
+    progress::Options progress;
+    bool estimate = false;               // scan/types: sample instead of walking everything
+    estimate::Options sampling;
 };
 
 void print_help() {
-    std::cout << colors::bold_cyan("dirstat") << " - Ultra-fast directory analyzer\n\n";
-    std::cout << colors::bold_white("USAGE:") << "\n";
-    std::cout << "    dirstat [COMMAND] [OPTIONS] [PATH]\n\n";
-    std::cout << colors::bold_white("COMMANDS:") << "\n";
-    std::cout << "    " << colors::green("scan") << "     Scan directory and show statistics (default)\n";
-    std::cout << "    " << colors::green("large") << "    Find largest files\n";
-    std::cout << "    " << colors::green("tree") << "     Show directory tree structure\n";
-    std::cout << "    " << colors::green("dupes") << "    Find potential duplicate files\n";
-    std::cout << "    " << colors::green("types") << "    Show file type breakdown\n";
-    std::cout << "    " << colors::green("help") << "     Show this help message\n\n";
-    std::cout << colors::bold_white("OPTIONS:") << "\n";
-    std::cout << "    " << colors::yellow("-H, --hidden") << "       Include hidden files\n";
-    std::cout << "    " << colors::yellow("-d, --depth") << " N      Maximum depth (default: 0 = unlimited)\n";
-    std::cout << "    " << colors::yellow("-c, --count") << " N      Number of items to show (default: 10)\n";
-    std::cout << "    " << colors::yellow("-m, --min") << " N        Minimum file size in bytes (for dupes)\n";
-    std::cout << "    " << colors::yellow("-e, --exclude") << " PAT  Exclude patterns (comma-separated)\n";
-    std::cout << "    " << colors::yellow("-j, --json") << "         Output as JSON\n";
-    std::cout << "    " << colors::yellow("-h, --help") << "         Show help\n\n";
-    std::cout << colors::bold_white("EXAMPLES:") << "\n";
-    std::cout << "    dirstat                              # Scan current directory\n";
-    std::cout << "    dirstat scan C:\\Users                # Scan specific path\n";
-    std::cout << "    dirstat large -c 20                  # Top 20 largest files\n";
-    std::cout << "    dirstat tree -d 3                    # Tree with depth 3\n";
-    std::cout << "    dirstat -e node_modules,.git         # Exclude folders\n";
-    std::cout << "    dirstat large --json                 # Output as JSON\n";
+    output::Writer& out = output::out();
+    out << colors::bold_cyan("dirstat") << " - Ultra-fast directory analyzer\n\n";
+    out << colors::bold_white("USAGE:") << "\n";
+    out << "    dirstat [COMMAND] [OPTIONS] [PATH]\n\n";
+    out << colors::bold_white("COMMANDS:") << "\n";
+    out << "    " << colors::green("scan") << "     Scan directory and show statistics (default)\n";
+    out << "    " << colors::green("large") << "    Find largest files\n";
+    out << "    " << colors::green("tree") << "     Show directory tree structure\n";
+    out << "    " << colors::green("dupes") << "    Find duplicate files (verified by content hash)\n";
+    out << "    " << colors::green("types") << "    Show file type breakdown\n";
+    out << "    " << colors::green("sizes") << "    File-size histogram with apparent and allocated bytes\n";
+    out << "    " << colors::green("report") << "   scan, large, types and dupes from a single traversal\n";
+    out << "    " << colors::green("snapshot") << " Save a compact binary snapshot of the tree (-o FILE)\n";
+    out << "    " << colors::green("diff") << "     Compare two snapshots: diff OLD NEW\n";
+    out << "    " << colors::green("compact") << "  Fold a hash cache's log into its base: compact FILE\n";
+    out << "    " << colors::green("help") << "     Show this help message\n\n";
+    out << colors::bold_white("OPTIONS:") << "\n";
+    out << "    " << colors::yellow("-H, --hidden") << "       Include hidden files\n";
+    out << "    " << colors::yellow("-d, --depth") << " N      Maximum depth (default: 0 = unlimited)\n";
+    out << "    " << colors::yellow("-c, --count") << " N      Number of items to show (default: 10)\n";
+    out << "    " << colors::yellow("--max-entries") << " N    Entries shown per directory, the rest summarized (tree)\n";
+    out << "    " << colors::yellow("--sort") << " KEY        Tree order: name (default) or size\n";
+    out << "    " << colors::yellow("--dirs") << "             Rank directories by total size (large)\n";
+    out << "    " << colors::yellow("-m, --min") << " N        Minimum file size in bytes (for dupes)\n";
+    out << "    " << colors::yellow("--mem-limit") << " SIZE   Bound dupes memory, spilling sorted runs to $TMPDIR (e.g. 512M)\n";
+    out << "    " << colors::yellow("--hash-cache") << " FILE  Reuse digests of unchanged files across dupes runs\n";
+    out << "    " << colors::yellow("--buckets") << " LIST     Size bucket limits, e.g. 4K,64K,1M (sizes; default: powers of 2)\n";
+    out << "    " << colors::yellow("--by-ext") << "           One histogram per extension too (sizes, top -c)\n";
+    out << "    " << colors::yellow("--estimate") << "         Estimate totals from random samples, with 95% intervals (scan, types)\n";
+    out << "    " << colors::yellow("--time-budget") << " SEC  Stop sampling after SEC seconds (default: 10, 0 = until converged)\n";
+    out << "    " << colors::yellow("-e, --exclude") << " PAT  Exclude gitignore-style patterns (comma-separated)\n";
+    out << "    " << colors::yellow("-w, --where") << " EXPR   Only files matching EXPR, e.g. 'size > 1G and mtime < 180d'\n";
+    out << "    " << colors::yellow("--gitignore") << "        Honor .gitignore/.dirstatignore files\n";
+    out << "    " << colors::yellow("-x, --one-file-system") << " Stay on the root's filesystem\n";
+    out << "    " << colors::yellow("--no-device-limits") << " Don't cap workers per disk (rotational, network)\n";
+    out << "    " << colors::yellow("-t, --threads") << " N    Worker threads (default: one per core)\n";
+    out << "    " << colors::yellow("--backend") << " NAME     Directory reader: native (default) or portable\n";
+    out << "    " << colors::yellow("--io-depth") << " N       Batch stat calls through io_uring, N in flight (Linux)\n";
+    out << "    " << colors::yellow("--index") << " FILE       Reuse unchanged directories from a scan index (scan)\n";
+    out << "    " << colors::yellow("--index-verify") << "     With --index: stat every file before reusing its directory\n";
+    out << "    " << colors::yellow("-o, --output") << " FILE  Snapshot file to write (default: dirstat.snap)\n";
+    out << "    " << colors::yellow("-j, --json") << "         Output as JSON\n";
+    out << "    " << colors::yellow("--ndjson") << "           Stream one JSON record per line (large, dupes, sizes, tree, --estimate)\n";
+    out << "    " << colors::yellow("--profile") << "          Report counters and per-phase timings (stderr or JSON)\n";
+    out << "    " << colors::yellow("--progress") << "         Live progress line on stderr while walking\n";
+    out << "    " << colors::yellow("--checkpoint") << " SEC   Partial results on stderr every SEC seconds (also on SIGUSR1)\n";
+    out << "    " << colors::yellow("-h, --help") << "         Show help\n\n";
+    out << colors::bold_white("EXAMPLES:") << "\n";
+    out << "    dirstat                              # Scan current directory\n";
+    out << "    dirstat scan C:\\Users                # Scan specific path\n";
+    out << "    dirstat large -c 20                  # Top 20 largest files\n";
+    out << "    dirstat large --dirs                 # Largest directories\n";
+    out << "    dirstat tree -d 3                    # Tree with depth 3\n";
+    out << "    dirstat tree --max-entries 20 --sort size  # Biggest 20 per directory\n";
+    out << "    dirstat -e node_modules,.git         # Exclude folders\n";
+    out << "    dirstat large -e '*.log,!keep.log'   # Globs and negation\n";
+    out << "    dirstat large -w \"size > 1G and mtime < 180d and path ~ '*/logs/*'\"  # Old big logs\n";
+    out << "    dirstat large --json                 # Output as JSON\n";
+    out << "    dirstat scan types large             # Several reports, one traversal\n";
+    out << "    dirstat sizes --buckets 4K,1M,1G     # How many small files\n";
+    out << "    dirstat dupes --mem-limit 1G /archive  # Dupes of more files than fit in RAM\n";
+    out << "    dirstat dupes --hash-cache ~/.dupes.cache /archive  # Only read what changed\n";
+    out << "    dirstat snapshot /data -o today.snap # Save a snapshot\n";
+    out << "    dirstat diff yesterday.snap today.snap  # What grew since\n";
+    out << "    dirstat large --progress /mnt/nfs    # Watch a long walk\n";
+    out << "    dirstat --estimate --time-budget 30 /  # Rough totals of a huge tree\n";
 }
 
 std::vector<std::string> split_string(const std::string& s, char delimiter) {
@@ -70,11 +144,14 @@ int main(int argc, char* argv[]) {
         
         if (arg == "-h" || arg == "--help" || arg == "help") {
             print_help();
+            output::out().flush();
             return 0;
         } else if (arg == "-H" || arg == "--hidden") {
             opts.show_hidden = true;
         } else if (arg == "-j" || arg == "--json") {
-            opts.json_output = true;
+            opts.format = output::Format::Json;
+        } else if (arg == "--ndjson") {
+            opts.format = output::Format::Ndjson;
         } else if (arg == "-d" || arg == "--depth") {
             if (i + 1 < args.size()) {
                 opts.depth = std::stoi(args[++i]);
@@ -87,33 +164,196 @@ int main(int argc, char* argv[]) {
             if (i + 1 < args.size()) {
                 opts.min_size = std::stoull(args[++i]);
             }
+        } else if (arg == "-t" || arg == "--threads") {
+            if (i + 1 < args.size()) {
+                opts.threads = static_cast<unsigned>(std::stoul(args[++i]));
+            }
+        } else if (arg == "--backend") {
+            if (i + 1 < args.size()) {
+                opts.backend = args[++i] == "portable" ? backend::Kind::Portable : backend::Kind::Native;
+            }
+        } else if (arg == "--io-depth") {
+            if (i + 1 < args.size()) {
+                opts.io_depth = static_cast<unsigned>(std::stoul(args[++i]));
+            }
+        } else if (arg == "--index") {
+            if (i + 1 < args.size()) {
+                opts.index_file = args[++i];
+            }
+        } else if (arg == "--index-verify") {
+            opts.index_verify = true;
+        } else if (arg == "--max-entries") {
+            if (i + 1 < args.size()) {
+                opts.tree.max_entries = std::stoul(args[++i]);
+            }
+        } else if (arg == "--sort") {
+            if (i + 1 < args.size()) {
+                opts.tree.sort = args[++i] == "size" ? display::TreeSort::Size : display::TreeSort::Name;
+            }
+        } else if (arg == "--mem-limit") {
+            if (i + 1 < args.size()) {
+                if (!parse_size(args[++i], opts.mem_limit) || opts.mem_limit < kMinMemLimit) {
+                    std::cerr << colors::red("[X]") << " --mem-limit needs a size of at least 4M" << std::endl;
+                    return 1;
+                }
+            }
+        } else if (arg == "--hash-cache") {
+            if (i + 1 < args.size()) {
+                opts.hash_cache = args[++i];
+            }
+        } else if (arg == "--buckets") {
+            if (i + 1 < args.size()) {
+                for (const auto& item : split_string(args[++i], ',')) {
+                    uint64_t bound;
+                    if (!parse_size(item, bound)) {
+                        std::cerr << colors::red("[X]") << " Bad bucket size: " << item << std::endl;
+                        return 1;
+                    }
+                    opts.buckets.push_back(bound);
+                }
+            }
+        } else if (arg == "--by-ext") {
+            opts.by_ext = true;
+        } else if (arg == "--estimate") {
+            opts.estimate = true;
+        } else if (arg == "--time-budget") {
+            if (i + 1 < args.size()) {
+                opts.sampling.time_budget = std::stod(args[++i]);
+            }
+        } else if (arg == "--dirs") {
+            opts.dirs = true;
+        } else if (arg == "--profile") {
+            opts.profile = true;
+        } else if (arg == "--progress") {
+            opts.progress.show = true;
+        } else if (arg == "--checkpoint") {
+            if (i + 1 < args.size()) {
+                opts.progress.checkpoint = std::stod(args[++i]);
+            }
+        } else if (arg == "-o" || arg == "--output") {
+            if (i + 1 < args.size()) {
+                opts.output_file = args[++i];
+            }
+        } else if (arg == "--gitignore") {
+            opts.ignore_files = true;
+        } else if (arg == "-x" || arg == "--one-file-system") {
+            opts.one_file_system = true;
+        } else if (arg == "--no-device-limits") {
+            opts.device_limits = false;
+        } else if (arg == "-w" || arg == "--where") {
+            // Given more than once, a file has to match every expression
+            if (i + 1 < args.size()) {
+                opts.where = opts.where.empty() ? args[++i] : "(" + opts.where + ") and (" + args[++i] + ")";
+            }
         } else if (arg == "-e" || arg == "--exclude") {
             if (i + 1 < args.size()) {
                 opts.exclude_patterns = split_string(args[++i], ',');
             }
-        } else if (arg == "scan" || arg == "large" || arg == "tree" || arg == "dupes" || arg == "types") {
-            opts.command = arg;
+        } else if (arg == "scan" || arg == "large" || arg == "tree" || arg == "dupes" || arg == "types"
+                   || arg == "sizes" || arg == "snapshot" || arg == "diff" || arg == "compact") {
+            if (std::find(opts.commands.begin(), opts.commands.end(), arg) == opts.commands.end()) {
+                opts.commands.push_back(arg);
+            }
+        } else if (arg == "report" || arg == "--all") {
+            opts.commands = {"scan", "large", "types", "dupes"};
         } else if (!arg.empty() && arg[0] != '-') {
             opts.path = arg;
+            opts.operands.push_back(arg);
+        }
+    }
+    
+    if (opts.commands.empty()) opts.commands.push_back("scan");
+    if (opts.commands.size() > 1) {
+        for (const char* single : {"tree", "snapshot", "diff", "compact"}) {
+            if (std::find(opts.commands.begin(), opts.commands.end(), single) == opts.commands.end()) continue;
+            std::cerr << colors::red("[X]") << " " << single << " can't be combined with other reports" << std::endl;
+            return 1;
+        }
+    }
+    if (opts.commands.front() == "diff" && opts.operands.size() != 2) {
+        std::cerr << colors::red("[X]") << " diff needs two snapshots: dirstat diff OLD NEW" << std::endl;
+        return 1;
+    }
+    if (opts.commands.front() == "compact" && opts.operands.size() != 1) {
+        std::cerr << colors::red("[X]") << " compact needs a hash cache: dirstat compact FILE" << std::endl;
+        return 1;
+    }
+    
+    if (opts.estimate && (opts.commands.size() > 1 || (opts.commands.front() != "scan"
+                                                       && opts.commands.front() != "types"))) {
+        std::cerr << colors::red("[X]") << " --estimate works with scan or types" << std::endl;
+        return 1;
+    }
+    opts.sampling.count = opts.count;
+    
+    std::shared_ptr<where::Filter> filter;
+    if (!opts.where.empty()) {
+        filter = std::make_shared<where::Filter>();
+        std::string error;
+        if (!filter->compile(opts.where, error)) {
+            std::cerr << colors::red("[X]") << " --where: " << error << std::endl;
+            return 1;
+        }
+        if (filter->native_only() && (opts.backend == backend::Kind::Portable || !backend::native_available())) {
+            std::cerr << colors::red("[X]") << " --where: atime and owner need the native backend" << std::endl;
+            return 1;
         }
     }
     
-    if (!opts.json_output) {
-        std::cout << colors::bold_cyan("dirstat") << " - Ultra-fast directory analyzer\n" << std::endl;
+    if (opts.profile) profile::enable();
+    progress::configure(opts.progress);
+    if (opts.format == output::Format::Text) {
+        output::out() << colors::bold_cyan("dirstat") << " - Ultra-fast directory analyzer\n" << '\n';
     }
     
-    if (opts.command == "scan") {
-        scanner::scan_directory(opts.path, opts.show_hidden, opts.depth, opts.exclude_patterns, opts.json_output);
-    } else if (opts.command == "large") {
-        scanner::find_largest_files(opts.path, opts.count, opts.show_hidden, opts.exclude_patterns, opts.json_output);
-    } else if (opts.command == "tree") {
-        if (opts.depth == 0) opts.depth = 3;
-        display::show_tree(opts.path, opts.depth, opts.show_hidden, opts.exclude_patterns);
-    } else if (opts.command == "dupes") {
-        scanner::find_duplicates(opts.path, opts.min_size, opts.exclude_patterns, opts.json_output);
-    } else if (opts.command == "types") {
-        scanner::show_file_types(opts.path, opts.count, opts.exclude_patterns, opts.json_output);
+    walker::Options walk;
+    walk.show_hidden = opts.show_hidden;
+    walk.max_depth = opts.depth;
+    walk.exclude = opts.exclude_patterns;
+    walk.ignore_files = opts.ignore_files;
+    walk.one_file_system = opts.one_file_system;
+    walk.device_limits = opts.device_limits;
+    walk.threads = opts.threads;
+    walk.backend = opts.backend;
+    walk.io_depth = opts.io_depth;
+    walk.where = std::move(filter);
+    
+    const std::string& command = opts.commands.front();
+    if (opts.commands.size() > 1) {
+        scanner::run_report(opts.path, opts.commands, opts.count, opts.min_size, opts.buckets, opts.by_ext, walk,
+                            opts.format, opts.mem_limit, opts.hash_cache);
+    } else if (opts.estimate) {
+        scanner::estimate_directory(opts.path, opts.sampling, walk, opts.format);
+    } else if (command == "scan") {
+        scanner::scan_directory(opts.path, walk, opts.format, opts.index_file, opts.index_verify);
+    } else if (command == "large" && opts.dirs) {
+        scanner::find_largest_dirs(opts.path, opts.count, walk, opts.format);
+    } else if (command == "large") {
+        scanner::find_largest_files(opts.path, opts.count, walk, opts.format);
+    } else if (command == "tree") {
+        if (walk.max_depth == 0) walk.max_depth = 3;
+        // A tree has no single-document form; --json gets the records too
+        if (opts.format == output::Format::Json) opts.format = output::Format::Ndjson;
+        display::show_tree(opts.path, walk, opts.tree, opts.format);
+    } else if (command == "dupes") {
+        scanner::find_duplicates(opts.path, opts.min_size, walk, opts.format, opts.mem_limit, opts.hash_cache);
+    } else if (command == "types") {
+        scanner::show_file_types(opts.path, opts.count, walk, opts.format);
+    } else if (command == "sizes") {
+        scanner::show_size_histogram(opts.path, opts.buckets, opts.by_ext, opts.count, walk, opts.format);
+    } else if (command == "snapshot") {
+        scanner::write_snapshot(opts.path, opts.output_file, walk, opts.format);
+    } else if (command == "diff") {
+        scanner::diff_snapshots(opts.operands[0], opts.operands[1], opts.count, opts.depth, opts.format);
+    } else if (command == "compact") {
+        scanner::compact_cache(opts.operands[0], opts.format);
     }
     
+    // JSON documents carry the profile as a member already
+    if (opts.profile && opts.format == output::Format::Ndjson) {
+        profile::write_record(output::out());
+    }
+    output::out().flush();
+    if (opts.profile && opts.format == output::Format::Text) profile::print(std::cerr);
     return 0;
 }
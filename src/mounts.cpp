@@ -0,0 +1,230 @@
+#include "mounts.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#ifdef __linux__
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#endif
+
+namespace mounts {
+
+const char* kind_name(Kind kind) {
+    switch (kind) {
+        case Kind::Solid: return "ssd";
+        case Kind::Rotational: return "rotational";
+        case Kind::Network: return "network";
+        case Kind::Pseudo: return "pseudo";
+        default: return "unknown";
+    }
+}
+
+Limits limits(Kind kind) {
+    switch (kind) {
+        // Seeks dominate; a couple of readers keep the head busy without
+        // thrashing it
+        case Kind::Rotational: return {2, 4};
+        // Latency-bound, so some parallelism pays, but a slow server must
+        // not hold every worker
+        case Kind::Network: return {4, 16};
+        default: return {};
+    }
+}
+
+#ifdef __linux__
+
+namespace {
+
+constexpr std::string_view kPseudo[] = {
+    "proc", "sysfs", "devtmpfs", "devpts", "cgroup", "cgroup2", "debugfs", "tracefs", "securityfs",
+    "pstore", "bpf", "configfs", "fusectl", "mqueue", "hugetlbfs", "autofs", "binfmt_misc", "efivarfs",
+    "rpc_pipefs", "nsfs", "selinuxfs",
+};
+
+constexpr std::string_view kNetwork[] = {
+    "nfs", "nfs4", "cifs", "smb3", "smbfs", "ncpfs", "ceph", "glusterfs", "fuse.glusterfs", "9p", "afs",
+    "lustre", "gpfs", "beegfs", "davfs", "fuse.sshfs", "fuse.rclone", "fuse.s3fs",
+};
+
+template <size_t N>
+bool listed(const std::string_view (&list)[N], std::string_view type) {
+    return std::find(std::begin(list), std::end(list), type) != std::end(list);
+}
+
+// Mount points escape space, tab, newline and backslash as \ooo
+std::string unescape(std::string_view s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '\\' && i + 3 < s.size() && s[i + 1] >= '0' && s[i + 1] <= '3') {
+            out.push_back(static_cast<char>((s[i + 1] - '0') * 64 + (s[i + 2] - '0') * 8 + (s[i + 3] - '0')));
+            i += 3;
+        } else {
+            out.push_back(s[i]);
+        }
+    }
+    return out;
+}
+
+std::string read_line(const std::string& file) {
+    std::ifstream in(file);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+std::string dev_name(uint64_t dev) {
+    return std::to_string(major(dev)) + ":" + std::to_string(minor(dev));
+}
+
+// The disk behind a block device: partitions resolve to their parent, so
+// two partitions of one disk share its limits
+uint64_t whole_disk(uint64_t dev) {
+    const std::string sys = "/sys/dev/block/" + dev_name(dev);
+    struct stat st;
+    if (::stat((sys + "/partition").c_str(), &st) != 0) return dev;
+    unsigned maj = 0, min = 0;
+    if (sscanf(read_line(sys + "/../dev").c_str(), "%u:%u", &maj, &min) != 2) return dev;
+    return makedev(maj, min);
+}
+
+Kind block_kind(uint64_t disk) {
+    std::string rotational = read_line("/sys/dev/block/" + dev_name(disk) + "/queue/rotational");
+    if (rotational == "1") return Kind::Rotational;
+    if (rotational == "0") return Kind::Solid;
+    return Kind::Unknown;
+}
+
+// Whether `path` is `dir` or below it
+bool within(std::string_view path, std::string_view dir) {
+    if (dir == "/") return true;
+    return path.size() >= dir.size() && path.compare(0, dir.size(), dir) == 0
+        && (path.size() == dir.size() || path[dir.size()] == '/');
+}
+
+} // namespace
+
+bool Table::load(const fs::path& root) {
+    std::ifstream in("/proc/self/mountinfo");
+    if (!in) return false;
+
+    // 36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw
+    std::unordered_map<std::string, size_t> by_path;
+    std::unordered_map<uint64_t, size_t> device_of;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::vector<std::string_view> fields;
+        std::string_view rest(line);
+        while (!rest.empty()) {
+            size_t space = rest.find(' ');
+            fields.push_back(rest.substr(0, space));
+            if (space == std::string_view::npos) break;
+            rest.remove_prefix(space + 1);
+        }
+        auto dash = std::find(fields.begin(), fields.end(), "-");
+        if (fields.size() < 5 || fields.end() - dash < 3) continue;
+
+        unsigned maj = 0, min = 0;
+        if (sscanf(std::string(fields[2]).c_str(), "%u:%u", &maj, &min) != 2) continue;
+        Mount m;
+        m.path = unescape(fields[4]);
+        m.type = std::string(dash[1]);
+        m.dev = makedev(maj, min);
+
+        // Memory and network filesystems have anonymous devices; block
+        // ones that do too (btrfs) name their disk as the source
+        uint64_t key = m.dev;
+        if (listed(kPseudo, m.type)) {
+            m.kind = Kind::Pseudo;
+        } else if (listed(kNetwork, m.type)) {
+            m.kind = Kind::Network;
+        } else {
+            uint64_t block = maj != 0 ? m.dev : 0;
+            struct stat st;
+            std::string source = unescape(dash[2]);
+            if (block == 0 && source.compare(0, 5, "/dev/") == 0 && ::stat(source.c_str(), &st) == 0
+                && S_ISBLK(st.st_mode)) {
+                block = st.st_rdev;
+            }
+            if (block != 0) {
+                key = whole_disk(block);
+                m.kind = block_kind(key);
+            }
+        }
+        auto [device, added] = device_of.emplace(key, devices_.size());
+        if (added) devices_.push_back(m.kind);
+        m.device = device->second;
+
+        // A later mount on the same point hides the earlier one
+        auto [slot, fresh] = by_path.emplace(m.path, mounts_.size());
+        if (fresh) {
+            mounts_.push_back(std::move(m));
+        } else {
+            mounts_[slot->second] = std::move(m);
+        }
+    }
+
+    std::error_code ec;
+    fs::path canonical = fs::weakly_canonical(root, ec);
+    if (ec) canonical = root;
+    const std::string& base = canonical.native();
+    size_t longest = 0;
+    for (size_t i = 0; i < mounts_.size(); ++i) {
+        const Mount& m = mounts_[i];
+        by_dev_.emplace(m.dev, static_cast<int>(i));
+        if (within(base, m.path) && (root_ < 0 || m.path.size() > longest)) {
+            root_ = static_cast<int>(i);
+            longest = m.path.size();
+        }
+        if (m.path.size() <= base.size() || !within(m.path, base)) continue;
+
+        // Below the root: key it the way the walk will build its path
+        std::string_view relative = std::string_view(m.path).substr(base == "/" ? 1 : base.size() + 1);
+        below_.emplace((root / std::string(relative)).native(), static_cast<int>(i));
+        names_.insert(std::string_view(m.path).substr(m.path.rfind('/') + 1));
+    }
+    return true;
+}
+
+int Table::at(const fs::path& parent, std::string_view name) const {
+    if (names_.empty() || names_.count(name) == 0) return -1;
+    auto it = below_.find((parent / name).native());
+    return it == below_.end() ? -1 : it->second;
+}
+
+#else
+
+bool Table::load(const fs::path&) {
+    return false;
+}
+
+int Table::at(const fs::path&, std::string_view) const {
+    return -1;
+}
+
+#endif
+
+int Table::by_dev(uint64_t dev) const {
+    auto it = by_dev_.find(dev);
+    return it == by_dev_.end() ? -1 : it->second;
+}
+
+int Table::descend(int mount, const fs::path& dir, std::string_view name, uint64_t dev, bool one_file_system,
+                   bool pseudo_filesystems) const {
+    int to = at(dir, name);
+    if (to < 0 && dev != 0 && mount >= 0 && dev != mounts_[static_cast<size_t>(mount)].dev) {
+        to = by_dev(dev);
+        if (to < 0 && one_file_system) return kSkip;
+    }
+    if (to < 0 || to == mount) return mount;
+
+    const Mount& target = mounts_[static_cast<size_t>(to)];
+    const Mount* top = root_ >= 0 ? &mounts_[static_cast<size_t>(root_)] : nullptr;
+    if (one_file_system && top && target.dev != top->dev) return kSkip;
+    // Pseudo filesystems are only walked when the root is on one
+    if (!pseudo_filesystems && target.kind == Kind::Pseudo && (!top || top->kind != Kind::Pseudo)) return kSkip;
+    return to;
+}
+
+} // namespace mounts
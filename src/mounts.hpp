@@ -0,0 +1,88 @@
+#pragma once
+#include <filesystem>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// The mounted filesystems a walk can run into, read once per walk from
+// /proc/self/mountinfo, and what kind of storage each one sits on. The
+// walker uses this to stay on one filesystem, to keep out of proc/sysfs
+// and friends, and to limit how hard it drives each device. Other
+// platforms get an empty table: one filesystem, no limits.
+namespace mounts {
+
+enum class Kind : uint8_t {
+    Unknown,                              // memory-backed or not classified; no limits
+    Solid,                                // SSD/NVMe
+    Rotational,
+    Network,                              // NFS, SMB and the like
+    Pseudo,                               // proc, sysfs, cgroup, ...: no files worth counting
+};
+
+const char* kind_name(Kind kind);
+
+// How hard a walk may drive one device: directories listed at once and
+// stat/open requests in flight per io_uring batch. 0 = no limit.
+struct Limits {
+    unsigned workers = 0;
+    unsigned depth = 0;
+};
+
+Limits limits(Kind kind);
+
+struct Mount {
+    std::string path;                     // mount point
+    std::string type;                     // as in mountinfo: ext4, nfs4, fuse.sshfs, ...
+    uint64_t dev = 0;                     // st_dev of everything on it
+    Kind kind = Kind::Unknown;
+    size_t device = 0;                    // index of the backing device; mounts of one disk share it
+};
+
+class Table {
+public:
+    Table() = default;
+    Table(const Table&) = delete;
+    Table& operator=(const Table&) = delete;
+
+    // Read the mounts at and below `root` (as the walk will spell its
+    // paths); false when the system doesn't say
+    bool load(const fs::path& root);
+
+    size_t size() const { return mounts_.size(); }
+    size_t devices() const { return devices_.size(); }
+    const Mount& mount(int index) const { return mounts_[static_cast<size_t>(index)]; }
+    // Kind of a backing device
+    Kind device_kind(size_t device) const { return devices_[device]; }
+
+    // The mount `root` is on; -1 when unknown
+    int root() const { return root_; }
+    // The mount whose mount point is `parent / name`; -1 when it isn't one.
+    // Cheap for names that are never a mount point's last component.
+    int at(const fs::path& parent, std::string_view name) const;
+    // A mount with this st_dev, for directories reached through symlinks
+    int by_dev(uint64_t dev) const;
+
+    static constexpr int kSkip = -2;
+    // Mount of subdirectory `name` of `dir` (on `mount`), or kSkip when a
+    // walk must stay out: another filesystem under one_file_system, or a
+    // pseudo filesystem unless allowed or the root is on one. dev: its
+    // st_dev if it was stat'ed, else 0; that catches directories reached
+    // through symlinks.
+    int descend(int mount, const fs::path& dir, std::string_view name, uint64_t dev, bool one_file_system,
+                bool pseudo_filesystems) const;
+
+private:
+    std::vector<Mount> mounts_;
+    std::vector<Kind> devices_;
+    int root_ = -1;
+    std::unordered_set<std::string_view> names_;         // last components of the mount points below root
+    std::unordered_map<std::string, int> below_;         // mount points below root, as walk paths
+    std::unordered_map<uint64_t, int> by_dev_;
+};
+
+} // namespace mounts
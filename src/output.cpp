@@ -0,0 +1,180 @@
+#include "output.hpp"
+#include <algorithm>
+#include <cerrno>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DIRSTAT_OUT_SSE2 1
+#endif
+
+namespace output {
+
+namespace {
+
+// Records reach a streaming consumer at most this late
+constexpr auto kStreamLatency = std::chrono::milliseconds(50);
+
+// Length of the prefix that can be copied into a JSON string as is: no
+// quote, backslash, control byte or non-ASCII byte (which needs checking)
+size_t plain_prefix(const char* data, size_t len) {
+    size_t i = 0;
+#ifdef DIRSTAT_OUT_SSE2
+    // Signed compare: bytes >= 0x80 are negative, so "< 0x20" also catches
+    // every non-ASCII byte
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(0x20);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                       _mm_cmplt_epi8(v, space));
+        int mask = _mm_movemask_epi8(special);
+        if (mask != 0) {
+#ifdef _MSC_VER
+            unsigned long bit;
+            _BitScanForward(&bit, static_cast<unsigned long>(mask));
+            return i + bit;
+#else
+            return i + static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+#endif
+        }
+    }
+#endif
+    for (; i < len; ++i) {
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\') return i;
+    }
+    return i;
+}
+
+// Length of the well-formed UTF-8 sequence at data, 0 if there is none
+size_t utf8_sequence(const unsigned char* data, size_t len) {
+    unsigned char c = data[0];
+    size_t need;
+    unsigned char lo = 0x80, hi = 0xBF;   // allowed range of the second byte
+    if (c >= 0xC2 && c <= 0xDF) {
+        need = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        need = 3;
+        if (c == 0xE0) lo = 0xA0;         // overlong
+        if (c == 0xED) hi = 0x9F;         // surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        need = 4;
+        if (c == 0xF0) lo = 0x90;         // overlong
+        if (c == 0xF4) hi = 0x8F;         // above U+10FFFF
+    } else {
+        return 0;
+    }
+    if (len < need || data[1] < lo || data[1] > hi) return 0;
+    for (size_t i = 2; i < need; ++i) {
+        if ((data[i] & 0xC0) != 0x80) return 0;
+    }
+    return need;
+}
+
+} // namespace
+
+Writer::Writer(int fd)
+    : fd_(fd), buffer_(new char[kBufferSize]), last_flush_(std::chrono::steady_clock::now()) {}
+
+Writer::~Writer() {
+    flush();
+}
+
+Writer& Writer::write_slow(const char* data, size_t len) {
+    while (len > 0) {
+        if (used_ == kBufferSize) flush();
+        size_t chunk = std::min(len, kBufferSize - used_);
+        std::memcpy(buffer_.get() + used_, data, chunk);
+        used_ += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    return *this;
+}
+
+void Writer::flush() {
+    const char* data = buffer_.get();
+    size_t left = used_;
+    used_ = 0;
+    last_flush_ = std::chrono::steady_clock::now();
+    while (left > 0 && !broken_) {
+#ifdef _WIN32
+        int n = _write(fd_, data, static_cast<unsigned>(std::min<size_t>(left, 1u << 30)));
+#else
+        ssize_t n = ::write(fd_, data, left);
+#endif
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            broken_ = true;
+            break;
+        }
+        data += n;
+        left -= static_cast<size_t>(n);
+    }
+}
+
+void Writer::tick() {
+    if (used_ > 0 && std::chrono::steady_clock::now() - last_flush_ >= kStreamLatency) flush();
+}
+
+Writer& Writer::operator<<(const colors::Painted& p) {
+    if (!colors::state().out) return *this << p.text;
+    return *this << p.code << p.text << colors::RESET;
+}
+
+Writer& Writer::operator<<(const Quoted& q) {
+    static const char hex[] = "0123456789abcdef";
+    const char* data = q.text.data();
+    size_t len = q.text.size();
+
+    *this << '"';
+    size_t i = 0;
+    while (i < len) {
+        size_t run = plain_prefix(data + i, len - i);
+        write(data + i, run);
+        i += run;
+        if (i == len) break;
+
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        if (c >= 0x80) {
+            size_t n = utf8_sequence(reinterpret_cast<const unsigned char*>(data + i), len - i);
+            if (n > 0) {
+                write(data + i, n);
+                i += n;
+            } else {
+                *this << "\\ufffd";
+                i++;
+            }
+            continue;
+        }
+        switch (c) {
+        case '"': *this << "\\\""; break;
+        case '\\': *this << "\\\\"; break;
+        case '\n': *this << "\\n"; break;
+        case '\r': *this << "\\r"; break;
+        case '\t': *this << "\\t"; break;
+        case '\b': *this << "\\b"; break;
+        case '\f': *this << "\\f"; break;
+        default: {
+            char escaped[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+            write(escaped, sizeof(escaped));
+        }
+        }
+        i++;
+    }
+    return *this << '"';
+}
+
+Writer& out() {
+    static Writer writer(1);
+    return writer;
+}
+
+} // namespace output
@@ -0,0 +1,112 @@
+#pragma once
+#include "colors.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Buffered report output. Everything for stdout goes through one large
+// buffer that is written out when full and at explicit flush points, never
+// per line; colors are written straight into it and dropped when stdout
+// isn't a terminal.
+namespace output {
+
+enum class Format : uint8_t {
+    Text,
+    Json,                                 // one document once the work is done
+    Ndjson,                               // one record per line, as results become final
+};
+
+// A string written as a JSON string literal
+struct Quoted {
+    std::string_view text;
+};
+inline Quoted quoted(std::string_view s) { return {s}; }
+
+class Writer {
+public:
+    static constexpr size_t kBufferSize = 64 * 1024;
+
+    explicit Writer(int fd);
+    ~Writer();
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    Writer& write(const char* data, size_t len) {
+        if (len > kBufferSize - used_) return write_slow(data, len);
+        std::memcpy(buffer_.get() + used_, data, len);
+        used_ += len;
+        return *this;
+    }
+
+    Writer& operator<<(std::string_view s) { return write(s.data(), s.size()); }
+    Writer& operator<<(const char* s) { return write(s, std::strlen(s)); }
+    Writer& operator<<(char c) {
+        if (used_ == kBufferSize) flush();
+        buffer_[used_++] = c;
+        return *this;
+    }
+    template <typename T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, char>
+                                           && !std::is_same_v<T, bool>, int> = 0>
+    Writer& operator<<(T value) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        return write(digits, static_cast<size_t>(result.ptr - digits));
+    }
+    Writer& operator<<(const colors::Painted& p);
+    // Quotes and escapes; bytes that aren't valid UTF-8 become U+FFFD so
+    // the document always parses
+    Writer& operator<<(const Quoted& q);
+
+    // Write out everything buffered so far
+    void flush();
+    // Flush if the oldest buffered output has waited longer than the
+    // streaming latency; called after each streamed record
+    void tick();
+
+private:
+    Writer& write_slow(const char* data, size_t len);
+
+    int fd_;
+    std::unique_ptr<char[]> buffer_;
+    size_t used_ = 0;
+    bool broken_ = false;                 // the reader went away; drop output
+    std::chrono::steady_clock::time_point last_flush_;
+};
+
+// The stdout writer
+Writer& out();
+
+// One NDJSON record: {"type":"...",...} and a newline once it goes out of
+// scope. Fields are written in the order they are added.
+class Record {
+public:
+    Record(Writer& out, std::string_view type) : out_(out) { out_ << "{\"type\":" << quoted(type); }
+    ~Record() {
+        out_ << "}\n";
+        out_.tick();
+    }
+    Record(const Record&) = delete;
+    Record& operator=(const Record&) = delete;
+
+    Record& field(std::string_view name, std::string_view value) {
+        key(name) << quoted(value);
+        return *this;
+    }
+    Record& field(std::string_view name, uint64_t value) {
+        key(name) << value;
+        return *this;
+    }
+    // Starts a field whose value the caller writes
+    Writer& key(std::string_view name) { return out_ << ',' << quoted(name) << ':'; }
+
+private:
+    Writer& out_;
+};
+
+} // namespace output
@@ -0,0 +1,125 @@
+#include "paths.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace paths {
+
+PathTable::PathTable(unsigned workers)
+    : chunks_(new std::atomic<Node*>[kChunks]), shards_(std::max(workers, 1u)) {
+    for (size_t i = 0; i < kChunks; ++i) chunks_[i].store(nullptr, std::memory_order_relaxed);
+}
+
+PathTable::~PathTable() {
+    for (size_t i = 0; i < kChunks; ++i) delete[] chunks_[i].load(std::memory_order_relaxed);
+}
+
+// Chunks are created on first use by whichever worker gets there first
+PathTable::Node* PathTable::chunk_for(NodeId id) {
+    std::atomic<Node*>& slot = chunks_[id >> kChunkBits];
+    Node* chunk = slot.load(std::memory_order_acquire);
+    if (chunk) return chunk;
+    Node* fresh = new Node[kChunkSize];
+    if (slot.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel)) return fresh;
+    delete[] fresh;
+    return chunk;
+}
+
+const char* PathTable::store_name(Shard& shard, std::string_view name) {
+    if (name.size() > shard.left) {
+        size_t size = std::max(kArenaBlock, name.size());
+        shard.blocks.push_back(std::make_unique<char[]>(size));
+        shard.cursor = shard.blocks.back().get();
+        shard.left = size;
+    }
+    char* out = shard.cursor;
+    if (!name.empty()) std::memcpy(out, name.data(), name.size());
+    shard.cursor += name.size();
+    shard.left -= name.size();
+    return out;
+}
+
+NodeId PathTable::add_root(const fs::path& root) {
+    return add(static_cast<unsigned>(shards_.size()), kNoNode, root.string());
+}
+
+NodeId PathTable::add(unsigned worker, NodeId parent, std::string_view name) {
+    Shard& shard = worker < shards_.size() ? shards_[worker] : root_shard_;
+    if (shard.next == shard.end) {
+        shard.next = next_id_.fetch_add(kIdBlock, std::memory_order_relaxed);
+        shard.end = shard.next + kIdBlock;
+    }
+    if (shard.next >= kNoNode) return kNoNode;
+
+    NodeId id = static_cast<NodeId>(shard.next++);
+    Node& n = chunk_for(id)[id & (kChunkSize - 1)];
+    n.parent = parent;
+    n.length = static_cast<uint32_t>(name.size());
+    n.name = store_name(shard, name);
+    return id;
+}
+
+std::string_view PathTable::name(NodeId id) const {
+    const Node& n = node(id);
+    return std::string_view(n.name, n.length);
+}
+
+// Ancestors of id from the root down, id included
+void PathTable::chain(NodeId id, std::vector<NodeId>& out) const {
+    out.clear();
+    for (NodeId at = id; at != kNoNode; at = node(at).parent) out.push_back(at);
+    std::reverse(out.begin(), out.end());
+}
+
+fs::path PathTable::path(NodeId id) const {
+    if (id == kNoNode) return {};
+    thread_local std::vector<NodeId> ids;
+    chain(id, ids);
+    fs::path result(std::string(name(ids.front())));
+    for (size_t i = 1; i < ids.size(); ++i) result /= name(ids[i]);
+    return result;
+}
+
+std::string PathTable::relative(NodeId id) const {
+    if (id == kNoNode) return {};
+    thread_local std::vector<NodeId> ids;
+    chain(id, ids);
+    std::string result;
+    for (size_t i = 1; i < ids.size(); ++i) {
+        if (i > 1) result.push_back(static_cast<char>(fs::path::preferred_separator));
+        result.append(name(ids[i]));
+    }
+    return result;
+}
+
+bool PathTable::less(NodeId a, NodeId b) const {
+    if (a == b) return false;
+    thread_local std::vector<NodeId> left, right;
+    chain(a, left);
+    chain(b, right);
+    // Both chains start at the same root; compare the names below it one
+    // component at a time, like fs::path does
+    size_t common = std::min(left.size(), right.size());
+    for (size_t i = 1; i < common; ++i) {
+        if (left[i] == right[i]) continue;
+        int c = name(left[i]).compare(name(right[i]));
+        if (c != 0) return c < 0;
+    }
+    return left.size() < right.size();
+}
+
+bool PathTable::less(NodeId parent, std::string_view leaf, NodeId b) const {
+    thread_local std::vector<NodeId> left, right;
+    chain(parent, left);
+    chain(b, right);
+    // As above, with `leaf` as the last component on the left
+    size_t length = left.size() + 1;
+    size_t common = std::min(length, right.size());
+    for (size_t i = 1; i < common; ++i) {
+        if (i < left.size() && left[i] == right[i]) continue;
+        int c = (i < left.size() ? name(left[i]) : leaf).compare(name(right[i]));
+        if (c != 0) return c < 0;
+    }
+    return length < right.size();
+}
+
+} // namespace paths
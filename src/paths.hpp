@@ -0,0 +1,84 @@
+#pragma once
+#include <filesystem>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Compact storage for the paths a walk hands out. Every node is a parent
+// index plus a name kept in a per-worker byte arena; results hold 32-bit
+// node IDs and full paths are only rebuilt when they're printed or opened.
+namespace paths {
+
+using NodeId = uint32_t;
+constexpr NodeId kNoNode = 0xFFFFFFFFu;
+
+class PathTable {
+public:
+    explicit PathTable(unsigned workers);
+    ~PathTable();
+    PathTable(const PathTable&) = delete;
+    PathTable& operator=(const PathTable&) = delete;
+
+    // The walk root, stored whole as a single node without a parent
+    NodeId add_root(const fs::path& root);
+
+    // A child of `parent`. Each worker may only pass its own index; nodes
+    // added by one worker can be read by others once the ID has been
+    // handed over through the task queue. Returns kNoNode when the table
+    // is full (2^32 - 1 nodes).
+    NodeId add(unsigned worker, NodeId parent, std::string_view name);
+
+    NodeId parent(NodeId id) const { return node(id).parent; }
+    std::string_view name(NodeId id) const;
+
+    // root / ... / name, exactly as the walker built it
+    fs::path path(NodeId id) const;
+    // The names below the root joined with the preferred separator
+    std::string relative(NodeId id) const;
+    // Same order as comparing path(a) < path(b) for nodes below one root
+    bool less(NodeId a, NodeId b) const;
+    // less(add(parent, name), b) without adding the node
+    bool less(NodeId parent, std::string_view name, NodeId b) const;
+
+private:
+    struct Node {
+        NodeId parent;
+        uint32_t length;
+        const char* name;
+    };
+
+    static constexpr unsigned kChunkBits = 16;
+    static constexpr size_t kChunkSize = size_t(1) << kChunkBits;
+    static constexpr size_t kChunks = (size_t(1) << 32) / kChunkSize;
+    // IDs are taken from the shared counter this many at a time
+    static constexpr uint32_t kIdBlock = 1024;
+    static constexpr size_t kArenaBlock = 64 * 1024;
+
+    struct alignas(64) Shard {
+        uint64_t next = 0;
+        uint64_t end = 0;
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char* cursor = nullptr;
+        size_t left = 0;
+    };
+
+    const Node& node(NodeId id) const {
+        return chunks_[id >> kChunkBits].load(std::memory_order_acquire)[id & (kChunkSize - 1)];
+    }
+    Node* chunk_for(NodeId id);
+    const char* store_name(Shard& shard, std::string_view name);
+    void chain(NodeId id, std::vector<NodeId>& out) const;
+
+    std::unique_ptr<std::atomic<Node*>[]> chunks_;
+    std::atomic<uint64_t> next_id_{0};
+    std::vector<Shard> shards_;
+    Shard root_shard_;
+};
+
+} // namespace paths
@@ -0,0 +1,112 @@
+#include "pool.hpp"
+#include <thread>
+
+namespace pool {
+
+unsigned default_threads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+WorkStealingPool::WorkStealingPool(unsigned threads) {
+    if (threads == 0) threads = default_threads();
+    queues_.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+}
+
+void WorkStealingPool::submit(unsigned worker, Task task) {
+    pending_.fetch_add(1);
+    {
+        Queue& q = *queues_[worker];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(std::move(task));
+    }
+    queued_.fetch_add(1);
+
+    // Pairs with the sleeping_ increment in worker_loop: either the sleeper
+    // sees queued_ > 0 or we see it asleep and wake it up
+    if (sleeping_.load() > 0) {
+        { std::lock_guard<std::mutex> lock(idle_mutex_); }
+        idle_cv_.notify_one();
+    }
+}
+
+bool WorkStealingPool::pop_or_steal(unsigned worker, Task& task) {
+    {
+        Queue& own = *queues_[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued_.fetch_sub(1);
+            return true;
+        }
+    }
+
+    const unsigned n = size();
+    for (unsigned i = 1; i < n; ++i) {
+        Queue& victim = *queues_[(worker + i) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued_.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::worker_loop(unsigned worker) {
+    Task task;
+    for (;;) {
+        if (pop_or_steal(worker, task)) {
+            // After a failure the rest is only drained; pending_ goes down
+            // whatever the task does, or run() would never return
+            if (!failed_.load(std::memory_order_relaxed)) {
+                try {
+                    task(worker);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex_);
+                    if (!error_) error_ = std::current_exception();
+                    failed_.store(true, std::memory_order_relaxed);
+                }
+            }
+            task = nullptr;
+            if (pending_.fetch_sub(1) == 1) {
+                { std::lock_guard<std::mutex> lock(idle_mutex_); }
+                idle_cv_.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(idle_mutex_);
+        sleeping_.fetch_add(1);
+        idle_cv_.wait(lock, [&] { return queued_.load() > 0 || pending_.load() == 0; });
+        sleeping_.fetch_sub(1);
+        if (queued_.load() == 0 && pending_.load() == 0) return;
+    }
+}
+
+void WorkStealingPool::run(Task root) {
+    submit(0, std::move(root));
+
+    std::vector<std::thread> threads;
+    threads.reserve(size() - 1);
+    for (unsigned i = 1; i < size(); ++i) {
+        threads.emplace_back([this, i] { worker_loop(i); });
+    }
+    worker_loop(0);
+    for (auto& t : threads) t.join();
+
+    if (error_) {
+        std::exception_ptr error = error_;
+        error_ = nullptr;
+        failed_.store(false);
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace pool
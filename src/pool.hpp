@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace pool {
+
+// Number of workers used when the user doesn't ask for a specific count
+unsigned default_threads();
+
+// Work-stealing pool: every worker owns a deque, pushes and pops at the back
+// (depth-first, cache friendly) and steals from the front of the other
+// deques when its own runs dry. The calling thread acts as worker 0.
+class WorkStealingPool {
+public:
+    using Task = std::function<void(unsigned worker)>;
+
+    explicit WorkStealingPool(unsigned threads);
+
+    unsigned size() const { return static_cast<unsigned>(queues_.size()); }
+
+    // Queue a task on a worker's deque (normally called from inside a task)
+    void submit(unsigned worker, Task task);
+
+    // Run the root task and everything it spawns, return once all are done.
+    // If a task throws, the tasks still queued are dropped and the first
+    // exception is rethrown here once every worker has stopped.
+    void run(Task root);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool pop_or_steal(unsigned worker, Task& task);
+    void worker_loop(unsigned worker);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::atomic<size_t> pending_{0};   // submitted but not yet finished
+    std::atomic<size_t> queued_{0};    // sitting in a deque
+    std::atomic<unsigned> sleeping_{0};
+    std::atomic<bool> failed_{false};
+    std::mutex error_mutex_;
+    std::exception_ptr error_;         // first exception a task threw
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+};
+
+} // namespace pool
@@ -0,0 +1,233 @@
+#include "profile.hpp"
+#include "colors.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <vector>
+
+namespace profile {
+
+namespace detail {
+
+bool enabled = false;
+
+} // namespace detail
+
+namespace {
+
+struct PhaseTotals {
+    std::string name;
+    int depth = 0;
+    uint64_t calls = 0;
+    double wall = 0;
+    double cpu = 0;
+};
+
+// Slots of running threads, and what exited threads counted
+std::mutex g_mutex;
+std::vector<detail::Slot*> g_live;
+uint64_t g_retired[kCounters] = {};
+uint64_t g_threads = 0;
+
+// Only touched from the main thread
+std::vector<PhaseTotals> g_phases;
+int g_depth = 0;
+std::chrono::steady_clock::time_point g_start;
+double g_cpu_start = 0;
+
+// CPU time of the whole process, all threads
+double cpu_seconds() {
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+#else
+    return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Snapshot {
+    uint64_t values[kCounters] = {};
+    uint64_t threads = 0;
+    double wall = 0;
+    double cpu = 0;
+
+    double entries_per_s() const { return wall > 0 ? static_cast<double>(values[Entries]) / wall : 0; }
+};
+
+Snapshot snapshot() {
+    Snapshot s;
+    std::lock_guard<std::mutex> lock(g_mutex);
+    std::copy(std::begin(g_retired), std::end(g_retired), s.values);
+    for (const detail::Slot* slot : g_live) {
+        for (unsigned i = 0; i < kCounters; ++i) s.values[i] += slot->values[i];
+    }
+    s.threads = g_threads;
+    s.wall = seconds_since(g_start);
+    s.cpu = cpu_seconds() - g_cpu_start;
+    return s;
+}
+
+std::string number(double value, const char* format = "%.6f") {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), format, value);
+    return buffer;
+}
+
+} // namespace
+
+namespace detail {
+
+Slot::Slot() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_live.push_back(this);
+    g_threads++;
+}
+
+Slot::~Slot() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    for (unsigned i = 0; i < kCounters; ++i) g_retired[i] += values[i];
+    g_live.erase(std::remove(g_live.begin(), g_live.end(), this), g_live.end());
+}
+
+Slot& local() {
+    thread_local Slot slot;
+    return slot;
+}
+
+} // namespace detail
+
+void enable() {
+    detail::enabled = true;
+    g_start = std::chrono::steady_clock::now();
+    g_cpu_start = cpu_seconds();
+}
+
+Phase::Phase(std::string name) {
+    if (!detail::enabled) return;
+    active_ = true;
+    int depth = g_depth++;
+    auto it = std::find_if(g_phases.begin(), g_phases.end(), [&](const PhaseTotals& p) {
+        return p.depth == depth && p.name == name;
+    });
+    if (it == g_phases.end()) it = g_phases.insert(it, PhaseTotals{std::move(name), depth});
+    index_ = static_cast<size_t>(it - g_phases.begin());
+    wall_ = std::chrono::steady_clock::now();
+    cpu_ = cpu_seconds();
+}
+
+Phase::~Phase() {
+    if (!active_) return;
+    PhaseTotals& p = g_phases[index_];
+    p.calls++;
+    p.wall += seconds_since(wall_);
+    p.cpu += cpu_seconds() - cpu_;
+    g_depth--;
+}
+
+void print(std::ostream& out) {
+    Snapshot s = snapshot();
+    char line[160];
+    auto row = [](const char* label, uint64_t value) {
+        char text[64];
+        snprintf(text, sizeof(text), "    %-20s %14llu", label, static_cast<unsigned long long>(value));
+        return std::string(text);
+    };
+
+    snprintf(line, sizeof(line), "[i] profile: %.3f s wall, %.3f s CPU, %llu threads", s.wall, s.cpu,
+             static_cast<unsigned long long>(s.threads));
+    out << colors::dim(line) << '\n';
+    out << colors::dim(row("directories opened", s.values[DirsOpened])) << '\n';
+    snprintf(line, sizeof(line), "  (%.0f/s)", s.entries_per_s());
+    out << colors::dim(row("entries read", s.values[Entries]) + line) << '\n';
+    out << colors::dim(row("stat calls", s.values[StatCalls])) << '\n';
+    out << colors::dim(row("bytes hashed", s.values[BytesHashed]) + "  (" + format_size(s.values[BytesHashed])
+                       + ")") << '\n';
+    snprintf(line, sizeof(line), "  (%llu permission denied)", static_cast<unsigned long long>(s.values[Denied]));
+    out << colors::dim(row("errors", s.values[Errors]) + line) << '\n';
+    out << colors::dim(row("mounts skipped", s.values[MountsSkipped])) << '\n';
+    out << colors::dim(row("device waits", s.values[DeviceWaits])) << '\n';
+    out << colors::dim(row("runs spilled", s.values[SpillRuns]) + "  (" + format_size(s.values[SpillBytes]) + ")")
+        << '\n';
+    out << colors::dim(row("hard links skipped", s.values[HardLinks])) << '\n';
+    out << colors::dim(row("hash cache hits", s.values[CacheHits]) + "  ("
+                       + std::to_string(s.values[CacheMisses]) + " misses)") << '\n';
+
+    if (!g_phases.empty()) {
+        snprintf(line, sizeof(line), "    %-24s %10s %10s %8s", "phase", "wall (s)", "cpu (s)", "calls");
+        out << colors::dim(line) << '\n';
+        for (const PhaseTotals& p : g_phases) {
+            std::string name = std::string(2 * static_cast<size_t>(p.depth), ' ') + p.name;
+            snprintf(line, sizeof(line), "    %-24s %10.3f %10.3f %8llu", name.c_str(), p.wall, p.cpu,
+                     static_cast<unsigned long long>(p.calls));
+            out << colors::dim(line) << '\n';
+        }
+    }
+    out.flush();
+}
+
+void write_json(output::Writer& out, const std::string& indent) {
+    Snapshot s = snapshot();
+    out << indent << "\"profile\": {\n";
+    out << indent << "  \"wall_s\": " << number(s.wall) << ", \"cpu_s\": " << number(s.cpu)
+        << ", \"threads\": " << s.threads << ",\n";
+    out << indent << "  \"dirs_opened\": " << s.values[DirsOpened] << ", \"entries\": " << s.values[Entries]
+        << ", \"entries_per_s\": " << number(s.entries_per_s(), "%.0f") << ",\n";
+    out << indent << "  \"stat_calls\": " << s.values[StatCalls] << ", \"bytes_hashed\": "
+        << s.values[BytesHashed] << ",\n";
+    out << indent << "  \"errors\": " << s.values[Errors] << ", \"permission_denied\": " << s.values[Denied]
+        << ",\n";
+    out << indent << "  \"mounts_skipped\": " << s.values[MountsSkipped] << ", \"device_waits\": "
+        << s.values[DeviceWaits] << ",\n";
+    out << indent << "  \"spill_runs\": " << s.values[SpillRuns] << ", \"spill_bytes\": " << s.values[SpillBytes]
+        << ",\n";
+    out << indent << "  \"hard_links\": " << s.values[HardLinks] << ", \"cache_hits\": " << s.values[CacheHits]
+        << ", \"cache_misses\": " << s.values[CacheMisses] << ",\n";
+    out << indent << "  \"phases\": [";
+    for (size_t i = 0; i < g_phases.size(); ++i) {
+        const PhaseTotals& p = g_phases[i];
+        out << (i ? ",\n" : "\n") << indent << "    {\"name\": " << output::quoted(p.name)
+            << ", \"depth\": " << p.depth << ", \"calls\": " << p.calls << ", \"wall_s\": " << number(p.wall)
+            << ", \"cpu_s\": " << number(p.cpu) << "}";
+    }
+    out << (g_phases.empty() ? "]\n" : "\n" + indent + "  ]\n");
+    out << indent << "}";
+}
+
+void write_record(output::Writer& out) {
+    Snapshot s = snapshot();
+    output::Record record(out, "profile");
+    record.key("wall_s") << number(s.wall);
+    record.key("cpu_s") << number(s.cpu);
+    record.field("threads", s.threads)
+        .field("dirs_opened", s.values[DirsOpened])
+        .field("entries", s.values[Entries]);
+    record.key("entries_per_s") << number(s.entries_per_s(), "%.0f");
+    record.field("stat_calls", s.values[StatCalls])
+        .field("bytes_hashed", s.values[BytesHashed])
+        .field("errors", s.values[Errors])
+        .field("permission_denied", s.values[Denied])
+        .field("mounts_skipped", s.values[MountsSkipped])
+        .field("device_waits", s.values[DeviceWaits])
+        .field("spill_runs", s.values[SpillRuns])
+        .field("spill_bytes", s.values[SpillBytes])
+        .field("hard_links", s.values[HardLinks])
+        .field("cache_hits", s.values[CacheHits])
+        .field("cache_misses", s.values[CacheMisses]);
+    record.key("phases") << '[';
+    for (size_t i = 0; i < g_phases.size(); ++i) {
+        const PhaseTotals& p = g_phases[i];
+        out << (i ? "," : "") << "{\"name\":" << output::quoted(p.name) << ",\"depth\":" << p.depth
+            << ",\"calls\":" << p.calls << ",\"wall_s\":" << number(p.wall) << ",\"cpu_s\":" << number(p.cpu)
+            << '}';
+    }
+    out << ']';
+}
+
+} // namespace profile
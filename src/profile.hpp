@@ -0,0 +1,88 @@
+#pragma once
+#include "output.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Opt-in instrumentation for --profile. Counters live in per-thread slots
+// and phases are timed with RAII scopes; both are only touched once
+// enable() was called, so a normal run pays one predictable branch per
+// counted event.
+namespace profile {
+
+enum Counter : unsigned {
+    DirsOpened,
+    Entries,                              // directory entries read
+    StatCalls,                            // stat/statx, batched ones included
+    BytesHashed,
+    Errors,                               // failed opens, stats and reads
+    Denied,                               // the subset that were EACCES/EPERM
+    MountsSkipped,                        // other filesystems (-x) and pseudo ones not entered
+    DeviceWaits,                          // directories put back because their device was busy
+    SpillRuns,                            // sorted run files written (--mem-limit)
+    SpillBytes,                           // bytes written to them
+    HardLinks,                            // dupes: further names of an inode already seen, not compared
+    CacheHits,                            // digests found in the hash cache (--hash-cache)
+    CacheMisses,                          // digests that had to be computed with it
+    kCounters
+};
+
+namespace detail {
+
+extern bool enabled;
+
+struct alignas(64) Slot {
+    uint64_t values[kCounters] = {};
+    Slot();
+    ~Slot();                              // folds the values into the totals
+};
+
+Slot& local();
+
+} // namespace detail
+
+// Start profiling; the total wall and CPU time are measured from here
+void enable();
+inline bool enabled() { return detail::enabled; }
+
+inline void count(Counter counter, uint64_t n = 1) {
+    if (detail::enabled) detail::local().values[counter] += n;
+}
+
+// Count a failure with its errno value
+inline void error(int err) {
+    if (!detail::enabled) return;
+    detail::Slot& slot = detail::local();
+    slot.values[Errors]++;
+    if (err == EACCES || err == EPERM) slot.values[Denied]++;
+}
+
+// Wall and CPU time from construction to destruction, added to the totals
+// of the phase with that name. Phases are timed from the main thread;
+// phases started inside another one are reported nested under it.
+class Phase {
+public:
+    explicit Phase(std::string name);
+    ~Phase();
+    Phase(const Phase&) = delete;
+    Phase& operator=(const Phase&) = delete;
+
+private:
+    bool active_ = false;
+    size_t index_ = 0;                    // into the phase totals
+    std::chrono::steady_clock::time_point wall_;
+    double cpu_ = 0;
+};
+
+// Human-readable report, for stderr
+void print(std::ostream& out);
+// `"profile": {...}` as a member of a JSON document, each line prefixed
+// with `indent`, no trailing newline
+void write_json(output::Writer& out, const std::string& indent);
+// The same as one NDJSON record
+void write_record(output::Writer& out);
+
+} // namespace profile
@@ -0,0 +1,206 @@
+#include "progress.hpp"
+#include "stats.hpp"
+#include <csignal>
+#include <cstdio>
+#include <string>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace progress {
+
+namespace {
+
+constexpr auto kTick = std::chrono::milliseconds(200);
+// Without a terminal to redraw on, one line this often
+constexpr auto kLogInterval = std::chrono::seconds(5);
+constexpr size_t kMaxPathWidth = 60;
+
+Options g_options;
+std::atomic<uint64_t> g_expected{0};
+std::atomic<bool> g_requested{false};
+
+#ifdef SIGUSR1
+extern "C" void on_sigusr1(int) {
+    g_requested.store(true, std::memory_order_relaxed);
+}
+#endif
+
+// "42s", "3m05s", "2h07m"
+std::string format_duration(double seconds) {
+    char buffer[32];
+    auto s = static_cast<unsigned long long>(seconds);
+    if (s < 60) {
+        snprintf(buffer, sizeof(buffer), "%llus", s);
+    } else if (s < 3600) {
+        snprintf(buffer, sizeof(buffer), "%llum%02llus", s / 60, s % 60);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%lluh%02llum", s / 3600, (s / 60) % 60);
+    }
+    return buffer;
+}
+
+bool stderr_is_tty() {
+#ifdef _WIN32
+    return _isatty(_fileno(stderr)) != 0;
+#else
+    return isatty(STDERR_FILENO) == 1;
+#endif
+}
+
+} // namespace
+
+void configure(const Options& opts) {
+    g_options = opts;
+#ifdef SIGUSR1
+    if (active()) {
+        struct sigaction action {};
+        action.sa_handler = on_sigusr1;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &action, nullptr);
+    }
+#endif
+}
+
+bool active() {
+    return g_options.show || g_options.checkpoint > 0;
+}
+
+void status(const std::string& line) {
+    if (!g_options.show) return;
+    if (stderr_is_tty()) {
+        std::fprintf(stderr, "\r\033[K%s", line.c_str());
+    } else {
+        std::fprintf(stderr, "%s\n", line.c_str());
+    }
+    std::fflush(stderr);
+}
+
+void clear_status() {
+    if (g_options.show && stderr_is_tty()) std::fputs("\r\033[K", stderr);
+}
+
+void expect(uint64_t dirs) {
+    g_expected.store(dirs, std::memory_order_relaxed);
+}
+
+Reporter::Reporter(unsigned workers, const paths::PathTable& table,
+                   std::function<void(output::Writer&)> checkpoint, Listener listener)
+    : workers_(workers), counters_(new Counters[workers]), table_(table), checkpoint_(std::move(checkpoint)),
+      listener_(std::move(listener)), err_(2), tty_(stderr_is_tty()),
+      expected_(g_expected.load(std::memory_order_relaxed)), start_(std::chrono::steady_clock::now()) {
+    thread_ = std::thread([this] { loop(); });
+}
+
+Reporter::~Reporter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    if (g_options.show && tty_) {
+        err_ << "\r\033[K";
+        err_.flush();
+    }
+}
+
+Reporter::Totals Reporter::totals() const {
+    Totals t;
+    for (unsigned i = 0; i < workers_; ++i) {
+        t.dirs += counters_[i].dirs.load(std::memory_order_relaxed);
+        t.files += counters_[i].files.load(std::memory_order_relaxed);
+        t.bytes += counters_[i].bytes.load(std::memory_order_relaxed);
+    }
+    return t;
+}
+
+void Reporter::loop() {
+    using clock = std::chrono::steady_clock;
+    const auto interval = std::chrono::duration<double>(g_options.checkpoint);
+    auto next_checkpoint = start_ + std::chrono::duration_cast<clock::duration>(interval);
+    auto next_line = start_ + kLogInterval;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!wake_.wait_for(lock, kTick, [this] { return stop_; })) {
+        const auto now = clock::now();
+        const double elapsed = std::chrono::duration<double>(now - start_).count();
+        const Totals current = totals();
+
+        if (listener_) {
+            listener_(Status{current.dirs, current.files, current.bytes, elapsed, current_path()});
+        }
+        if (!active()) continue;
+
+        bool due = g_requested.exchange(false, std::memory_order_relaxed);
+        if (g_options.checkpoint > 0 && now >= next_checkpoint) {
+            due = true;
+            next_checkpoint = now + std::chrono::duration_cast<clock::duration>(interval);
+        }
+        if (due && checkpoint_) write_checkpoint(current, elapsed);
+
+        if (g_options.show && (tty_ || now >= next_line)) {
+            draw(current, elapsed);
+            next_line = now + kLogInterval;
+        }
+    }
+}
+
+// Each worker's latest directory in turn, "." for the root
+std::string Reporter::current_path() {
+    for (unsigned i = 0; i < workers_; ++i) {
+        unsigned worker = (next_worker_ + i) % workers_;
+        paths::NodeId dir = counters_[worker].current.load(std::memory_order_acquire);
+        if (dir == paths::kNoNode) continue;
+        next_worker_ = worker + 1;
+        std::string path = table_.relative(dir);
+        return path.empty() ? std::string(".") : path;
+    }
+    return {};
+}
+
+void Reporter::draw(const Totals& now, double elapsed) {
+    std::string line = "[~] " + format_count(now.dirs) + " dirs, " + format_count(now.files) + " files, "
+                     + format_size(now.bytes);
+    if (elapsed > 0) {
+        line += ", " + format_count(static_cast<uint64_t>(static_cast<double>(now.dirs + now.files) / elapsed))
+              + " entries/s";
+    }
+    line += ", " + format_duration(elapsed);
+    // The ETA assumes directories keep coming at the average rate so far
+    if (expected_ > now.dirs && now.dirs > 0) {
+        double rate = static_cast<double>(now.dirs) / elapsed;
+        line += ", ETA " + format_duration(static_cast<double>(expected_ - now.dirs) / rate);
+    }
+
+    std::string path = current_path();
+    if (path.size() > kMaxPathWidth) path = "..." + path.substr(path.size() - kMaxPathWidth + 3);
+    if (!path.empty()) line += "  " + path;
+
+    if (tty_) {
+        err_ << "\r\033[K" << line;
+    } else {
+        err_ << line << '\n';
+    }
+    err_.flush();
+}
+
+void Reporter::write_checkpoint(const Totals& now, double elapsed) {
+    if (g_options.show && tty_) err_ << "\r\033[K";
+    {
+        output::Record record(err_, "checkpoint");
+        record.field("seq", ++checkpoints_);
+        char seconds[32];
+        snprintf(seconds, sizeof(seconds), "%.3f", elapsed);
+        record.key("elapsed_s") << seconds;
+        record.field("dirs", now.dirs).field("files", now.files).field("bytes", now.bytes);
+    }
+    checkpoint_(err_);
+    err_.flush();
+}
+
+} // namespace progress
@@ -0,0 +1,109 @@
+#pragma once
+#include "paths.hpp"
+#include "output.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Live progress on stderr and partial-result checkpoints for long walks.
+// Workers bump their own counters; a timer thread reads them, redraws the
+// status line and, every --checkpoint seconds or on SIGUSR1, writes what
+// the collectors have so far without stopping the walk.
+namespace progress {
+
+struct Options {
+    bool show = false;                    // status line on stderr
+    double checkpoint = 0;                // seconds between checkpoints, 0 = only on SIGUSR1
+};
+
+// Set once before any walk; also makes SIGUSR1 request a checkpoint
+void configure(const Options& opts);
+// Anything to report; walks only set up a reporter when this is true
+bool active();
+
+// The status line for work that isn't a walk (an estimate): redrawn in
+// place on a terminal, one line each otherwise. Nothing without --progress.
+void status(const std::string& line);
+// Clear it once that work is done
+void clear_status();
+
+// Number of directories the walk is expected to visit (e.g. from a scan
+// index), for the ETA; 0 = unknown
+void expect(uint64_t dirs);
+
+// One worker's counters. Only that worker writes them, so updates are a
+// relaxed load and store rather than a locked read-modify-write.
+struct alignas(64) Counters {
+    std::atomic<uint64_t> dirs{0};
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<paths::NodeId> current{paths::kNoNode};   // last directory finished
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+// Where a walk is, as handed to a Listener
+struct Status {
+    uint64_t dirs = 0;
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    double elapsed = 0;                   // seconds
+    std::string current;                  // a directory just finished, below the root
+};
+
+// Called from the reporter's thread on every tick
+using Listener = std::function<void(const Status& status)>;
+
+// Reports on one walk for as long as it exists
+class Reporter {
+public:
+    // checkpoint: writes the partial results as NDJSON records
+    // listener: optional, gets the status on every tick, whatever configure() set
+    Reporter(unsigned workers, const paths::PathTable& table, std::function<void(output::Writer&)> checkpoint,
+             Listener listener = {});
+    ~Reporter();
+    Reporter(const Reporter&) = delete;
+    Reporter& operator=(const Reporter&) = delete;
+
+    Counters& counters(unsigned worker) { return counters_[worker]; }
+
+private:
+    struct Totals {
+        uint64_t dirs = 0;
+        uint64_t files = 0;
+        uint64_t bytes = 0;
+    };
+
+    Totals totals() const;
+    void loop();
+    std::string current_path();
+    void draw(const Totals& now, double elapsed);
+    void write_checkpoint(const Totals& now, double elapsed);
+
+    unsigned workers_;
+    std::unique_ptr<Counters[]> counters_;
+    const paths::PathTable& table_;
+    std::function<void(output::Writer&)> checkpoint_;
+    Listener listener_;
+    output::Writer err_;
+    bool tty_;
+    uint64_t expected_;
+    uint64_t checkpoints_ = 0;
+    unsigned next_worker_ = 0;            // whose current directory is shown
+    std::chrono::steady_clock::time_point start_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+} // namespace progress
@@ -2,388 +2,790 @@
 #include "display.hpp"
 #include "stats.hpp"
 #include "colors.hpp"
+#include "walker.hpp"
+#include "collectors.hpp"
+#include "dirstat.hpp"
+#include "dirindex.hpp"
+#include "hashcache.hpp"
+#include "extensions.hpp"
+#include "output.hpp"
+#include "profile.hpp"
+#include "progress.hpp"
+#include "snapshot.hpp"
 #include <iostream>
 #include <vector>
 #include <algorithm>
 #include <map>
-#include <functional>
+#include <memory>
+#include <iterator>
+#include <cmath>
+#include <csignal>
 
 namespace scanner {
 
-// Check if path matches any exclude pattern
-bool is_excluded(const fs::path& path, const std::vector<std::string>& exclude) {
-    std::string name = path.filename().string();
-    for (const auto& pattern : exclude) {
-        if (name == pattern || name.find(pattern) != std::string::npos) {
-            return true;
-        }
+// io_uring throughput goes to stderr so it never mixes with JSON output
+static void report_io(const walker::Options& walk, const walker::Stats& stats) {
+    if (walk.io_depth == 0) return;
+    if (!stats.io_uring) {
+        std::cerr << colors::dim("[i] io_uring not available, used synchronous stat calls") << std::endl;
+        return;
     }
-    return false;
+    double rate = stats.seconds > 0 ? static_cast<double>(stats.io_ops) / stats.seconds : 0.0;
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "[i] io_uring: %llu ops in %.2f s (%.0f ops/s, depth %u)",
+             static_cast<unsigned long long>(stats.io_ops), stats.seconds, rate, walk.io_depth);
+    std::cerr << colors::dim(buffer) << std::endl;
 }
 
-// Check if entry should be skipped
-bool should_skip(const fs::directory_entry& entry, bool show_hidden, const std::vector<std::string>& exclude) {
-    std::string name = entry.path().filename().string();
-    
-    // Check exclude patterns
-    if (is_excluded(entry.path(), exclude)) return true;
-    
-    // Check hidden
-    if (!show_hidden && !name.empty() && name[0] == '.') return true;
-    
-    return false;
+// A dupes result cut short by its run files, on stderr like other warnings
+static void report_dupes_error(const collectors::Dupes& dupes) {
+    if (dupes.error().empty()) return;
+    std::cerr << colors::red("[X]") << " " << dupes.error() << std::endl;
 }
 
-// Recursive scan helper
-void scan_recursive(const fs::path& path, DirStats& stats, bool show_hidden, int max_depth, int current_depth, const std::vector<std::string>& exclude) {
-    if (max_depth > 0 && current_depth > max_depth) return;
-    
-    std::error_code ec;
-    for (const auto& entry : fs::directory_iterator(path, fs::directory_options::skip_permission_denied, ec)) {
-        if (should_skip(entry, show_hidden, exclude)) continue;
-        
-        if (entry.is_regular_file(ec)) {
-            uint64_t size = entry.file_size(ec);
-            if (!ec) {
-                stats.total_files++;
-                stats.total_size += size;
-                
-                if (size > stats.largest_file_size) {
-                    stats.largest_file_size = size;
-                    stats.largest_file_path = entry.path();
-                }
-                
-                std::string ext = entry.path().extension().string();
-                if (ext.empty()) {
-                    ext = "(no ext)";
-                } else {
-                    ext = ext.substr(1);
-                    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-                }
-                stats.extensions[ext]++;
-            }
-        } else if (entry.is_directory(ec)) {
-            stats.total_dirs++;
-            scan_recursive(entry.path(), stats, show_hidden, max_depth, current_depth + 1, exclude);
-        }
+// Let dupes reuse the digests in a hash cache file
+static void use_cache(collectors::Dupes& dupes, hashcache::Cache& cache, const fs::path& file) {
+    if (file.empty()) return;
+    profile::Phase phase("cache load");
+    cache.load(file, collectors::Dupes::kEdgeBytes);
+    dupes.cache(&cache);
+}
+
+// Append what dupes hashed to the cache file; its hit rate on stderr like
+// the index's reuse
+static void save_cache(hashcache::Cache& cache, const fs::path& file, output::Format format) {
+    if (file.empty()) return;
+    profile::Phase phase("cache save");
+    if (!cache.save()) {
+        std::cerr << colors::yellow("[!]") << " Could not write hash cache: " << file.string() << std::endl;
+        return;
     }
+    if (format != output::Format::Text) return;
+    hashcache::Stats s = cache.stats();
+    char buffer[160];
+    snprintf(buffer, sizeof(buffer), "[i] hash cache: %llu of %llu lookups hit (%.1f%%), %s not read, %llu added",
+             static_cast<unsigned long long>(s.hits), static_cast<unsigned long long>(s.lookups),
+             100.0 * s.hit_rate(), format_size(s.bytes_saved).c_str(), static_cast<unsigned long long>(s.added));
+    std::cerr << colors::dim(buffer) << std::endl;
 }
 
-void scan_directory(const fs::path& path, bool show_hidden, int max_depth, const std::vector<std::string>& exclude, bool json_output) {
+// Absolute path of the root, or an error reported in the requested format
+static bool resolve_root(const fs::path& path, output::Format format, fs::path& abs_path) {
     std::error_code ec;
-    fs::path abs_path = fs::absolute(path, ec);
+    abs_path = fs::absolute(path, ec);
     
     if (!fs::exists(abs_path, ec)) {
-        if (json_output) {
-            std::cout << "{\"error\": \"Cannot access path\"}" << std::endl;
+        if (format != output::Format::Text) {
+            output::Writer& out = output::out();
+            out << "{\"error\": \"Cannot access path\"}" << '\n';
+            out.flush();
         } else {
             std::cerr << colors::red("[X]") << " Cannot access path: " << path << std::endl;
         }
-        return;
+        return false;
+    }
+    return true;
+}
+
+// Close a JSON document; with --profile the profile is its last member
+static void end_json(output::Writer& out) {
+    if (profile::enabled()) {
+        out << ",\n";
+        profile::write_json(out, "  ");
     }
+    out << "\n}" << '\n';
+}
+
+// Single-collector commands print their members as the whole document
+static void print_json(const collectors::Collector& collector, const fs::path& root) {
+    output::Writer& out = output::out();
+    out << "{\n";
+    {
+        profile::Phase phase("output");
+        collector.write_json(out, root, "  ");
+    }
+    end_json(out);
+}
+
+void scan_directory(const fs::path& path, const walker::Options& walk, output::Format format,
+                    const fs::path& index_file, bool index_verify) {
+    fs::path abs_path;
+    if (!resolve_root(path, format, abs_path)) return;
     
+    output::Writer& out = output::out();
+    const bool json_output = format != output::Format::Text;
     if (!json_output) {
-        std::cout << colors::yellow("[>]") << " Scanning: " << colors::cyan(abs_path.string()) << std::endl;
-        std::cout << colors::dim("    Analyzing directory...") << std::endl;
+        out << colors::yellow("[>]") << " Scanning: " << colors::cyan(abs_path.string()) << '\n';
+        out << colors::dim("    Analyzing directory...") << '\n';
+        out.flush();
     }
     
-    DirStats stats;
-    scan_recursive(abs_path, stats, show_hidden, max_depth, 0, exclude);
+    dirstat::Scan scan(abs_path, walk);
+    collectors::Totals& totals = scan.totals();
+    walker::Callbacks& hooks = scan.hooks();
+
+    // With an index, directories whose mtime hasn't changed are taken from
+    // the previous run (with index_verify, only if their files also still
+    // have their recorded sizes and mtimes); every other directory is
+    // listed and recorded. Reused records are copied into the new index
+    // only if something was read, otherwise the file is left as it is.
+    struct IndexState {
+        bool active = false;
+        dirindex::DirRecord current;
+        dirindex::DirRecord found;        // scratch for reused records
+        std::vector<dirindex::DirRecord> records;
+        std::vector<dirindex::DirId> reused_ids;
+        uint64_t read = 0;
+    };
+    const bool use_index = !index_file.empty();
+    const uint64_t index_options = dirindex::options_hash(walk);
+    // Files a stat-based --where left out aren't stamped, so a change to
+    // them couldn't be verified: such scans record but don't reuse
+    const bool reuse = !(index_verify && walk.where && walk.where->reads_stat());
+    if (use_index && !reuse && !json_output) {
+        std::cerr << colors::dim("[i] index: --where reads file stats, so no directory is verified and reused")
+                  << std::endl;
+    }
+    dirindex::Index previous;
+    bool loaded = false;
+    std::vector<IndexState> index_state;
+    if (use_index) {
+        profile::Phase phase("index load");
+        loaded = previous.load(index_file, index_options);
+        index_state.resize(walker::thread_count(walk));
+
+        hooks.on_enter_dir = [&](unsigned worker, const walker::Dir& dir, std::vector<std::string>& children) {
+            IndexState& state = index_state[worker];
+            state.active = false;
+            dirindex::DirId id;
+            if (!dirindex::identify(dir.path, id)) return false;
+
+            dirindex::DirRecord& record = state.found;
+            if (reuse && previous.find(id, record, index_verify)
+                && (!index_verify || dirindex::files_unchanged(dir.path, record))) {
+                DirStats& local = totals.local(worker);
+                local.total_files += record.files;
+                local.total_size += record.size;
+                local.total_dirs += record.children.size();
+                paths::PathTable& table = totals.table();
+                if (!record.largest_name.empty()
+                    && (record.largest_size > local.largest_file_size
+                        || (record.largest_size == local.largest_file_size && local.largest_file != paths::kNoNode
+                            && table.less(dir.id, record.largest_name, local.largest_file)))) {
+                    paths::NodeId file = table.add(worker, dir.id, record.largest_name);
+                    if (file != paths::kNoNode) {
+                        local.largest_file_size = record.largest_size;
+                        local.largest_file = file;
+                    }
+                }
+                for (const auto& [ext, count] : record.extensions) local.extensions[ext] += count;
+                children.swap(record.children);
+                state.reused_ids.push_back(id);
+                return true;
+            }
+
+            state.current = dirindex::DirRecord{};
+            state.current.id = id;
+            state.active = true;
+            state.read++;
+            return false;
+        };
+        hooks.on_file = [&](unsigned worker, const walker::Entry& entry, uint64_t size) {
+            IndexState& state = index_state[worker];
+            if (!state.active) return;
+            dirindex::DirRecord& record = state.current;
+            record.files++;
+            record.size += size;
+            if (record.largest_name.empty() || size > record.largest_size
+                || (size == record.largest_size && entry.name < record.largest_name)) {
+                record.largest_size = size;
+                record.largest_name = entry.name;
+            }
+            record.extensions[extensions::key(entry.name)]++;
+            record.stamps.push_back(
+                dirindex::FileStamp{std::string(entry.name), size, entry.mtime, entry.mtime_nsec});
+        };
+        hooks.on_dir = [&](unsigned worker, const walker::Entry& entry) {
+            IndexState& state = index_state[worker];
+            if (state.active) state.current.children.emplace_back(entry.name);
+        };
+        hooks.on_leave_dir = [&](unsigned worker, const walker::Dir&) {
+            IndexState& state = index_state[worker];
+            if (!state.active) return;
+            state.records.push_back(std::move(state.current));
+            state.active = false;
+        };
+    }
+
+    // The previous run's directory count is what the progress ETA goes by
+    progress::expect(previous.size());
+    report_io(walk, scan.run(!json_output).walk);
+    progress::expect(0);
+
+    uint64_t reused_dirs = 0;
+    uint64_t read_dirs = 0;
+    if (use_index) {
+        profile::Phase phase("index save");
+        for (const auto& state : index_state) {
+            reused_dirs += state.reused_ids.size();
+            read_dirs += state.read;
+        }
+        bool saved = true;
+        if (read_dirs > 0 || !loaded) {
+            std::vector<dirindex::DirRecord> records;
+            for (auto& state : index_state) {
+                std::move(state.records.begin(), state.records.end(), std::back_inserter(records));
+                for (const auto& id : state.reused_ids) {
+                    records.emplace_back();
+                    previous.find(id, records.back());
+                }
+            }
+            saved = dirindex::save(index_file, index_options, records);
+        }
+        if (!saved) {
+            std::cerr << colors::yellow("[!]") << " Could not write index: " << index_file.string() << std::endl;
+        } else if (!json_output) {
+            std::cerr << colors::dim("[i] index: reused " + std::to_string(reused_dirs) + " directories, read "
+                                     + std::to_string(read_dirs)) << std::endl;
+        }
+    }
     
     if (json_output) {
-        std::cout << "{\n";
-        std::cout << "  \"path\": \"" << abs_path.string() << "\",\n";
-        std::cout << "  \"files\": " << stats.total_files << ",\n";
-        std::cout << "  \"directories\": " << stats.total_dirs << ",\n";
-        std::cout << "  \"total_size\": " << stats.total_size << ",\n";
-        std::cout << "  \"total_size_human\": \"" << format_size(stats.total_size) << "\",\n";
-        if (stats.largest_file_path.has_value()) {
-            std::cout << "  \"largest_file\": {\n";
-            std::cout << "    \"path\": \"" << stats.largest_file_path.value().string() << "\",\n";
-            std::cout << "    \"size\": " << stats.largest_file_size << ",\n";
-            std::cout << "    \"size_human\": \"" << format_size(stats.largest_file_size) << "\"\n";
-            std::cout << "  },\n";
-        }
-        std::cout << "  \"extensions\": {\n";
-        bool first = true;
-        for (const auto& [ext, count] : stats.extensions) {
-            if (!first) std::cout << ",\n";
-            std::cout << "    \"" << ext << "\": " << count;
-            first = false;
+        out << "{\n";
+        {
+            profile::Phase phase("output");
+            out << "  \"path\": " << output::quoted(abs_path.string()) << ",\n";
+            totals.write_json(out, abs_path, "  ");
+            if (use_index) {
+                out << ",\n  \"index\": {\"reused_dirs\": " << reused_dirs
+                          << ", \"read_dirs\": " << read_dirs << "}";
+            }
         }
-        std::cout << "\n  }\n";
-        std::cout << "}" << std::endl;
+        end_json(out);
     } else {
-        display::show_stats(stats, abs_path);
+        profile::Phase phase("output");
+        totals.print(abs_path);
     }
+    out.flush();
 }
 
-void find_largest_files(const fs::path& path, size_t count, bool show_hidden, const std::vector<std::string>& exclude, bool json_output) {
-    std::error_code ec;
-    fs::path abs_path = fs::absolute(path, ec);
+void find_largest_files(const fs::path& path, size_t count, const walker::Options& walk,
+                        output::Format format) {
+    fs::path abs_path;
+    if (!resolve_root(path, format, abs_path)) return;
     
-    if (!fs::exists(abs_path, ec)) {
-        if (json_output) {
-            std::cout << "{\"error\": \"Cannot access path\"}" << std::endl;
-        } else {
-            std::cerr << colors::red("[X]") << " Cannot access path: " << path << std::endl;
-        }
-        return;
+    output::Writer& out = output::out();
+    if (format == output::Format::Text) {
+        out << colors::yellow("[>]") << " Finding " << colors::green(std::to_string(count)) 
+            << " largest files in: " << colors::cyan(abs_path.string()) << '\n';
+        out << colors::dim("    Scanning files...") << '\n';
+        out.flush();
     }
     
-    if (!json_output) {
-        std::cout << colors::yellow("[>]") << " Finding " << colors::green(std::to_string(count)) 
-                  << " largest files in: " << colors::cyan(abs_path.string()) << std::endl;
-        std::cout << colors::dim("    Scanning files...") << std::endl;
-    }
+    walker::Options opts = walk;
+    opts.max_depth = 0;
     
-    std::vector<std::pair<uint64_t, fs::path>> files;
+    dirstat::Scan scan(abs_path, opts);
+    collectors::Largest& largest = scan.largest(count);
+    report_io(opts, scan.run(format == output::Format::Text).walk);
     
-    std::function<void(const fs::path&)> collect_files = [&](const fs::path& dir) {
-        std::error_code ec;
-        for (const auto& entry : fs::directory_iterator(dir, fs::directory_options::skip_permission_denied, ec)) {
-            if (should_skip(entry, show_hidden, exclude)) continue;
-            
-            if (entry.is_regular_file(ec)) {
-                uint64_t size = entry.file_size(ec);
-                if (!ec) {
-                    files.emplace_back(size, entry.path());
-                }
-            } else if (entry.is_directory(ec)) {
-                collect_files(entry.path());
-            }
-        }
-    };
+    if (format == output::Format::Ndjson) {
+        profile::Phase phase("output");
+        largest.write_records(out);
+    } else if (format == output::Format::Json) {
+        print_json(largest, abs_path);
+    } else {
+        profile::Phase phase("output");
+        largest.print(abs_path);
+    }
+    out.flush();
+}
+
+void find_largest_dirs(const fs::path& path, size_t count, const walker::Options& walk,
+                       output::Format format) {
+    fs::path abs_path;
+    if (!resolve_root(path, format, abs_path)) return;
     
-    collect_files(abs_path);
+    output::Writer& out = output::out();
+    if (format == output::Format::Text) {
+        out << colors::yellow("[>]") << " Finding " << colors::green(std::to_string(count)) 
+            << " largest directories in: " << colors::cyan(abs_path.string()) << '\n';
+        out << colors::dim("    Scanning files...") << '\n';
+        out.flush();
+    }
     
-    std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
-        return a.first > b.first;
-    });
+    walker::Options opts = walk;
+    opts.max_depth = 0;
     
-    if (json_output) {
-        std::cout << "{\n  \"largest_files\": [\n";
-        for (size_t i = 0; i < std::min(count, files.size()); ++i) {
-            const auto& [size, file_path] = files[i];
-            fs::path relative = fs::relative(file_path, abs_path, ec);
-            if (ec) relative = file_path;
-            
-            std::cout << "    {\"path\": \"" << relative.string() << "\", \"size\": " << size 
-                      << ", \"size_human\": \"" << format_size(size) << "\"}";
-            if (i < std::min(count, files.size()) - 1) std::cout << ",";
-            std::cout << "\n";
-        }
-        std::cout << "  ]\n}" << std::endl;
+    dirstat::Scan scan(abs_path, opts);
+    collectors::DirSizes& dirs = scan.dir_sizes(count);
+    report_io(opts, scan.run(format == output::Format::Text).walk);
+    
+    if (format == output::Format::Ndjson) {
+        profile::Phase phase("output");
+        dirs.write_records(out);
+    } else if (format == output::Format::Json) {
+        print_json(dirs, abs_path);
     } else {
-        std::cout << std::endl;
-        std::cout << colors::bold_cyan("[*] Largest Files:") << std::endl;
-        std::cout << colors::dim(std::string(60, '-')) << std::endl;
-        
-        for (size_t i = 0; i < std::min(count, files.size()); ++i) {
-            const auto& [size, file_path] = files[i];
-            fs::path relative = fs::relative(file_path, abs_path, ec);
-            if (ec) relative = file_path;
-            
-            std::cout << colors::yellow(std::to_string(i + 1) + ".") << " "
-                      << colors::bold_green(format_size(size)) << " "
-                      << colors::white(relative.string()) << std::endl;
-        }
-        
-        if (files.empty()) {
-            std::cout << colors::dim("  No files found.") << std::endl;
-        }
+        profile::Phase phase("output");
+        dirs.print(abs_path);
     }
+    out.flush();
 }
 
-void find_duplicates(const fs::path& path, uint64_t min_size, const std::vector<std::string>& exclude, bool json_output) {
-    std::error_code ec;
-    fs::path abs_path = fs::absolute(path, ec);
-    
-    if (!fs::exists(abs_path, ec)) {
-        if (json_output) {
-            std::cout << "{\"error\": \"Cannot access path\"}" << std::endl;
-        } else {
-            std::cerr << colors::red("[X]") << " Cannot access path: " << path << std::endl;
-        }
-        return;
-    }
+void find_duplicates(const fs::path& path, uint64_t min_size, const walker::Options& walk,
+                     output::Format format, uint64_t mem_limit, const fs::path& cache_file) {
+    fs::path abs_path;
+    if (!resolve_root(path, format, abs_path)) return;
     
-    if (!json_output) {
-        std::cout << colors::yellow("[>]") << " Finding potential duplicates (min size: " 
-                  << colors::green(format_size(min_size)) << ")" << std::endl;
-        std::cout << colors::dim("    Scanning files...") << std::endl;
+    output::Writer& out = output::out();
+    if (format == output::Format::Text) {
+        out << colors::yellow("[>]") << " Finding duplicates (min size: " 
+            << colors::green(format_size(min_size)) << ")" << '\n';
+        out << colors::dim("    Scanning files...") << '\n';
+        out.flush();
     }
     
-    std::map<uint64_t, std::vector<fs::path>> size_map;
+    walker::Options opts = walk;
+    opts.show_hidden = false;
+    opts.max_depth = 0;
     
-    std::function<void(const fs::path&)> collect_files = [&](const fs::path& dir) {
-        std::error_code ec;
-        for (const auto& entry : fs::directory_iterator(dir, fs::directory_options::skip_permission_denied, ec)) {
-            if (should_skip(entry, false, exclude)) continue;
-            
-            if (entry.is_regular_file(ec)) {
-                uint64_t size = entry.file_size(ec);
-                if (!ec && size >= min_size) {
-                    size_map[size].push_back(entry.path());
-                }
-            } else if (entry.is_directory(ec)) {
-                collect_files(entry.path());
-            }
-        }
-    };
+    dirstat::Scan scan(abs_path, opts);
+    collectors::Dupes& dupes = scan.dupes(min_size, mem_limit);
+    if (format == output::Format::Ndjson) dupes.stream(&out);
+    hashcache::Cache cache;
+    use_cache(dupes, cache, cache_file);
+    report_io(opts, scan.run(format == output::Format::Text).walk);
+    report_dupes_error(dupes);
+    save_cache(cache, cache_file, format);
     
-    collect_files(abs_path);
+    if (format == output::Format::Ndjson) {
+        profile::Phase phase("output");
+        dupes.write_records(out);
+    } else if (format == output::Format::Json) {
+        print_json(dupes, abs_path);
+    } else {
+        profile::Phase phase("output");
+        dupes.print(abs_path);
+    }
+    out.flush();
+}
+
+void show_file_types(const fs::path& path, size_t count, const walker::Options& walk,
+                     output::Format format) {
+    fs::path abs_path;
+    if (!resolve_root(path, format, abs_path)) return;
     
-    std::vector<std::pair<uint64_t, std::vector<fs::path>>> duplicates;
-    for (auto& [size, paths] : size_map) {
-        if (paths.size() > 1) {
-            duplicates.emplace_back(size, std::move(paths));
-        }
+    output::Writer& out = output::out();
+    const bool json_output = format != output::Format::Text;
+    if (!json_output) {
+        out << colors::yellow("[>]") << " Analyzing file types in: " 
+            << colors::cyan(abs_path.string()) << '\n';
+        out << colors::dim("    Scanning files...") << '\n';
+        out.flush();
     }
     
-    std::sort(duplicates.begin(), duplicates.end(), [](const auto& a, const auto& b) {
-        return a.first > b.first;
-    });
+    walker::Options opts = walk;
+    opts.show_hidden = false;
+    opts.max_depth = 0;
+    
+    dirstat::Scan scan(abs_path, opts);
+    collectors::Types& types = scan.types(count);
+    report_io(opts, scan.run(!json_output).walk);
     
     if (json_output) {
-        std::cout << "{\n  \"potential_duplicates\": [\n";
-        size_t shown = 0;
-        for (const auto& [size, paths] : duplicates) {
-            if (shown++ >= 10) break;
-            std::cout << "    {\"size\": " << size << ", \"size_human\": \"" << format_size(size) << "\", \"files\": [";
-            for (size_t i = 0; i < paths.size(); ++i) {
-                fs::path relative = fs::relative(paths[i], abs_path, ec);
-                if (ec) relative = paths[i];
-                std::cout << "\"" << relative.string() << "\"";
-                if (i < paths.size() - 1) std::cout << ", ";
-            }
-            std::cout << "]}";
-            if (shown < std::min(size_t(10), duplicates.size())) std::cout << ",";
-            std::cout << "\n";
-        }
-        std::cout << "  ]\n}" << std::endl;
+        print_json(types, abs_path);
+    } else {
+        profile::Phase phase("output");
+        types.print(abs_path);
+    }
+    out.flush();
+}
+
+void show_size_histogram(const fs::path& path, const std::vector<uint64_t>& bounds, bool by_ext, size_t count,
+                         const walker::Options& walk, output::Format format) {
+    fs::path abs_path;
+    if (!resolve_root(path, format, abs_path)) return;
+
+    output::Writer& out = output::out();
+    if (format == output::Format::Text) {
+        out << colors::yellow("[>]") << " File sizes in: " << colors::cyan(abs_path.string()) << '\n';
+        out << colors::dim("    Scanning files...") << '\n';
+        out.flush();
+    }
+
+    walker::Options opts = walk;
+    opts.max_depth = 0;
+
+    dirstat::Scan scan(abs_path, opts);
+    collectors::Sizes& sizes = scan.sizes(bounds, by_ext, count);
+    report_io(opts, scan.run(format == output::Format::Text).walk);
+
+    if (format == output::Format::Ndjson) {
+        profile::Phase phase("output");
+        sizes.write_records(out);
+    } else if (format == output::Format::Json) {
+        print_json(sizes, abs_path);
     } else {
-        std::cout << std::endl;
-        std::cout << colors::bold_cyan("[*] Potential Duplicates (same size):") << std::endl;
-        std::cout << colors::dim(std::string(60, '-')) << std::endl;
-        
-        if (duplicates.empty()) {
-            std::cout << colors::dim("  No potential duplicates found.") << std::endl;
-            return;
+        profile::Phase phase("output");
+        sizes.print(abs_path);
+    }
+    out.flush();
+}
+
+namespace {
+
+extern "C" void on_estimate_interrupt(int) {
+    estimate::stop();
+}
+
+uint64_t rounded(double value) {
+    return static_cast<uint64_t>(std::llround(value));
+}
+
+std::string fixed(double value, int digits) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+    return buffer;
+}
+
+std::string percent(double fraction) {
+    return fixed(fraction * 100, 1) + "%";
+}
+
+// "~12.3K (11.9K - 12.7K, ±3.1%)"
+std::string describe(const estimate::Interval& i, std::string (*format)(uint64_t)) {
+    return "~" + format(rounded(i.value)) + " (" + format(rounded(i.low)) + " - " + format(rounded(i.high))
+         + ", ±" + percent(i.relative()) + ")";
+}
+
+std::string status_line(const estimate::Result& r) {
+    return "[~] ~" + format_count(rounded(r.files.value)) + " files ±" + percent(r.files.relative()) + ", ~"
+         + format_size(rounded(r.bytes.value)) + " ±" + percent(r.bytes.relative()) + ", "
+         + std::to_string(r.probes) + " probes, " + fixed(r.seconds, 0) + "s";
+}
+
+void write_interval(output::Writer& out, const char* name, const estimate::Interval& i) {
+    out << '"' << name << "\": {\"value\": " << rounded(i.value) << ", \"low\": " << rounded(i.low)
+        << ", \"high\": " << rounded(i.high) << '}';
+}
+
+void interval_fields(output::Record& record, const std::string& name, const estimate::Interval& i) {
+    record.field(name, rounded(i.value)).field(name + "_low", rounded(i.low)).field(name + "_high", rounded(i.high));
+}
+
+void write_estimate_record(output::Writer& out, const estimate::Result& r, bool final) {
+    output::Record record(out, "estimate");
+    record.field("probes", r.probes).field("dirs_read", r.dirs_read);
+    record.key("seconds") << fixed(r.seconds, 2);
+    interval_fields(record, "files", r.files);
+    interval_fields(record, "directories", r.dirs);
+    interval_fields(record, "total_size", r.bytes);
+    record.key("converged") << (r.converged ? "true" : "false");
+    record.key("final") << (final ? "true" : "false");
+}
+
+} // namespace
+
+void estimate_directory(const fs::path& path, const estimate::Options& opts, const walker::Options& walk,
+                        output::Format format) {
+    fs::path abs_path;
+    if (!resolve_root(path, format, abs_path)) return;
+
+    output::Writer& out = output::out();
+    if (format == output::Format::Text) {
+        out << colors::yellow("[>]") << " Estimating: " << colors::cyan(abs_path.string()) << '\n';
+        std::string budget = opts.time_budget > 0 ? "up to " + fixed(opts.time_budget, 0) + " s" : "until converged";
+        out << colors::dim("    Sampling directories " + budget + " (Ctrl-C to stop early)...") << '\n';
+        out.flush();
+    }
+
+    auto previous = std::signal(SIGINT, on_estimate_interrupt);
+    estimate::Result result;
+    bool ok = estimate::run(abs_path, walk, opts, result, [&](const estimate::Result& now) {
+        progress::status(status_line(now));
+        if (format == output::Format::Ndjson) write_estimate_record(out, now, false);
+    });
+    std::signal(SIGINT, previous);
+    progress::clear_status();
+
+    if (!ok) {
+        if (format != output::Format::Text) {
+            out << "{\"error\": \"Cannot read directory\"}\n";
+            out.flush();
+        } else {
+            std::cerr << colors::red("[X]") << " Cannot read directory: " << path << std::endl;
         }
-        
-        size_t shown = 0;
-        for (const auto& [size, paths] : duplicates) {
-            if (shown++ >= 10) break;
-            
-            std::cout << std::endl;
-            std::cout << colors::bold_green(format_size(size)) << " (" 
-                      << colors::yellow(std::to_string(paths.size())) << " files):" << std::endl;
-            
-            size_t file_shown = 0;
-            for (const auto& p : paths) {
-                if (file_shown++ >= 5) {
-                    std::cout << colors::dim("    ... and " + std::to_string(paths.size() - 5) + " more...") << std::endl;
-                    break;
-                }
-                fs::path relative = fs::relative(p, abs_path, ec);
-                if (ec) relative = p;
-                std::cout << "    " << colors::white(relative.string()) << std::endl;
+        return;
+    }
+
+    profile::Phase phase("output");
+    if (format == output::Format::Ndjson) {
+        for (const auto& ext : result.extensions) {
+            output::Record record(out, "estimate_extension");
+            record.field("extension", ext.name);
+            interval_fields(record, "files", ext.files);
+            interval_fields(record, "bytes", ext.bytes);
+            record.key("share") << fixed(ext.share.value, 4);
+            record.key("share_low") << fixed(ext.share.low, 4);
+            record.key("share_high") << fixed(ext.share.high, 4);
+        }
+        write_estimate_record(out, result, true);
+    } else if (format == output::Format::Json) {
+        out << "{\n";
+        out << "  \"path\": " << output::quoted(abs_path.string()) << ",\n";
+        out << "  \"estimate\": {\n";
+        out << "    \"confidence\": 0.95,\n";
+        out << "    \"probes\": " << result.probes << ",\n";
+        out << "    \"dirs_read\": " << result.dirs_read << ",\n";
+        out << "    \"seconds\": " << fixed(result.seconds, 2) << ",\n";
+        out << "    \"converged\": " << (result.converged ? "true" : "false") << ",\n";
+        out << "    ";
+        write_interval(out, "files", result.files);
+        out << ",\n    ";
+        write_interval(out, "directories", result.dirs);
+        out << ",\n    ";
+        write_interval(out, "total_size", result.bytes);
+        out << ",\n    \"extensions\": [";
+        for (size_t i = 0; i < result.extensions.size(); ++i) {
+            const auto& ext = result.extensions[i];
+            out << (i ? ",\n" : "\n") << "      {\"extension\": " << output::quoted(ext.name) << ", ";
+            write_interval(out, "files", ext.files);
+            out << ", ";
+            write_interval(out, "bytes", ext.bytes);
+            out << ", \"share\": {\"value\": " << fixed(ext.share.value, 4) << ", \"low\": "
+                << fixed(ext.share.low, 4) << ", \"high\": " << fixed(ext.share.high, 4) << "}}";
+        }
+        out << (result.extensions.empty() ? "]\n" : "\n    ]\n") << "  }";
+        end_json(out);
+    } else {
+        out << '\n';
+        out << colors::bold_cyan("[*] Estimated Statistics (95% confidence)") << '\n';
+        out << colors::dim(std::string(50, '-')) << '\n';
+        out << "  " << colors::white("Path:") << " " << colors::cyan(abs_path.string()) << '\n';
+        out << "  " << colors::white("Files:") << " " << colors::bold_green(describe(result.files, format_count))
+            << '\n';
+        out << "  " << colors::white("Directories:") << " " << colors::yellow(describe(result.dirs, format_count))
+            << '\n';
+        out << "  " << colors::white("Total Size:") << " " << colors::bold_green(describe(result.bytes, format_size))
+            << '\n';
+
+        if (!result.extensions.empty()) {
+            out << '\n';
+            out << colors::bold_cyan("[*] Top File Types by Size:") << '\n';
+            for (const auto& ext : result.extensions) {
+                std::string label = ext.name == "(no ext)" ? ext.name : "." + ext.name;
+                if (label.size() < 12) label.resize(12, ' ');
+                std::string files = "~" + format_count(rounded(ext.files.value)) + " files";
+                std::string size = "~" + format_size(rounded(ext.bytes.value));
+                if (files.size() < 14) files.resize(14, ' ');
+                if (size.size() < 12) size.resize(12, ' ');
+                out << "    " << colors::cyan(label) << colors::yellow(files) << colors::green(size)
+                    << percent(ext.share.value) << colors::dim(" ±" + percent(ext.share.relative() * ext.share.value))
+                    << '\n';
             }
         }
+
+        out << '\n';
+        std::string basis = std::to_string(result.probes) + " probes, " + std::to_string(result.dirs_read)
+                          + " directory listings, " + fixed(result.seconds, 1) + " s";
+        out << colors::dim("  Based on " + basis + (result.converged ? "; converged" : "; stopped before converging"))
+            << '\n';
+        out << colors::dim(std::string(50, '-')) << '\n';
+        out << colors::green("[OK] Estimate complete!") << '\n';
     }
+    out.flush();
 }
 
-void show_file_types(const fs::path& path, size_t count, const std::vector<std::string>& exclude, bool json_output) {
-    std::error_code ec;
-    fs::path abs_path = fs::absolute(path, ec);
-    
-    if (!fs::exists(abs_path, ec)) {
-        if (json_output) {
-            std::cout << "{\"error\": \"Cannot access path\"}" << std::endl;
+void write_snapshot(const fs::path& path, const fs::path& file, const walker::Options& walk,
+                    output::Format format) {
+    fs::path abs_path;
+    if (!resolve_root(path, format, abs_path)) return;
+
+    output::Writer& out = output::out();
+    if (format == output::Format::Text) {
+        out << colors::yellow("[>]") << " Snapshot of: " << colors::cyan(abs_path.string()) << '\n';
+        out << colors::dim("    Scanning files...") << '\n';
+        out.flush();
+    }
+
+    snapshot::Summary summary;
+    if (!snapshot::write(abs_path, walk, file, summary)) {
+        if (format != output::Format::Text) {
+            out << "{\"error\": " << output::quoted("Cannot write snapshot: " + file.string()) << "}\n";
+            out.flush();
         } else {
-            std::cerr << colors::red("[X]") << " Cannot access path: " << path << std::endl;
+            std::cerr << colors::red("[X]") << " Cannot write snapshot: " << file << std::endl;
         }
         return;
     }
-    
-    if (!json_output) {
-        std::cout << colors::yellow("[>]") << " Analyzing file types in: " 
-                  << colors::cyan(abs_path.string()) << std::endl;
-        std::cout << colors::dim("    Scanning files...") << std::endl;
+
+    profile::Phase phase("output");
+    if (format == output::Format::Ndjson) {
+        output::Record(out, "snapshot")
+            .field("file", file.string())
+            .field("root", abs_path.string())
+            .field("dirs", summary.dirs)
+            .field("files", summary.files)
+            .field("size", summary.size)
+            .field("bytes", summary.bytes);
+    } else if (format == output::Format::Json) {
+        out << "{\n";
+        out << "  \"file\": " << output::quoted(file.string()) << ",\n";
+        out << "  \"root\": " << output::quoted(abs_path.string()) << ",\n";
+        out << "  \"dirs\": " << summary.dirs << ",\n";
+        out << "  \"files\": " << summary.files << ",\n";
+        out << "  \"size\": " << summary.size << ",\n";
+        out << "  \"bytes\": " << summary.bytes;
+        end_json(out);
+    } else {
+        out << '\n';
+        out << colors::green("[OK]") << " Wrote " << colors::cyan(file.string()) << ": "
+            << std::to_string(summary.dirs) << " directories, " << std::to_string(summary.files) << " files, "
+            << format_size(summary.size) << " in " << colors::bold_green(format_size(summary.bytes)) << '\n';
     }
+    out.flush();
+}
+
+void compact_cache(const fs::path& file, output::Format format) {
+    output::Writer& out = output::out();
+    hashcache::Compaction result;
+    bool ok;
+    {
+        profile::Phase phase("compact");
+        ok = hashcache::compact(file, result);
+    }
+    if (!ok) {
+        std::string error = "Not a hash cache or cannot rewrite it: " + file.string();
+        if (format != output::Format::Text) {
+            out << "{\"error\": " << output::quoted(error) << "}\n";
+            out.flush();
+        } else {
+            std::cerr << colors::red("[X]") << " " << error << std::endl;
+        }
+        return;
+    }
+
+    if (format == output::Format::Ndjson) {
+        output::Record(out, "compact")
+            .field("file", file.string())
+            .field("records_before", result.records_before)
+            .field("records_after", result.records_after)
+            .field("bytes_before", result.bytes_before)
+            .field("bytes_after", result.bytes_after);
+    } else if (format == output::Format::Json) {
+        out << "{\n";
+        out << "  \"file\": " << output::quoted(file.string()) << ",\n";
+        out << "  \"records_before\": " << result.records_before << ",\n";
+        out << "  \"records_after\": " << result.records_after << ",\n";
+        out << "  \"bytes_before\": " << result.bytes_before << ",\n";
+        out << "  \"bytes_after\": " << result.bytes_after;
+        end_json(out);
+    } else {
+        out << colors::green("[OK]") << " Compacted " << colors::cyan(file.string()) << ": "
+            << std::to_string(result.records_before) << " records -> " << std::to_string(result.records_after)
+            << ", " << format_size(result.bytes_before) << " -> " << colors::bold_green(format_size(result.bytes_after))
+            << '\n';
+    }
+    out.flush();
+}
+
+void diff_snapshots(const fs::path& before, const fs::path& after, size_t count, int max_depth,
+                    output::Format format) {
+    output::Writer& out = output::out();
+    if (format == output::Format::Text) {
+        out << colors::yellow("[>]") << " Comparing " << colors::cyan(before.string()) << " -> "
+            << colors::cyan(after.string()) << '\n';
+        out.flush();
+    }
+
+    snapshot::Diff diff(count, max_depth);
+    std::string error;
+    if (!diff.run(before, after, error)) {
+        if (format != output::Format::Text) {
+            out << "{\"error\": " << output::quoted(error) << "}\n";
+            out.flush();
+        } else {
+            std::cerr << colors::red("[X]") << " " << error << std::endl;
+        }
+        return;
+    }
+
+    if (format == output::Format::Ndjson) {
+        profile::Phase phase("output");
+        diff.write_records(out);
+    } else if (format == output::Format::Json) {
+        out << "{\n";
+        {
+            profile::Phase phase("output");
+            diff.write_json(out, "  ");
+        }
+        end_json(out);
+    } else {
+        profile::Phase phase("output");
+        diff.print();
+    }
+    out.flush();
+}
+
+void run_report(const fs::path& path, const std::vector<std::string>& sections, size_t count,
+                uint64_t min_size, const std::vector<uint64_t>& bounds, bool by_ext,
+                const walker::Options& walk, output::Format format, uint64_t mem_limit,
+                const fs::path& cache_file) {
+    fs::path abs_path;
+    if (!resolve_root(path, format, abs_path)) return;
     
-    std::map<std::string, std::pair<uint64_t, uint64_t>> ext_stats;
-    
-    std::function<void(const fs::path&)> analyze = [&](const fs::path& dir) {
-        std::error_code ec;
-        for (const auto& entry : fs::directory_iterator(dir, fs::directory_options::skip_permission_denied, ec)) {
-            if (should_skip(entry, false, exclude)) continue;
-            
-            if (entry.is_regular_file(ec)) {
-                uint64_t size = entry.file_size(ec);
-                if (!ec) {
-                    std::string ext = entry.path().extension().string();
-                    if (ext.empty()) {
-                        ext = "(no ext)";
-                    } else {
-                        ext = ext.substr(1);
-                        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-                    }
-                    ext_stats[ext].first++;
-                    ext_stats[ext].second += size;
-                }
-            } else if (entry.is_directory(ec)) {
-                analyze(entry.path());
-            }
+    dirstat::Scan scan(abs_path, walk);
+    std::vector<const collectors::Collector*> list;
+    for (const auto& section : sections) {
+        if (section == "scan") {
+            list.push_back(&scan.totals());
+        } else if (section == "large") {
+            list.push_back(&scan.largest(count));
+        } else if (section == "types") {
+            list.push_back(&scan.types(count));
+        } else if (section == "dupes") {
+            list.push_back(&scan.dupes(min_size, mem_limit));
+        } else if (section == "sizes") {
+            list.push_back(&scan.sizes(bounds, by_ext, count));
         }
-    };
+    }
     
-    analyze(abs_path);
+    output::Writer& out = output::out();
+    const bool json_output = format != output::Format::Text;
+    if (!json_output) {
+        out << colors::yellow("[>]") << " Building report for: " << colors::cyan(abs_path.string()) << '\n';
+        out << colors::dim("    Scanning files (" + std::to_string(list.size()) + " reports, one pass)...")
+            << '\n';
+        out.flush();
+    }
     
-    std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>> sorted(
-        ext_stats.begin(), ext_stats.end());
-    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
-        return a.second.second > b.second.second;
-    });
+    const bool dupes = std::find(sections.begin(), sections.end(), "dupes") != sections.end();
+    hashcache::Cache cache;
+    if (dupes) use_cache(scan.dupes(min_size, mem_limit), cache, cache_file);
+    report_io(walk, scan.run(!json_output).walk);
+    if (dupes) {
+        report_dupes_error(scan.dupes(min_size, mem_limit));
+        save_cache(cache, cache_file, format);
+    }
     
     if (json_output) {
-        std::cout << "{\n  \"file_types\": [\n";
-        for (size_t i = 0; i < std::min(count, sorted.size()); ++i) {
-            const auto& [ext, data] = sorted[i];
-            const auto& [file_count, total_size] = data;
-            std::cout << "    {\"extension\": \"" << ext << "\", \"count\": " << file_count 
-                      << ", \"total_size\": " << total_size << ", \"total_size_human\": \"" 
-                      << format_size(total_size) << "\"}";
-            if (i < std::min(count, sorted.size()) - 1) std::cout << ",";
-            std::cout << "\n";
+        out << "{\n";
+        {
+            profile::Phase phase("output");
+            out << "  \"path\": " << output::quoted(abs_path.string());
+            for (const auto* c : list) {
+                out << ",\n  " << output::quoted(c->name()) << ": {\n";
+                c->write_json(out, abs_path, "    ");
+                out << "\n  }";
+            }
         }
-        std::cout << "  ]\n}" << std::endl;
+        end_json(out);
     } else {
-        std::cout << std::endl;
-        std::cout << colors::bold_cyan("[*] File Types by Size:") << std::endl;
-        std::cout << colors::dim(std::string(60, '-')) << std::endl;
-        
-        printf("%s%-12s %10s %12s%s\n", 
-               colors::BOLD_WHITE.c_str(), "Extension", "Count", "Total Size", colors::RESET.c_str());
-        std::cout << colors::dim(std::string(60, '-')) << std::endl;
-        
-        for (size_t i = 0; i < std::min(count, sorted.size()); ++i) {
-            const auto& [ext, data] = sorted[i];
-            const auto& [file_count, total_size] = data;
-            
-            std::cout << colors::cyan("." + ext);
-            for (size_t j = ext.length() + 1; j < 12; ++j) std::cout << ' ';
-            
-            std::string count_str = std::to_string(file_count);
-            for (size_t j = count_str.length(); j < 10; ++j) std::cout << ' ';
-            std::cout << colors::yellow(count_str);
-            
-            std::string size_str = format_size(total_size);
-            for (size_t j = size_str.length(); j < 12; ++j) std::cout << ' ';
-            std::cout << colors::green(size_str) << std::endl;
-        }
+        profile::Phase phase("output");
+        for (const auto* c : list) c->print(abs_path);
     }
+    out.flush();
 }
 
 } // namespace scanner
@@ -1,4 +1,7 @@
 #pragma once
+#include "walker.hpp"
+#include "output.hpp"
+#include "estimate.hpp"
 #include <filesystem>
 #include <cstdint>
 #include <vector>
@@ -8,13 +11,48 @@ namespace fs = std::filesystem;
 
 namespace scanner {
 
-void scan_directory(const fs::path& path, bool show_hidden, int max_depth, 
-                   const std::vector<std::string>& exclude, bool json_output);
-void find_largest_files(const fs::path& path, size_t count, bool show_hidden,
-                       const std::vector<std::string>& exclude, bool json_output);
-void find_duplicates(const fs::path& path, uint64_t min_size,
-                    const std::vector<std::string>& exclude, bool json_output);
-void show_file_types(const fs::path& path, size_t count,
-                    const std::vector<std::string>& exclude, bool json_output);
+// index_file: when not empty, reuse and refresh a persistent scan index.
+// index_verify: also stat every file of a directory before reusing it
+void scan_directory(const fs::path& path, const walker::Options& walk, output::Format format,
+                    const fs::path& index_file = {}, bool index_verify = false);
+// Ndjson streams a record per file
+void find_largest_files(const fs::path& path, size_t count, const walker::Options& walk,
+                        output::Format format);
+// Directories ranked by the total size of everything below them
+void find_largest_dirs(const fs::path& path, size_t count, const walker::Options& walk,
+                       output::Format format);
+// mem_limit: when not 0, bound memory with sorted run files (see
+// collectors::Dupes). cache_file: when not empty, reuse and extend a
+// persistent hash cache. Ndjson streams a record per group.
+void find_duplicates(const fs::path& path, uint64_t min_size, const walker::Options& walk,
+                     output::Format format, uint64_t mem_limit = 0, const fs::path& cache_file = {});
+void show_file_types(const fs::path& path, size_t count, const walker::Options& walk,
+                     output::Format format);
+// File-size histogram; bounds: bucket limits (empty = powers of two),
+// by_ext: also one histogram for each of the `count` commonest extensions
+void show_size_histogram(const fs::path& path, const std::vector<uint64_t>& bounds, bool by_ext, size_t count,
+                         const walker::Options& walk, output::Format format);
+// Totals and the `opts.count` biggest extensions estimated from random
+// probes, with confidence intervals; Ctrl-C ends the sampling early.
+// Ndjson also streams the estimate so far about once a second.
+void estimate_directory(const fs::path& path, const estimate::Options& opts, const walker::Options& walk,
+                        output::Format format);
+
+// Walk the tree and write its snapshot to `file`
+void write_snapshot(const fs::path& path, const fs::path& file, const walker::Options& walk,
+                    output::Format format);
+// Directories and extensions that changed most between two snapshots;
+// directories deeper than max_depth aren't ranked (0 = all)
+void diff_snapshots(const fs::path& before, const fs::path& after, size_t count, int max_depth,
+                    output::Format format);
+// Fold a hash cache's log into its base, one record per inode
+void compact_cache(const fs::path& file, output::Format format);
+
+// Several of the reports above (by command name: scan, large, types,
+// dupes, sizes) from a single traversal. Every section sees the same options.
+void run_report(const fs::path& path, const std::vector<std::string>& sections, size_t count,
+                uint64_t min_size, const std::vector<uint64_t>& bounds, bool by_ext,
+                const walker::Options& walk, output::Format format, uint64_t mem_limit = 0,
+                const fs::path& cache_file = {});
 
 } // namespace scanner
@@ -0,0 +1,603 @@
+#include "snapshot.hpp"
+#include "collectors.hpp"
+#include "dirstat.hpp"
+#include "colors.hpp"
+#include "extensions.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace snapshot {
+
+namespace {
+
+constexpr char kMagic[8] = {'D', 'S', 'T', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t kVersion = 1;
+
+// On-disk layout: header, root path, then the columns back to back:
+// kind bitmap (bit set = directory), paths as (shared prefix with the
+// previous path, suffix length, suffix), sizes, mtimes as zigzag deltas
+// from the previous entry, and file counts of directories. Every number
+// after the header is a LEB128 varint.
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t created;
+    uint64_t entries;
+    uint64_t files;
+    uint64_t size;
+    uint64_t root_bytes;
+    uint64_t column_bytes[5];             // kinds, paths, sizes, mtimes, counts
+};
+
+void put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Everything the walk saw, arranged in path order once it is done
+class Listing : public collectors::Collector {
+public:
+    explicit Listing(const collectors::DirSizes& sizes) : sizes_(sizes) {}
+    const char* name() const override { return "snapshot"; }
+
+    void begin(unsigned workers) override { partial_.assign(workers, {}); }
+
+    void on_file(unsigned worker, const walker::Entry& entry, uint64_t size) override {
+        paths::NodeId id = table_->add(worker, entry.dir_id, entry.name);
+        if (id != paths::kNoNode) partial_[worker].push_back(Item{entry.dir_id, id, size, entry.mtime, false});
+    }
+
+    void on_leave_dir(unsigned worker, const walker::Dir& dir) override {
+        if (dir.id == paths::kNoNode) return;
+        partial_[worker].push_back(Item{table_->parent(dir.id), dir.id, 0, 0, true});
+    }
+
+    void finish(const walker::Options&, bool) override {
+        for (auto& local : partial_) {
+            items_.insert(items_.end(), local.begin(), local.end());
+            local = {};
+        }
+        partial_.clear();
+        // Siblings next to each other by name; the root has no parent and
+        // sorts last
+        const paths::PathTable& table = *table_;
+        std::sort(items_.begin(), items_.end(), [&table](const Item& a, const Item& b) {
+            if (a.parent != b.parent) return a.parent < b.parent;
+            return table.name(a.id) < table.name(b.id);
+        });
+    }
+
+    void print(const fs::path&) const override {}
+    void write_json(output::Writer&, const fs::path&, const std::string&) const override {}
+
+    // Encode every entry depth first, children by name
+    bool encode(FileHeader& header, std::string columns[5]) {
+        if (items_.empty() || items_.back().parent != paths::kNoNode) return false;
+
+        // Preorder positions, each with its parent's position
+        constexpr uint32_t kNone = 0xFFFFFFFFu;
+        std::vector<uint32_t> order, parents;
+        order.reserve(items_.size());
+        parents.reserve(items_.size());
+        std::vector<std::pair<uint32_t, uint32_t>> stack{{static_cast<uint32_t>(items_.size() - 1), kNone}};
+        while (!stack.empty()) {
+            auto [index, parent] = stack.back();
+            stack.pop_back();
+            const uint32_t position = static_cast<uint32_t>(order.size());
+            order.push_back(index);
+            parents.push_back(parent);
+            const Item& item = items_[index];
+            if (!item.is_dir) continue;
+            auto range = std::equal_range(items_.begin(), items_.end() - 1, item.id,
+                                          ParentOrder{});
+            for (auto it = range.second; it != range.first;) {
+                --it;
+                stack.emplace_back(static_cast<uint32_t>(it - items_.begin()), position);
+            }
+        }
+
+        // A directory's mtime is the newest of anything below it
+        for (size_t i = order.size(); i-- > 1;) {
+            Item& parent = items_[order[parents[i]]];
+            parent.mtime = std::max(parent.mtime, items_[order[i]].mtime);
+        }
+
+        std::string& kinds = columns[0];
+        kinds.assign((order.size() + 7) / 8, '\0');
+        std::string path, previous;
+        std::vector<size_t> lengths(order.size());    // path length per position
+        int64_t mtime = 0;
+        for (size_t i = 0; i < order.size(); ++i) {
+            const Item& item = items_[order[i]];
+            path.clear();
+            if (i > 0) {
+                const size_t parent_length = lengths[parents[i]];
+                path.assign(previous, 0, parent_length);
+                if (parent_length > 0) path.push_back('/');
+                path.append(table_->name(item.id));
+            }
+            lengths[i] = path.size();
+            size_t shared = static_cast<size_t>(
+                std::mismatch(path.begin(), path.begin() + static_cast<std::ptrdiff_t>(std::min(path.size(), previous.size())),
+                              previous.begin()).first - path.begin());
+            put_varint(columns[1], shared);
+            put_varint(columns[1], path.size() - shared);
+            columns[1].append(path, shared, std::string::npos);
+
+            if (item.is_dir) {
+                kinds[i / 8] = static_cast<char>(kinds[i / 8] | (1 << (i % 8)));
+                collectors::DirSizes::Subtree totals;
+                if (!sizes_.find(item.id, totals)) totals = {};
+                put_varint(columns[2], totals.size);
+                put_varint(columns[4], totals.files);
+                if (i == 0) {
+                    header.files = totals.files;
+                    header.size = totals.size;
+                }
+            } else {
+                put_varint(columns[2], item.size);
+            }
+            put_varint(columns[3], zigzag(item.mtime - mtime));
+            mtime = item.mtime;
+            previous.swap(path);
+        }
+        header.entries = order.size();
+        return true;
+    }
+
+private:
+    struct Item {
+        paths::NodeId parent;
+        paths::NodeId id;
+        uint64_t size;
+        int64_t mtime;
+        bool is_dir;
+    };
+
+    struct ParentOrder {
+        bool operator()(const Item& item, paths::NodeId id) const { return item.parent < id; }
+        bool operator()(paths::NodeId id, const Item& item) const { return id < item.parent; }
+    };
+
+    const collectors::DirSizes& sizes_;
+    std::vector<std::vector<Item>> partial_;
+    std::vector<Item> items_;
+};
+
+// "+12.3 MB", "-4 B"
+std::string signed_size(int64_t delta) {
+    uint64_t magnitude = delta < 0 ? 0 - static_cast<uint64_t>(delta) : static_cast<uint64_t>(delta);
+    return (delta < 0 ? "-" : "+") + format_size(magnitude);
+}
+
+std::string signed_count(int64_t delta) {
+    return (delta > 0 ? "+" : "") + std::to_string(delta);
+}
+
+std::string format_time(int64_t seconds) {
+    std::time_t t = static_cast<std::time_t>(seconds);
+    std::tm tm{};
+#ifdef _WIN32
+    localtime_s(&tm, &t);
+#else
+    localtime_r(&t, &tm);
+#endif
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M", &tm);
+    return buffer;
+}
+
+} // namespace
+
+int compare_paths(std::string_view a, std::string_view b) {
+    size_t common = std::min(a.size(), b.size());
+    for (size_t i = 0; i < common; ++i) {
+        if (a[i] == b[i]) continue;
+        // The separator ends a component, so it sorts before any name byte
+        if (a[i] == '/') return -1;
+        if (b[i] == '/') return 1;
+        return static_cast<unsigned char>(a[i]) < static_cast<unsigned char>(b[i]) ? -1 : 1;
+    }
+    return a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0;
+}
+
+bool write(const fs::path& root, const walker::Options& walk, const fs::path& file, Summary& out) {
+    walker::Options opts = walk;
+    opts.max_depth = 0;
+
+    dirstat::Scan scan(root, opts);
+    Listing listing(scan.dir_sizes(0));
+    scan.add(listing);
+    scan.run();
+
+    FileHeader header{};
+    std::string columns[5];
+    {
+        profile::Phase phase("encode");
+        if (!listing.encode(header, columns)) return false;
+    }
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.created = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    const std::string root_string = root.string();
+    header.root_bytes = root_string.size();
+    for (int i = 0; i < 5; ++i) header.column_bytes[i] = columns[i].size();
+
+    // Write next to the target and rename, like the scan index
+    profile::Phase phase("snapshot save");
+    fs::path tmp = file;
+    tmp += ".tmp";
+    {
+        std::ofstream stream(tmp, std::ios::binary | std::ios::trunc);
+        if (!stream) return false;
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(root_string.data(), static_cast<std::streamsize>(root_string.size()));
+        for (const std::string& column : columns) {
+            stream.write(column.data(), static_cast<std::streamsize>(column.size()));
+        }
+        if (!stream) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, file, ec);
+    if (ec) return false;
+
+    out.files = header.files;
+    out.size = header.size;
+    out.dirs = header.entries - header.files;
+    out.bytes = sizeof(header) + root_string.size();
+    for (const std::string& column : columns) out.bytes += column.size();
+    return true;
+}
+
+// ---------------------------------------------------------------- reader
+
+Reader::~Reader() {
+#ifndef _WIN32
+    if (mapped_) munmap(const_cast<char*>(data_), length_);
+#endif
+}
+
+bool Reader::Column::varint(uint64_t& out) {
+    out = 0;
+    for (unsigned shift = 0; at < end && shift < 64; shift += 7) {
+        uint8_t byte = *at++;
+        out |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+bool Reader::open(const fs::path& file) {
+#ifdef _WIN32
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    if (!in) return false;
+    owned_.resize(static_cast<size_t>(in.tellg()));
+    in.seekg(0);
+    if (!in.read(owned_.data(), static_cast<std::streamsize>(owned_.size()))) return false;
+    data_ = owned_.data();
+    length_ = owned_.size();
+#else
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(FileHeader))) {
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    // Read once, front to back
+    madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    data_ = static_cast<const char*>(p);
+    length_ = static_cast<size_t>(st.st_size);
+    mapped_ = true;
+#endif
+
+    if (length_ < sizeof(FileHeader)) return false;
+    FileHeader header;
+    std::memcpy(&header, data_, sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion) return false;
+    uint64_t total = sizeof(header) + header.root_bytes;
+    for (uint64_t bytes : header.column_bytes) total += bytes;
+    if (total != length_ || header.column_bytes[0] < (header.entries + 7) / 8) return false;
+
+    const char* at = data_ + sizeof(header);
+    root_.assign(at, header.root_bytes);
+    at += header.root_bytes;
+    kinds_ = reinterpret_cast<const uint8_t*>(at);
+    at += header.column_bytes[0];
+    Column* columns[] = {&paths_, &sizes_, &mtimes_, &counts_};
+    for (int i = 0; i < 4; ++i) {
+        columns[i]->at = reinterpret_cast<const uint8_t*>(at);
+        at += header.column_bytes[i + 1];
+        columns[i]->end = reinterpret_cast<const uint8_t*>(at);
+    }
+    created_ = header.created;
+    entries_ = header.entries;
+    files_ = header.files;
+    size_ = header.size;
+    return true;
+}
+
+bool Reader::next(Entry& out) {
+    if (read_ == entries_ || damaged_) return false;
+    uint64_t shared, suffix, size, mtime_delta, files = 0;
+    const bool is_dir = (kinds_[read_ / 8] >> (read_ % 8)) & 1;
+    if (!paths_.varint(shared) || !paths_.varint(suffix) || shared > path_.size()
+        || suffix > static_cast<uint64_t>(paths_.end - paths_.at) || !sizes_.varint(size)
+        || !mtimes_.varint(mtime_delta) || (is_dir && !counts_.varint(files))) {
+        damaged_ = true;
+        return false;
+    }
+    path_.resize(shared);
+    path_.append(reinterpret_cast<const char*>(paths_.at), suffix);
+    paths_.at += suffix;
+    mtime_ += unzigzag(mtime_delta);
+    read_++;
+
+    out.path = path_;
+    out.is_dir = is_dir;
+    out.size = size;
+    out.files = files;
+    out.mtime = mtime_;
+    return true;
+}
+
+// ------------------------------------------------------------------ diff
+
+void Diff::offer(std::vector<Change>& heap, int64_t delta, const Entry* before, const Entry* after) {
+    if (count_ == 0) return;
+    // Front of the heap is the smallest change kept
+    auto weaker = [](const Change& a, const Change& b) {
+        uint64_t x = a.delta < 0 ? 0 - static_cast<uint64_t>(a.delta) : static_cast<uint64_t>(a.delta);
+        uint64_t y = b.delta < 0 ? 0 - static_cast<uint64_t>(b.delta) : static_cast<uint64_t>(b.delta);
+        if (x != y) return x > y;
+        return a.path < b.path;
+    };
+    Change change{delta, before ? before->size : 0, after ? after->size : 0,
+                  std::string(before ? before->path : after->path)};
+    if (heap.size() == count_) {
+        if (!weaker(change, heap.front())) return;
+        std::pop_heap(heap.begin(), heap.end(), weaker);
+        heap.back() = std::move(change);
+    } else {
+        heap.push_back(std::move(change));
+    }
+    std::push_heap(heap.begin(), heap.end(), weaker);
+}
+
+bool Diff::run(const fs::path& before_file, const fs::path& after_file, std::string& error) {
+    Reader before, after;
+    if (!before.open(before_file)) {
+        error = "Cannot read snapshot: " + before_file.string();
+        return false;
+    }
+    if (!after.open(after_file)) {
+        error = "Cannot read snapshot: " + after_file.string();
+        return false;
+    }
+    before_ = Side{before.root(), before.created(), before.files(), before.size()};
+    after_ = Side{after.root(), after.created(), after.files(), after.size()};
+
+    // Files per extension before and after, indexed by extension ID
+    extensions::Table table;
+    struct ExtTotals {
+        uint64_t files[2] = {0, 0};
+        uint64_t bytes[2] = {0, 0};
+    };
+    std::vector<ExtTotals> ext;
+    auto count_file = [&](const Entry& e, int side) {
+        size_t slash = e.path.rfind('/');
+        uint32_t id = table.id(slash == std::string_view::npos ? e.path : e.path.substr(slash + 1));
+        if (id >= ext.size()) ext.resize(table.size());
+        ext[id].files[side]++;
+        ext[id].bytes[side] += e.size;
+    };
+    auto ranked = [this](std::string_view path) {
+        if (path.empty()) return false;
+        return max_depth_ <= 0 || std::count(path.begin(), path.end(), '/') < max_depth_;
+    };
+
+    // Both files are in path order, so one merge pass pairs every path up
+    profile::Phase phase("diff");
+    Entry a, b;
+    bool have_a = before.next(a);
+    bool have_b = after.next(b);
+    while (have_a || have_b) {
+        int c = !have_a ? 1 : !have_b ? -1 : compare_paths(a.path, b.path);
+        if (c < 0) {
+            if (a.is_dir) {
+                if (ranked(a.path) && a.size > 0) offer(shrinking_, -static_cast<int64_t>(a.size), &a, nullptr);
+            } else {
+                removed_++;
+                count_file(a, 0);
+            }
+            have_a = before.next(a);
+        } else if (c > 0) {
+            if (b.is_dir) {
+                if (ranked(b.path) && b.size > 0) offer(growing_, static_cast<int64_t>(b.size), nullptr, &b);
+            } else {
+                added_++;
+                count_file(b, 1);
+            }
+            have_b = after.next(b);
+        } else {
+            // A path that changed kind counts as removed and added
+            if (a.is_dir != b.is_dir) {
+                if (!a.is_dir) {
+                    removed_++;
+                    count_file(a, 0);
+                }
+                if (!b.is_dir) {
+                    added_++;
+                    count_file(b, 1);
+                }
+            } else if (a.is_dir) {
+                int64_t delta = static_cast<int64_t>(b.size - a.size);
+                if (ranked(a.path) && delta != 0) offer(delta > 0 ? growing_ : shrinking_, delta, &a, &b);
+            } else {
+                if (a.size != b.size || a.mtime != b.mtime) changed_++;
+                count_file(a, 0);
+                count_file(b, 1);
+            }
+            have_a = before.next(a);
+            have_b = after.next(b);
+        }
+    }
+    if (before.damaged() || after.damaged()) {
+        error = "Snapshot is damaged: " + (before.damaged() ? before_file : after_file).string();
+        return false;
+    }
+
+    auto largest_first = [](const Change& x, const Change& y) {
+        if (x.delta != y.delta) return x.delta < 0 ? x.delta < y.delta : x.delta > y.delta;
+        return x.path < y.path;
+    };
+    std::sort(growing_.begin(), growing_.end(), largest_first);
+    std::sort(shrinking_.begin(), shrinking_.end(), largest_first);
+
+    extensions_.clear();
+    for (uint32_t id = 0; id < ext.size(); ++id) {
+        const ExtTotals& e = ext[id];
+        ExtChange change{table.name(id), static_cast<int64_t>(e.files[1] - e.files[0]),
+                         static_cast<int64_t>(e.bytes[1] - e.bytes[0])};
+        if (change.files != 0 || change.bytes != 0) extensions_.push_back(std::move(change));
+    }
+    auto magnitude = [](int64_t v) { return v < 0 ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v); };
+    size_t keep = std::min(count_, extensions_.size());
+    std::partial_sort(extensions_.begin(), extensions_.begin() + static_cast<std::ptrdiff_t>(keep),
+                      extensions_.end(), [&](const ExtChange& x, const ExtChange& y) {
+        if (magnitude(x.bytes) != magnitude(y.bytes)) return magnitude(x.bytes) > magnitude(y.bytes);
+        return x.name < y.name;
+    });
+    extensions_.resize(keep);
+    return true;
+}
+
+void Diff::print() const {
+    output::Writer& out = output::out();
+    const int64_t size_delta = static_cast<int64_t>(after_.size - before_.size);
+    const int64_t files_delta = static_cast<int64_t>(after_.files - before_.files);
+
+    out << '\n';
+    out << colors::bold_cyan("[*] Changes:") << '\n';
+    out << colors::dim(std::string(60, '-')) << '\n';
+    out << "  " << colors::white("Before:") << " " << colors::cyan(before_.root) << " "
+        << colors::dim(format_time(before_.created)) << " (" << format_size(before_.size) << ", "
+        << std::to_string(before_.files) << " files)" << '\n';
+    out << "  " << colors::white("After:") << "  " << colors::cyan(after_.root) << " "
+        << colors::dim(format_time(after_.created)) << " (" << format_size(after_.size) << ", "
+        << std::to_string(after_.files) << " files)" << '\n';
+    out << "  " << colors::white("Total:") << "  "
+        << (size_delta < 0 ? colors::green(signed_size(size_delta)) : colors::yellow(signed_size(size_delta)))
+        << " (" << signed_count(files_delta) << " files)" << '\n';
+    out << "  " << colors::white("Files:") << "  " << std::to_string(added_) << " added, "
+        << std::to_string(removed_) << " removed, " << std::to_string(changed_) << " changed" << '\n';
+
+    auto list = [&](const char* title, const std::vector<Change>& changes) {
+        out << '\n' << colors::bold_cyan(title) << '\n';
+        for (size_t i = 0; i < changes.size(); ++i) {
+            const Change& c = changes[i];
+            out << colors::yellow(std::to_string(i + 1) + ".") << " "
+                << (c.delta < 0 ? colors::green(signed_size(c.delta)) : colors::bold_green(signed_size(c.delta)))
+                << " " << colors::white(c.path + "/")
+                << colors::dim(" (" + format_size(c.before) + " -> " + format_size(c.after) + ")") << '\n';
+        }
+        if (changes.empty()) out << colors::dim("  None.") << '\n';
+    };
+    list("[*] Growing Directories:", growing_);
+    list("[*] Shrinking Directories:", shrinking_);
+
+    out << '\n' << colors::bold_cyan("[*] Extensions:") << '\n';
+    for (const ExtChange& e : extensions_) {
+        std::string name = e.name == "(no ext)" ? e.name : "." + e.name;
+        out << "    " << colors::cyan(name);
+        for (size_t j = name.size(); j < 12; ++j) out << ' ';
+        std::string bytes = signed_size(e.bytes);
+        for (size_t j = bytes.size(); j < 12; ++j) out << ' ';
+        out << colors::bold_green(bytes) << colors::dim("  " + signed_count(e.files) + " files") << '\n';
+    }
+    if (extensions_.empty()) out << colors::dim("  None.") << '\n';
+}
+
+void Diff::write_json(output::Writer& out, const std::string& indent) const {
+    auto side = [&](const char* name, const Side& s) {
+        out << indent << output::quoted(name) << ": {\"root\": " << output::quoted(s.root) << ", \"created\": "
+            << s.created << ", \"files\": " << s.files << ", \"size\": " << s.size << "},\n";
+    };
+    side("before", before_);
+    side("after", after_);
+    out << indent << "\"size_delta\": " << static_cast<int64_t>(after_.size - before_.size) << ",\n";
+    out << indent << "\"files_added\": " << added_ << ", \"files_removed\": " << removed_
+        << ", \"files_changed\": " << changed_ << ",\n";
+    auto list = [&](const char* name, const std::vector<Change>& changes) {
+        out << indent << output::quoted(name) << ": [\n";
+        for (size_t i = 0; i < changes.size(); ++i) {
+            const Change& c = changes[i];
+            out << indent << "  {\"path\": " << output::quoted(c.path) << ", \"delta\": " << c.delta
+                << ", \"before\": " << c.before << ", \"after\": " << c.after << "}";
+            if (i + 1 < changes.size()) out << ",";
+            out << "\n";
+        }
+        out << indent << "],\n";
+    };
+    list("growing", growing_);
+    list("shrinking", shrinking_);
+    out << indent << "\"extensions\": [\n";
+    for (size_t i = 0; i < extensions_.size(); ++i) {
+        const ExtChange& e = extensions_[i];
+        out << indent << "  {\"extension\": " << output::quoted(e.name) << ", \"files_delta\": " << e.files
+            << ", \"size_delta\": " << e.bytes << "}";
+        if (i + 1 < extensions_.size()) out << ",";
+        out << "\n";
+    }
+    out << indent << "]";
+}
+
+void Diff::write_records(output::Writer& out) const {
+    for (const auto* changes : {&growing_, &shrinking_}) {
+        for (const Change& c : *changes) {
+            output::Record record(out, "dir");
+            record.field("path", c.path);
+            record.key("delta") << c.delta;
+            record.field("before", c.before).field("after", c.after);
+        }
+    }
+    for (const ExtChange& e : extensions_) {
+        output::Record record(out, "extension");
+        record.field("extension", e.name);
+        record.key("files_delta") << e.files;
+        record.key("size_delta") << e.bytes;
+    }
+    output::Record record(out, "summary");
+    record.key("size_delta") << static_cast<int64_t>(after_.size - before_.size);
+    record.field("files_added", added_).field("files_removed", removed_).field("files_changed", changed_);
+}
+
+} // namespace snapshot
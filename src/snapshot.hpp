@@ -0,0 +1,140 @@
+#pragma once
+#include "walker.hpp"
+#include "output.hpp"
+#include <filesystem>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Binary snapshots of a whole tree (`dirstat snapshot`) and a streaming
+// diff of two of them (`dirstat diff`). A snapshot stores every directory
+// and file in path order as separate columns: a bitmap of kinds, front-coded
+// paths, varint sizes, delta-coded mtimes and per-directory file counts.
+// Readers map the file and decode it front to back, so two snapshots can be
+// merged without loading either.
+namespace snapshot {
+
+// One stored entry
+struct Entry {
+    std::string_view path;                // below the root, '/'-separated; valid until the next read
+    bool is_dir = false;
+    uint64_t size = 0;                    // directories: everything below them
+    uint64_t files = 0;                   // directories: files below them
+    int64_t mtime = 0;                    // directories: newest file below them
+};
+
+// What a written snapshot holds
+struct Summary {
+    uint64_t dirs = 0;
+    uint64_t files = 0;
+    uint64_t size = 0;
+    uint64_t bytes = 0;                   // of the snapshot file
+};
+
+// Snapshot order: names compared one component at a time, so a directory
+// is directly followed by everything below it. <0, 0 or >0.
+int compare_paths(std::string_view a, std::string_view b);
+
+// Walk `root` (depth is ignored) and write its snapshot to `file`,
+// replacing it atomically
+bool write(const fs::path& root, const walker::Options& walk, const fs::path& file, Summary& out);
+
+// Sequential reader over a mapped snapshot
+class Reader {
+public:
+    Reader() = default;
+    ~Reader();
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    bool open(const fs::path& file);
+    // The next entry in path order; false at the end or on a damaged file
+    bool next(Entry& out);
+    // Set when next() stopped before the last entry
+    bool damaged() const { return damaged_; }
+
+    const std::string& root() const { return root_; }
+    int64_t created() const { return created_; }
+    uint64_t files() const { return files_; }
+    uint64_t size() const { return size_; }
+
+private:
+    struct Column {
+        const uint8_t* at = nullptr;
+        const uint8_t* end = nullptr;
+        bool varint(uint64_t& out);
+    };
+
+    const char* data_ = nullptr;
+    size_t length_ = 0;
+    bool mapped_ = false;
+    std::vector<char> owned_;
+
+    std::string root_;
+    int64_t created_ = 0;
+    uint64_t entries_ = 0;
+    uint64_t files_ = 0;
+    uint64_t size_ = 0;
+
+    uint64_t read_ = 0;
+    bool damaged_ = false;
+    const uint8_t* kinds_ = nullptr;
+    Column paths_, sizes_, mtimes_, counts_;
+    std::string path_;
+    int64_t mtime_ = 0;
+};
+
+// Differences between two snapshots: the directories that grew or shrank
+// most and the change per extension. One pass over both files; memory is
+// the `count` kept per ranking plus one slot per extension.
+class Diff {
+public:
+    // max_depth: directories deeper than this aren't ranked (0 = all)
+    Diff(size_t count, int max_depth) : count_(count), max_depth_(max_depth) {}
+
+    // error: what went wrong when this returns false
+    bool run(const fs::path& before, const fs::path& after, std::string& error);
+
+    void print() const;
+    // JSON members without the surrounding braces, no trailing newline
+    void write_json(output::Writer& out, const std::string& indent) const;
+    void write_records(output::Writer& out) const;
+
+    struct Change {
+        int64_t delta;
+        uint64_t before;
+        uint64_t after;
+        std::string path;
+    };
+
+    struct ExtChange {
+        std::string name;
+        int64_t files;
+        int64_t bytes;
+    };
+
+private:
+    struct Side {
+        std::string root;
+        int64_t created = 0;
+        uint64_t files = 0;
+        uint64_t size = 0;
+    };
+
+    void offer(std::vector<Change>& heap, int64_t delta, const Entry* before, const Entry* after);
+
+    size_t count_;
+    int max_depth_;
+    Side before_, after_;
+    uint64_t added_ = 0;
+    uint64_t removed_ = 0;
+    uint64_t changed_ = 0;
+    std::vector<Change> growing_;
+    std::vector<Change> shrinking_;
+    std::vector<ExtChange> extensions_;
+};
+
+} // namespace snapshot
@@ -0,0 +1,226 @@
+#include "spill.hpp"
+#include "profile.hpp"
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <random>
+
+namespace spill {
+
+namespace {
+
+// Stream buffer of every run being written or read
+constexpr size_t kFileBuffer = 64 * 1024;
+
+// size, digest.lo, digest.hi, dev, ino, mtime_ns, path length
+constexpr size_t kHeader = 6 * 8 + 4;
+
+void put_u64(char* out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) out[i] = static_cast<char>(v >> (8 * i));
+}
+
+uint64_t get_u64(const char* in, int bytes = 8) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i) v |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    return v;
+}
+
+class Writer {
+public:
+    explicit Writer(const fs::path& file) : buffer_(new char[kFileBuffer]) {
+        out_.rdbuf()->pubsetbuf(buffer_.get(), kFileBuffer);
+        out_.open(file, std::ios::binary | std::ios::trunc);
+    }
+
+    bool put(const Key& key, const Origin& origin, std::string_view path) {
+        char header[kHeader];
+        put_u64(header, key.size);
+        put_u64(header + 8, key.digest.lo);
+        put_u64(header + 16, key.digest.hi);
+        put_u64(header + 24, origin.dev);
+        put_u64(header + 32, origin.ino);
+        put_u64(header + 40, static_cast<uint64_t>(origin.mtime_ns));
+        auto length = static_cast<uint32_t>(path.size());
+        for (int i = 0; i < 4; ++i) header[48 + i] = static_cast<char>(length >> (8 * i));
+        out_.write(header, kHeader);
+        out_.write(path.data(), static_cast<std::streamsize>(path.size()));
+        written_ += kHeader + path.size();
+        return static_cast<bool>(out_);
+    }
+
+    bool close() {
+        out_.close();
+        profile::count(profile::SpillRuns);
+        profile::count(profile::SpillBytes, written_);
+        return !out_.fail();
+    }
+
+private:
+    std::unique_ptr<char[]> buffer_;
+    std::ofstream out_;
+    uint64_t written_ = 0;
+};
+
+class Reader {
+public:
+    Reader(const fs::path& file, size_t buffer) : buffer_(new char[buffer]) {
+        in_.rdbuf()->pubsetbuf(buffer_.get(), static_cast<std::streamsize>(buffer));
+        in_.open(file, std::ios::binary);
+        failed_ = !in_;
+    }
+
+    // False at the end of the run or on a read error (see failed())
+    bool next() {
+        char header[kHeader];
+        if (!in_.read(header, kHeader)) {
+            failed_ = in_.gcount() != 0 || !in_.eof();
+            return false;
+        }
+        record_.key.size = get_u64(header);
+        record_.key.digest.lo = get_u64(header + 8);
+        record_.key.digest.hi = get_u64(header + 16);
+        record_.origin.dev = get_u64(header + 24);
+        record_.origin.ino = get_u64(header + 32);
+        record_.origin.mtime_ns = static_cast<int64_t>(get_u64(header + 40));
+        auto length = static_cast<uint32_t>(get_u64(header + 48, 4));
+        path_.resize(length);
+        if (!in_.read(path_.data(), length)) {
+            failed_ = true;
+            return false;
+        }
+        record_.path = path_;
+        return true;
+    }
+
+    const Record& record() const { return record_; }
+    bool failed() const { return failed_; }
+
+private:
+    std::unique_ptr<char[]> buffer_;
+    std::ifstream in_;
+    std::string path_;
+    Record record_;
+    bool failed_ = false;
+};
+
+} // namespace
+
+Runs::Runs(fs::path parent) : parent_(std::move(parent)) {}
+
+Runs::~Runs() {
+    if (dir_.empty()) return;
+    std::error_code ec;
+    fs::remove_all(dir_, ec);
+}
+
+bool Runs::create_directory() {
+    if (!dir_.empty()) return true;
+    std::random_device random;
+    for (int attempt = 0; attempt < 16; ++attempt) {
+        fs::path dir = parent_ / ("dirstat-spill-" + std::to_string(random()));
+        std::error_code ec;
+        if (fs::create_directory(dir, ec)) {
+            dir_ = dir;
+            return true;
+        }
+        if (ec) return false;
+    }
+    return false;
+}
+
+fs::path Runs::next_file() {
+    return dir_ / ("run-" + std::to_string(next_.fetch_add(1, std::memory_order_relaxed)));
+}
+
+bool Runs::write(Buffer& buffer) {
+    if (buffer.empty()) return true;
+    fs::path file;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!create_directory()) return false;
+        file = next_file();
+    }
+
+    std::sort(buffer.items.begin(), buffer.items.end(),
+              [](const Buffer::Item& a, const Buffer::Item& b) { return a.key < b.key; });
+    Writer out(file);
+    bool ok = true;
+    for (const auto& item : buffer.items) {
+        if (!(ok = out.put(item.key, item.origin, buffer.path(item)))) break;
+    }
+    ok = out.close() && ok;
+    buffer.clear();
+
+    std::error_code ec;
+    if (!ok) {
+        fs::remove(file, ec);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    files_.push_back(std::move(file));
+    return true;
+}
+
+bool Runs::merge_files(const std::vector<fs::path>& inputs, size_t buffer,
+                       const std::function<bool(const Record&)>& sink) {
+    std::vector<std::unique_ptr<Reader>> readers;
+    for (const auto& file : inputs) readers.push_back(std::make_unique<Reader>(file, buffer));
+
+    // Smallest key on top; the run index only makes the order total
+    using Head = std::pair<Key, size_t>;
+    auto later = [](const Head& a, const Head& b) {
+        if (!(a.first == b.first)) return b.first < a.first;
+        return a.second > b.second;
+    };
+    std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+    for (size_t i = 0; i < readers.size(); ++i) {
+        if (readers[i]->failed()) return false;
+        if (readers[i]->next()) heads.push({readers[i]->record().key, i});
+        if (readers[i]->failed()) return false;
+    }
+
+    while (!heads.empty()) {
+        size_t i = heads.top().second;
+        heads.pop();
+        Reader& reader = *readers[i];
+        if (!sink(reader.record())) return false;
+        if (reader.next()) {
+            heads.push({reader.record().key, i});
+        } else if (reader.failed()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Runs::merge(size_t memory, const std::function<bool(const Record&)>& sink) {
+    std::vector<fs::path> files;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        files.swap(files_);
+    }
+    auto remove = [](const std::vector<fs::path>& done) {
+        std::error_code ec;
+        for (const auto& file : done) fs::remove(file, ec);
+    };
+
+    // One buffer per open run, plus one for the run an early pass writes
+    const size_t fan_in = std::max<size_t>(2, memory / kFileBuffer - 1);
+    bool ok = true;
+    while (ok && files.size() > fan_in) {
+        std::vector<fs::path> group(files.begin(), files.begin() + static_cast<std::ptrdiff_t>(fan_in));
+        files.erase(files.begin(), files.begin() + static_cast<std::ptrdiff_t>(fan_in));
+        fs::path merged = next_file();
+        Writer out(merged);
+        ok = merge_files(group, kFileBuffer, [&out](const Record& r) { return out.put(r.key, r.origin, r.path); });
+        ok = out.close() && ok;
+        remove(group);
+        files.push_back(std::move(merged));
+    }
+    ok = ok && merge_files(files, kFileBuffer, sink);
+    remove(files);
+    return ok;
+}
+
+} // namespace spill
@@ -0,0 +1,107 @@
+#pragma once
+#include "hash.hpp"
+#include <filesystem>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Sorted run files for work that doesn't fit in memory (dupes with
+// --mem-limit). Records are a fixed key, a file size and a 128-bit digest,
+// plus the file's origin and a path. They are collected in a bounded Buffer, written sorted by key
+// as one run file, and read back in key order by a k-way merge of all runs.
+namespace spill {
+
+struct Key {
+    uint64_t size = 0;
+    hashing::Digest digest;
+
+    bool operator==(const Key& o) const { return size == o.size && digest == o.digest; }
+    bool operator<(const Key& o) const { return size != o.size ? size < o.size : digest < o.digest; }
+};
+
+// Which version of which file a record stands for, carried along but not
+// sorted by (dupes: hard links and the hash cache)
+struct Origin {
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+    int64_t mtime_ns = 0;
+};
+
+// A record read back from a run; `path` is valid until the next one
+struct Record {
+    Key key;
+    Origin origin;
+    std::string_view path;
+};
+
+// Records waiting to become a run, with their paths in one arena
+struct Buffer {
+    struct Item {
+        Key key;
+        Origin origin;
+        uint64_t offset;
+        uint32_t length;
+    };
+
+    std::vector<Item> items;
+    std::string paths;
+
+    void add(const Key& key, const Origin& origin, std::string_view path) {
+        items.push_back({key, origin, paths.size(), static_cast<uint32_t>(path.size())});
+        paths.append(path);
+    }
+    std::string_view path(const Item& item) const { return std::string_view(paths).substr(item.offset, item.length); }
+    // Memory held, for comparing against a budget
+    size_t bytes() const { return items.size() * sizeof(Item) + paths.size(); }
+    bool empty() const { return items.empty(); }
+    void clear() {
+        items.clear();
+        paths.clear();
+    }
+};
+
+// The run files of one sort, in a private directory removed with them
+class Runs {
+public:
+    // The directory is created below `parent` on the first write
+    explicit Runs(fs::path parent);
+    ~Runs();
+    Runs(const Runs&) = delete;
+    Runs& operator=(const Runs&) = delete;
+
+    // Sort `buffer` by key, write it as one run and clear it. Safe to call
+    // from several threads. False when the run couldn't be written.
+    bool write(Buffer& buffer);
+
+    // Where the run directory goes
+    const fs::path& parent() const { return parent_; }
+
+    // Every record of every run in key order; records with equal keys come
+    // out in no particular order. `memory` bounds the read buffers: when
+    // there are more runs than it allows open at once, groups of them are
+    // merged into longer runs first. Runs are deleted once read. False on a
+    // read or write error, or when `sink` returns false.
+    bool merge(size_t memory, const std::function<bool(const Record&)>& sink);
+
+private:
+    bool create_directory();
+    fs::path next_file();
+    // Merge `inputs` into `sink`, buffer bytes per input
+    bool merge_files(const std::vector<fs::path>& inputs, size_t buffer,
+                     const std::function<bool(const Record&)>& sink);
+
+    fs::path parent_;
+    fs::path dir_;
+    mutable std::mutex mutex_;
+    std::vector<fs::path> files_;
+    std::atomic<uint64_t> next_{0};
+};
+
+} // namespace spill
@@ -1,7 +1,10 @@
 #pragma once
+#include "paths.hpp"
+#include <charconv>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <map>
-#include <optional>
 #include <filesystem>
 
 namespace fs = std::filesystem;
@@ -11,10 +14,34 @@ struct DirStats {
     uint64_t total_dirs = 0;
     uint64_t total_size = 0;
     uint64_t largest_file_size = 0;
-    std::optional<fs::path> largest_file_path;
+    paths::NodeId largest_file = paths::kNoNode;
     std::map<std::string, uint64_t> extensions;
 };
 
+// Ties on the largest file go to the smaller path, so the result doesn't
+// depend on traversal order or on which thread saw the file first
+inline bool is_new_largest(const DirStats& stats, uint64_t size, paths::NodeId file,
+                           const paths::PathTable& table) {
+    if (size > stats.largest_file_size) return true;
+    return size == stats.largest_file_size && stats.largest_file != paths::kNoNode
+        && table.less(file, stats.largest_file);
+}
+
+// Merge per-thread stats into a single result
+inline void merge_stats(DirStats& into, const DirStats& from, const paths::PathTable& table) {
+    into.total_files += from.total_files;
+    into.total_dirs += from.total_dirs;
+    into.total_size += from.total_size;
+    if (from.largest_file != paths::kNoNode
+        && is_new_largest(into, from.largest_file_size, from.largest_file, table)) {
+        into.largest_file_size = from.largest_file_size;
+        into.largest_file = from.largest_file;
+    }
+    for (const auto& [ext, count] : from.extensions) {
+        into.extensions[ext] += count;
+    }
+}
+
 // Format bytes to human readable
 inline std::string format_size(uint64_t bytes) {
     const char* units[] = {"B", "KB", "MB", "GB", "TB"};
@@ -34,3 +61,38 @@ inline std::string format_size(uint64_t bytes) {
     }
     return std::string(buffer);
 }
+
+// Format a count compactly: 1234 -> "1234", 1234567 -> "1.2M"
+inline std::string format_count(uint64_t n) {
+    const char* units[] = {"", "K", "M", "G", "T"};
+    if (n < 10000) return std::to_string(n);
+    double value = static_cast<double>(n);
+    int unit_index = 0;
+    while (value >= 1000.0 && unit_index < 4) {
+        value /= 1000.0;
+        unit_index++;
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.1f%s", value, units[unit_index]);
+    return std::string(buffer);
+}
+
+// "4096", "4K", "64k", "1M", "2G", "1T" (binary units); false if malformed
+inline bool parse_size(std::string_view s, uint64_t& out) {
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+    if (ec != std::errc() || end == s.data()) return false;
+    size_t used = static_cast<size_t>(end - s.data());
+    if (used == s.size()) return true;
+    if (used + 1 != s.size()) return false;
+    int shift = 0;
+    switch (s[used]) {
+        case 'K': case 'k': shift = 10; break;
+        case 'M': case 'm': shift = 20; break;
+        case 'G': case 'g': shift = 30; break;
+        case 'T': case 't': shift = 40; break;
+        default: return false;
+    }
+    if (out > (UINT64_MAX >> shift)) return false;
+    out <<= shift;
+    return true;
+}
@@ -0,0 +1,334 @@
+#pragma once
+#include "walker.hpp"
+#include "backend.hpp"
+#include "ignore.hpp"
+#include "mounts.hpp"
+#include "pool.hpp"
+#include "profile.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// The traversal kernel behind walker::walk(), for callers whose visitor is
+// known at compile time (collectors::run). The per-entry loop is
+// instantiated per reader and visitor type, so the visitor's calls are
+// direct. Filters are tested at run time: each is a flag fixed for the
+// walk, which the branch predictor settles after the first few entries.
+//
+// A visitor provides the Callbacks members as functions:
+//     bool wants_files() const;                   // false: files aren't stat'ed
+//     void on_file(unsigned worker, const Entry& entry, uint64_t size);
+//     void on_dir(unsigned worker, const Entry& entry);
+//     bool on_enter_dir(unsigned worker, const Dir& dir, std::vector<std::string>& children);
+//     void on_leave_dir(unsigned worker, const Dir& dir);
+//     paths::PathTable* paths() const;
+//     const std::atomic<bool>* cancel() const;
+namespace walker {
+
+inline bool dot_file(std::string_view name) {
+    return !name.empty() && name[0] == '.';
+}
+
+// Listing slots of one device. A directory whose device is full goes back
+// to the gate instead of blocking its worker, and is queued again when a
+// slot frees up, so a slow mount holds at most `limit` workers.
+struct Gate {
+    unsigned limit = 0;
+    std::mutex mutex;
+    unsigned active = 0;
+    std::vector<pool::WorkStealingPool::Task> parked;
+};
+
+// Where the walk may go and how hard it may drive each device on the way:
+// directories carry the index of the mount they are on (mounts::Table),
+// -1 when that isn't known
+class Devices {
+public:
+    static constexpr int kSkip = mounts::Table::kSkip;
+
+    Devices(const fs::path& root, const Options& opts, unsigned workers) : opts_(opts) {
+        if (!table_.load(root)) return;
+        gates_.resize(table_.devices());
+        for (size_t d = 0; opts.device_limits && d < gates_.size(); ++d) {
+            unsigned limit = mounts::limits(table_.device_kind(d)).workers;
+            if (limit == 0 || limit >= workers) continue;
+            gates_[d] = std::make_unique<Gate>();
+            gates_[d]->limit = limit;
+        }
+    }
+
+    int root() const { return table_.root(); }
+
+    // Mount of subdirectory `name` of `dir` (on `mount`), or kSkip when
+    // the walk must stay out; see mounts::Table::descend
+    int enter(int mount, const fs::path& dir, std::string_view name, uint64_t dev) const {
+        int to = table_.descend(mount, dir, name, dev, opts_.one_file_system, opts_.pseudo_filesystems);
+        if (to == kSkip) profile::count(profile::MountsSkipped);
+        return to;
+    }
+
+    // Gate of the device `mount` is on; null when it has no worker limit
+    Gate* gate(int mount) const {
+        if (mount < 0 || gates_.empty()) return nullptr;
+        return gates_[table_.mount(mount).device].get();
+    }
+
+    // io_uring requests in flight for a directory on `mount`
+    size_t depth(int mount, size_t capacity) const {
+        if (mount < 0 || !opts_.device_limits) return capacity;
+        unsigned limit = mounts::limits(table_.device_kind(table_.mount(mount).device)).depth;
+        return limit == 0 ? capacity : std::min<size_t>(capacity, limit);
+    }
+
+private:
+    const Options& opts_;
+    mounts::Table table_;
+    std::vector<std::unique_ptr<Gate>> gates_;
+};
+
+// Take a listing slot, or park `retry` when the device is full
+inline bool acquire(Gate& gate, pool::WorkStealingPool::Task retry) {
+    std::lock_guard<std::mutex> lock(gate.mutex);
+    if (gate.active < gate.limit) {
+        gate.active++;
+        return true;
+    }
+    gate.parked.push_back(std::move(retry));
+    profile::count(profile::DeviceWaits);
+    return false;
+}
+
+// Gives the slot back when a directory's visit ends, handing it to a
+// parked directory if there is one
+struct SlotGuard {
+    Gate* gate;
+    pool::WorkStealingPool& workers;
+    unsigned worker;
+    ~SlotGuard() {
+        if (!gate) return;
+        pool::WorkStealingPool::Task next;
+        {
+            std::lock_guard<std::mutex> lock(gate->mutex);
+            gate->active--;
+            if (!gate->parked.empty()) {
+                next = std::move(gate->parked.back());
+                gate->parked.pop_back();
+            }
+        }
+        if (next) workers.submit(worker, std::move(next));
+    }
+};
+
+// Calls on_leave_dir however the visit of an opened directory ends
+template <typename Visitor>
+struct LeaveGuard {
+    Visitor& visitor;
+    unsigned worker;
+    const Dir& dir;
+    ~LeaveGuard() { visitor.on_leave_dir(worker, dir); }
+};
+
+// Node for a subdirectory about to be queued
+template <typename Visitor>
+paths::NodeId child_node(const Visitor& visitor, unsigned worker, const Dir& dir, std::string_view name) {
+    paths::PathTable* table = visitor.paths();
+    return table ? table->add(worker, dir.id, name) : paths::kNoNode;
+}
+
+// Give on_enter_dir the chance to supply a directory's contents; when it
+// does, queue the known subdirectories and report the directory as done
+template <typename Visitor, typename Submit>
+bool reuse_dir(unsigned worker, const Dir& dir, Visitor& visitor, Submit submit, const Options& opts) {
+    thread_local std::vector<std::string> children;
+    children.clear();
+    if (!visitor.on_enter_dir(worker, dir, children)) return false;
+
+    if (!(opts.max_depth > 0 && dir.depth + 1 > opts.max_depth)) {
+        for (const auto& name : children) submit(name, child_node(visitor, worker, dir, name));
+    }
+    visitor.on_leave_dir(worker, dir);
+    return true;
+}
+
+// A directory waiting to be listed, queued or parked at a Gate. It is the
+// same type for every Kernel, which `visit` is the entry point of, so the
+// pool's task machinery is only instantiated once.
+struct DirTask {
+    void (*visit)(void* kernel, unsigned worker, const DirTask& task);
+    void* kernel;
+    fs::path path;
+    paths::NodeId id;
+    int depth;
+    std::shared_ptr<const ignore::Scope> scope;   // of the parent directory
+    int mount;
+
+    void operator()(unsigned worker) const { visit(kernel, worker, *this); }
+};
+
+// One directory per task, listed with a Reader per worker. Subdirectories
+// go onto the current worker's deque so idle workers can steal them.
+template <typename Reader, typename Visitor>
+class Kernel {
+public:
+    Kernel(const fs::path& root, const Options& opts, const ignore::Matcher& matcher, Visitor& visitor)
+        : root_(root), opts_(opts), matcher_(matcher), visitor_(visitor), cancel_(visitor.cancel()),
+          skip_hidden_(!opts.show_hidden), exclude_(matcher.active()), depth_limit_(opts.max_depth > 0),
+          where_(opts.where.get()), workers_(thread_count(opts)), devices_(root, opts, workers_.size()) {
+        // One reader (and its getdents buffer) per worker, reused for every
+        // directory that worker lists
+        for (unsigned i = 0; i < workers_.size(); ++i) readers_.push_back(std::make_unique<Reader>());
+    }
+
+    void run() {
+        paths::PathTable* table = visitor_.paths();
+        paths::NodeId root_id = table ? table->add_root(root_) : paths::kNoNode;
+        workers_.run(make_task(root_, root_id, 0, nullptr, devices_.root()));
+    }
+
+private:
+    using ScopePtr = std::shared_ptr<const ignore::Scope>;
+
+    DirTask make_task(fs::path path, paths::NodeId id, int depth, ScopePtr scope, int mount) {
+        return DirTask{&Kernel::visit, this, std::move(path), id, depth, std::move(scope), mount};
+    }
+
+    static void visit(void* kernel, unsigned worker, const DirTask& task) {
+        static_cast<Kernel*>(kernel)->visit_dir(worker, task);
+    }
+
+    bool cancelled() const { return cancel_ && cancel_->load(std::memory_order_relaxed); }
+
+    void visit_dir(unsigned worker, const DirTask& task) {
+        if (cancelled()) return;
+        Gate* gate = devices_.gate(task.mount);
+        if (gate && !acquire(*gate, task)) return;
+        SlotGuard slot{gate, workers_, worker};
+
+        const fs::path& path = task.path;
+        const int depth = task.depth;
+        const Dir dir{path, task.id, depth};
+        const ScopePtr scope = exclude_ ? matcher_.enter(task.scope, path) : nullptr;
+        if (reuse_dir(worker, dir, visitor_, [&](const std::string& name, paths::NodeId child_id) {
+                int mount = devices_.enter(task.mount, path, name, 0);
+                if (mount == Devices::kSkip) return;
+                workers_.submit(worker, make_task(path / name, child_id, depth + 1, scope, mount));
+            }, opts_)) {
+            return;
+        }
+        Reader& reader = *readers_[worker];
+        if (!reader.open(path)) return;
+        LeaveGuard<Visitor> leave{visitor_, worker, dir};
+
+        backend::Entry raw;
+        while (reader.next(raw)) {
+            if (skip_hidden_ && dot_file(raw.name)) continue;
+            if (cancelled()) break;
+
+            // d_type is enough for most entries; symlinks and filesystems
+            // without d_type need a stat to find out what they point to
+            backend::Stat st;
+            bool have_stat = false;
+            if (raw.type == backend::EntryType::Unknown) {
+                if (!reader.stat(raw.name.data(), st)) continue;
+                raw.type = st.type;
+                have_stat = true;
+            }
+            // Exclusion is decided once the type is known, so excluded
+            // directories are never queued, opened or listed
+            if (exclude_
+                && matcher_.excluded(scope.get(), path, raw.name, raw.type == backend::EntryType::Directory)) {
+                continue;
+            }
+
+            Entry entry{path, raw.name, depth, task.id};
+            if (raw.type == backend::EntryType::File) {
+                if (!visitor_.wants_files()) continue;
+                // Files the listing already rules out are never stat'ed
+                if (where_
+                    && !where::select(*where_, reader, {path, raw.name, depth + 1, raw.link}, st, have_stat)) {
+                    continue;
+                }
+                if (!have_stat && !reader.stat(raw.name.data(), st)) continue;
+                entry.mtime = st.mtime;
+                entry.allocated = st.allocated;
+                entry.mtime_nsec = st.mtime_nsec;
+                entry.dev = st.dev;
+                entry.ino = st.ino;
+                visitor_.on_file(worker, entry, st.size);
+            } else if (raw.type == backend::EntryType::Directory) {
+                visitor_.on_dir(worker, entry);
+                if (depth_limit_ && depth + 1 > opts_.max_depth) continue;
+                int mount = devices_.enter(task.mount, path, raw.name, have_stat ? st.dev : 0);
+                if (mount == Devices::kSkip) continue;
+                workers_.submit(worker, make_task(entry.path(), child_node(visitor_, worker, dir, raw.name),
+                                                  depth + 1, scope, mount));
+            }
+        }
+        reader.close();
+    }
+
+    const fs::path& root_;
+    const Options& opts_;
+    const ignore::Matcher& matcher_;
+    Visitor& visitor_;
+    const std::atomic<bool>* cancel_;
+    const bool skip_hidden_;              // dot files are skipped
+    const bool exclude_;                  // -e patterns or ignore files
+    const bool depth_limit_;              // max_depth is set
+    const where::Filter* where_;          // files are tested against a --where filter
+    pool::WorkStealingPool workers_;
+    const Devices devices_;
+    std::vector<std::unique_ptr<Reader>> readers_;
+};
+
+// Run the Kernel for Reader and `visitor` with the filters of `opts`
+template <typename Reader, typename Visitor>
+Stats traverse(const fs::path& root, const Options& opts, Visitor& visitor) {
+    auto start = std::chrono::steady_clock::now();
+    const ignore::Matcher matcher(root, opts.exclude, opts.ignore_files);
+    Kernel<Reader, Visitor>(root, opts, matcher, visitor).run();
+    Stats stats;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+// Whether walk() takes the io_uring pipeline for these options
+bool batched(const Options& opts);
+
+// Callbacks calling `visitor`, for the walks that take Callbacks
+template <typename Visitor>
+Callbacks callbacks_of(Visitor& visitor) {
+    Callbacks callbacks;
+    if (visitor.wants_files()) {
+        callbacks.on_file = [&visitor](unsigned worker, const Entry& entry, uint64_t size) {
+            visitor.on_file(worker, entry, size);
+        };
+    }
+    callbacks.on_dir = [&visitor](unsigned worker, const Entry& entry) { visitor.on_dir(worker, entry); };
+    callbacks.on_enter_dir = [&visitor](unsigned worker, const Dir& dir, std::vector<std::string>& children) {
+        return visitor.on_enter_dir(worker, dir, children);
+    };
+    callbacks.on_leave_dir = [&visitor](unsigned worker, const Dir& dir) { visitor.on_leave_dir(worker, dir); };
+    callbacks.paths = visitor.paths();
+    callbacks.cancel = visitor.cancel();
+    return callbacks;
+}
+
+// Same as walk(), calling `visitor` directly. Only the native reader gets
+// a kernel per visitor; the portable one and the io_uring pipeline are
+// given callbacks_of(visitor).
+template <typename Visitor>
+Stats visit(const fs::path& root, const Options& opts, Visitor& visitor) {
+#ifdef __linux__
+    if (opts.backend == backend::Kind::Native && !batched(opts)) {
+        return traverse<backend::NativeReader>(root, opts, visitor);
+    }
+#endif
+    return walk(root, opts, callbacks_of(visitor));
+}
+
+} // namespace walker
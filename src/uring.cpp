@@ -0,0 +1,192 @@
+#include "uring.hpp"
+
+#ifdef DIRSTAT_HAVE_IO_URING
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace uring {
+
+#ifdef DIRSTAT_HAVE_IO_URING
+
+namespace {
+
+int sys_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int sys_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+unsigned load_acquire(const unsigned* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+void store_release(unsigned* p, unsigned v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+bool probe() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = sys_setup(4, &params);
+    if (fd < 0) return false;
+
+    // Ask the kernel which opcodes it knows; IORING_REGISTER_PROBE itself
+    // needs 5.6, the same release that added STATX and OPENAT
+    constexpr unsigned kOps = 256;
+    std::vector<char> buffer(sizeof(io_uring_probe) + kOps * sizeof(io_uring_probe_op), 0);
+    auto* p = reinterpret_cast<io_uring_probe*>(buffer.data());
+    bool ok = sys_register(fd, IORING_REGISTER_PROBE, p, kOps) == 0
+        && p->last_op >= IORING_OP_STATX
+        && (p->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED)
+        && (p->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED);
+    ::close(fd);
+    return ok;
+}
+
+} // namespace
+
+bool available() {
+    static std::once_flag once;
+    static bool result = false;
+    std::call_once(once, [] { result = probe(); });
+    return result;
+}
+
+Ring::~Ring() {
+    if (sqes_) munmap(sqes_, sqes_size_);
+    if (cq_ring_ && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_) munmap(sq_ring_, sq_ring_size_);
+    if (fd_ >= 0) ::close(fd_);
+}
+
+bool Ring::init(unsigned entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = sys_setup(entries, &params);
+    if (fd < 0) return false;
+    fd_ = fd;
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+        sq_ring_ = nullptr;
+        return false;
+    }
+    if (single_mmap) {
+        cq_ring_ = sq_ring_;
+    } else {
+        cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            cq_ring_ = nullptr;
+            return false;
+        }
+    }
+
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return false;
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_local_tail_ = *sq_tail_;
+
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe* Ring::next_sqe() {
+    unsigned head = load_acquire(sq_head_);
+    if (sq_local_tail_ - head >= sq_entries_) return nullptr;
+
+    unsigned index = sq_local_tail_ & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    sq_local_tail_++;
+    to_submit_++;
+    return sqe;
+}
+
+bool Ring::prep_statx(int dirfd, const char* name, unsigned mask, struct statx* out, uint64_t user_data) {
+    io_uring_sqe* sqe = next_sqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = dirfd;
+    sqe->addr = reinterpret_cast<uint64_t>(name);
+    sqe->len = mask;
+    sqe->off = reinterpret_cast<uint64_t>(out);
+    sqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool Ring::prep_openat(int dirfd, const char* name, int flags, uint64_t user_data) {
+    io_uring_sqe* sqe = next_sqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = dirfd;
+    sqe->addr = reinterpret_cast<uint64_t>(name);
+    sqe->open_flags = static_cast<uint32_t>(flags);
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool Ring::submit(unsigned wait_nr) {
+    store_release(sq_tail_, sq_local_tail_);
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+        int ret = sys_enter(fd_, to_submit_, wait_nr, flags);
+        if (ret >= 0) {
+            to_submit_ -= std::min(to_submit_, static_cast<unsigned>(ret));
+            return true;
+        }
+        // EAGAIN/EBUSY: the kernel is short on resources or the completion
+        // queue is full; the caller reaps and calls us again
+        if (errno == EAGAIN || errno == EBUSY) return true;
+        if (errno != EINTR) return false;
+    }
+}
+
+bool Ring::pop(uint64_t& user_data, int& result) {
+    unsigned head = *cq_head_;
+    if (head == load_acquire(cq_tail_)) return false;
+    const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+    user_data = cqe.user_data;
+    result = cqe.res;
+    store_release(cq_head_, head + 1);
+    return true;
+}
+
+#else
+
+bool available() {
+    return false;
+}
+
+#endif
+
+} // namespace uring
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define DIRSTAT_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/stat.h>
+#endif
+
+namespace uring {
+
+// True when the running kernel lets us create a ring that supports
+// IORING_OP_STATX and IORING_OP_OPENAT (probed once, then cached)
+bool available();
+
+#ifdef DIRSTAT_HAVE_IO_URING
+
+// Minimal io_uring wrapper on the raw syscalls, no liburing needed.
+// One ring per worker thread; not thread-safe.
+class Ring {
+public:
+    Ring() = default;
+    ~Ring();
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    bool init(unsigned entries);
+    bool ready() const { return fd_ >= 0; }
+    unsigned capacity() const { return sq_entries_; }
+
+    // Queue requests; false when the submission queue is full
+    bool prep_statx(int dirfd, const char* name, unsigned mask, struct statx* out, uint64_t user_data);
+    bool prep_openat(int dirfd, const char* name, int flags, uint64_t user_data);
+
+    // Submit everything queued and wait for at least wait_nr completions
+    bool submit(unsigned wait_nr);
+
+    // Pop one completion, false when the completion queue is empty
+    bool pop(uint64_t& user_data, int& result);
+
+private:
+    io_uring_sqe* next_sqe();
+
+    int fd_ = -1;
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    unsigned sq_local_tail_ = 0;   // queued locally, published by submit()
+    unsigned to_submit_ = 0;
+};
+
+#endif
+
+} // namespace uring
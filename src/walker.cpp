@@ -0,0 +1,377 @@
+#include "walker.hpp"
+#include "traversal.hpp"
+#include "uring.hpp"
+#include "ignore.hpp"
+#include "profile.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+#ifdef DIRSTAT_HAVE_IO_URING
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/sysmacros.h>
+#endif
+
+namespace walker {
+
+unsigned thread_count(const Options& opts) {
+    return opts.threads == 0 ? pool::default_threads() : opts.threads;
+}
+
+bool is_hidden(std::string_view name, const Options& opts) {
+    return !opts.show_hidden && dot_file(name);
+}
+
+namespace {
+
+// The Callbacks of walk() as a visitor (traversal.hpp), the optional ones
+// checked on every call
+struct CallbackVisitor {
+    const Callbacks& callbacks;
+
+    bool wants_files() const { return static_cast<bool>(callbacks.on_file); }
+    void on_file(unsigned worker, const Entry& entry, uint64_t size) { callbacks.on_file(worker, entry, size); }
+    void on_dir(unsigned worker, const Entry& entry) {
+        if (callbacks.on_dir) callbacks.on_dir(worker, entry);
+    }
+    bool on_enter_dir(unsigned worker, const Dir& dir, std::vector<std::string>& children) {
+        return callbacks.on_enter_dir && callbacks.on_enter_dir(worker, dir, children);
+    }
+    void on_leave_dir(unsigned worker, const Dir& dir) {
+        if (callbacks.on_leave_dir) callbacks.on_leave_dir(worker, dir);
+    }
+    paths::PathTable* paths() const { return callbacks.paths; }
+    const std::atomic<bool>* cancel() const { return callbacks.cancel; }
+};
+
+} // namespace
+
+#ifdef DIRSTAT_HAVE_IO_URING
+
+namespace {
+
+using ScopePtr = std::shared_ptr<const ignore::Scope>;
+
+bool cancelled(const Callbacks& callbacks) {
+    return callbacks.cancel && callbacks.cancel->load(std::memory_order_relaxed);
+}
+
+constexpr int kDirOpenFlags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOCTTY;
+
+// One entry of the directory being listed, waiting for its statx/openat
+struct Pending {
+    size_t name;                          // offset into BatchWorker::names
+    backend::EntryType type;
+    bool stat_ok = false;
+    bool recurse = false;
+    bool check = false;                   // exclusion waits for the type
+    bool skip = false;                    // excluded once the type was known
+    bool link = false;                    // listed as a symlink
+    int child_fd = -1;                    // -2 while its openat is in flight
+    uint64_t dev = 0;                     // st_dev once stat'ed
+    int mount = -1;                       // the subdirectory's, see Devices
+    struct statx sx{};
+};
+
+struct BatchWorker {
+    backend::NativeReader reader;
+    uring::Ring ring;
+    bool ring_ok = false;
+    std::string names;
+    std::vector<Pending> items;
+    // Buffers of a ring that failed mid-batch; the kernel may still read or
+    // write them, so they live as long as the ring
+    std::vector<std::vector<Pending>> retired_items;
+    std::vector<std::string> retired_names;
+    uint64_t ops = 0;
+
+    // Stop using the ring, carrying on with copies of the current buffers
+    void retire_ring() {
+        ring_ok = false;
+        std::vector<Pending> items_copy = items;
+        std::string names_copy = names;
+        retired_items.push_back(std::move(items));
+        retired_names.push_back(std::move(names));
+        items = std::move(items_copy);
+        names = std::move(names_copy);
+    }
+};
+
+// Keep up to `depth` requests in flight until all `count` are done.
+// prep(i) queues request i, complete(i, res) consumes its result.
+template <typename Prep, typename Complete>
+bool run_batch(BatchWorker& w, size_t count, size_t depth, Prep prep, Complete complete) {
+    size_t next = 0, done = 0, in_flight = 0;
+    while (done < count) {
+        while (next < count && in_flight < depth && prep(next)) {
+            next++;
+            in_flight++;
+        }
+        if (!w.ring.submit(1)) return false;
+
+        uint64_t user_data;
+        int result;
+        while (w.ring.pop(user_data, result)) {
+            complete(static_cast<size_t>(user_data), result);
+            done++;
+            in_flight--;
+            w.ops++;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+// Same traversal as walk_with(), but every directory is listed first and the
+// statx calls for its entries, plus the opens of its subdirectories, go to
+// the kernel as one io_uring batch instead of one blocking syscall each
+static Stats walk_batched(const fs::path& root, const Options& opts, const Callbacks& callbacks) {
+    CallbackVisitor visitor{callbacks};
+    pool::WorkStealingPool workers(thread_count(opts));
+    const Devices devices(root, opts, workers.size());
+
+    std::vector<std::unique_ptr<BatchWorker>> state;
+    for (unsigned i = 0; i < workers.size(); ++i) {
+        state.push_back(std::make_unique<BatchWorker>());
+        state.back()->ring_ok = state.back()->ring.init(opts.io_depth);
+    }
+
+    // Pre-opened subdirectory fds wait in the task queues; cap how many can
+    // be held at once so wide trees don't run out of descriptors
+    struct rlimit limit;
+    long max_open = 1024;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        max_open = std::min<long>(max_open, static_cast<long>(limit.rlim_cur) / 4);
+    }
+    std::atomic<long> held_fds{0};
+
+    const unsigned stat_mask = STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_BLOCKS | STATX_INO | STATX_ATIME
+                               | STATX_UID;
+    const ignore::Matcher matcher(root, opts.exclude, opts.ignore_files);
+    const bool filter = matcher.active();
+    const where::Filter* where = opts.where.get();
+
+    std::function<void(unsigned, const fs::path&, paths::NodeId, int, int, const ScopePtr&, int)> visit_dir;
+    visit_dir = [&](unsigned worker, const fs::path& path, paths::NodeId id, int depth, int fd,
+                    const ScopePtr& outer, int mount) {
+        Gate* gate = devices.gate(mount);
+        if (gate && !acquire(*gate, [&visit_dir, path, id, depth, fd, outer, mount](unsigned w) {
+                visit_dir(w, path, id, depth, fd, outer, mount);
+            })) {
+            return;
+        }
+        SlotGuard slot{gate, workers, worker};
+
+        const Dir dir{path, id, depth};
+        const ScopePtr scope = matcher.enter(outer, path);
+        auto queue_child = [&](const std::string& name, paths::NodeId child_id) {
+            int child_mount = devices.enter(mount, path, name, 0);
+            if (child_mount == Devices::kSkip) return;
+            workers.submit(worker, [&visit_dir, child = path / name, child_id, depth, scope,
+                                    child_mount](unsigned w) {
+                visit_dir(w, child, child_id, depth + 1, -1, scope, child_mount);
+            });
+        };
+        if (cancelled(callbacks) || reuse_dir(worker, dir, visitor, queue_child, opts)) {
+            if (fd >= 0) {
+                ::close(fd);
+                held_fds.fetch_sub(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+        BatchWorker& w = *state[worker];
+        if (fd >= 0) {
+            held_fds.fetch_sub(1, std::memory_order_relaxed);
+            w.reader.open_fd(fd);
+        } else if (!w.reader.open(path)) {
+            return;
+        }
+        LeaveGuard<CallbackVisitor> leave{visitor, worker, dir};
+
+        w.names.clear();
+        w.items.clear();
+        backend::Entry raw;
+        while (w.reader.next(raw)) {
+            if (is_hidden(raw.name, opts)) continue;
+            if (cancelled(callbacks)) break;
+            // Entries without d_type are matched after their statx
+            bool check = filter && raw.type == backend::EntryType::Unknown;
+            if (filter && !check
+                && matcher.excluded(scope.get(), path, raw.name, raw.type == backend::EntryType::Directory)) {
+                continue;
+            }
+            // --where on what the listing tells; the rest waits for the statx
+            if (where && raw.type == backend::EntryType::File
+                && where->test({path, raw.name, depth + 1, raw.link}) == where::Result::No) {
+                continue;
+            }
+            w.items.push_back(Pending{w.names.size(), raw.type});
+            w.items.back().check = check;
+            w.items.back().link = raw.link;
+            w.names.append(raw.name);
+            w.names.push_back('\0');
+        }
+        const int dirfd = w.reader.fd();
+        const bool recurse = !(opts.max_depth > 0 && depth + 1 > opts.max_depth);
+
+        // Batch 1: stat everything whose type or size we still need
+        std::vector<size_t> todo;
+        for (size_t i = 0; i < w.items.size(); ++i) {
+            auto type = w.items[i].type;
+            if (type == backend::EntryType::Unknown || (type == backend::EntryType::File && callbacks.on_file)) {
+                todo.push_back(i);
+            }
+        }
+        const size_t ring_depth = devices.depth(mount, w.ring.capacity());
+        bool batched = w.ring_ok && run_batch(w, todo.size(), ring_depth,
+            [&](size_t k) {
+                Pending& p = w.items[todo[k]];
+                return w.ring.prep_statx(dirfd, w.names.c_str() + p.name, stat_mask, &p.sx, k);
+            },
+            [&](size_t k, int result) {
+                w.items[todo[k]].stat_ok = result == 0;
+                profile::count(profile::StatCalls);
+                if (result < 0) profile::error(-result);
+            });
+        if (!batched && w.ring_ok) w.retire_ring();
+        for (size_t i : todo) {
+            Pending& p = w.items[i];
+            if (batched) {
+                if (p.stat_ok) {
+                    p.type = S_ISREG(p.sx.stx_mode) ? backend::EntryType::File
+                           : S_ISDIR(p.sx.stx_mode) ? backend::EntryType::Directory
+                           : backend::EntryType::Other;
+                    p.dev = makedev(p.sx.stx_dev_major, p.sx.stx_dev_minor);
+                }
+            } else {
+                backend::Stat st;
+                p.stat_ok = w.reader.stat(w.names.c_str() + p.name, st);
+                if (p.stat_ok) {
+                    p.type = st.type;
+                    p.dev = st.dev;
+                    p.sx.stx_size = st.size;
+                    p.sx.stx_mtime.tv_sec = st.mtime;
+                    p.sx.stx_mtime.tv_nsec = st.mtime_nsec;
+                    p.sx.stx_blocks = st.allocated / 512;
+                    p.sx.stx_ino = st.ino;
+                    p.sx.stx_atime.tv_sec = st.atime;
+                    p.sx.stx_uid = st.uid;
+                }
+            }
+            if (p.check && p.stat_ok) {
+                p.skip = matcher.excluded(scope.get(), path, w.names.c_str() + p.name,
+                                          p.type == backend::EntryType::Directory);
+            }
+        }
+
+        // Batch 2: open the subdirectories we're going to descend into, so
+        // the worker that picks them up can start reading right away
+        todo.clear();
+        for (size_t i = 0; i < w.items.size(); ++i) {
+            Pending& p = w.items[i];
+            if (p.skip || p.type != backend::EntryType::Directory || !recurse) continue;
+            p.mount = devices.enter(mount, path, w.names.c_str() + p.name, p.dev);
+            if (p.mount == Devices::kSkip) continue;
+            p.recurse = true;
+            if (w.ring_ok && held_fds.fetch_add(1, std::memory_order_relaxed) < max_open) {
+                p.child_fd = -2;
+                todo.push_back(i);
+            } else if (w.ring_ok) {
+                held_fds.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        if (!todo.empty()) {
+            bool opened = run_batch(w, todo.size(), ring_depth,
+                [&](size_t k) {
+                    return w.ring.prep_openat(dirfd, w.names.c_str() + w.items[todo[k]].name, kDirOpenFlags, k);
+                },
+                [&](size_t k, int result) {
+                    w.items[todo[k]].child_fd = result;
+                    if (result < 0) held_fds.fetch_sub(1, std::memory_order_relaxed);
+                });
+            if (!opened) {
+                // Children whose open never completed get opened by path
+                w.retire_ring();
+                for (size_t i : todo) {
+                    if (w.items[i].child_fd != -2) continue;
+                    w.items[i].child_fd = -1;
+                    held_fds.fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        for (const Pending& p : w.items) {
+            if (p.skip) continue;
+            std::string_view name(w.names.c_str() + p.name);
+            Entry entry{path, name, depth, id};
+            if (p.type == backend::EntryType::File) {
+                if (where && p.stat_ok) {
+                    backend::Stat st;
+                    st.type = p.type;
+                    st.size = p.sx.stx_size;
+                    st.mtime = p.sx.stx_mtime.tv_sec;
+                    st.atime = p.sx.stx_atime.tv_sec;
+                    st.uid = p.sx.stx_uid;
+                    if (where->test({path, name, depth + 1, p.link, &st}) != where::Result::Yes) continue;
+                }
+                entry.mtime = p.sx.stx_mtime.tv_sec;
+                entry.allocated = p.sx.stx_blocks * 512;
+                entry.mtime_nsec = p.sx.stx_mtime.tv_nsec;
+                entry.dev = p.dev;
+                entry.ino = p.sx.stx_ino;
+                if (callbacks.on_file && p.stat_ok) callbacks.on_file(worker, entry, p.sx.stx_size);
+            } else if (p.type == backend::EntryType::Directory) {
+                if (callbacks.on_dir) callbacks.on_dir(worker, entry);
+                if (!p.recurse) continue;
+                workers.submit(worker, [&visit_dir, child = entry.path(),
+                                        child_id = child_node(visitor, worker, dir, name), depth,
+                                        fd = p.child_fd, scope, child_mount = p.mount](unsigned w) {
+                    visit_dir(w, child, child_id, depth + 1, fd, scope, child_mount);
+                });
+            }
+        }
+        w.reader.close();
+    };
+
+    paths::NodeId root_id = callbacks.paths ? callbacks.paths->add_root(root) : paths::kNoNode;
+    workers.run([&](unsigned worker) { visit_dir(worker, root, root_id, 0, -1, nullptr, devices.root()); });
+
+    Stats stats;
+    stats.io_uring = true;
+    for (const auto& w : state) stats.io_ops += w->ops;
+    return stats;
+}
+
+#endif
+
+bool batched(const Options& opts) {
+#ifdef DIRSTAT_HAVE_IO_URING
+    return opts.backend == backend::Kind::Native && opts.io_depth > 0 && uring::available();
+#else
+    (void)opts;
+    return false;
+#endif
+}
+
+Stats walk(const fs::path& root, const Options& opts, const Callbacks& callbacks) {
+    CallbackVisitor visitor{callbacks};
+#ifdef __linux__
+    if (opts.backend == backend::Kind::Native) {
+#ifdef DIRSTAT_HAVE_IO_URING
+        if (batched(opts)) {
+            auto start = std::chrono::steady_clock::now();
+            Stats stats = walk_batched(root, opts, callbacks);
+            stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return stats;
+        }
+#endif
+        return traverse<backend::NativeReader>(root, opts, visitor);
+    }
+#endif
+    return traverse<backend::FsReader>(root, opts, visitor);
+}
+
+} // namespace walker
@@ -0,0 +1,92 @@
+#pragma once
+#include "backend.hpp"
+#include "paths.hpp"
+#include "where.hpp"
+#include <filesystem>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <string>
+#include <string_view>
+
+namespace fs = std::filesystem;
+
+namespace walker {
+
+struct Options {
+    bool show_hidden = false;
+    int max_depth = 0;                    // 0 = unlimited
+    std::vector<std::string> exclude;     // gitignore-style patterns
+    bool ignore_files = false;            // honor .gitignore/.dirstatignore
+    unsigned threads = 0;                 // 0 = one per core
+    backend::Kind backend = backend::Kind::Native;
+    unsigned io_depth = 0;                // >0: batch stat/open through io_uring
+    bool one_file_system = false;         // don't descend into other filesystems (-x)
+    bool pseudo_filesystems = false;      // enter proc, sysfs, cgroup, ... mounted below the root
+    bool device_limits = true;            // cap workers and io_uring depth per device (mounts.hpp)
+    std::shared_ptr<const where::Filter> where;  // files not matching it aren't reported
+};
+
+// What a walk did, for reporting
+struct Stats {
+    bool io_uring = false;                // the io_uring pipeline was used
+    uint64_t io_ops = 0;                  // statx/openat requests it completed
+    double seconds = 0;                   // wall time of the walk
+};
+
+// An entry as seen by the callbacks; the full path is only built on demand
+struct Entry {
+    const fs::path& dir;
+    std::string_view name;
+    int depth;
+    paths::NodeId dir_id;                 // kNoNode without a path table
+    int64_t mtime = 0;                    // files: modification time, seconds since the epoch
+    uint64_t allocated = 0;               // files: bytes of storage allocated (st_blocks * 512)
+    uint32_t mtime_nsec = 0;              // files: nanoseconds past `mtime`
+    uint64_t dev = 0;                     // files: device and inode, 0 when the backend doesn't know
+    uint64_t ino = 0;
+
+    fs::path path() const { return dir / name; }
+};
+
+// A directory being visited
+struct Dir {
+    const fs::path& path;
+    paths::NodeId id;                     // kNoNode without a path table
+    int depth;
+};
+
+// Called from worker threads; `worker` indexes the caller's per-thread buffers
+struct Callbacks {
+    std::function<void(unsigned worker, const Entry& entry, uint64_t size)> on_file;
+    std::function<void(unsigned worker, const Entry& entry)> on_dir;
+
+    // Optional: called before a directory is listed. Returning true means
+    // the caller already knows its contents; the walker then skips the
+    // listing and only descends into `children` (names of subdirectories).
+    std::function<bool(unsigned worker, const Dir& dir, std::vector<std::string>& children)> on_enter_dir;
+    // Optional: called once everything directly inside a directory has been
+    // reported; not called for directories that couldn't be opened
+    std::function<void(unsigned worker, const Dir& dir)> on_leave_dir;
+
+    // Optional: the root and every directory descended into get a node
+    // here, which Entry::dir_id and Dir::id refer to
+    paths::PathTable* paths = nullptr;
+
+    // Optional: once set, no further directories are listed and the walk
+    // winds down; what was already reported stays reported
+    const std::atomic<bool>* cancel = nullptr;
+};
+
+// Number of workers a walk with these options will use
+unsigned thread_count(const Options& opts);
+
+// Dot files are skipped unless show_hidden is set
+bool is_hidden(std::string_view name, const Options& opts);
+
+// Walk the tree below root in parallel, one task per directory
+Stats walk(const fs::path& root, const Options& opts, const Callbacks& callbacks);
+
+} // namespace walker
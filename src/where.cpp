@@ -0,0 +1,507 @@
+#include "where.hpp"
+#include "extensions.hpp"
+#include "stats.hpp"
+#include <charconv>
+#include <cstdio>
+#include <ctime>
+#include <limits>
+#include <type_traits>
+
+#ifndef _WIN32
+#include <pwd.h>
+#endif
+
+namespace where {
+
+namespace {
+
+Result of(bool yes) { return yes ? Result::Yes : Result::No; }
+
+// One character token of a glob at p[i] against c; `next` is where the
+// token ends. [a-z], [!a-z] (or [^a-z]), ? and \x; a [ without a closing ]
+// is a literal.
+bool match_one(std::string_view p, size_t i, char c, size_t& next) {
+    if (p[i] == '?') {
+        next = i + 1;
+        return true;
+    }
+    if (p[i] == '\\' && i + 1 < p.size()) {
+        next = i + 2;
+        return p[i + 1] == c;
+    }
+    if (p[i] == '[') {
+        size_t j = i + 1;
+        bool negate = j < p.size() && (p[j] == '!' || p[j] == '^');
+        if (negate) j++;
+        size_t close = p.find(']', j + 1);
+        if (close != std::string_view::npos) {
+            bool found = false;
+            for (size_t k = j; k < close; ++k) {
+                if (k + 2 < close && p[k + 1] == '-') {
+                    found = found || (p[k] <= c && c <= p[k + 2]);
+                    k += 2;
+                } else {
+                    found = found || p[k] == c;
+                }
+            }
+            next = close + 1;
+            return found != negate;
+        }
+    }
+    next = i + 1;
+    return p[i] == c;
+}
+
+// Shell-style glob over the whole text; * also matches '/', as in
+// find -path. Backtracks only to the last *, so it is linear for patterns
+// like *.log and */logs/*.
+bool glob(std::string_view p, std::string_view text) {
+    size_t pi = 0, ti = 0;
+    size_t star = std::string_view::npos, mark = 0;
+    while (ti < text.size()) {
+        size_t next;
+        if (pi < p.size() && p[pi] == '*') {
+            star = ++pi;
+            mark = ti;
+        } else if (pi < p.size() && match_one(p, pi, text[ti], next)) {
+            pi = next;
+            ti++;
+        } else if (star != std::string_view::npos) {
+            pi = star;
+            ti = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (pi < p.size() && p[pi] == '*') pi++;
+    return pi == p.size();
+}
+
+bool parse_int(std::string_view s, int64_t& out) {
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+    return ec == std::errc() && end == s.data() + s.size();
+}
+
+int days_in_month(int year, int month) {
+    static const int kDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return month == 2 && leap ? 29 : kDays[month - 1];
+}
+
+// "180d" (that long before `now`), "2024-01-31" or "2024-01-31T08:30[:00]"
+// (local time)
+bool parse_time(std::string_view s, int64_t now, int64_t& out, bool& relative) {
+    if (s.size() >= 10 && s[4] == '-') {
+        std::tm tm{};
+        int consumed = 0;
+        std::string text(s);
+        if (std::sscanf(text.c_str(), "%4d-%2d-%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &consumed) != 3) {
+            return false;
+        }
+        if (consumed != static_cast<int>(text.size())) {
+            int more = 0;
+            if (std::sscanf(text.c_str() + consumed, "T%2d:%2d%n", &tm.tm_hour, &tm.tm_min, &more) != 2) return false;
+            consumed += more;
+            if (consumed != static_cast<int>(text.size())
+                && (std::sscanf(text.c_str() + consumed, ":%2d%n", &tm.tm_sec, &more) != 1
+                    || consumed + more != static_cast<int>(text.size()))) {
+                return false;
+            }
+        }
+        // mktime would roll 2024-02-31 over into March instead of failing
+        if (tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > days_in_month(tm.tm_year, tm.tm_mon)
+            || tm.tm_hour < 0 || tm.tm_hour > 23 || tm.tm_min < 0 || tm.tm_min > 59 || tm.tm_sec < 0
+            || tm.tm_sec > 59) {
+            return false;
+        }
+        const std::tm typed = tm;
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        out = static_cast<int64_t>(std::mktime(&tm));
+        // A local time skipped by a DST change comes back as another one
+        return out != -1 && tm.tm_year + 1900 == typed.tm_year && tm.tm_mon + 1 == typed.tm_mon
+               && tm.tm_mday == typed.tm_mday && tm.tm_hour == typed.tm_hour && tm.tm_min == typed.tm_min;
+    }
+
+    int64_t count = 0;
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), count);
+    if (ec != std::errc() || end == s.data() || count < 0) return false;
+    std::string_view unit(end, static_cast<size_t>(s.data() + s.size() - end));
+    int64_t seconds;
+    if (unit == "s") {
+        seconds = 1;
+    } else if (unit == "min") {
+        seconds = 60;
+    } else if (unit == "h") {
+        seconds = 3600;
+    } else if (unit == "d") {
+        seconds = 86400;
+    } else if (unit == "w") {
+        seconds = 7 * 86400;
+    } else if (unit == "y") {
+        seconds = 365 * 86400;
+    } else {
+        return false;
+    }
+    // now - count * seconds, refused when it doesn't fit
+    if (count > std::numeric_limits<int64_t>::max() / seconds) return false;
+    const int64_t span = count * seconds;
+    if (now < std::numeric_limits<int64_t>::min() + span) return false;
+    out = now - span;
+    relative = true;
+    return true;
+}
+
+bool parse_owner(std::string_view s, int64_t& uid) {
+    if (parse_int(s, uid)) return uid >= 0;
+#ifndef _WIN32
+    std::string name(s);
+    if (const passwd* pw = getpwnam(name.c_str())) {
+        uid = static_cast<int64_t>(pw->pw_uid);
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string lowered(std::string_view s) {
+    std::string out(s.size(), '\0');
+    extensions::to_lower(s.data(), s.size(), out.data());
+    return out;
+}
+
+} // namespace
+
+// Recursive descent over the tokens of an expression:
+//     or      := and ('or' and)*
+//     and     := unary ('and' unary)*
+//     unary   := 'not' unary | '(' or ')' | field op value | field 'in' '(' value, ... ')'
+class Parser {
+public:
+    Parser(Filter& filter, std::string_view text) : f_(filter), text_(text) { advance(); }
+
+    bool parse(std::string& error) {
+        bool ok = parse_or(f_.root_) && (token_.kind == Token::End || fail("unexpected '" + token_.text + "'"));
+        if (!ok) error = error_;
+        return ok;
+    }
+
+private:
+    using Op = Filter::Op;
+    using Cmp = Filter::Cmp;
+
+    struct Token {
+        enum Kind : uint8_t { End, Word, Quoted, Punct } kind = End;
+        std::string text;
+    };
+
+    static bool special(char c) {
+        return c == '(' || c == ')' || c == ',' || c == '=' || c == '!' || c == '<' || c == '>' || c == '~'
+               || c == '\'' || c == '"' || c == '&' || c == '|';
+    }
+
+    void advance() {
+        while (pos_ < text_.size() && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n')) pos_++;
+        token_ = Token{};
+        if (pos_ >= text_.size()) return;
+        char c = text_[pos_];
+        if (c == '\'' || c == '"') {
+            size_t close = text_.find(c, pos_ + 1);
+            if (close == std::string_view::npos) {
+                token_ = Token{Token::Punct, std::string(1, c)};
+                pos_ = text_.size();
+                unterminated_ = true;
+                return;
+            }
+            token_ = Token{Token::Quoted, std::string(text_.substr(pos_ + 1, close - pos_ - 1))};
+            pos_ = close + 1;
+            return;
+        }
+        if (special(c)) {
+            static const char* const kTwo[] = {"==", "!=", "<=", ">=", "!~", "&&", "||"};
+            for (const char* two : kTwo) {
+                if (text_.compare(pos_, 2, two) == 0) {
+                    token_ = Token{Token::Punct, two};
+                    pos_ += 2;
+                    return;
+                }
+            }
+            token_ = Token{Token::Punct, std::string(1, c)};
+            pos_++;
+            return;
+        }
+        size_t end = pos_;
+        while (end < text_.size() && text_[end] != ' ' && text_[end] != '\t' && text_[end] != '\n'
+               && !special(text_[end])) {
+            end++;
+        }
+        token_ = Token{Token::Word, std::string(text_.substr(pos_, end - pos_))};
+        pos_ = end;
+    }
+
+    bool accept(std::string_view word) {
+        if (token_.kind == Token::Quoted || token_.text != word) return false;
+        advance();
+        return true;
+    }
+
+    bool fail(std::string message) {
+        if (error_.empty()) error_ = unterminated_ ? "unterminated quote" : std::move(message);
+        return false;
+    }
+
+    bool parse_or(uint32_t& out) {
+        if (!parse_and(out)) return false;
+        while (accept("or") || accept("||")) {
+            uint32_t right;
+            if (!parse_and(right)) return false;
+            out = f_.add({Op::Or, Cmp::Eq, out, right});
+        }
+        return true;
+    }
+
+    bool parse_and(uint32_t& out) {
+        if (!parse_unary(out)) return false;
+        while (accept("and") || accept("&&")) {
+            uint32_t right;
+            if (!parse_unary(right)) return false;
+            out = f_.add({Op::And, Cmp::Eq, out, right});
+        }
+        return true;
+    }
+
+    bool parse_unary(uint32_t& out) {
+        if (accept("not") || accept("!")) {
+            uint32_t inner;
+            if (!parse_unary(inner)) return false;
+            out = f_.add({Op::Not, Cmp::Eq, inner});
+            return true;
+        }
+        if (accept("(")) {
+            if (!parse_or(out)) return false;
+            return accept(")") || fail("missing ')'");
+        }
+        return parse_comparison(out);
+    }
+
+    bool parse_comparison(uint32_t& out) {
+        static const std::pair<const char*, Op> kFields[] = {
+            {"size", Op::Size}, {"mtime", Op::Mtime}, {"atime", Op::Atime}, {"depth", Op::Depth},
+            {"owner", Op::Owner}, {"type", Op::Type}, {"ext", Op::Ext}, {"name", Op::Name}, {"path", Op::Path},
+        };
+        if (token_.kind != Token::Word) {
+            return fail(token_.kind == Token::End ? "expected a field" : "expected a field, not '" + token_.text + "'");
+        }
+        const std::string field = token_.text;
+        const Op* op = nullptr;
+        for (const auto& [name, o] : kFields) {
+            if (field == name) op = &o;
+        }
+        if (!op) return fail("unknown field '" + field + "' (size, mtime, atime, ext, name, path, depth, owner, type)");
+        advance();
+
+        if (accept("in")) {
+            if (!accept("(")) return fail("expected '(' after '" + field + " in'");
+            if (!parse_value(*op, Cmp::Eq, field, out)) return false;
+            while (accept(",")) {
+                uint32_t next;
+                if (!parse_value(*op, Cmp::Eq, field, next)) return false;
+                out = f_.add({Op::Or, Cmp::Eq, out, next});
+            }
+            return accept(")") || fail("missing ')' after the values of '" + field + " in'");
+        }
+
+        static const std::pair<const char*, Cmp> kCmps[] = {
+            {"==", Cmp::Eq}, {"=", Cmp::Eq}, {"!=", Cmp::Ne}, {"<", Cmp::Lt}, {"<=", Cmp::Le},
+            {">", Cmp::Gt}, {">=", Cmp::Ge}, {"~", Cmp::Glob}, {"!~", Cmp::NoGlob},
+        };
+        const Cmp* cmp = nullptr;
+        if (token_.kind == Token::Punct) {
+            for (const auto& [name, c] : kCmps) {
+                if (token_.text == name) cmp = &c;
+            }
+        }
+        if (!cmp) return fail("expected a comparison after '" + field + "'");
+        const std::string cmp_text = token_.text;
+        advance();
+
+        const bool text = *op == Op::Ext || *op == Op::Name || *op == Op::Path;
+        const bool ordered = *cmp == Cmp::Lt || *cmp == Cmp::Le || *cmp == Cmp::Gt || *cmp == Cmp::Ge;
+        const bool globbed = *cmp == Cmp::Glob || *cmp == Cmp::NoGlob;
+        if ((text && ordered) || (!text && globbed) || ((*op == Op::Type || *op == Op::Owner) && ordered)) {
+            return fail("'" + field + " " + cmp_text + "' isn't a valid comparison");
+        }
+        if ((*op == Op::Mtime || *op == Op::Atime) && !ordered) {
+            return fail("compare times with <, <=, > or >=, e.g. '" + field + " < 30d'");
+        }
+        return parse_value(*op, *cmp, field, out);
+    }
+
+    bool parse_value(Op op, Cmp cmp, const std::string& field, uint32_t& out) {
+        if (token_.kind != Token::Word && token_.kind != Token::Quoted) {
+            return fail("expected a value after '" + field + "'");
+        }
+        const std::string value = token_.text;
+        advance();
+
+        Filter::Node node{op, cmp};
+        bool ok = true;
+        f_.reads_stat_ = f_.reads_stat_ || op == Op::Size || op == Op::Mtime || op == Op::Atime || op == Op::Owner;
+        switch (op) {
+            case Op::Size: {
+                uint64_t size = 0;
+                ok = parse_size(value, size) && size <= static_cast<uint64_t>(INT64_MAX);
+                node.value = static_cast<int64_t>(size);
+                break;
+            }
+            case Op::Depth:
+                ok = parse_int(value, node.value);
+                break;
+            case Op::Mtime:
+            case Op::Atime:
+                ok = parse_time(value, f_.now_, node.value, f_.relative_);
+                f_.native_only_ = f_.native_only_ || op == Op::Atime;
+                break;
+            case Op::Owner:
+                if (!parse_owner(value, node.value)) return fail("unknown owner '" + value + "'");
+                f_.native_only_ = true;
+                break;
+            case Op::Type:
+                ok = value == "file" || value == "f" || value == "link" || value == "l";
+                node.value = value[0] == 'l';
+                if (!ok) return fail("type is file (f) or link (l): --where selects files, directories are always walked");
+                break;
+            case Op::Ext:
+            case Op::Name:
+            case Op::Path: {
+                std::string_view text = value;
+                if (op == Op::Ext && !text.empty() && text[0] == '.') text.remove_prefix(1);
+                node.left = static_cast<uint32_t>(f_.strings_.size());
+                f_.strings_.push_back(op == Op::Ext ? lowered(text) : std::string(text));
+                break;
+            }
+            default:
+                break;
+        }
+        if (!ok) {
+            const char* expected = op == Op::Size    ? "a size like 4096, 64K or 1G"
+                                   : op == Op::Depth ? "a number"
+                                                     : "an age like 30d (s, min, h, d, w, y) or a date like 2024-01-31";
+            return fail("bad value '" + value + "' for " + field + ": expected " + expected);
+        }
+        out = f_.add(node);
+        return true;
+    }
+
+    Filter& f_;
+    std::string_view text_;
+    size_t pos_ = 0;
+    Token token_;
+    bool unterminated_ = false;
+    std::string error_;
+};
+
+bool Filter::compile(std::string_view text, std::string& error) {
+    *this = Filter{};
+    text_ = std::string(text);
+    now_ = static_cast<int64_t>(std::time(nullptr));
+    return Parser(*this, text_).parse(error);
+}
+
+template <typename T>
+bool Filter::compare(T a, Cmp cmp, T b) {
+    switch (cmp) {
+        case Cmp::Eq: return a == b;
+        case Cmp::Ne: return a != b;
+        case Cmp::Lt: return a < b;
+        case Cmp::Le: return a <= b;
+        case Cmp::Gt: return a > b;
+        default: return a >= b;
+    }
+}
+
+uint32_t Filter::add(const Node& node) {
+    nodes_.push_back(node);
+    return static_cast<uint32_t>(nodes_.size() - 1);
+}
+
+std::string Filter::key() const {
+    return relative_ ? text_ + '@' + std::to_string(now_) : text_;
+}
+
+Result Filter::test(const Subject& file) const {
+    return eval(root_, file);
+}
+
+Result Filter::eval(uint32_t index, const Subject& file) const {
+    const Node& n = nodes_[index];
+    const Cmp cmp = n.cmp;
+    switch (n.op) {
+        case Op::And: {
+            Result left = eval(n.left, file);
+            if (left == Result::No) return Result::No;
+            Result right = eval(n.right, file);
+            if (right == Result::No) return Result::No;
+            return left == Result::Yes && right == Result::Yes ? Result::Yes : Result::Unknown;
+        }
+        case Op::Or: {
+            Result left = eval(n.left, file);
+            if (left == Result::Yes) return Result::Yes;
+            Result right = eval(n.right, file);
+            if (right == Result::Yes) return Result::Yes;
+            return left == Result::No && right == Result::No ? Result::No : Result::Unknown;
+        }
+        case Op::Not: {
+            Result inner = eval(n.left, file);
+            return inner == Result::Unknown ? inner : of(inner == Result::No);
+        }
+        case Op::Depth:
+            return of(compare<int64_t>(file.depth, cmp, n.value));
+        case Op::Type:
+            return of(compare<int64_t>(file.link, cmp, n.value));
+        case Op::Size:
+            if (!file.stat) return Result::Unknown;
+            return of(compare<uint64_t>(file.stat->size, cmp, static_cast<uint64_t>(n.value)));
+        case Op::Mtime:
+            if (!file.stat) return Result::Unknown;
+            return of(compare<int64_t>(file.stat->mtime, cmp, n.value));
+        case Op::Atime:
+            if (!file.stat) return Result::Unknown;
+            return of(compare<int64_t>(file.stat->atime, cmp, n.value));
+        case Op::Owner:
+            if (!file.stat) return Result::Unknown;
+            return of(compare<int64_t>(file.stat->uid, cmp, n.value));
+        default:
+            break;
+    }
+
+    // Ext, Name, Path: == and != compare, ~ and !~ glob
+    thread_local std::string buffer;
+    std::string_view text = file.name;
+    if (n.op == Op::Ext) {
+        std::string_view ext;
+        if (!extensions::find(file.name, ext)) ext = {};
+        buffer.resize(ext.size());
+        extensions::to_lower(ext.data(), ext.size(), buffer.data());
+        text = buffer;
+    } else if (n.op == Op::Path) {
+        if constexpr (std::is_same_v<fs::path::value_type, char>) {
+            buffer = file.dir.native();
+        } else {
+            buffer = file.dir.string();
+        }
+        if (buffer.empty() || buffer.back() != '/') buffer += '/';
+        buffer.append(file.name);
+        text = buffer;
+    }
+    const std::string& value = strings_[n.left];
+    switch (n.cmp) {
+        case Cmp::Eq: return of(text == value);
+        case Cmp::Ne: return of(text != value);
+        case Cmp::Glob: return of(glob(value, text));
+        default: return of(!glob(value, text));
+    }
+}
+
+} // namespace where
@@ -0,0 +1,95 @@
+#pragma once
+#include "backend.hpp"
+#include <filesystem>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// File filter expressions (--where), e.g.
+//     size > 1G and mtime < 180d and path ~ '*/logs/*'
+// Comparisons of size, mtime, atime, ext, name, path, depth, owner and type,
+// joined with and, or, not and parentheses. An expression is compiled once
+// into a flat array of nodes. Walks test every file against it before it is
+// reported: first with what the listing says (name, depth, whether it is a
+// symlink), which settles most files without a stat, then with the stat if
+// the answer depends on it. Directories are always walked.
+namespace where {
+
+// A file being tested
+struct Subject {
+    const fs::path& dir;
+    std::string_view name;                // NUL-terminated, for Reader::stat
+    int depth;                            // 1: directly in the root
+    bool link = false;                    // listed as a symlink (d_type)
+    const backend::Stat* stat = nullptr;  // null until the file is stat'ed
+};
+
+enum class Result : uint8_t { No, Yes, Unknown };
+
+class Filter {
+public:
+    // Compile `text`; false with a message in `error` when it is malformed
+    bool compile(std::string_view text, std::string& error);
+
+    // Unknown only when `file.stat` is null and the answer depends on it
+    Result test(const Subject& file) const;
+
+    // Some predicate reads what only the native backend reports (atime,
+    // owner)
+    bool native_only() const { return native_only_; }
+    // Some predicate needs a stat (size, mtime, atime, owner)
+    bool reads_stat() const { return reads_stat_; }
+    const std::string& text() const { return text_; }
+    // What results computed with this filter must be keyed by (the scan
+    // index): the text, plus the time relative ages were taken from
+    std::string key() const;
+
+private:
+    enum class Op : uint8_t { And, Or, Not, Size, Mtime, Atime, Depth, Owner, Type, Ext, Name, Path };
+    enum class Cmp : uint8_t { Eq, Ne, Lt, Le, Gt, Ge, Glob, NoGlob };
+
+    // And/Or: children `left` and `right`, Not: `left`; Ext/Name/Path:
+    // strings_[left]; the rest compare against `value`
+    struct Node {
+        Op op;
+        Cmp cmp = Cmp::Eq;
+        uint32_t left = 0;
+        uint32_t right = 0;
+        int64_t value = 0;
+    };
+
+    friend class Parser;
+
+    template <typename T>
+    static bool compare(T a, Cmp cmp, T b);
+    Result eval(uint32_t node, const Subject& file) const;
+    uint32_t add(const Node& node);
+
+    std::vector<Node> nodes_;             // children before their parents
+    std::vector<std::string> strings_;
+    uint32_t root_ = 0;
+    std::string text_;
+    int64_t now_ = 0;
+    bool relative_ = false;               // some time is an age (180d)
+    bool native_only_ = false;
+    bool reads_stat_ = false;
+};
+
+// Whether a file passes `filter`, stat'ing it into `st` through `reader`
+// only when the listing can't decide. have_stat: `st` already holds the
+// file's stat; set when this stat'ed it.
+template <typename Reader>
+bool select(const Filter& filter, Reader& reader, Subject file, backend::Stat& st, bool& have_stat) {
+    if (have_stat) file.stat = &st;
+    Result result = filter.test(file);
+    if (result != Result::Unknown) return result == Result::Yes;
+    if (!reader.stat(file.name.data(), st)) return false;
+    have_stat = true;
+    file.stat = &st;
+    return filter.test(file) == Result::Yes;
+}
+
+} // namespace where
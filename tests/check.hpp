@@ -0,0 +1,58 @@
+#pragma once
+#include <filesystem>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+// What the tests under tests/ share: CHECK reports a failed condition and
+// carries on, and main() returns check::result() so ctest sees the failure
+namespace check {
+
+inline int failures = 0;
+
+inline bool expect(bool ok, const char* what, const char* file, int line) {
+    if (!ok) {
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+        failures++;
+    }
+    return ok;
+}
+
+inline int result() {
+    if (failures > 0) std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures > 0 ? 1 : 0;
+}
+
+// A fresh directory under the system temp directory, removed with it
+class TempDir {
+public:
+    explicit TempDir(std::string_view name) {
+        path_ = fs::temp_directory_path() / (std::string(name) + "-" + std::to_string(std::random_device{}()));
+        fs::create_directories(path_);
+    }
+    ~TempDir() {
+        std::error_code ec;
+        fs::remove_all(path_, ec);
+    }
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    const fs::path& path() const { return path_; }
+
+private:
+    fs::path path_;
+};
+
+inline void write_file(const fs::path& file, std::string_view content) {
+    fs::create_directories(file.parent_path());
+    std::ofstream(file, std::ios::binary).write(content.data(), static_cast<std::streamsize>(content.size()));
+}
+
+} // namespace check
+
+#define CHECK(cond) check::expect((cond), #cond, __FILE__, __LINE__)
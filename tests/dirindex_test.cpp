@@ -0,0 +1,129 @@
+// Scan index (dirindex.hpp): records found again only for an unchanged
+// directory, stamps only when asked for, and damaged files refused
+#include "check.hpp"
+#include "dirindex.hpp"
+#include "backend.hpp"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using dirindex::DirId;
+using dirindex::DirRecord;
+using dirindex::Index;
+
+static const uint64_t kOptions = 42;
+
+static std::string read_file(const fs::path& file) {
+    std::ifstream in(file, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static bool loads(const fs::path& file) {
+    Index index;
+    return index.load(file, kOptions);
+}
+
+static DirRecord record(uint64_t ino, int64_t mtime_ns) {
+    DirRecord r;
+    r.id = DirId{1, ino, mtime_ns};
+    r.files = 2;
+    r.size = 300;
+    r.largest_size = 200;
+    r.largest_name = "big.log";
+    r.children = {"sub", "other"};
+    r.extensions = {{"log", 1}, {"txt", 1}};
+    r.stamps = {{"big.log", 200, 1'700'000'000, 5}, {"a.txt", 100, 1'700'000'001, 0}};
+    return r;
+}
+
+static void round_trip(const fs::path& file) {
+    std::vector<DirRecord> records = {record(30, 7), record(10, 8), record(20, 9)};
+    CHECK(dirindex::save(file, kOptions, records));
+
+    Index index;
+    CHECK(!index.load(file, kOptions + 1));
+    CHECK(index.load(file, kOptions));
+    CHECK(index.size() == 3);
+
+    DirRecord out;
+    CHECK(index.find(DirId{1, 10, 8}, out));
+    CHECK(out.files == 2 && out.size == 300 && out.largest_name == "big.log");
+    CHECK((out.children == std::vector<std::string>{"sub", "other"}));
+    CHECK(out.extensions.at("txt") == 1);
+    CHECK(out.stamps.size() == 2 && out.stamps[1].name == "a.txt" && out.stamps[0].mtime_nsec == 5);
+
+    CHECK(index.find(DirId{1, 20, 9}, out, false));
+    CHECK(out.stamps.empty() && out.children.size() == 2);
+
+    // Another mtime, device or inode isn't this record
+    CHECK(!index.find(DirId{1, 10, 9}, out));
+    CHECK(!index.find(DirId{2, 10, 8}, out));
+    CHECK(!index.find(DirId{1, 15, 8}, out));
+}
+
+// Each way of damaging a good index is refused at load
+static void damaged(const fs::path& good, const fs::path& file) {
+    const std::string image = read_file(good);
+
+    check::write_file(file, image.substr(0, image.size() - 5));
+    CHECK(!loads(file));
+    check::write_file(file, image.substr(0, 40));
+    CHECK(!loads(file));
+
+    // The string table has lost its final NUL
+    std::string bytes = image;
+    bytes.back() = 'x';
+    check::write_file(file, bytes);
+    CHECK(!loads(file));
+
+    // A header count so large the layout would overflow (dir_count, at 24)
+    bytes = image;
+    const uint64_t huge = uint64_t(1) << 62;
+    std::memcpy(&bytes[24], &huge, sizeof(huge));
+    check::write_file(file, bytes);
+    CHECK(!loads(file));
+
+    // The first record's children (child_begin, 64 + 52) and largest name
+    // (64 + 48) pointing past their tables
+    bytes = image;
+    const uint32_t past = 1000;
+    std::memcpy(&bytes[64 + 52], &past, sizeof(past));
+    check::write_file(file, bytes);
+    CHECK(!loads(file));
+    bytes = image;
+    std::memcpy(&bytes[64 + 48], &past, sizeof(past));
+    check::write_file(file, bytes);
+    CHECK(!loads(file));
+
+    check::write_file(file, image);
+    CHECK(loads(file));
+}
+
+// files_unchanged() notices a file rewritten in place
+static void stamps_of_real_files(const fs::path& dir) {
+    check::write_file(dir / "a.txt", "hello");
+    DirRecord r;
+    CHECK(dirindex::identify(dir, r.id));
+    backend::FsReader reader;
+    CHECK(reader.open(dir));
+    backend::Stat st;
+    CHECK(reader.stat("a.txt", st));
+    r.stamps.push_back({"a.txt", st.size, st.mtime, 0});
+    CHECK(dirindex::files_unchanged(dir, r));
+
+    check::write_file(dir / "a.txt", "hello, again");
+    CHECK(!dirindex::files_unchanged(dir, r));
+    fs::remove(dir / "a.txt");
+    CHECK(!dirindex::files_unchanged(dir, r));
+}
+
+int main() {
+    check::TempDir temp("dirstat-dirindex-test");
+    const fs::path good = temp.path() / "index";
+    round_trip(good);
+    damaged(good, temp.path() / "damaged");
+    stamps_of_real_files(temp.path() / "files");
+    return check::result();
+}
@@ -0,0 +1,128 @@
+// Hash cache (hashcache.hpp) round trips: digests saved by one run are
+// found by the next only for the same version of the same file
+#include "check.hpp"
+#include "hashcache.hpp"
+#include <cstdint>
+#include <string>
+
+using hashcache::Cache;
+using hashcache::FileId;
+using hashcache::Part;
+
+static const uint64_t kEdge = 4096;
+
+static hashing::Digest digest(uint64_t n) {
+    return hashing::Digest{n, ~n};
+}
+
+static bool found(Cache& cache, const FileId& id, Part part, const hashing::Digest& expected) {
+    hashing::Digest out;
+    return cache.find(id, part, out) && out == expected;
+}
+
+static bool missing(Cache& cache, const FileId& id, Part part) {
+    hashing::Digest out;
+    return !cache.find(id, part, out);
+}
+
+int main() {
+    check::TempDir temp("dirstat-hashcache-test");
+    const fs::path file = temp.path() / "hashes";
+
+    const FileId a{1, 100, 5000, 1'700'000'000'000'000'001};
+    const FileId b{1, 101, 70000, 1'700'000'000'000'000'002};
+    const FileId unknown{1, 0, 10, 3};    // ino 0: never cached
+
+    // First run: no file yet, so the cache starts empty and save() creates it
+    {
+        Cache cache;
+        CHECK(!cache.load(file, kEdge));
+        CHECK(missing(cache, a, Part::Edges));
+        cache.record(a, Part::Edges, digest(1));
+        cache.record(a, Part::Full, digest(2));
+        cache.record(b, Part::Edges, digest(3));
+        cache.record(unknown, Part::Full, digest(4));
+        CHECK(cache.save());
+        CHECK(cache.stats().added == 2);
+    }
+
+    // Second run: what was saved is found, for this version of each file
+    {
+        Cache cache;
+        CHECK(cache.load(file, kEdge));
+        CHECK(cache.size() == 2);
+        CHECK(found(cache, a, Part::Edges, digest(1)));
+        CHECK(found(cache, a, Part::Full, digest(2)));
+        CHECK(found(cache, b, Part::Edges, digest(3)));
+        CHECK(missing(cache, b, Part::Full));
+        CHECK(missing(cache, unknown, Part::Full));
+
+        // Stale: the same inode with another size or mtime
+        FileId grown = a;
+        grown.size++;
+        CHECK(missing(cache, grown, Part::Edges));
+        FileId touched = a;
+        touched.mtime_ns++;
+        CHECK(missing(cache, touched, Part::Full));
+        FileId other_device = a;
+        other_device.dev = 2;
+        CHECK(missing(cache, other_device, Part::Edges));
+
+        hashcache::Stats stats = cache.stats();
+        CHECK(stats.hits == 3);
+        CHECK(stats.lookups == 7);
+        CHECK(stats.bytes_saved == a.size + a.size + 2 * kEdge);
+
+        // a was rewritten: its new digest goes to the log
+        cache.record(touched, Part::Edges, digest(5));
+        CHECK(cache.save());
+    }
+
+    // Third run: the newest record of an inode wins, the old version is stale
+    {
+        Cache cache;
+        CHECK(cache.load(file, kEdge));
+        FileId touched = a;
+        touched.mtime_ns++;
+        CHECK(found(cache, touched, Part::Edges, digest(5)));
+        CHECK(missing(cache, touched, Part::Full));
+        CHECK(missing(cache, a, Part::Edges));
+        CHECK(found(cache, b, Part::Edges, digest(3)));
+    }
+
+    // Compaction keeps one record per inode and the same answers
+    hashcache::Compaction compaction;
+    CHECK(hashcache::compact(file, compaction));
+    CHECK(compaction.records_before == 3);
+    CHECK(compaction.records_after == 2);
+    {
+        Cache cache;
+        CHECK(cache.load(file, kEdge));
+        CHECK(cache.size() == 2);
+        FileId touched = a;
+        touched.mtime_ns++;
+        CHECK(found(cache, touched, Part::Edges, digest(5)));
+        CHECK(found(cache, b, Part::Edges, digest(3)));
+    }
+
+    // Edge digests of another size can't be used
+    {
+        Cache cache;
+        CHECK(!cache.load(file, kEdge * 2));
+        CHECK(missing(cache, b, Part::Edges));
+    }
+
+    // A file that isn't a hash cache is never overwritten
+    const fs::path other = temp.path() / "other";
+    check::write_file(other, std::string(256, 'x'));
+    {
+        Cache cache;
+        CHECK(!cache.load(other, kEdge));
+        cache.record(a, Part::Edges, digest(1));
+        CHECK(!cache.save());
+    }
+    CHECK(fs::file_size(other) == 256);
+    CHECK(!hashcache::compact(other, compaction));
+
+    return check::result();
+}
@@ -0,0 +1,120 @@
+// Sorted runs (spill.hpp) and dupes with a mem_limit, checked against the
+// same data grouped in memory
+#include "check.hpp"
+#include "spill.hpp"
+#include "dirstat.hpp"
+#include "output.hpp"
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#define fileno _fileno
+#endif
+
+// Records spread over many small runs, merged with no memory to spare so
+// that runs are first merged into longer ones
+static void merge_matches_grouping(const fs::path& dir) {
+    std::map<spill::Key, std::multiset<std::string>> expected;
+    spill::Runs runs(dir);
+    spill::Buffer buffer;
+    std::mt19937_64 random(7);
+    const size_t kRecords = 5000;
+    for (size_t i = 0; i < kRecords; ++i) {
+        spill::Key key;
+        key.size = random() % 40;
+        key.digest.lo = random() % 3;
+        key.digest.hi = key.digest.lo * 31;
+        spill::Origin origin;
+        origin.ino = i;
+        std::string path = "dir/f" + std::to_string(i);
+        buffer.add(key, origin, path);
+        expected[key].insert(path);
+        if (buffer.items.size() == 300) CHECK(runs.write(buffer));
+    }
+    CHECK(runs.write(buffer));
+    CHECK(buffer.empty());
+
+    std::map<spill::Key, std::multiset<std::string>> merged;
+    size_t records = 0;
+    bool ordered = true;
+    spill::Key last;
+    bool ok = runs.merge(0, [&](const spill::Record& r) {
+        if (records > 0 && r.key < last) ordered = false;
+        last = r.key;
+        merged[r.key].insert(std::string(r.path));
+        CHECK(r.path == "dir/f" + std::to_string(r.origin.ino));
+        records++;
+        return true;
+    });
+    CHECK(ok);
+    CHECK(ordered);
+    CHECK(records == kRecords);
+    CHECK(merged == expected);
+}
+
+// A sink returning false stops the merge, which then reports failure
+static void merge_stops_when_sink_does(const fs::path& dir) {
+    spill::Runs runs(dir);
+    spill::Buffer buffer;
+    for (uint64_t i = 0; i < 10; ++i) buffer.add(spill::Key{i, {}}, spill::Origin{}, "x");
+    CHECK(runs.write(buffer));
+    size_t seen = 0;
+    CHECK(!runs.merge(1 << 20, [&seen](const spill::Record&) { return ++seen < 3; }));
+    CHECK(seen == 3);
+}
+
+// The dupes report as JSON
+static std::string dupes_json(const fs::path& root, uint64_t mem_limit) {
+    walker::Options options;
+    options.show_hidden = true;
+    dirstat::Scan scan(root, options);
+    collectors::Dupes& dupes = scan.dupes(0, mem_limit);
+    scan.run();
+    CHECK(dupes.error().empty());
+
+    std::FILE* file = std::tmpfile();
+    if (!CHECK(file != nullptr)) return {};
+    {
+        output::Writer out(fileno(file));
+        dupes.write_json(out, root, "");
+    }
+    std::string text;
+    std::rewind(file);
+    char chunk[4096];
+    size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) text.append(chunk, n);
+    std::fclose(file);
+    return text;
+}
+
+// Files of a few sizes: some identical, some sharing only their edges so
+// that the full hash has to tell them apart
+static void dupes_with_mem_limit_match(const fs::path& root) {
+    for (int i = 0; i < 60; ++i) {
+        size_t size = 1000 + 4096 * 2 * static_cast<size_t>(i % 3);
+        std::string content(size, static_cast<char>('a' + i % 5));
+        if (i % 7 == 0) content[size / 2] = '#';
+        std::string dir = "d" + std::to_string(i % 4) + "/s" + std::to_string(i % 3);
+        check::write_file(root / dir / ("f" + std::to_string(i)), content);
+    }
+    check::write_file(root / "unique", "only one");
+
+    std::string in_memory = dupes_json(root, 0);
+    CHECK(in_memory.find("\"groups\": 0") == std::string::npos);
+    CHECK(dupes_json(root, 1) == in_memory);
+    CHECK(dupes_json(root, 64 * 1024) == in_memory);
+}
+
+int main() {
+    check::TempDir temp("dirstat-spill-test");
+    merge_matches_grouping(temp.path());
+    merge_stops_when_sink_does(temp.path());
+    // Runs and their directory are gone once merged and destroyed
+    CHECK(fs::is_empty(temp.path()));
+    dupes_with_mem_limit_match(temp.path() / "tree");
+    return check::result();
+}
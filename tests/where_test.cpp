@@ -0,0 +1,186 @@
+// --where expressions (where.hpp): what parses, what is refused with which
+// message, and how files are tested with and without their stat
+#include "check.hpp"
+#include "where.hpp"
+#include <ctime>
+#include <string>
+
+using where::Filter;
+using where::Result;
+using where::Subject;
+
+static bool compiles(const char* text) {
+    Filter filter;
+    std::string error;
+    bool ok = filter.compile(text, error);
+    if (!ok) std::fprintf(stderr, "    '%s': %s\n", text, error.c_str());
+    return ok && error.empty();
+}
+
+// The message a malformed expression is refused with; empty if it compiles
+static std::string error_of(const char* text) {
+    Filter filter;
+    std::string error;
+    if (filter.compile(text, error)) return {};
+    return error.empty() ? "(no message)" : error;
+}
+
+static bool contains(const std::string& text, const char* part) {
+    return text.find(part) != std::string::npos;
+}
+
+static Filter compiled(const char* text) {
+    Filter filter;
+    std::string error;
+    CHECK(filter.compile(text, error));
+    return filter;
+}
+
+// A reader whose only file is `file`, counting the stats it is asked for
+struct FakeReader {
+    backend::Stat file;
+    int stats = 0;
+    bool stat_ok = true;
+
+    bool stat(const char*, backend::Stat& out) {
+        stats++;
+        out = file;
+        return stat_ok;
+    }
+};
+
+static void valid() {
+    CHECK(compiles("size > 1G"));
+    CHECK(compiles("size >= 4096 and size < 64K"));
+    CHECK(compiles("mtime < 180d and path ~ '*/logs/*'"));
+    CHECK(compiles("atime > 2h or mtime <= 2024-01-31"));
+    CHECK(compiles("mtime > 2024-01-31T08:30 and mtime < 2024-01-31T08:30:59"));
+    CHECK(compiles("ext in (gz, 'tar', .ZIP)"));
+    CHECK(compiles("not (name == a.txt or name ~ \"*.tmp\") && depth <= 3"));
+    CHECK(compiles("! type == link || owner == 0"));
+    CHECK(compiles("name !~ '[!a-z]*' and ext != log"));
+    CHECK(compiles("(((depth = 1)))"));
+    CHECK(compiles("mtime < 2024-02-29T23:59:59 and mtime > 2000-12-31"));
+}
+
+static void invalid() {
+    CHECK(contains(error_of(""), "expected a field"));
+    CHECK(contains(error_of("color == red"), "unknown field 'color'"));
+    CHECK(contains(error_of("size"), "expected a comparison after 'size'"));
+    CHECK(contains(error_of("size >"), "expected a value after 'size'"));
+    CHECK(contains(error_of("size > big"), "bad value 'big' for size"));
+    CHECK(contains(error_of("depth > -x"), "expected a number"));
+    CHECK(contains(error_of("mtime < 3 days"), "bad value '3' for mtime"));
+    CHECK(contains(error_of("mtime < 99999999999999999y"), "bad value '99999999999999999y' for mtime"));
+    CHECK(contains(error_of("atime > 9223372036854775807min"), "bad value"));
+    CHECK(contains(error_of("mtime < 2024-13-40"), "bad value '2024-13-40' for mtime"));
+    CHECK(contains(error_of("mtime < 2024-02-31"), "bad value '2024-02-31' for mtime"));
+    CHECK(contains(error_of("mtime < 2023-02-29"), "bad value"));
+    CHECK(contains(error_of("mtime < 2024-00-10"), "bad value"));
+    CHECK(contains(error_of("mtime < 2024-01-31T24:00"), "bad value"));
+    CHECK(contains(error_of("mtime < 2024-01-31T08:60"), "bad value"));
+    CHECK(contains(error_of("mtime < 2024-01-31T08:30:60"), "bad value"));
+    CHECK(contains(error_of("mtime == 30d"), "compare times with"));
+    CHECK(contains(error_of("name < b"), "'name <' isn't a valid comparison"));
+    CHECK(contains(error_of("size ~ 1K"), "'size ~' isn't a valid comparison"));
+    CHECK(contains(error_of("type == dir"), "type is file (f) or link (l)"));
+    CHECK(contains(error_of("(size > 1"), "missing ')'"));
+    CHECK(contains(error_of("ext in gz"), "expected '(' after 'ext in'"));
+    CHECK(contains(error_of("ext in (gz, zip"), "missing ')' after the values of 'ext in'"));
+    CHECK(contains(error_of("size > 1 size > 2"), "unexpected 'size'"));
+    CHECK(contains(error_of("size > 1 and"), "expected a field"));
+    CHECK(contains(error_of("name == 'a.txt"), "unterminated quote"));
+    CHECK(contains(error_of("owner == nosuchuser-dirstat-test"), "unknown owner"));
+}
+
+static void listing_only() {
+    const fs::path dir = "/data/logs";
+    Subject log{dir, "app.LOG", 2};
+    Subject txt{dir, "notes.txt", 4};
+
+    Filter ext = compiled("ext == log");
+    CHECK(!ext.reads_stat());
+    CHECK(ext.test(log) == Result::Yes);
+    CHECK(ext.test(txt) == Result::No);
+
+    Filter path = compiled("path ~ '*/logs/*' and depth <= 2");
+    CHECK(path.test(log) == Result::Yes);
+    CHECK(path.test(txt) == Result::No);
+
+    Filter name = compiled("name in (notes.txt, other) and not type == link");
+    CHECK(name.test(txt) == Result::Yes);
+    Subject link{dir, "notes.txt", 4, true};
+    CHECK(name.test(link) == Result::No);
+
+    CHECK(compiled("name ~ '[a-m]*.LOG'").test(log) == Result::Yes);
+    CHECK(compiled("name ~ 'app.?OG' and name !~ '*.txt'").test(log) == Result::Yes);
+}
+
+static void with_stat() {
+    const fs::path dir = "/data";
+    backend::Stat st;
+    st.type = backend::EntryType::File;
+    st.size = 2 * 1024 * 1024;
+    st.mtime = static_cast<int64_t>(std::time(nullptr)) - 40 * 86400;
+    st.uid = 1000;
+
+    Filter big_old = compiled("size > 1M and mtime < 30d");
+    CHECK(big_old.reads_stat());
+    CHECK(!big_old.native_only());
+    Subject file{dir, "a.bin", 1};
+    CHECK(big_old.test(file) == Result::Unknown);
+    file.stat = &st;
+    CHECK(big_old.test(file) == Result::Yes);
+    st.size = 1024;
+    CHECK(big_old.test(file) == Result::No);
+
+    // A side the listing settles decides without the stat
+    Filter either = compiled("ext == bin or size > 1G");
+    Subject unstated{dir, "a.bin", 1};
+    CHECK(either.test(unstated) == Result::Yes);
+    Filter both = compiled("ext == gz and size > 1G");
+    CHECK(both.test(unstated) == Result::No);
+    CHECK(compiled("not size > 1G").test(unstated) == Result::Unknown);
+
+    CHECK(compiled("owner == 1000").native_only());
+    CHECK(compiled("atime < 1d").native_only());
+    CHECK(!compiled("name == a").native_only());
+}
+
+// select() stats a file only when the listing can't decide
+static void select_stats_lazily() {
+    const fs::path dir = "/data";
+    FakeReader reader;
+    reader.file.type = backend::EntryType::File;
+    reader.file.size = 10;
+
+    Filter filter = compiled("ext == gz and size > 5");
+    backend::Stat st;
+    bool have_stat = false;
+    CHECK(!where::select(filter, reader, Subject{dir, "a.txt", 1}, st, have_stat));
+    CHECK(reader.stats == 0);
+    CHECK(!have_stat);
+
+    CHECK(where::select(filter, reader, Subject{dir, "a.gz", 1}, st, have_stat));
+    CHECK(reader.stats == 1);
+    CHECK(have_stat);
+    CHECK(st.size == 10);
+
+    // A stat the caller already has isn't taken again
+    CHECK(where::select(filter, reader, Subject{dir, "b.gz", 1}, st, have_stat));
+    CHECK(reader.stats == 1);
+
+    // A file that can't be stat'ed is left out
+    reader.stat_ok = false;
+    have_stat = false;
+    CHECK(!where::select(filter, reader, Subject{dir, "c.gz", 1}, st, have_stat));
+}
+
+int main() {
+    valid();
+    invalid();
+    listing_only();
+    with_stat();
+    select_stats_lazily();
+    return check::result();
+}